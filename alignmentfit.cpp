@@ -0,0 +1,329 @@
+#include "alignmentfit.h"
+#include "eventsource.h"
+#include "trace.h"
+#include "TMath.h"
+
+#include <QMutexLocker>
+#include <QScopedPointer>
+#include <QtConcurrentRun>
+#include <algorithm>
+
+namespace {
+
+// the slot each detector's hits are compared with, and the first and last slots of the
+// tracker extrapolated from, whichever of its stations is nearest, see EventStore::NearestSlot()
+const int target_slot[AlignmentFit::NDetectors] = {0, 1, -1, 7, 12};
+const int source_first[AlignmentFit::NDetectors] = {2, 2, -1, 2, 7};
+const int source_last[AlignmentFit::NDetectors] = {6, 6, -1, 6, 11};
+
+const int batch_entries = 16; // tree entries read between updates
+
+}
+
+AlignmentFit::AlignmentFit(QObject *parent) :
+    QObject(parent)
+{
+    total = empty_sums();
+    spillsRead = 0;
+    spillsTotal = 0;
+    generation = 0;
+}
+
+AlignmentFit::~AlignmentFit(){
+    // the worker adds to this object, so it has to be finished before this goes away
+    Stop();
+    watcher.waitForFinished();
+}
+
+double AlignmentFit::Window(){
+    return 200.0; // mm
+}
+
+AlignmentFit::residual_sums AlignmentFit::empty_sums(){
+    residual_sums sums;
+    for(int detector = 0; detector < NDetectors; detector++){
+        sums.n[detector] = 0;
+        for(int axis = 0; axis < 2; axis++){
+            sums.sum[detector][axis] = 0.0;
+            sums.sum2[detector][axis] = 0.0;
+        }
+    }
+    return sums;
+}
+
+void AlignmentFit::Start(QString file, QVector<QVector<double> > locations, TOFCalibration calibration,
+                         QMap<int, Long64_t> spill_entries){
+    /*
+     * Anything still running is cancelled; its results, should any arrive, belong to
+     * an older generation and are dropped.  Without an index from the chunk loader the
+     * worker builds its own before fitting.
+     */
+    Stop();
+
+    fit_request request;
+    {
+        QMutexLocker lock(&mutex);
+        generation++;
+        total = empty_sums();
+        spillsRead = 0;
+        spillsTotal = spill_entries.size();
+        fitLocations = locations;
+        request.generation = generation;
+    }
+    request.filename = file;
+    request.locations = locations;
+    request.calibration = calibration;
+    request.spill_entries = spill_entries;
+    request.cancel = QSharedPointer<QAtomicInt>(new QAtomicInt(0));
+    cancel = request.cancel;
+
+    watcher.setFuture(QtConcurrent::run(&AlignmentFit::fit_file, this, request));
+}
+
+void AlignmentFit::Stop(){
+    if(cancel){
+        cancel->store(1);
+    }
+}
+
+bool AlignmentFit::IsRunning(){
+    return watcher.isRunning();
+}
+
+void AlignmentFit::fit_file(AlignmentFit *fit, fit_request request){
+    QString error;
+    if(!EventSource::CanRead(request.filename, &error)){
+        fit->finish(request.generation, error);
+        return;
+    }
+    QScopedPointer<EventSource> reader(EventSource::Create(request.filename));
+    reader->SetDetectorPositions(request.locations.at(0), request.locations.at(1),
+                                 request.locations.at(2), request.locations.at(3),
+                                 request.locations.at(4));
+    reader->SetCancelFlag(request.cancel.data());
+    reader->SetTOFCalibration(request.calibration);
+
+    if(request.spill_entries.isEmpty()){
+        request.spill_entries = reader->IndexSpills(request.filename);
+    }
+    if(request.spill_entries.isEmpty()){
+        if(request.cancel->load() == 0){
+            fit->finish(request.generation, QString("No spills in %1").arg(request.filename));
+        }
+        return;
+    }
+    // in file order, so that the reads go forwards through the tree
+    QVector<Long64_t> entries = request.spill_entries.values().toVector();
+    std::sort(entries.begin(), entries.end());
+
+    for(int begin = 0; begin < entries.size() && request.cancel->load() == 0; begin += batch_entries){
+        QVector<Long64_t> batch = entries.mid(begin, batch_entries);
+        EventStore store;
+        store.Fill(reader->ReadEntries(request.filename, batch));
+        if(request.cancel->load() != 0){
+            return; // the batch may be incomplete
+        }
+        fit->add(fit_store(store), batch.size(), entries.size(), request.generation);
+    }
+    if(request.cancel->load() == 0){
+        fit->finish(request.generation, QString());
+    }
+}
+
+AlignmentFit::residual_sums AlignmentFit::fit_store(const EventStore &store){
+    TRACE_SCOPE("AlignmentFit::fit_store");
+    /*
+     * Straight-line extrapolation from the tracker station nearest the detector to its
+     * z.  A missing value (Infinity), or pz = 0, gives an infinite or NaN residual,
+     * which fails the window test along with wrong matches, so one masked select covers
+     * every case.
+     */
+    const double window = Window();
+    const double missing = TMath::Infinity();
+    residual_sums sums = empty_sums();
+    const int rows = store.Size();
+    QVector<double> source(6*rows);
+
+    for(int detector = 0; detector < NDetectors; detector++){
+        int to = target_slot[detector];
+        if(to < 0){
+            continue;
+        }
+        // the nearest station's point, gathered into columns of its own
+        QVector<int> from = store.NearestSlot(source_first[detector], source_last[detector], to);
+        double *x0 = source.data();
+        double *y0 = x0 + rows;
+        double *z0 = y0 + rows;
+        double *px = z0 + rows;
+        double *py = px + rows;
+        double *pz = py + rows;
+        const int quantities[6] = {0, 1, 2, 4, 5, 6};
+        for(int q = 0; q < 6; q++){
+            double *out = x0 + q*rows;
+            for(int row = 0; row < rows; row++){
+                out[row] = from.at(row) >= 0 ? store.Value(quantities[q], from.at(row), row) : missing;
+            }
+        }
+        const double *x1 = store.Column(0, to);
+        const double *y1 = store.Column(1, to);
+        const double *z1 = store.Column(2, to);
+
+        double n = 0.0;
+        double sum_x = 0.0, sum_y = 0.0, sum2_x = 0.0, sum2_y = 0.0;
+        for(int row = 0; row < rows; row++){
+            double dz = z1[row] - z0[row];
+            double rx = x1[row] - (x0[row] + px[row]/pz[row]*dz);
+            double ry = y1[row] - (y0[row] + py[row]/pz[row]*dz);
+            bool valid = (TMath::Abs(rx) < window) & (TMath::Abs(ry) < window);
+            n += valid ? 1.0 : 0.0;
+            rx = valid ? rx : 0.0;
+            ry = valid ? ry : 0.0;
+            sum_x += rx;
+            sum_y += ry;
+            sum2_x += rx*rx;
+            sum2_y += ry*ry;
+        }
+        sums.n[detector] = int(n);
+        sums.sum[detector][0] = sum_x;
+        sums.sum[detector][1] = sum_y;
+        sums.sum2[detector][0] = sum2_x;
+        sums.sum2[detector][1] = sum2_y;
+    }
+    return sums;
+}
+
+void AlignmentFit::finish(int from_generation, QString error){
+    // called on the worker thread, like add(); nothing is emitted for an older generation
+    int read;
+    {
+        QMutexLocker lock(&mutex);
+        if(from_generation != generation){
+            return;
+        }
+        read = spillsRead;
+    }
+    if(error.isEmpty()){
+        emit Finished(read);
+    }
+    else{
+        emit Failed(error);
+    }
+}
+
+void AlignmentFit::add(const residual_sums &sums, int spills, int total_spills, int from_generation){
+    // called on the worker thread; Progress() is queued to receivers on the GUI thread
+    int read, spills_total;
+    {
+        QMutexLocker lock(&mutex);
+        if(from_generation != generation){
+            return;
+        }
+        for(int detector = 0; detector < NDetectors; detector++){
+            total.n[detector] += sums.n[detector];
+            for(int axis = 0; axis < 2; axis++){
+                total.sum[detector][axis] += sums.sum[detector][axis];
+                total.sum2[detector][axis] += sums.sum2[detector][axis];
+            }
+        }
+        spillsRead += spills;
+        spillsTotal = total_spills;
+        read = spillsRead;
+        spills_total = spillsTotal;
+    }
+    emit Progress(read, spills_total);
+}
+
+int AlignmentFit::SpillsRead(){
+    QMutexLocker lock(&mutex);
+    return spillsRead;
+}
+
+int AlignmentFit::SpillsTotal(){
+    QMutexLocker lock(&mutex);
+    return spillsTotal;
+}
+
+int AlignmentFit::Entries(int detector){
+    QMutexLocker lock(&mutex);
+    return total.n[detector];
+}
+
+double AlignmentFit::Shift(int detector, int axis){
+    // the mean residual, which the offset has to take away
+    QMutexLocker lock(&mutex);
+    int n = total.n[detector];
+    return n > 0 ? total.sum[detector][axis]/n : TMath::Infinity();
+}
+
+double AlignmentFit::RMS(int detector, int axis){
+    QMutexLocker lock(&mutex);
+    int n = total.n[detector];
+    if(n < 2){
+        return TMath::Infinity();
+    }
+    double mean = total.sum[detector][axis]/n;
+    return TMath::Sqrt(qMax(0.0, total.sum2[detector][axis]/n - mean*mean));
+}
+
+QVector<QVector<double> > AlignmentFit::Proposal(){
+    QVector<QVector<double> > proposal;
+    {
+        QMutexLocker lock(&mutex);
+        proposal = fitLocations;
+    }
+    for(int detector = 0; detector < proposal.size() && detector < NDetectors; detector++){
+        for(int axis = 0; axis < 2; axis++){
+            double shift = Shift(detector, axis);
+            if(shift != TMath::Infinity()){
+                proposal[detector][axis] -= shift;
+            }
+        }
+    }
+    return proposal;
+}
+
+QString AlignmentFit::DetectorName(int detector){
+    switch(detector){
+    case TOF0: return "TOF0";
+    case TOF1: return "TOF1";
+    case TKU: return "TKU";
+    case TKD: return "TKD";
+    case TOF2: return "TOF2";
+    default: return "";
+    }
+}
+
+QString AlignmentFit::Report(){
+    // an HTML table for the Settings window
+    QVector<QVector<double> > proposal = Proposal();
+    QString report = QString("<p>%1 of %2 spills read.</p>").arg(SpillsRead()).arg(SpillsTotal());
+    report += "<table border=\"1\" cellpadding=\"3\" cellspacing=\"0\">"
+            "<tr><th></th><th>Tracks</th><th>Mean x (mm)</th><th>Mean y (mm)</th>"
+            "<th>RMS x (mm)</th><th>RMS y (mm)</th><th>x offset (mm)</th><th>y offset (mm)</th></tr>";
+    for(int detector = 0; detector < NDetectors; detector++){
+        report += QString("<tr><td>%1</td>").arg(DetectorName(detector));
+        if(detector == TKU){
+            report += "<td colspan=\"5\">reference</td>";
+        }
+        else{
+            report += QString("<td>%1</td>").arg(Entries(detector));
+            for(int axis = 0; axis < 2; axis++){
+                double shift = Shift(detector, axis);
+                report += shift == TMath::Infinity() ? QString("<td>-</td>")
+                                                     : QString("<td>%1</td>").arg(shift, 0, 'f', 2);
+            }
+            for(int axis = 0; axis < 2; axis++){
+                double rms = RMS(detector, axis);
+                report += rms == TMath::Infinity() ? QString("<td>-</td>")
+                                                   : QString("<td>%1</td>").arg(rms, 0, 'f', 2);
+            }
+        }
+        for(int axis = 0; axis < 2; axis++){
+            report += detector < proposal.size() ? QString("<td>%1</td>").arg(proposal.at(detector).at(axis), 0, 'f', 2)
+                                                 : QString("<td>-</td>");
+        }
+        report += "</tr>";
+    }
+    report += "</table>";
+    return report;
+}
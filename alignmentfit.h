@@ -0,0 +1,98 @@
+#ifndef ALIGNMENTFIT_H
+#define ALIGNMENTFIT_H
+
+#include <QObject>
+#include <QFutureWatcher>
+#include <QString>
+#include <QVector>
+#include <QMap>
+#include <QMutex>
+#include <QAtomicInt>
+#include <QSharedPointer>
+#include <Rtypes.h>
+#include "eventstore.h"
+#include "tofcalibration.h"
+
+/*
+ * Fits x and y offsets for the TOFs and TKD from the tracks in a whole file, taking
+ * TKU as the reference.
+ *
+ * Tracker tracks are extrapolated in straight lines, with the track point momentum,
+ * to the z of the other detectors, each event from the station nearest in z that has
+ * a point: from TKU back to TOF0 and TOF1 (station 5, the upstream end, when it was
+ * hit), from TKU across the absorber to TKD station 1, and from TKD on to TOF2.
+ * The offset that minimises the sum of squared residuals (hit minus extrapolation) is
+ * minus their mean, so only sums are kept; residuals further than Window() from zero
+ * are taken to be from a wrong match and left out.
+ *
+ * Start() reads the file on a worker thread, a few tree entries at a time, and emits
+ * Progress() on the GUI thread after each batch, so the proposal firms up as more
+ * spills are decoded, then Finished() once the whole file is in, or Failed() if it
+ * can't be read; a fit that is stopped emits neither.  Proposal() gives the detector locations the file was read
+ * with, corrected by the offsets found so far, in the order the Settings window has
+ * them (TOF0, TOF1, TKU, TKD, TOF2).
+ */
+class AlignmentFit : public QObject
+{
+    Q_OBJECT
+
+public:
+    enum Detector { TOF0 = 0, TOF1 = 1, TKU = 2, TKD = 3, TOF2 = 4 };
+    static const int NDetectors = 5;
+
+    explicit AlignmentFit(QObject *parent = 0);
+    ~AlignmentFit();
+
+    void Start(QString file, QVector<QVector<double> > locations, TOFCalibration calibration,
+               QMap<int, Long64_t> spill_entries = QMap<int, Long64_t>());
+    void Stop();
+    bool IsRunning();
+    static double Window();
+
+    int SpillsRead();
+    int SpillsTotal();
+    int Entries(int detector);
+    double Shift(int detector, int axis);
+    double RMS(int detector, int axis);
+    QVector<QVector<double> > Proposal();
+    QString Report();
+
+    static QString DetectorName(int detector);
+
+signals:
+    void Progress(int spills_read, int spills_total);
+    void Finished(int spills_read);
+    void Failed(QString error);
+
+private:
+    struct residual_sums {
+        int n[NDetectors];
+        double sum[NDetectors][2], sum2[NDetectors][2]; // x, y
+    };
+
+    struct fit_request {
+        QString filename;
+        QVector<QVector<double> > locations;
+        TOFCalibration calibration;
+        QMap<int, Long64_t> spill_entries;
+        QSharedPointer<QAtomicInt> cancel;
+        int generation;
+    };
+
+    static residual_sums empty_sums();
+    static residual_sums fit_store(const EventStore &store);
+    static void fit_file(AlignmentFit *fit, fit_request request);
+    void finish(int from_generation, QString error);
+    void add(const residual_sums &sums, int spills, int total, int from_generation);
+
+    QMutex mutex; // guards everything below, which the worker thread adds to
+    residual_sums total;
+    int spillsRead, spillsTotal;
+    QVector<QVector<double> > fitLocations;
+    int generation;
+
+    QFutureWatcher<void> watcher;
+    QSharedPointer<QAtomicInt> cancel;
+};
+
+#endif // ALIGNMENTFIT_H
@@ -0,0 +1,243 @@
+#include "batchexport.h"
+#include "particleid.h"
+
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFuture>
+#include <QImage>
+#include <QPainter>
+#include <QPdfWriter>
+#include <QProgressDialog>
+#include <QRegExp>
+#include <QStringList>
+#include <QThreadPool>
+#include <QtConcurrentRun>
+
+BatchExport::BatchExport()
+{
+    // these plots are never shown, they only exist to be painted into pictures
+    plot_position_xz = new QCustomPlot();
+    plot_position_yz = new QCustomPlot();
+    plot_momentum_t = new QCustomPlot();
+    plot_momentum_z = new QCustomPlot();
+    display = new EventDisplay(plot_position_xz, plot_position_yz, plot_momentum_t, plot_momentum_z);
+
+    outputDirectory = QDir::currentPath();
+    imageFormat = "png";
+    plotWidth = 800;
+    plotHeight = 400;
+    imagesPerSecond = 0.0;
+}
+
+BatchExport::~BatchExport(){
+    delete display;
+    delete plot_position_xz;
+    delete plot_position_yz;
+    delete plot_momentum_t;
+    delete plot_momentum_z;
+}
+
+QList<QPair<int, int> > BatchExport::ParseEventList(QString list){
+    /*
+     * Accepts a comma or space separated list of:
+     *   12      -> every event in spill 12
+     *   12:3    -> event 3 of spill 12
+     *   20-25   -> every event in spills 20 to 25 (inclusive)
+     *
+     * Whole spills are returned with an event number of -1.  Anything that doesn't
+     * parse is skipped.
+     */
+    QList<QPair<int, int> > requested;
+    QStringList tokens = list.split(QRegExp("[,\\s]+"), QString::SkipEmptyParts);
+
+    foreach(QString token, tokens){
+        bool ok_first = false;
+        bool ok_second = false;
+        if(token.contains(':')){
+            int spill_number = token.section(':', 0, 0).toInt(&ok_first);
+            int event_number = token.section(':', 1, 1).toInt(&ok_second);
+            if(ok_first && ok_second){
+                requested << qMakePair(spill_number, event_number);
+            }
+        }
+        else if(token.contains('-')){
+            int first_spill = token.section('-', 0, 0).toInt(&ok_first);
+            int last_spill = token.section('-', 1, 1).toInt(&ok_second);
+            if(ok_first && ok_second){
+                for(int spill_number = first_spill; spill_number <= last_spill; spill_number++){
+                    requested << qMakePair(spill_number, -1);
+                }
+            }
+        }
+        else{
+            int spill_number = token.toInt(&ok_first);
+            if(ok_first){
+                requested << qMakePair(spill_number, -1);
+            }
+        }
+    }
+
+    return requested;
+}
+
+void BatchExport::SetOutputDirectory(QString directory){
+    outputDirectory = directory;
+}
+
+void BatchExport::SetFormat(QString format){
+    imageFormat = format.toLower();
+}
+
+void BatchExport::SetPlotSize(int width, int height){
+    plotWidth = width;
+    plotHeight = height;
+}
+
+void BatchExport::SetGeometry(QVector<double> tof0_location, QVector<double> tof1_location,
+                              QVector<double> tof2_location, QVector<double> tracker_station_z){
+    display->SetGeometry(tof0_location, tof1_location, tof2_location, tracker_station_z);
+}
+
+void BatchExport::SetTracks(QVector<double> tracker_fields, int charge){
+    display->SetTracks(tracker_fields, charge);
+}
+
+double BatchExport::ImagesPerSecond(){
+    return imagesPerSecond;
+}
+
+int BatchExport::Export(const QList<QPair<int, int> > &requested,
+                        const QHash<int, QHash<int, QVector<QVector<double> > > > &data,
+                        const EventStore &store, QProgressDialog *progress){
+    /*
+     * Returns the number of images written.  Requested spills/events that aren't in
+     * data are skipped; store holds the same events, classified.
+     */
+    QList<QPair<int, int> > events;
+    for(int i = 0; i < requested.size(); i++){
+        int spill_number = requested.at(i).first;
+        int event_number = requested.at(i).second;
+        if(!data.contains(spill_number)){
+            continue;
+        }
+        if(event_number < 0){
+            QList<int> event_numbers = data.value(spill_number).keys();
+            qSort(event_numbers);
+            foreach(int number, event_numbers){
+                events << qMakePair(spill_number, number);
+            }
+        }
+        else if(data.value(spill_number).contains(event_number)){
+            events << qMakePair(spill_number, event_number);
+        }
+    }
+
+    if(progress){
+        progress->setMaximum(events.size());
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+
+    // keep at most a couple of events per thread recorded but not yet written,
+    // otherwise the pictures pile up in memory faster than they're written out
+    int max_pending = 2*QThreadPool::globalInstance()->maxThreadCount();
+    QList<QFuture<bool> > pending;
+    int written = 0;
+
+    for(int i = 0; i < events.size(); i++){
+        if(progress && progress->wasCanceled()){
+            break;
+        }
+
+        int spill_number = events.at(i).first;
+        int event_number = events.at(i).second;
+        int row = store.Row(spill_number, event_number);
+        display->SetSpecies(row >= 0 ? store.Species(row) : ParticleID::Unknown);
+        display->SetEvent(data.value(spill_number).value(event_number), spill_number, event_number);
+        display->SetDerived(store, row);
+        QList<QPicture> pictures = record_event();
+
+        QString filename = QDir(outputDirectory).filePath(QString("spill%1_event%2.%3")
+                                                          .arg(spill_number, 5, 10, QChar('0'))
+                                                          .arg(event_number, 4, 10, QChar('0'))
+                                                          .arg(imageFormat));
+        pending << QtConcurrent::run(&BatchExport::write_image, pictures, filename,
+                                     imageFormat, plotWidth, plotHeight);
+
+        while(pending.size() >= max_pending){
+            if(pending.first().result()){
+                written++;
+            }
+            pending.removeFirst();
+        }
+
+        if(progress){
+            progress->setValue(i+1);
+        }
+    }
+
+    while(!pending.isEmpty()){
+        if(pending.first().result()){
+            written++;
+        }
+        pending.removeFirst();
+    }
+
+    double seconds = timer.elapsed()/1000.0;
+    imagesPerSecond = seconds > 0.0 ? written/seconds : 0.0;
+
+    return written;
+}
+
+QList<QPicture> BatchExport::record_event(){
+    QList<QPicture> pictures;
+    foreach(QCustomPlot *plot, display->Plots()){
+        QPicture picture;
+        QCPPainter painter;
+        painter.begin(&picture);
+        if(imageFormat == "pdf"){
+            painter.setMode(QCPPainter::pmVectorized);
+        }
+        plot->toPainter(&painter, plotWidth, plotHeight);
+        painter.end();
+        pictures << picture;
+    }
+    return pictures;
+}
+
+bool BatchExport::write_image(QList<QPicture> pictures, QString filename, QString format,
+                              int width, int height){
+    /*
+     * Runs on a pool thread.  Lays the four plots out on a 2x2 page, positions on
+     * the top row and momenta underneath, then writes the file.
+     */
+    if(format == "pdf"){
+        QPdfWriter writer(filename);
+        QPagedPaintDevice::Margins margins = {0.0, 0.0, 0.0, 0.0};
+        writer.setMargins(margins);
+        writer.setPageSizeMM(QSizeF(2*width*25.4/72.0, 2*height*25.4/72.0));
+
+        QPainter painter;
+        if(!painter.begin(&writer)){
+            return false;
+        }
+        painter.scale(writer.width()/(2.0*width), writer.height()/(2.0*height));
+        for(int i = 0; i < pictures.size(); i++){
+            painter.drawPicture(QPoint((i%2)*width, (i/2)*height), pictures.at(i));
+        }
+        painter.end();
+        return true;
+    }
+
+    QImage image(2*width, 2*height, QImage::Format_ARGB32_Premultiplied);
+    image.fill(Qt::white);
+    QPainter painter(&image);
+    painter.setRenderHint(QPainter::Antialiasing);
+    for(int i = 0; i < pictures.size(); i++){
+        painter.drawPicture(QPoint((i%2)*width, (i/2)*height), pictures.at(i));
+    }
+    painter.end();
+
+    return image.save(filename, format.toUpper().toLatin1().constData());
+}
@@ -0,0 +1,62 @@
+#ifndef BATCHEXPORT_H
+#define BATCHEXPORT_H
+
+#include <QString>
+#include <QList>
+#include <QPair>
+#include <QHash>
+#include <QVector>
+#include <QPicture>
+#include "eventdisplay.h"
+#include "eventstore.h"
+
+class QProgressDialog;
+
+/*
+ * Writes one image per event, holding the four position/momentum plots, for a list
+ * of spills/events.  Each is drawn as the viewer draws it: coloured by species, with
+ * the pt and |p| graphs from the store's row for the event.
+ *
+ * QCustomPlot is a QWidget and may only be touched from the GUI thread, so the plots
+ * are filled and recorded into QPictures there (cheap, no rasterisation).  The
+ * expensive part, rasterising/compressing the PNG or writing the PDF, is done on the
+ * global thread pool, one event per task.
+ */
+class BatchExport
+{
+public:
+    BatchExport();
+    ~BatchExport();
+
+    static QList<QPair<int, int> > ParseEventList(QString list);
+
+    void SetOutputDirectory(QString directory);
+    void SetFormat(QString format);
+    void SetPlotSize(int width, int height);
+    void SetGeometry(QVector<double> tof0_location, QVector<double> tof1_location,
+                     QVector<double> tof2_location, QVector<double> tracker_station_z);
+    void SetTracks(QVector<double> tracker_fields, int charge);
+
+    int Export(const QList<QPair<int, int> > &requested,
+               const QHash<int, QHash<int, QVector<QVector<double> > > > &data,
+               const EventStore &store, QProgressDialog *progress);
+    double ImagesPerSecond();
+
+private:
+    QCustomPlot *plot_position_xz;
+    QCustomPlot *plot_position_yz;
+    QCustomPlot *plot_momentum_t;
+    QCustomPlot *plot_momentum_z;
+    EventDisplay *display;
+
+    QString outputDirectory;
+    QString imageFormat;
+    int plotWidth, plotHeight;
+    double imagesPerSecond;
+
+    QList<QPicture> record_event();
+    static bool write_image(QList<QPicture> pictures, QString filename, QString format,
+                            int width, int height);
+};
+
+#endif // BATCHEXPORT_H
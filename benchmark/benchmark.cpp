@@ -0,0 +1,420 @@
+/*
+ * EventViewerBenchmark: times the main stages of the event viewer on a fixed input.
+ *
+ *   EventViewerBenchmark [options] file.root
+ *   EventViewerBenchmark [options] synthetic:spills=100,events=40
+ *     --spills N       read the first N physics spills of the file (default 100)
+ *     --events N       build and render at most N of their events (default 500)
+ *     --sizes WxH,...  plot sizes to render at (default 800x400,1600x800)
+ *     --output FILE    append the results to FILE (default benchmark_results.jsonl)
+ *     --label TEXT     a name for this run, e.g. the commit built
+ *     --trace FILE     also write the trace spans of the run to FILE (builds with
+ *                      CONFIG+=trace only, see trace.h)
+ *
+ * Stages:
+ *   read     EventSource::ReadEntries(), per spill: ROOT unpacking (or making the
+ *            events up) and everything after it
+ *   tof      of which matching TOF slab hits to space points, per spill
+ *   tracker  of which extracting tracker track points, per spill
+ *   store    EventStore::Fill() of all the spills read, once
+ *   build    EventDisplay::SetSpecies()/SetEvent() per event, as MainWindow::replot() does
+ *   render   QCustomPlot::replot() of each plot per event, at each size
+ *
+ * Each stage reports its throughput, latency percentiles and heap allocations (calls
+ * to malloc, calloc and realloc) per operation.  Results are appended to the output
+ * file as one JSON object per line, and the medians compared with the last run on the
+ * same input, so that regressions show up between builds.
+ *
+ * A synthetic run (see SyntheticSource) gives the same input on any machine, with or
+ * without MAUS.  The plots are never shown; run with -platform offscreen where there's
+ * no display.
+ */
+
+#include <QApplication>
+#include <QStringList>
+#include <QElapsedTimer>
+#include <QDateTime>
+#include <QScopedPointer>
+#include <QFile>
+#include <QTextStream>
+#include <QJsonObject>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+
+#include "eventsource.h"
+#include "eventstore.h"
+#include "eventdisplay.h"
+#include "particleid.h"
+#include "trace.h"
+
+namespace {
+
+std::atomic<long long> allocation_count(0);
+
+}
+
+#ifdef __GLIBC__
+/*
+ * Count heap allocations by standing in for malloc and friends, which glibc lets a
+ * program do; Qt's containers allocate with malloc rather than operator new, so
+ * counting only the latter would miss most of them.
+ */
+extern "C" {
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t n, size_t size);
+void *__libc_realloc(void *pointer, size_t size);
+
+void *malloc(size_t size){
+    allocation_count.fetch_add(1, std::memory_order_relaxed);
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t n, size_t size){
+    allocation_count.fetch_add(1, std::memory_order_relaxed);
+    return __libc_calloc(n, size);
+}
+
+void *realloc(void *pointer, size_t size){
+    allocation_count.fetch_add(1, std::memory_order_relaxed);
+    return __libc_realloc(pointer, size);
+}
+}
+#endif
+
+namespace {
+
+struct stage {
+    QString name;
+    QString unit;                // what an operation is, e.g. "spill"
+    QVector<double> latency_us;  // per operation
+    double items;                // events, for throughput
+    double seconds;              // wall time of the whole stage
+    long long allocations;
+};
+
+stage new_stage(QString name, QString unit){
+    stage s;
+    s.name = name;
+    s.unit = unit;
+    s.items = 0;
+    s.seconds = 0;
+    s.allocations = 0;
+    return s;
+}
+
+double percentile(QVector<double> sorted, double fraction){
+    // nearest rank
+    if(sorted.isEmpty()){
+        return 0.0;
+    }
+    int rank = qBound(0, int(std::ceil(fraction*sorted.size())) - 1, sorted.size() - 1);
+    return sorted.at(rank);
+}
+
+QJsonObject summarise(const stage &s){
+    QVector<double> sorted = s.latency_us;
+    std::sort(sorted.begin(), sorted.end());
+    int ops = sorted.size();
+
+    QJsonObject summary;
+    summary["unit"] = s.unit;
+    summary["ops"] = ops;
+    summary["ops_per_s"] = s.seconds > 0 ? ops/s.seconds : 0.0;
+    summary["events_per_s"] = s.seconds > 0 ? s.items/s.seconds : 0.0;
+    summary["p50_us"] = percentile(sorted, 0.50);
+    summary["p90_us"] = percentile(sorted, 0.90);
+    summary["p99_us"] = percentile(sorted, 0.99);
+    summary["max_us"] = sorted.isEmpty() ? 0.0 : sorted.last();
+    summary["allocs_per_op"] = ops > 0 ? double(s.allocations)/ops : 0.0;
+    return summary;
+}
+
+QJsonObject last_run(QString output, QJsonObject input){
+    // the most recent run in the output file on the same input, if there is one
+    QFile file(output);
+    QJsonObject previous;
+    if(!file.open(QIODevice::ReadOnly | QIODevice::Text)){
+        return previous;
+    }
+    QTextStream stream(&file);
+    while(!stream.atEnd()){
+        QJsonObject run = QJsonDocument::fromJson(stream.readLine().toUtf8()).object();
+        if(run.value("input").toObject() == input){
+            previous = run;
+        }
+    }
+    return previous;
+}
+
+void print_stage(QString name, QJsonObject summary, QJsonObject previous){
+    QString change;
+    if(!previous.isEmpty() && previous.value("p50_us").toDouble() > 0){
+        double ratio = summary.value("p50_us").toDouble()/previous.value("p50_us").toDouble();
+        change = QString("%1%2%").arg(ratio >= 1 ? "+" : "").arg(100.0*(ratio - 1.0), 0, 'f', 1);
+    }
+    std::printf("%-22s %8d %-6s %10.1f/s %10.1f %10.1f %10.1f %10.1f %10.1f   %s\n",
+                name.toLatin1().constData(),
+                summary.value("ops").toInt(), summary.value("unit").toString().toLatin1().constData(),
+                summary.value("ops_per_s").toDouble(),
+                summary.value("p50_us").toDouble(), summary.value("p90_us").toDouble(),
+                summary.value("p99_us").toDouble(), summary.value("max_us").toDouble(),
+                summary.value("allocs_per_op").toDouble(), change.toLatin1().constData());
+}
+
+}
+
+int main(int argc, char *argv[])
+{
+    QApplication app(argc, argv);
+    QStringList arguments = app.arguments();
+
+    QString filename;
+    QString output = "benchmark_results.jsonl";
+    QString label;
+    QString trace_file;
+    int n_spills = 100;
+    int n_events = 500;
+    QList<QSize> sizes;
+    sizes << QSize(800, 400) << QSize(1600, 800);
+
+    for(int i = 1; i < arguments.size(); i++){
+        QString argument = arguments.at(i);
+        QString value = i + 1 < arguments.size() ? arguments.at(i + 1) : QString();
+        if(argument == "--spills"){
+            n_spills = value.toInt();
+            i++;
+        }
+        else if(argument == "--events"){
+            n_events = value.toInt();
+            i++;
+        }
+        else if(argument == "--output"){
+            output = value;
+            i++;
+        }
+        else if(argument == "--label"){
+            label = value;
+            i++;
+        }
+        else if(argument == "--trace"){
+            trace_file = value;
+            i++;
+        }
+        else if(argument == "--sizes"){
+            sizes.clear();
+            foreach(QString size, value.split(',', QString::SkipEmptyParts)){
+                QStringList dimensions = size.split('x');
+                if(dimensions.size() == 2 && dimensions.at(0).toInt() > 0 && dimensions.at(1).toInt() > 0){
+                    sizes << QSize(dimensions.at(0).toInt(), dimensions.at(1).toInt());
+                }
+            }
+            i++;
+        }
+        else{
+            filename = argument;
+        }
+    }
+    if(filename.isEmpty() || n_spills <= 0 || sizes.isEmpty()){
+        std::fprintf(stderr, "usage: %s [--spills N] [--events N] [--sizes WxH,...] "
+                             "[--output FILE] [--label TEXT] [--trace FILE] file.root|synthetic:...\n",
+                     argv[0]);
+        return 1;
+    }
+
+    if(!trace_file.isEmpty()){
+        Trace::SetThreadName("main");
+        Trace::Start();
+    }
+
+    /*
+     * The input: the first n_spills physics spills of the file, by tree entry.
+     */
+    QScopedPointer<EventSource> reader(EventSource::Create(filename));
+    QVector<Long64_t> entries = reader->IndexSpills(filename).values().toVector();
+    std::sort(entries.begin(), entries.end());
+    entries.resize(qMin(entries.size(), n_spills));
+    if(entries.isEmpty()){
+        std::fprintf(stderr, "no physics spills in %s\n", filename.toLocal8Bit().constData());
+        return 1;
+    }
+
+    stage read = new_stage("read", "spill");
+    stage tof = new_stage("tof", "spill");
+    stage tracker = new_stage("tracker", "spill");
+    stage fill = new_stage("store", "fill");
+    stage build = new_stage("build", "event");
+    QList<stage> render;
+
+    // read: the allocations are for the whole read, the reader can't split them by stage
+    reader->SetTimeStages(true);
+    QElapsedTimer wall;
+    long long allocations = allocation_count.load();
+    wall.start();
+    QHash<int, QHash<int, QVector<QVector<double> > > > data = reader->ReadEntries(filename, entries);
+    read.seconds = wall.nsecsElapsed()/1.0e9;
+    read.allocations = allocation_count.load() - allocations;
+
+    QVector<EventSource::SpillTiming> timings = reader->StageTimings();
+    for(int i = 0; i < timings.size(); i++){
+        read.latency_us << timings.at(i).read_ns/1.0e3;
+        tof.latency_us << timings.at(i).tof_ns/1.0e3;
+        tracker.latency_us << timings.at(i).tracker_ns/1.0e3;
+        read.items += timings.at(i).events;
+        tof.seconds += timings.at(i).tof_ns/1.0e9;
+        tracker.seconds += timings.at(i).tracker_ns/1.0e9;
+    }
+    tof.items = tracker.items = read.items;
+
+    EventStore store;
+    allocations = allocation_count.load();
+    wall.start();
+    store.Fill(data);
+    fill.latency_us << wall.nsecsElapsed()/1.0e3;
+    fill.seconds = wall.nsecsElapsed()/1.0e9;
+    fill.allocations = allocation_count.load() - allocations;
+    fill.items = store.Size();
+    store.SetSpecies(ParticleID().Classify(store));
+
+    /*
+     * build and render: the events in order of spill and event number, with the
+     * detector positions the readers start with.
+     */
+    QCustomPlot *plots[4];
+    for(int i = 0; i < 4; i++){
+        plots[i] = new QCustomPlot();
+        plots[i]->setAttribute(Qt::WA_DontShowOnScreen);
+    }
+    EventDisplay *display = new EventDisplay(plots[0], plots[1], plots[2], plots[3]);
+    QVector<double> tof0_location, tof1_location, tof2_location;
+    tof0_location << 0.0 << 0.0 << 5285.66;
+    tof1_location << 0.0 << 0.0 << 12922.00;
+    tof2_location << 0.0 << 0.0 << 21127.27;
+    display->SetGeometry(tof0_location, tof1_location, tof2_location, store.TrackerStationZ());
+
+    QList<int> rows;
+    for(int row = 0; row < store.Size() && rows.size() < n_events; row++){
+        rows << row;
+    }
+
+    wall.start();
+    for(int i = 0; i < rows.size(); i++){
+        int spill_number = store.Spill(rows.at(i));
+        int event_number = store.Event(rows.at(i));
+        const QVector<QVector<double> > &event = data[spill_number][event_number];
+
+        QElapsedTimer timer;
+        allocations = allocation_count.load();
+        timer.start();
+        display->SetSpecies(store.Species(rows.at(i)));
+        display->SetEvent(event, spill_number, event_number);
+        build.latency_us << timer.nsecsElapsed()/1.0e3;
+        build.allocations += allocation_count.load() - allocations;
+    }
+    build.seconds = wall.nsecsElapsed()/1.0e9;
+    build.items = rows.size();
+
+    QList<QCustomPlot*> display_plots = display->Plots();
+    for(int s = 0; s < sizes.size(); s++){
+        foreach(QCustomPlot *plot, display_plots){
+            plot->resize(sizes.at(s));
+            plot->show();
+        }
+        app.processEvents();
+
+        for(int p = 0; p < display_plots.size(); p++){
+            render << new_stage(QString("render %1 %2x%3").arg(p).arg(sizes.at(s).width()).arg(sizes.at(s).height()),
+                                "replot");
+        }
+        int first = render.size() - display_plots.size();
+
+        for(int i = 0; i < rows.size(); i++){
+            int spill_number = store.Spill(rows.at(i));
+            int event_number = store.Event(rows.at(i));
+            display->SetSpecies(store.Species(rows.at(i)));
+            display->SetEvent(data[spill_number][event_number], spill_number, event_number);
+
+            for(int p = 0; p < display_plots.size(); p++){
+                stage &r = render[first + p];
+                QElapsedTimer timer;
+                allocations = allocation_count.load();
+                timer.start();
+                display_plots.at(p)->replot();
+                double elapsed = timer.nsecsElapsed();
+                r.latency_us << elapsed/1.0e3;
+                r.seconds += elapsed/1.0e9;
+                r.allocations += allocation_count.load() - allocations;
+                r.items += 1;
+            }
+        }
+    }
+
+    /*
+     * Report, and keep.
+     */
+    QJsonObject input;
+    input["file"] = filename;
+    input["spills"] = entries.size();
+    input["events"] = rows.size();
+    QJsonArray size_list;
+    foreach(QSize size, sizes){
+        size_list << QString("%1x%2").arg(size.width()).arg(size.height());
+    }
+    input["sizes"] = size_list;
+
+    QList<stage> stages;
+    stages << read << tof << tracker << fill << build << render;
+
+    QJsonObject results;
+    foreach(stage s, stages){
+        results[s.name] = summarise(s);
+    }
+
+    QJsonObject run;
+    run["label"] = label;
+    run["time"] = QDateTime::currentDateTime().toString(Qt::ISODate);
+    run["qt"] = QString(qVersion());
+#ifdef __VERSION__
+    run["compiler"] = QString(__VERSION__);
+#endif
+    run["input"] = input;
+    run["stages"] = results;
+
+    QJsonObject previous = last_run(output, input).value("stages").toObject();
+    std::printf("%d spills, %d events from %s\n", entries.size(), int(read.items),
+                filename.toLocal8Bit().constData());
+    std::printf("%-22s %8s %-6s %12s %10s %10s %10s %10s %10s   %s\n", "stage", "ops", "", "throughput",
+                "p50 us", "p90 us", "p99 us", "max us", "allocs/op", "p50 vs last");
+    foreach(stage s, stages){
+        print_stage(s.name, results.value(s.name).toObject(), previous.value(s.name).toObject());
+    }
+
+    QFile file(output);
+    if(!file.open(QIODevice::WriteOnly | QIODevice::Append | QIODevice::Text)){
+        std::fprintf(stderr, "couldn't write %s\n", output.toLocal8Bit().constData());
+        return 1;
+    }
+    file.write(QJsonDocument(run).toJson(QJsonDocument::Compact) + "\n");
+    std::printf("results appended to %s\n", output.toLocal8Bit().constData());
+
+    if(!trace_file.isEmpty()){
+        Trace::Stop();
+        QString error;
+        if(Trace::Save(trace_file, &error)){
+            std::printf("%d trace spans written to %s\n", Trace::Spans(), trace_file.toLocal8Bit().constData());
+        }
+        else{
+            std::fprintf(stderr, "couldn't write %s: %s\n", trace_file.toLocal8Bit().constData(),
+                         error.toLocal8Bit().constData());
+        }
+    }
+
+    delete display;
+    for(int i = 0; i < 4; i++){
+        delete plots[i];
+    }
+    return 0;
+}
@@ -0,0 +1,13 @@
+#-------------------------------------------------
+#
+# Timings of the reader, plot building and rendering, see benchmark.cpp
+#
+#-------------------------------------------------
+
+include(../eventviewer.pri)
+
+TARGET = EventViewerBenchmark
+TEMPLATE = app
+
+
+SOURCES += benchmark.cpp
@@ -0,0 +1,516 @@
+#include "chunkloader.h"
+#include "eventsource.h"
+#include "trace.h"
+#include "memoryaccount.h"
+
+#include <QElapsedTimer>
+#include <QScopedPointer>
+#include <QtConcurrentRun>
+#include "TThread.h"
+
+ChunkLoader::ChunkLoader(QObject *parent) :
+    QObject(parent)
+{
+    // ROOT has to be told before it is used from more than one thread
+    TThread::Initialize();
+
+    settings.start_spill = 0;
+    settings.spill_range = 100;
+    settings.generation = 0;
+    settings.locations.resize(5);
+    loading = false;
+    loading_spill = 0;
+    decodeTime = 0.0;
+    chunkBytes = 0;
+    indexed = false;
+    spill_wanted = false;
+    wanted_spill = 0;
+    reading_spill = 0;
+    loading_cancel = QSharedPointer<QAtomicInt>(new QAtomicInt(0));
+    index_cancel = QSharedPointer<QAtomicInt>(new QAtomicInt(0));
+    spill_cancel = QSharedPointer<QAtomicInt>(new QAtomicInt(0));
+    spill_result.cancelled = false;
+    spill_result.start_spill = 0;
+    spill_result.generation = -1;
+    spill_result.bytes = 0;
+    resident = false;
+    runGeneration = 0;
+    run_cancel = QSharedPointer<QAtomicInt>(new QAtomicInt(0));
+
+    connect(&watcher, SIGNAL(finished()), SLOT(read_finished()));
+    connect(&index_watcher, SIGNAL(finished()), SLOT(index_finished()));
+    connect(&spill_watcher, SIGNAL(finished()), SLOT(spill_finished()));
+    connect(&run_watcher, SIGNAL(finished()), SLOT(run_finished()));
+}
+
+ChunkLoader::~ChunkLoader(){
+    // stop any reads at the next spill, and let them finish before the watchers go away
+    loading_cancel->store(1);
+    index_cancel->store(1);
+    spill_cancel->store(1);
+    run_cancel->store(1);
+    watcher.waitForFinished();
+    index_watcher.waitForFinished();
+    spill_watcher.waitForFinished();
+    run_watcher.waitForFinished();
+    MemoryAccount::Remove("Chunks read ahead");
+    MemoryAccount::Remove("Resident run");
+}
+
+void ChunkLoader::SetFile(QString file){
+    if(file != settings.filename){
+        settings.filename = file;
+        Clear();
+        spill_entries.clear();
+        indexed = false;
+        index_cancel->store(1);
+        start_index();
+        reset_run();
+    }
+}
+
+void ChunkLoader::SetDetectorPositions(QVector<double> tof0_location, QVector<double> tof1_location,
+                                       QVector<double> tku_location, QVector<double> tkd_location,
+                                       QVector<double> tof2_location){
+    QVector<QVector<double> > locations;
+    locations << tof0_location << tof1_location << tku_location << tkd_location << tof2_location;
+    if(locations != settings.locations){
+        settings.locations = locations;
+        Clear();
+        reset_run();
+    }
+}
+
+void ChunkLoader::SetSpillRange(int spill_range){
+    if(spill_range != settings.spill_range){
+        settings.spill_range = spill_range;
+        Clear();
+    }
+}
+
+void ChunkLoader::SetTOFCalibration(const TOFCalibration &calibration){
+    if(calibration != settings.calibration){
+        settings.calibration = calibration;
+        Clear();
+        reset_run();
+    }
+}
+
+void ChunkLoader::SetResident(bool hold_run){
+    if(hold_run != resident){
+        resident = hold_run;
+        reset_run();
+    }
+}
+
+bool ChunkLoader::IsResident(){
+    // whether chunks are decoded from the resident run now
+    return !run.isNull();
+}
+
+void ChunkLoader::SetParticleID(const ParticleID &particle_id){
+    // no need to read anything again: reclassify what has been read, on this thread
+    settings.pid = particle_id;
+    QHash<int, chunk_result>::iterator chunk;
+    for(chunk = ready.begin(); chunk != ready.end(); ++chunk){
+        update_species(chunk.value());
+    }
+    update_species(spill_result);
+    account();
+}
+
+void ChunkLoader::account(){
+    // everything read but not yet taken
+    qint64 bytes = 0;
+    QHash<int, chunk_result>::const_iterator chunk;
+    for(chunk = ready.constBegin(); chunk != ready.constEnd(); ++chunk){
+        bytes += chunk.value().bytes;
+    }
+    if(spill_result.generation >= 0){
+        bytes += spill_result.bytes;
+    }
+    MemoryAccount::Set("Chunks read ahead", bytes);
+}
+
+void ChunkLoader::update_species(chunk_result &result){
+    // classify again if the store was classified with other cuts, e.g. read before a change
+    if(result.pid_cuts != settings.pid.Cuts()){
+        result.store.SetSpecies(settings.pid.Classify(result.store));
+        result.pid_cuts = settings.pid.Cuts();
+    }
+}
+
+void ChunkLoader::Clear(){
+    /*
+     * Forget every chunk read or queued.  Reads already running are cancelled; their
+     * results carry the old generation number and are dropped when they arrive.
+     */
+    settings.generation++;
+    loading_cancel->store(1);
+    spill_cancel->store(1);
+    queue.clear();
+    ready.clear();
+    spill_wanted = false;
+    spill_result.data.clear();
+    spill_result.store.Clear();
+    spill_result.generation = -1;
+    account();
+}
+
+void ChunkLoader::Request(int start_spill){
+    if(ready.contains(start_spill)){
+        emit ChunkReady(start_spill);
+        return;
+    }
+    queue.removeAll(start_spill);
+    if(loading && loading_spill != start_spill){
+        // whatever is being read now isn't what's wanted any more; a prefetch that is
+        // still useful will be asked for again once this chunk is in
+        loading_cancel->store(1);
+    }
+    if(!(loading && loading_spill == start_spill)){
+        queue.prepend(start_spill);
+    }
+    start_next();
+}
+
+void ChunkLoader::Prefetch(int start_spill){
+    if(ready.contains(start_spill) || queue.contains(start_spill) ||
+       (loading && loading_spill == start_spill)){
+        return;
+    }
+    if(!MemoryAccount::Fits(chunkBytes)){
+        // it would only push out something that is wanted more
+        return;
+    }
+    queue.append(start_spill);
+    start_next();
+}
+
+bool ChunkLoader::IsReady(int start_spill){
+    return ready.contains(start_spill);
+}
+
+QHash<int, QHash<int, QVector<QVector<double> > > > ChunkLoader::Take(int start_spill, EventStore *store){
+    chunk_result result = ready.take(start_spill);
+    account();
+    if(store){
+        *store = result.store;
+    }
+    return result.data;
+}
+
+double ChunkLoader::DecodeTime(){
+    return decodeTime;
+}
+
+void ChunkLoader::start_next(){
+    if(loading || queue.isEmpty() || settings.filename.isEmpty()){
+        return;
+    }
+
+    chunk_request request = settings;
+    request.start_spill = queue.takeFirst();
+    request.run = run;
+    if(indexed && run.isNull()){
+        request.entries = chunk_entries(request.start_spill, request.spill_range);
+    }
+    loading = true;
+    loading_spill = request.start_spill;
+    loading_cancel = QSharedPointer<QAtomicInt>(new QAtomicInt(0));
+    request.cancel = loading_cancel;
+    watcher.setFuture(QtConcurrent::run(&ChunkLoader::read_chunk, request));
+}
+
+void ChunkLoader::read_finished(){
+    chunk_result result = watcher.result();
+    loading = false;
+
+    if(result.generation == settings.generation && !result.cancelled){
+        decodeTime = result.decode_time;
+        chunkBytes = result.bytes;
+
+        // hold on to at most the chunk just read and one other, they're big, and make
+        // room within the memory budget for the new one
+        ready.remove(result.start_spill);
+        while(ready.size() >= 2){
+            ready.erase(ready.begin());
+        }
+        account();
+        while(!ready.isEmpty() && !MemoryAccount::Fits(result.bytes)){
+            ready.erase(ready.begin());
+            account();
+        }
+        update_species(result);
+        ready.insert(result.start_spill, result);
+        account();
+        emit ChunkReady(result.start_spill);
+    }
+
+    start_next();
+}
+
+ChunkLoader::chunk_result ChunkLoader::read_chunk(chunk_request request){
+    TRACE_SCOPE("ChunkLoader::read_chunk");
+    QElapsedTimer timer;
+    timer.start();
+
+    chunk_result result;
+    if(!request.run.isNull()){
+        decode_chunk(request, result);
+    }
+    else{
+        QScopedPointer<EventSource> reader(EventSource::Create(request.filename));
+        reader->SetDetectorPositions(request.locations.at(0), request.locations.at(1),
+                                     request.locations.at(2), request.locations.at(3),
+                                     request.locations.at(4));
+        reader->SetSpillRange(request.spill_range);
+        reader->SetStartingSpill(request.start_spill);
+        reader->SetCancelFlag(request.cancel.data());
+        reader->SetTOFCalibration(request.calibration);
+
+        if(request.entries.isEmpty()){
+            result.data = reader->Read(request.filename);
+        }
+        else{
+            result.data = reader->ReadEntries(request.filename, request.entries);
+        }
+        result.store.Fill(result.data);
+    }
+    result.store.SetSpecies(request.pid.Classify(result.store));
+    result.pid_cuts = request.pid.Cuts();
+    result.start_spill = request.start_spill;
+    result.generation = request.generation;
+    result.cancelled = request.cancel->load() != 0;
+    result.decode_time = timer.nsecsElapsed()/1.0e6;
+    result.bytes = MemoryAccount::SizeOf(result.data) + result.store.MemoryBytes();
+    return result;
+}
+
+bool ChunkLoader::HasIndex(){
+    return indexed;
+}
+
+bool ChunkLoader::IndexContains(int spill_number){
+    return spill_entries.contains(spill_number);
+}
+
+QMap<int, Long64_t> ChunkLoader::Index(){
+    // tree entry of each spill, empty until IndexReady()
+    return indexed ? spill_entries : QMap<int, Long64_t>();
+}
+
+void ChunkLoader::start_index(){
+    // only one index build at a time; index_finished() starts again if the file changed
+    if(index_watcher.isRunning() || settings.filename.isEmpty()){
+        return;
+    }
+    index_cancel = QSharedPointer<QAtomicInt>(new QAtomicInt(0));
+    index_watcher.setFuture(QtConcurrent::run(&ChunkLoader::build_index, settings.filename, index_cancel));
+}
+
+ChunkLoader::index_result ChunkLoader::build_index(QString filename, QSharedPointer<QAtomicInt> cancel){
+    TRACE_SCOPE("ChunkLoader::build_index");
+    QScopedPointer<EventSource> reader(EventSource::Create(filename));
+    reader->SetCancelFlag(cancel.data());
+    index_result result;
+    result.filename = filename;
+    result.index = reader->IndexSpills(filename);
+    return result;
+}
+
+void ChunkLoader::index_finished(){
+    index_result result = index_watcher.result();
+    if(result.filename != settings.filename){
+        start_index();
+        return;
+    }
+
+    spill_entries = result.index;
+    indexed = !spill_entries.isEmpty();
+    if(indexed){
+        emit IndexReady();
+    }
+    start_spill();
+}
+
+QVector<Long64_t> ChunkLoader::chunk_entries(int start_spill, int spill_range){
+    QVector<Long64_t> entries;
+    QMap<int, Long64_t>::const_iterator entry = spill_entries.lowerBound(start_spill);
+    for(; entry != spill_entries.constEnd() && entry.key() < start_spill + spill_range; ++entry){
+        entries << entry.value();
+    }
+    return entries;
+}
+
+void ChunkLoader::RequestSpill(int spill_number){
+    /*
+     * Read just this spill, using the index, without waiting for any chunk read.  Only
+     * the latest request matters: if another spill is being read, that read is
+     * cancelled and this one started as soon as it has stopped.
+     */
+    spill_wanted = true;
+    wanted_spill = spill_number;
+    if(spill_watcher.isRunning() && reading_spill != spill_number){
+        spill_cancel->store(1);
+    }
+    start_spill();
+}
+
+void ChunkLoader::CancelSpill(){
+    spill_wanted = false;
+    spill_cancel->store(1);
+}
+
+void ChunkLoader::start_spill(){
+    if(!spill_wanted || (!indexed && run.isNull()) || spill_watcher.isRunning()){
+        return;
+    }
+
+    chunk_request request = settings;
+    request.start_spill = wanted_spill;
+    request.spill_range = 1;
+    request.run = run;
+    bool in_file;
+    if(!run.isNull()){
+        in_file = run->FirstRow(wanted_spill) != run->FirstRow(wanted_spill + 1);
+    }
+    else{
+        request.entries = chunk_entries(wanted_spill, 1);
+        in_file = !request.entries.isEmpty();
+    }
+    if(!in_file){
+        // not a spill in this file; report it anyway so the caller stops waiting
+        spill_wanted = false;
+        spill_result.data.clear();
+        spill_result.store.Clear();
+        spill_result.start_spill = wanted_spill;
+        spill_result.generation = settings.generation;
+        spill_result.bytes = 0;
+        account();
+        emit SpillReady(wanted_spill);
+        return;
+    }
+    reading_spill = wanted_spill;
+    spill_cancel = QSharedPointer<QAtomicInt>(new QAtomicInt(0));
+    request.cancel = spill_cancel;
+    spill_watcher.setFuture(QtConcurrent::run(&ChunkLoader::read_chunk, request));
+}
+
+void ChunkLoader::spill_finished(){
+    chunk_result result = spill_watcher.result();
+    bool current = result.generation == settings.generation && !result.cancelled &&
+            spill_wanted && result.start_spill == wanted_spill;
+
+    if(current){
+        spill_wanted = false;
+        update_species(result);
+        spill_result = result;
+        account();
+        emit SpillReady(result.start_spill);
+    }
+    else{
+        start_spill();
+    }
+}
+
+QHash<int, QHash<int, QVector<QVector<double> > > > ChunkLoader::TakeSpill(int spill_number, EventStore *store){
+    QHash<int, QHash<int, QVector<QVector<double> > > > data;
+    if(spill_result.generation == settings.generation && spill_result.start_spill == spill_number){
+        data = spill_result.data;
+        if(store){
+            *store = spill_result.store;
+        }
+    }
+    spill_result.data.clear();
+    spill_result.store.Clear();
+    spill_result.generation = -1;
+    account();
+    return data;
+}
+
+void ChunkLoader::decode_chunk(const chunk_request &request, chunk_result &result){
+    // the chunk's rows of the resident run, back as a store and as event vectors
+    TRACE_SCOPE("ChunkLoader::decode_chunk");
+    int begin = request.run->FirstRow(request.start_spill);
+    int end = request.run->FirstRow(request.start_spill + request.spill_range);
+    result.store = request.run->Expand(begin, end);
+    result.data = result.store.Events();
+}
+
+void ChunkLoader::reset_run(){
+    // forget the resident run, which was for another file or other settings
+    runGeneration++;
+    run_cancel->store(1);
+    run.clear();
+    MemoryAccount::Set("Resident run", 0);
+    start_run();
+}
+
+void ChunkLoader::start_run(){
+    // one run read at a time; run_finished() starts again if it was for something else
+    if(!resident || !run.isNull() || run_watcher.isRunning() || settings.filename.isEmpty()){
+        return;
+    }
+    chunk_request request = settings;
+    request.generation = runGeneration;
+    run_cancel = QSharedPointer<QAtomicInt>(new QAtomicInt(0));
+    request.cancel = run_cancel;
+    run_watcher.setFuture(QtConcurrent::run(&ChunkLoader::read_run, request));
+}
+
+ChunkLoader::run_result ChunkLoader::read_run(chunk_request request){
+    /*
+     * Every spill in the index, a slice of entries at a time, so that only one slice is
+     * ever held uncompressed.  A file that can't be indexed isn't held at all.
+     */
+    TRACE_SCOPE("ChunkLoader::read_run");
+    run_result result;
+    result.generation = request.generation;
+
+    QScopedPointer<EventSource> reader(EventSource::Create(request.filename));
+    reader->SetDetectorPositions(request.locations.at(0), request.locations.at(1),
+                                 request.locations.at(2), request.locations.at(3),
+                                 request.locations.at(4));
+    reader->SetCancelFlag(request.cancel.data());
+    reader->SetTOFCalibration(request.calibration);
+    QVector<Long64_t> entries = reader->IndexSpills(request.filename).values().toVector();
+    if(entries.isEmpty()){
+        return result;
+    }
+
+    const int slice = 500;
+    QSharedPointer<CompactStore> run(new CompactStore);
+    for(int begin = 0; begin < entries.size(); begin += slice){
+        if(request.cancel->load() != 0){
+            return result;
+        }
+        EventStore store;
+        store.Fill(reader->ReadEntries(request.filename, entries.mid(begin, slice)));
+        run->Append(store);
+        MemoryAccount::Set("Resident run", run->MemoryBytes());
+        if(!MemoryAccount::Fits(0)){
+            MemoryAccount::Set("Resident run", 0);
+            return result;
+        }
+    }
+    if(request.cancel->load() == 0){
+        result.run = run;
+    }
+    return result;
+}
+
+void ChunkLoader::run_finished(){
+    run_result result = run_watcher.result();
+    if(result.generation == runGeneration && resident){
+        run = result.run;
+        MemoryAccount::Set("Resident run", run.isNull() ? 0 : run->MemoryBytes());
+        if(!run.isNull()){
+            emit RunReady();
+        }
+    }
+    else{
+        MemoryAccount::Set("Resident run", 0);
+        start_run();
+    }
+}
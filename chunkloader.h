@@ -0,0 +1,172 @@
+#ifndef CHUNKLOADER_H
+#define CHUNKLOADER_H
+
+#include <QObject>
+#include <QFutureWatcher>
+#include <QString>
+#include <QList>
+#include <QHash>
+#include <QVector>
+#include <QMap>
+#include <QAtomicInt>
+#include <QSharedPointer>
+#include <Rtypes.h>
+#include "eventstore.h"
+#include "compactstore.h"
+#include "particleid.h"
+#include "tofcalibration.h"
+
+/*
+ * Reads chunks of spills with an EventSource on a worker thread, so the GUI never waits
+ * on ROOT.  Chunks are identified by their starting spill.
+ *
+ * One read runs at a time, each with a source of its own.  Request() puts a chunk at
+ * the front of the queue, Prefetch() at the back; ChunkReady() is emitted on the GUI
+ * thread when a chunk has been read, and Take() hands it over, along with its
+ * EventStore, which is also filled, and its events classified with the ParticleID,
+ * on the worker thread.  Changing the file,
+ * detector positions, TOF calibration or spill range throws away everything read or queued so far.
+ *
+ * Setting a file also starts building an index of the tree entry holding each spill,
+ * in the background.  Once IndexReady() has been emitted, chunks are read entry by
+ * entry instead of streaming through the file from the beginning, and single spills
+ * can be read on their own with RequestSpill(), alongside any chunk read.
+ *
+ * Reads that are no longer wanted are cancelled rather than left to run: a Request()
+ * for another chunk stops the chunk being read, another RequestSpill() or
+ * CancelSpill() stops the spill being read, and Clear() stops both.  The source checks
+ * for this between spills, so a cancelled read ends within one tree entry and its
+ * result is thrown away.
+ *
+ * Chunks held but not yet taken are accounted as "Chunks read ahead" in the
+ * MemoryAccount.  Prefetch() does nothing while another chunk the size of the last one
+ * read would go over the budget, and older chunks are dropped to make room for a new one.
+ *
+ * With SetResident(), the whole run is also read, a slice of spills at a time, into a
+ * CompactStore on another worker thread, accounted as "Resident run".  Once RunReady()
+ * has been emitted, chunks and single spills are decoded from that instead of being
+ * read from the file, so moving anywhere in the run costs no I/O.  A run that outgrows
+ * the memory budget is given up on, and chunks go on being read from the file.
+ */
+class ChunkLoader : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit ChunkLoader(QObject *parent = 0);
+    ~ChunkLoader();
+
+    void SetFile(QString file);
+    void SetDetectorPositions(QVector<double> tof0_location, QVector<double> tof1_location,
+                              QVector<double> tku_location, QVector<double> tkd_location,
+                              QVector<double> tof2_location);
+    void SetSpillRange(int spill_range);
+    void SetParticleID(const ParticleID &particle_id);
+    void SetTOFCalibration(const TOFCalibration &calibration);
+    void SetResident(bool resident);
+    bool IsResident();
+
+    void Request(int start_spill);
+    void Prefetch(int start_spill);
+    bool IsReady(int start_spill);
+    QHash<int, QHash<int, QVector<QVector<double> > > > Take(int start_spill, EventStore *store = 0);
+    double DecodeTime();
+    void Clear();
+
+    bool HasIndex();
+    bool IndexContains(int spill_number);
+    QMap<int, Long64_t> Index();
+    void RequestSpill(int spill_number);
+    void CancelSpill();
+    QHash<int, QHash<int, QVector<QVector<double> > > > TakeSpill(int spill_number, EventStore *store = 0);
+
+signals:
+    void ChunkReady(int start_spill);
+    void IndexReady();
+    void SpillReady(int spill_number);
+    void RunReady();
+
+private slots:
+    void read_finished();
+    void index_finished();
+    void spill_finished();
+    void run_finished();
+
+private:
+    struct chunk_request {
+        QString filename;
+        QVector<QVector<double> > locations; // TOF0, TOF1, TKU, TKD, TOF2
+        int start_spill;
+        int spill_range;
+        int generation;
+        QVector<Long64_t> entries; // read these tree entries if there are any
+        QSharedPointer<QAtomicInt> cancel;
+        ParticleID pid;
+        TOFCalibration calibration;
+        QSharedPointer<const CompactStore> run; // decode from this instead if there is one
+    };
+
+    struct chunk_result {
+        QHash<int, QHash<int, QVector<QVector<double> > > > data;
+        EventStore store;
+        int start_spill;
+        int generation;
+        double decode_time; // ms
+        bool cancelled;
+        qint64 bytes; // data and store, see MemoryAccount
+        QVector<double> pid_cuts; // the ParticleID the store was classified with
+    };
+
+    struct index_result {
+        QString filename;
+        QMap<int, Long64_t> index;
+    };
+
+    struct run_result {
+        QSharedPointer<const CompactStore> run; // null if cancelled or over the budget
+        int generation;
+    };
+
+    static chunk_result read_chunk(chunk_request request);
+    static index_result build_index(QString filename, QSharedPointer<QAtomicInt> cancel);
+    static run_result read_run(chunk_request request);
+    static void decode_chunk(const chunk_request &request, chunk_result &result);
+    void start_next();
+    void start_index();
+    void start_spill();
+    void start_run();
+    void reset_run();
+    void update_species(chunk_result &result);
+    void account();
+    QVector<Long64_t> chunk_entries(int start_spill, int spill_range);
+
+    QFutureWatcher<chunk_result> watcher;
+    chunk_request settings;
+    bool loading;
+    int loading_spill;
+    QSharedPointer<QAtomicInt> loading_cancel;
+    QList<int> queue;
+    QHash<int, chunk_result> ready;
+    double decodeTime;
+    qint64 chunkBytes; // of the last chunk read
+
+    QFutureWatcher<index_result> index_watcher;
+    QMap<int, Long64_t> spill_entries;
+    bool indexed;
+    QSharedPointer<QAtomicInt> index_cancel;
+
+    QFutureWatcher<chunk_result> spill_watcher;
+    bool spill_wanted;
+    int wanted_spill;
+    int reading_spill;
+    QSharedPointer<QAtomicInt> spill_cancel;
+    chunk_result spill_result;
+
+    QFutureWatcher<run_result> run_watcher;
+    bool resident;
+    int runGeneration; // changes with the file, detector positions and TOF calibration
+    QSharedPointer<const CompactStore> run;
+    QSharedPointer<QAtomicInt> run_cancel;
+};
+
+#endif // CHUNKLOADER_H
@@ -0,0 +1,267 @@
+#include "compactstore.h"
+#include "trace.h"
+#include "memoryaccount.h"
+#include "TMath.h"
+
+#include <cstring>
+#include <algorithm>
+
+CompactStore::CompactStore()
+{
+    columns.resize(EventStore::NQuantities*EventStore::NSlots);
+}
+
+CompactStore::~CompactStore(){
+
+}
+
+double CompactStore::Resolution(int quantity){
+    // x, y, z in mm, t in ns, px, py, pz in MeV/c
+    const double resolutions[EventStore::NQuantities] = {0.01, 0.01, 0.01, 0.001, 0.01, 0.01, 0.01};
+    return resolutions[quantity];
+}
+
+void CompactStore::Clear(){
+    spills.clear();
+    events.clear();
+    species.clear();
+    blockBegin.clear();
+    for(int i = 0; i < columns.size(); i++){
+        columns[i] = column();
+    }
+}
+
+void CompactStore::Append(const EventStore &store){
+    /*
+     * The rows have to come after any held already, in (spill, event) order, e.g. the
+     * next slice of a run.  They start a block of their own.
+     */
+    TRACE_SCOPE("CompactStore::Append");
+    int first_row = spills.size();
+    int n_rows = store.Size();
+    if(n_rows == 0){
+        return;
+    }
+
+    spills.reserve(first_row + n_rows);
+    events.reserve(first_row + n_rows);
+    species.reserve(first_row + n_rows);
+    for(int row = 0; row < n_rows; row++){
+        spills << store.Spill(row);
+        events << store.Event(row);
+        species << qint8(store.Species(row));
+    }
+    for(int begin = 0; begin < n_rows; begin += BlockRows){
+        blockBegin << first_row + begin;
+    }
+
+    int n_words = (first_row + n_rows + 63)/64;
+    for(int quantity = 0; quantity < EventStore::NQuantities; quantity++){
+        for(int slot = 0; slot < EventStore::NSlots; slot++){
+            column &encoded = columns[quantity*EventStore::NSlots + slot];
+            encoded.valid.resize(n_words);
+            const double *values = store.Column(quantity, slot);
+            for(int begin = 0; begin < n_rows; begin += BlockRows){
+                encode_block(encoded, quantity, values + begin, first_row + begin,
+                             qMin(BlockRows, n_rows - begin));
+            }
+            encoded.bytes.squeeze();
+            encoded.blocks.squeeze();
+        }
+    }
+}
+
+void CompactStore::encode_block(column &encoded, int quantity, const double *values, int first_row, int rows){
+    double scale = Resolution(quantity);
+    QVector<qint64> quantized(rows);
+    qint64 smallest = 0, largest = 0;
+    bool any = false;
+    for(int i = 0; i < rows; i++){
+        if(!qIsFinite(values[i])){
+            continue;
+        }
+        int row = first_row + i;
+        encoded.valid[row/64] |= Q_UINT64_C(1) << (row%64);
+        quantized[i] = qRound64(values[i]/scale);
+        smallest = any ? qMin(smallest, quantized.at(i)) : quantized.at(i);
+        largest = any ? qMax(largest, quantized.at(i)) : quantized.at(i);
+        any = true;
+    }
+
+    block encoded_block;
+    encoded_block.reference = smallest;
+    quint64 spread = quint64(largest - smallest);
+    encoded_block.width = spread == 0 ? 0 : spread <= 0xff ? 1 : spread <= 0xffff ? 2
+                                     : spread <= Q_UINT64_C(0xffffffff) ? 4 : 8;
+    // aligned to the width, so the offsets can be read in place
+    int width = qMax(encoded_block.width, 1);
+    encoded_block.offset = (encoded.bytes.size() + width - 1)/width*width;
+    encoded.blocks << encoded_block;
+    if(encoded_block.width == 0){
+        return;
+    }
+
+    // missing values are stored as 0, the mask says which they are
+    encoded.bytes.resize(encoded_block.offset + rows*encoded_block.width);
+    quint8 *out = encoded.bytes.data() + encoded_block.offset;
+    for(int i = 0; i < rows; i++){
+        quint64 value = qIsFinite(values[i]) ? quint64(quantized.at(i) - smallest) : 0;
+        switch(encoded_block.width){
+        case 1: { quint8 v = quint8(value); std::memcpy(out + i, &v, 1); break; }
+        case 2: { quint16 v = quint16(value); std::memcpy(out + 2*i, &v, 2); break; }
+        case 4: { quint32 v = quint32(value); std::memcpy(out + 4*i, &v, 4); break; }
+        default: std::memcpy(out + 8*i, &value, 8); break;
+        }
+    }
+}
+
+int CompactStore::block_of(int row) const{
+    return std::upper_bound(blockBegin.constBegin(), blockBegin.constEnd(), row) - blockBegin.constBegin() - 1;
+}
+
+void CompactStore::decode_block(const column &encoded, int block_index, int block_begin, double scale,
+                                int begin, int end, double *values){
+    /*
+     * Rows begin to end of one block.  The mask is spread out into bytes first so that
+     * each width's loop is a convert, a multiply-add and a select, the value being
+     * worked out whether it is wanted or not.
+     */
+    const block &encoded_block = encoded.blocks.at(block_index);
+    const int rows = end - begin;
+    const double missing = TMath::Infinity();
+    const double base = encoded_block.reference*scale;
+
+    unsigned char valid[BlockRows];
+    const quint64 *words = encoded.valid.constData();
+    for(int i = 0; i < rows; i++){
+        int row = begin + i;
+        valid[i] = (words[row/64] >> (row%64)) & 1;
+    }
+
+    int first = begin - block_begin;
+    const quint8 *bytes = encoded.bytes.constData() + encoded_block.offset;
+    switch(encoded_block.width){
+    case 0:
+        for(int i = 0; i < rows; i++){
+            values[i] = valid[i] ? base : missing;
+        }
+        break;
+    case 1: {
+        const quint8 *offsets = bytes + first;
+        for(int i = 0; i < rows; i++){
+            double value = base + offsets[i]*scale;
+            values[i] = valid[i] ? value : missing;
+        }
+        break;
+    }
+    case 2: {
+        const quint16 *offsets = reinterpret_cast<const quint16*>(bytes) + first;
+        for(int i = 0; i < rows; i++){
+            double value = base + offsets[i]*scale;
+            values[i] = valid[i] ? value : missing;
+        }
+        break;
+    }
+    case 4: {
+        const quint32 *offsets = reinterpret_cast<const quint32*>(bytes) + first;
+        for(int i = 0; i < rows; i++){
+            double value = base + offsets[i]*scale;
+            values[i] = valid[i] ? value : missing;
+        }
+        break;
+    }
+    default: {
+        const quint64 *offsets = reinterpret_cast<const quint64*>(bytes) + first;
+        for(int i = 0; i < rows; i++){
+            double value = base + double(offsets[i])*scale;
+            values[i] = valid[i] ? value : missing;
+        }
+        break;
+    }
+    }
+}
+
+void CompactStore::Decode(int quantity, int slot, int begin, int end, double *values) const{
+    // rows begin to end of a column, as EventStore has them
+    const column &encoded = columns.at(quantity*EventStore::NSlots + slot);
+    double scale = Resolution(quantity);
+    begin = qMax(begin, 0);
+    end = qMin(end, spills.size());
+    for(int block_index = block_of(begin); begin < end; block_index++){
+        int block_begin = blockBegin.at(block_index);
+        int block_end = block_index + 1 < blockBegin.size() ? blockBegin.at(block_index + 1) : spills.size();
+        int stop = qMin(end, block_end);
+        decode_block(encoded, block_index, block_begin, scale, begin, stop, values);
+        values += stop - begin;
+        begin = stop;
+    }
+}
+
+EventStore CompactStore::Expand(int begin, int end) const{
+    TRACE_SCOPE("CompactStore::Expand");
+    EventStore store;
+    begin = qBound(0, begin, spills.size());
+    end = qBound(begin, end, spills.size());
+    store.spills = spills.mid(begin, end - begin);
+    store.events = events.mid(begin, end - begin);
+    store.species = species.mid(begin, end - begin);
+    for(int quantity = 0; quantity < EventStore::NQuantities; quantity++){
+        for(int slot = 0; slot < EventStore::NSlots; slot++){
+            QVector<double> &values = store.columns[quantity*EventStore::NSlots + slot];
+            values.resize(end - begin);
+            Decode(quantity, slot, begin, end, values.data());
+        }
+    }
+    store.derive();
+    return store;
+}
+
+int CompactStore::Size() const{
+    return spills.size();
+}
+
+int CompactStore::Spill(int row) const{
+    return spills.at(row);
+}
+
+int CompactStore::Event(int row) const{
+    return events.at(row);
+}
+
+int CompactStore::Row(int spill, int event) const{
+    // rows are sorted by (spill, event), as in EventStore
+    int row = FirstRow(spill);
+    int end = FirstRow(spill + 1);
+    QVector<int>::const_iterator found = std::lower_bound(events.constBegin() + row, events.constBegin() + end, event);
+    if(found != events.constBegin() + end && *found == event){
+        return found - events.constBegin();
+    }
+    return -1;
+}
+
+int CompactStore::FirstRow(int spill) const{
+    return std::lower_bound(spills.constBegin(), spills.constEnd(), spill) - spills.constBegin();
+}
+
+bool CompactStore::IsValid(int quantity, int slot, int row) const{
+    const column &encoded = columns.at(quantity*EventStore::NSlots + slot);
+    return (encoded.valid.at(row/64) >> (row%64)) & 1;
+}
+
+double CompactStore::Value(int quantity, int slot, int row) const{
+    double value;
+    Decode(quantity, slot, row, row + 1, &value);
+    return value;
+}
+
+qint64 CompactStore::MemoryBytes() const{
+    // see MemoryAccount
+    qint64 bytes = MemoryAccount::SizeOf(spills) + MemoryAccount::SizeOf(events)
+            + MemoryAccount::SizeOf(species) + MemoryAccount::SizeOf(blockBegin)
+            + MemoryAccount::SizeOf(columns);
+    for(int i = 0; i < columns.size(); i++){
+        bytes += MemoryAccount::SizeOf(columns.at(i).valid) + MemoryAccount::SizeOf(columns.at(i).blocks)
+                + MemoryAccount::SizeOf(columns.at(i).bytes);
+    }
+    return bytes;
+}
@@ -0,0 +1,74 @@
+#ifndef COMPACTSTORE_H
+#define COMPACTSTORE_H
+
+#include <QVector>
+#include "eventstore.h"
+
+/*
+ * The columns of an EventStore, encoded small enough to hold a whole run: a few hundred
+ * bytes an event at most, instead of 728 plus the containers.
+ *
+ * Each value is quantized to a fixed point at Resolution() (0.01 mm, 1 ps, 0.01 MeV/c),
+ * well below what the detectors resolve.  Rows are grouped in blocks of BlockRows, and
+ * within a block each column is stored as offsets from its smallest value, in as few
+ * bytes as the spread of the values needs: none for a column that is constant or empty
+ * in the block (z, and slots nothing hit), one or two for most.  Missing values are a
+ * bit in the column's validity mask rather than an Infinity; any value that isn't
+ * finite counts as missing.
+ *
+ * Append() adds the rows of an EventStore after those held so far, so a run can be
+ * encoded a slice at a time.  Decode() writes a range of a column back out as doubles,
+ * with Infinity where values are missing, in loops the compiler vectorises, and
+ * Expand() does that for every column to give an EventStore of some rows back.  The
+ * EventStore's derived columns aren't held here, Expand() derives them again.
+ */
+class CompactStore
+{
+public:
+    static const int BlockRows = 1024;
+
+    CompactStore();
+    ~CompactStore();
+
+    void Append(const EventStore &store);
+    void Clear();
+
+    int Size() const;
+    int Spill(int row) const;
+    int Event(int row) const;
+    int Row(int spill, int event) const;
+    int FirstRow(int spill) const;
+    bool IsValid(int quantity, int slot, int row) const;
+    double Value(int quantity, int slot, int row) const;
+    void Decode(int quantity, int slot, int begin, int end, double *values) const;
+    EventStore Expand(int begin, int end) const;
+    qint64 MemoryBytes() const;
+
+    static double Resolution(int quantity);
+
+private:
+    struct block {
+        qint64 reference; // the smallest value in the block, in units of Resolution()
+        int offset;       // into the column's bytes
+        int width;        // bytes per value: 0, 1, 2, 4 or 8
+    };
+
+    struct column {
+        QVector<quint64> valid; // a bit per row
+        QVector<block> blocks;
+        QVector<quint8> bytes;
+    };
+
+    void encode_block(column &encoded, int quantity, const double *values, int first_row, int rows);
+    static void decode_block(const column &encoded, int block_index, int block_begin, double scale,
+                             int begin, int end, double *values);
+    int block_of(int row) const;
+
+    QVector<int> spills;
+    QVector<int> events;
+    QVector<qint8> species;
+    QVector<int> blockBegin; // first row of each block
+    QVector<column> columns; // [quantity*NSlots + slot]
+};
+
+#endif // COMPACTSTORE_H
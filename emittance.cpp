@@ -0,0 +1,230 @@
+#include "emittance.h"
+#include "TMath.h"
+#include "TMatrixDSym.h"
+
+#include <QFuture>
+#include <QList>
+#include <QtConcurrentRun>
+#include <algorithm>
+#include <limits>
+
+Emittance::Emittance()
+{
+    Clear();
+}
+
+Emittance::~Emittance(){
+
+}
+
+void Emittance::Clear(){
+    spill_numbers.clear();
+    spill_moments.clear();
+    selected.fill(empty_moments(), NStations);
+}
+
+Emittance::moments Emittance::empty_moments(){
+    moments m;
+    m.n = 0;
+    for(int i = 0; i < 4; i++){
+        m.mean[i] = 0.0;
+        for(int j = 0; j < 4; j++){
+            m.c[i][j] = 0.0;
+        }
+    }
+    return m;
+}
+
+void Emittance::Fill(const EventStore &store){
+    /*
+     * Blocks of about 4096 rows, cut at spill boundaries so that no spill is split
+     * between two blocks, are filled on the global thread pool and joined in order.
+     */
+    Clear();
+
+    const int block_size = 4096;
+    QList<QFuture<spill_block> > blocks;
+    int begin = 0;
+    while(begin < store.Size()){
+        int end = qMin(begin + block_size, store.Size());
+        if(end < store.Size()){
+            end = store.FirstRow(store.Spill(end - 1) + 1);
+        }
+        blocks << QtConcurrent::run(&Emittance::fill_block, &store, begin, end);
+        begin = end;
+    }
+
+    for(int i = 0; i < blocks.size(); i++){
+        spill_block block = blocks[i].result();
+        spill_numbers += block.spill_numbers;
+        spill_moments += block.spill_moments;
+    }
+
+    Select(std::numeric_limits<int>::min(), std::numeric_limits<int>::max());
+}
+
+Emittance::spill_block Emittance::fill_block(const EventStore *store, int begin, int end){
+    const double missing = TMath::Infinity();
+    const int quantities[4] = {0, 4, 1, 5}; // x, px, y, py
+    spill_block block;
+
+    int spill_begin = begin;
+    while(spill_begin < end){
+        int spill_number = store->Spill(spill_begin);
+        int spill_end = spill_begin;
+        while(spill_end < end && store->Spill(spill_end) == spill_number){
+            spill_end++;
+        }
+        block.spill_numbers << spill_number;
+
+        for(int station = 0; station < NStations; station++){
+            const double *column[4];
+            for(int i = 0; i < 4; i++){
+                column[i] = store->Column(quantities[i], FirstSlot + station);
+            }
+
+            /*
+             * Two passes over the spill: count and sum the events with all four of
+             * (x, px, y, py), then sum the products of their deviations from the means.
+             * An event missing any of them is masked out with a select.
+             */
+            moments m = empty_moments();
+            double count = 0.0;
+            double sum[4] = {0.0, 0.0, 0.0, 0.0};
+            for(int row = spill_begin; row < spill_end; row++){
+                bool valid = (column[0][row] != missing) & (column[1][row] != missing) &
+                        (column[2][row] != missing) & (column[3][row] != missing);
+                count += valid ? 1.0 : 0.0;
+                for(int i = 0; i < 4; i++){
+                    sum[i] += valid ? column[i][row] : 0.0;
+                }
+            }
+            m.n = qint64(count);
+            if(m.n > 0){
+                for(int i = 0; i < 4; i++){
+                    m.mean[i] = sum[i]/m.n;
+                }
+                for(int row = spill_begin; row < spill_end; row++){
+                    bool valid = (column[0][row] != missing) & (column[1][row] != missing) &
+                            (column[2][row] != missing) & (column[3][row] != missing);
+                    double deviation[4];
+                    for(int i = 0; i < 4; i++){
+                        deviation[i] = valid ? column[i][row] - m.mean[i] : 0.0;
+                    }
+                    for(int i = 0; i < 4; i++){
+                        for(int j = i; j < 4; j++){
+                            m.c[i][j] += deviation[i]*deviation[j];
+                        }
+                    }
+                }
+                for(int i = 0; i < 4; i++){
+                    for(int j = 0; j < i; j++){
+                        m.c[i][j] = m.c[j][i];
+                    }
+                }
+            }
+            block.spill_moments << m;
+        }
+
+        spill_begin = spill_end;
+    }
+    return block;
+}
+
+void Emittance::merge(moments &total, const moments &block){
+    // combine the means and co-moments of two sets of events (Chan et al.)
+    if(block.n == 0){
+        return;
+    }
+    if(total.n == 0){
+        total = block;
+        return;
+    }
+    double n_total = total.n;
+    double n_block = block.n;
+    double n = n_total + n_block;
+    double delta[4];
+    for(int i = 0; i < 4; i++){
+        delta[i] = block.mean[i] - total.mean[i];
+    }
+    for(int i = 0; i < 4; i++){
+        for(int j = 0; j < 4; j++){
+            total.c[i][j] += block.c[i][j] + delta[i]*delta[j]*n_total*n_block/n;
+        }
+    }
+    for(int i = 0; i < 4; i++){
+        total.mean[i] += delta[i]*n_block/n;
+    }
+    total.n += block.n;
+}
+
+void Emittance::Select(int first_spill, int last_spill){
+    // spill_numbers are in order, so the range is one contiguous run of spills
+    selected.fill(empty_moments(), NStations);
+    int first = std::lower_bound(spill_numbers.constBegin(), spill_numbers.constEnd(), first_spill)
+            - spill_numbers.constBegin();
+    for(int spill = first; spill < spill_numbers.size() && spill_numbers.at(spill) <= last_spill; spill++){
+        for(int station = 0; station < NStations; station++){
+            merge(selected[station], spill_moments.at(spill*NStations + station));
+        }
+    }
+}
+
+int Emittance::Entries(int station) const{
+    return selected.at(station).n;
+}
+
+double Emittance::Mean(int station, int i) const{
+    const moments &m = selected.at(station);
+    return m.n > 0 ? m.mean[i] : TMath::Infinity();
+}
+
+double Emittance::Covariance(int station, int i, int j) const{
+    const moments &m = selected.at(station);
+    return m.n > 1 ? m.c[i][j]/m.n : TMath::Infinity();
+}
+
+double Emittance::Value(int station) const{
+    const moments &m = selected.at(station);
+    if(m.n < 2){
+        return TMath::Infinity();
+    }
+    TMatrixDSym covariance(4);
+    for(int i = 0; i < 4; i++){
+        for(int j = 0; j < 4; j++){
+            covariance(i, j) = m.c[i][j]/m.n;
+        }
+    }
+    double determinant = covariance.Determinant();
+    if(determinant <= 0){
+        return TMath::Infinity();
+    }
+    const double muon_mass = 105.6583745; // MeV/c^2
+    return TMath::Power(determinant, 0.25)/muon_mass;
+}
+
+QString Emittance::StationName(int station){
+    return QString("%1 %2").arg(station < 5 ? "TKU" : "TKD").arg(station%5 + 1);
+}
+
+QString Emittance::Report() const{
+    // an HTML table for the emittance tab
+    QString report = "<table border=\"1\" cellpadding=\"3\" cellspacing=\"0\">"
+            "<tr><th></th><th>Events</th><th>Emittance (mm)</th>"
+            "<th>&sigma;x (mm)</th><th>&sigma;px (MeV/c)</th>"
+            "<th>&sigma;y (mm)</th><th>&sigma;py (MeV/c)</th></tr>";
+    for(int station = 0; station < NStations; station++){
+        report += QString("<tr><td>%1</td><td>%2</td>").arg(StationName(station)).arg(Entries(station));
+        double emittance = Value(station);
+        report += emittance == TMath::Infinity() ? QString("<td>-</td>")
+                                                 : QString("<td>%1</td>").arg(emittance, 0, 'f', 2);
+        for(int i = 0; i < 4; i++){
+            double variance = Covariance(station, i, i);
+            report += variance == TMath::Infinity() ? QString("<td>-</td>")
+                                                    : QString("<td>%1</td>").arg(TMath::Sqrt(variance), 0, 'f', 2);
+        }
+        report += "</tr>";
+    }
+    report += "</table>";
+    return report;
+}
@@ -0,0 +1,62 @@
+#ifndef EMITTANCE_H
+#define EMITTANCE_H
+
+#include <QVector>
+#include <QString>
+#include "eventstore.h"
+
+/*
+ * Transverse (4D) emittance at each tracker station, from the (x, px, y, py) of the
+ * events in an EventStore.
+ *
+ * Fill() goes over the store once, in parallel blocks of whole spills, and keeps the
+ * count, means and co-moments of (x, px, y, py) for every spill and station.  Select()
+ * then merges the spills in a range, so choosing another spill or the whole chunk only
+ * costs a merge per spill rather than another pass over the events.
+ *
+ * Stations are numbered 0-9: TKU 1-5 then TKD 1-5, which are EventStore slots 2-11.
+ * The emittance is the normalised one, det(covariance)^(1/4)/m_mu, in mm.
+ */
+class Emittance
+{
+public:
+    static const int NStations = 10;
+    static const int FirstSlot = 2;
+
+    Emittance();
+    ~Emittance();
+
+    void Fill(const EventStore &store);
+    void Clear();
+    void Select(int first_spill, int last_spill);
+
+    int Entries(int station) const;
+    double Mean(int station, int i) const;
+    double Covariance(int station, int i, int j) const;
+    double Value(int station) const;
+    static QString StationName(int station);
+
+    QString Report() const;
+
+private:
+    struct moments {
+        qint64 n;
+        double mean[4];     // x, px, y, py
+        double c[4][4];     // sums of products of deviations from the means
+    };
+
+    struct spill_block {
+        QVector<int> spill_numbers;
+        QVector<moments> spill_moments; // [spill*NStations + station]
+    };
+
+    static spill_block fill_block(const EventStore *store, int begin, int end);
+    static moments empty_moments();
+    static void merge(moments &total, const moments &block);
+
+    QVector<int> spill_numbers;
+    QVector<moments> spill_moments;
+    QVector<moments> selected;
+};
+
+#endif // EMITTANCE_H
@@ -0,0 +1,670 @@
+#include "eventdisplay.h"
+#include "particleid.h"
+#include "trace.h"
+#include "TMath.h"
+
+EventDisplay::EventDisplay(QCustomPlot *position_xz, QCustomPlot *position_yz,
+                           QCustomPlot *momentum_t, QCustomPlot *momentum_z) :
+    plot_position_xz(position_xz),
+    plot_position_yz(position_yz),
+    plot_momentum_t(momentum_t),
+    plot_momentum_z(momentum_z)
+{
+    position_plots();
+    momentum_plots();
+
+    foreach(QCustomPlot *plot, Plots()){
+        setup_layers(plot);
+    }
+    static_layers_changed = true;
+}
+
+EventDisplay::~EventDisplay(){
+
+}
+
+void EventDisplay::position_plots(){
+    QPen pen;
+
+    /*
+     * (z, x) and (z, y) plot settings:
+     * -> colours, symbols, plot interactivity
+     */
+
+    position_xz_graphs << add_graph(plot_position_xz); // graph 0
+    position_xz_graphs << add_graph(plot_position_xz); // tof0, graph 1
+    position_xz_graphs << add_graph(plot_position_xz); // tof1, graph 2
+    position_xz_graphs << add_graph(plot_position_xz); // tku, graph 3
+    position_xz_graphs << add_graph(plot_position_xz); // tkd, graph 4
+    position_xz_graphs << add_graph(plot_position_xz); // tof2, graph 5
+    position_xz_graphs << add_graph(plot_position_xz); // all events in chunk, graph 6
+
+    int yBoundLower = -180.0;
+    int yBoundUpper = 180.0;
+
+    plot_position_xz->xAxis->setLabel("z (mm)");
+    plot_position_xz->yAxis->setLabel("x (mm)");
+    plot_position_xz->xAxis->setRange(5000.0, 25000.0);
+    plot_position_xz->yAxis->setRange(yBoundLower, yBoundUpper);
+
+    pen.setColor(Qt::gray);
+    position_xz_graphs.at(0)->setPen(pen);
+
+    pen.setColor(Qt::darkBlue);
+    position_xz_graphs.at(1)->setPen(pen);
+    position_xz_graphs.at(1)->setScatterStyle(QCPScatterStyle::ssSquare);
+    position_xz_graphs.at(1)->setLineStyle(QCPGraph::lsNone);
+
+    pen.setColor(Qt::red);
+    position_xz_graphs.at(2)->setPen(pen);
+    position_xz_graphs.at(2)->setScatterStyle(QCPScatterStyle::ssSquare);
+    position_xz_graphs.at(2)->setLineStyle(QCPGraph::lsNone);
+
+    pen.setColor(Qt::darkGreen);
+    position_xz_graphs.at(3)->setPen(pen);
+    position_xz_graphs.at(3)->setScatterStyle(QCPScatterStyle::ssSquare);
+    position_xz_graphs.at(3)->setLineStyle(QCPGraph::lsNone);
+
+    pen.setColor(Qt::green);
+    position_xz_graphs.at(4)->setPen(pen);
+    position_xz_graphs.at(4)->setScatterStyle(QCPScatterStyle::ssSquare);
+    position_xz_graphs.at(4)->setLineStyle(QCPGraph::lsNone);
+
+    pen.setColor(Qt::cyan);
+    position_xz_graphs.at(5)->setPen(pen);
+    position_xz_graphs.at(5)->setScatterStyle(QCPScatterStyle::ssSquare);
+    position_xz_graphs.at(5)->setLineStyle(QCPGraph::lsNone);
+
+
+    // interactive elements set here
+    plot_position_xz->setInteraction(QCP::iRangeDrag, true);
+    plot_position_xz->setInteraction(QCP::iRangeZoom, true);
+
+    // legend set here
+    plot_position_xz->setLocale(QLocale(QLocale::English, QLocale::UnitedKingdom));
+    plot_position_xz->legend->setVisible(true);
+    position_xz_graphs.at(0)->removeFromLegend();
+    position_xz_graphs.at(1)->setName("TOF0");
+    position_xz_graphs.at(2)->setName("TOF1");
+    position_xz_graphs.at(3)->setName("TkUS");
+    position_xz_graphs.at(4)->setName("TkDS");
+    position_xz_graphs.at(5)->setName("TOF2");
+
+    // overlay of every event in the chunk, only drawn when asked for:
+    pen.setColor(Qt::lightGray);
+    position_xz_graphs.at(6)->setPen(pen);
+    position_xz_graphs.at(6)->setScatterStyle(QCPScatterStyle(QCPScatterStyle::ssDisc, 3));
+    position_xz_graphs.at(6)->setLineStyle(QCPGraph::lsNone);
+    position_xz_graphs.at(6)->setScatterDecimation(true);
+    position_xz_graphs.at(6)->setName("All events");
+    position_xz_graphs.at(6)->setVisible(false);
+    position_xz_graphs.at(6)->removeFromLegend();
+    plot_position_xz->addLayer("overlay", plot_position_xz->layer("main"), QCustomPlot::limBelow);
+    position_xz_graphs.at(6)->setLayer("overlay");
+    add_species_overlays(plot_position_xz, position_xz_graphs); // graphs 7-9
+    add_comparison_graph(plot_position_xz, position_xz_graphs); // graph 10
+
+
+
+    position_yz_graphs << add_graph(plot_position_yz); // graph 0
+    position_yz_graphs << add_graph(plot_position_yz); // tof0, graph 1
+    position_yz_graphs << add_graph(plot_position_yz); // tof1, graph 2
+    position_yz_graphs << add_graph(plot_position_yz); // tku, graph 3
+    position_yz_graphs << add_graph(plot_position_yz); // tkd, graph 4
+    position_yz_graphs << add_graph(plot_position_yz); // tof2, graph 5
+    position_yz_graphs << add_graph(plot_position_yz); // all events in chunk, graph 6
+
+    plot_position_yz->xAxis->setLabel("z (mm)");
+    plot_position_yz->yAxis->setLabel("y (mm)");
+    plot_position_yz->xAxis->setRange(5000.0, 25000.0);
+    plot_position_yz->yAxis->setRange(yBoundLower, yBoundUpper);
+
+    pen.setColor(Qt::gray);
+    position_yz_graphs.at(0)->setPen(pen);
+
+    pen.setColor(Qt::darkBlue);
+    position_yz_graphs.at(1)->setPen(pen);
+    position_yz_graphs.at(1)->setScatterStyle(QCPScatterStyle::ssSquare);
+    position_yz_graphs.at(1)->setLineStyle(QCPGraph::lsNone);
+
+    pen.setColor(Qt::red);
+    position_yz_graphs.at(2)->setPen(pen);
+    position_yz_graphs.at(2)->setScatterStyle(QCPScatterStyle::ssSquare);
+    position_yz_graphs.at(2)->setLineStyle(QCPGraph::lsNone);
+
+    pen.setColor(Qt::darkGreen);
+    position_yz_graphs.at(3)->setPen(pen);
+    position_yz_graphs.at(3)->setScatterStyle(QCPScatterStyle::ssSquare);
+    position_yz_graphs.at(3)->setLineStyle(QCPGraph::lsNone);
+
+    pen.setColor(Qt::green);
+    position_yz_graphs.at(4)->setPen(pen);
+    position_yz_graphs.at(4)->setScatterStyle(QCPScatterStyle::ssSquare);
+    position_yz_graphs.at(4)->setLineStyle(QCPGraph::lsNone);
+
+    pen.setColor(Qt::cyan);
+    position_yz_graphs.at(5)->setPen(pen);
+    position_yz_graphs.at(5)->setScatterStyle(QCPScatterStyle::ssSquare);
+    position_yz_graphs.at(5)->setLineStyle(QCPGraph::lsNone);
+
+    // interactive elements set here
+    plot_position_yz->setInteraction(QCP::iRangeDrag, true);
+    plot_position_yz->setInteraction(QCP::iRangeZoom, true);
+
+    // legend set here
+    plot_position_yz->setLocale(QLocale(QLocale::English, QLocale::UnitedKingdom));
+    plot_position_yz->legend->setVisible(true);
+    position_yz_graphs.at(0)->removeFromLegend();
+    position_yz_graphs.at(1)->setName("TOF0");
+    position_yz_graphs.at(2)->setName("TOF1");
+    position_yz_graphs.at(3)->setName("TkUS");
+    position_yz_graphs.at(4)->setName("TkDS");
+    position_yz_graphs.at(5)->setName("TOF2");
+
+    // overlay of every event in the chunk, only drawn when asked for:
+    pen.setColor(Qt::lightGray);
+    position_yz_graphs.at(6)->setPen(pen);
+    position_yz_graphs.at(6)->setScatterStyle(QCPScatterStyle(QCPScatterStyle::ssDisc, 3));
+    position_yz_graphs.at(6)->setLineStyle(QCPGraph::lsNone);
+    position_yz_graphs.at(6)->setScatterDecimation(true);
+    position_yz_graphs.at(6)->setName("All events");
+    position_yz_graphs.at(6)->setVisible(false);
+    position_yz_graphs.at(6)->removeFromLegend();
+    plot_position_yz->addLayer("overlay", plot_position_yz->layer("main"), QCustomPlot::limBelow);
+    position_yz_graphs.at(6)->setLayer("overlay");
+    add_species_overlays(plot_position_yz, position_yz_graphs); // graphs 7-9
+    add_comparison_graph(plot_position_yz, position_yz_graphs); // graph 10
+
+
+}
+
+void EventDisplay::momentum_plots(){
+
+    momentum_t_graphs << add_graph(plot_momentum_t); // graph 0, all Px
+    momentum_t_graphs << add_graph(plot_momentum_t); // graph 1, upstream tracker Px
+    momentum_t_graphs << add_graph(plot_momentum_t); // graph 2, downstream tracker Px
+
+    momentum_t_graphs << add_graph(plot_momentum_t); // graph 3, all Py
+    momentum_t_graphs << add_graph(plot_momentum_t); // graph 4, upstream tracker Py
+    momentum_t_graphs << add_graph(plot_momentum_t); // graph 5, downstream tracker Py
+    momentum_t_graphs << add_graph(plot_momentum_t); // graph 6, Pt at every detector
+
+    plot_momentum_t->xAxis->setLabel("z (mm)");
+    plot_momentum_t->xAxis->setRange(5000.0, 25000.0);
+    plot_momentum_t->yAxis->setLabel("Px, Py or Pt (MeV)");
+    plot_momentum_t->yAxis->setRange(-50.0, 50.0);
+
+    plot_momentum_t->setInteraction(QCP::iRangeDrag, true);
+    plot_momentum_t->setInteraction(QCP::iRangeZoom, true);
+
+    momentum_z_graphs << add_graph(plot_momentum_z); // graph 0, all Pz
+    momentum_z_graphs << add_graph(plot_momentum_z); // graph 1, upstream tracker Pz
+    momentum_z_graphs << add_graph(plot_momentum_z); // graoh 2, downstream tracker Pz
+    momentum_z_graphs << add_graph(plot_momentum_z); // graph 3, |P| at every detector
+
+    plot_momentum_z->xAxis->setLabel("z (mm)");
+    plot_momentum_z->xAxis->setRange(5000.0, 25000.0);
+    plot_momentum_z->yAxis->setLabel("Pz or |P| (MeV)");
+    plot_momentum_z->yAxis->setRange(100.0, 400.0);
+
+    plot_momentum_z->setInteraction(QCP::iRangeDrag, true);
+    plot_momentum_z->setInteraction(QCP::iRangeZoom, true);
+
+    QPen pen;
+    pen.setColor(Qt::darkBlue);
+    momentum_t_graphs.at(0)->setPen(pen);
+    momentum_t_graphs.at(0)->setName("Px");
+    pen.setColor(Qt::darkGreen);
+    momentum_t_graphs.at(1)->setPen(pen);
+    momentum_t_graphs.at(1)->setScatterStyle(QCPScatterStyle::ssSquare);
+    momentum_t_graphs.at(1)->setLineStyle(QCPGraph::lsNone);
+    momentum_t_graphs.at(1)->setName("Px, Upstream Tracker");
+    pen.setColor(Qt::green);
+    momentum_t_graphs.at(2)->setPen(pen);
+    momentum_t_graphs.at(2)->setScatterStyle(QCPScatterStyle::ssSquare);
+    momentum_t_graphs.at(2)->setLineStyle(QCPGraph::lsNone);
+    momentum_t_graphs.at(2)->setName("Px, Downstream Tracker");
+
+
+    pen.setColor(Qt::darkRed);
+    momentum_t_graphs.at(3)->setPen(pen);
+    momentum_t_graphs.at(3)->setName("Py");
+    pen.setColor(Qt::darkGreen);
+    momentum_t_graphs.at(4)->setPen(pen);
+    momentum_t_graphs.at(4)->setScatterStyle(QCPScatterStyle::ssSquare);
+    momentum_t_graphs.at(4)->setLineStyle(QCPGraph::lsNone);
+    momentum_t_graphs.at(4)->setName("Py, Upstream Tracker");
+    pen.setColor(Qt::green);
+    momentum_t_graphs.at(5)->setPen(pen);
+    momentum_t_graphs.at(5)->setScatterStyle(QCPScatterStyle::ssSquare);
+    momentum_t_graphs.at(5)->setLineStyle(QCPGraph::lsNone);
+    momentum_t_graphs.at(5)->setName("Py, Downstream Tracker");
+    pen.setColor(Qt::darkMagenta);
+    momentum_t_graphs.at(6)->setPen(pen);
+    momentum_t_graphs.at(6)->setScatterStyle(QCPScatterStyle::ssDiamond);
+    momentum_t_graphs.at(6)->setName("Pt");
+    plot_momentum_t->legend->setVisible(true);
+
+    pen.setColor(Qt::darkBlue);
+    momentum_z_graphs.at(0)->setPen(pen);
+    pen.setColor(Qt::darkGreen);
+    momentum_z_graphs.at(1)->setPen(pen);
+    momentum_z_graphs.at(1)->setScatterStyle(QCPScatterStyle::ssSquare);
+    momentum_z_graphs.at(1)->setLineStyle(QCPGraph::lsNone);
+    momentum_z_graphs.at(1)->setName("Pz, Upstream Tracker");
+    pen.setColor(Qt::green);
+    momentum_z_graphs.at(2)->setPen(pen);
+    momentum_z_graphs.at(1)->setName("Pz, Downstream Tracker");
+    momentum_z_graphs.at(2)->setScatterStyle(QCPScatterStyle::ssSquare);
+    momentum_z_graphs.at(2)->setLineStyle(QCPGraph::lsNone);
+    pen.setColor(Qt::darkMagenta);
+    momentum_z_graphs.at(3)->setPen(pen);
+    momentum_z_graphs.at(3)->setScatterStyle(QCPScatterStyle::ssDiamond);
+    momentum_z_graphs.at(3)->setName("|P|");
+    plot_momentum_z->legend->setVisible(true);
+
+
+}
+
+void EventDisplay::SetEvent(const QVector<QVector<double> > &event, int spill_number, int event_number){
+    /*
+     * Fill the graphs from one event as stored by ReadMAUS::add_to_events():
+     * seven vectors (x, y, z, t, px, py, pz) of 13 detector slots each.  Given its
+     * spill and event number, the event's trajectory is cached.
+     */
+    TRACE_SCOPE("EventDisplay::SetEvent");
+    if(event.size() < 7){
+        return;
+    }
+
+    const QVector<double> &x = event.at(0);
+    const QVector<double> &y = event.at(1);
+    const QVector<double> &z = event.at(2);
+    const QVector<double> &t = event.at(3);
+    const QVector<double> &px = event.at(4);
+    const QVector<double> &py = event.at(5);
+    const QVector<double> &pz = event.at(6);
+
+    update_tolerance();
+    TrackPropagator::Trajectory trajectory = spill_number >= 0 ?
+                propagator.Cached(spill_number, event_number, event) : propagator.Propagate(event);
+
+    position_xz_graphs.at(0)->setData(trajectory.z, trajectory.x, true);
+    position_yz_graphs.at(0)->setData(trajectory.z, trajectory.y, true);
+
+    momentum_t_graphs.at(0)->setData(trajectory.z, trajectory.px, true);
+    momentum_t_graphs.at(3)->setData(trajectory.z, trajectory.py, true);
+
+    momentum_z_graphs.at(0)->setData(z, pz);
+    // Pt and |P| come from the store's derived columns, see SetDerived()
+
+
+    // plot TOF0:
+    QVector<double> tof0_x, tof0_y, tof0_z;
+    tof0_x << x.at(0);
+    tof0_y << y.at(0);
+    tof0_z << z.at(0);
+
+    position_xz_graphs.at(1)->setData(tof0_z, tof0_x);
+    position_yz_graphs.at(1)->setData(tof0_z, tof0_y);
+
+    // plot TOF1:
+    QVector<double> tof1_x, tof1_y, tof1_z;
+    tof1_x << x.at(1);
+    tof1_y << y.at(1);
+    tof1_z << z.at(1);
+
+    position_xz_graphs.at(2)->setData(tof1_z, tof1_x);
+    position_yz_graphs.at(2)->setData(tof1_z, tof1_y);
+
+    // plot upstream tracker:
+    QVector<double> tku_x, tku_y, tku_z, tku_px, tku_py, tku_pz;
+    tku_x << x.at(2) << x.at(3) << x.at(4) << x.at(5) << x.at(6);
+    tku_y << y.at(2) << y.at(3) << y.at(4) << y.at(5) << y.at(6);
+    tku_z << z.at(2) << z.at(3) << z.at(4) << z.at(5) << z.at(6);
+    tku_px << px.at(2) << px.at(3) << px.at(4) << px.at(5) << px.at(6);
+    tku_py << py.at(2) << py.at(3) << py.at(4) << py.at(5) << py.at(6);
+    tku_pz << pz.at(2) << pz.at(3) << pz.at(4) << pz.at(5) << pz.at(6);
+
+    position_xz_graphs.at(3)->setData(tku_z, tku_x);
+    position_yz_graphs.at(3)->setData(tku_z, tku_y);
+    momentum_t_graphs.at(1)->setData(tku_z, tku_px);
+    momentum_t_graphs.at(4)->setData(tku_z, tku_py);
+    momentum_z_graphs.at(1)->setData(tku_z, tku_pz);
+
+    // plot downstream tracker:
+    QVector<double> tkd_x, tkd_y, tkd_z, tkd_px, tkd_py, tkd_pz;
+    tkd_x << x.at(7) << x.at(8) << x.at(9) << x.at(10) << x.at(11);
+    tkd_y << y.at(7) << y.at(8) << y.at(9) << y.at(10) << y.at(11);
+    tkd_z << z.at(7) << z.at(8) << z.at(9) << z.at(10) << z.at(11);
+    tkd_px << px.at(7) << px.at(8) << px.at(9) << px.at(10) << px.at(11);
+    tkd_py << py.at(7) << py.at(8) << py.at(9) << py.at(10) << py.at(11);
+    tkd_pz << pz.at(7) << pz.at(8) << pz.at(9) << pz.at(10) << pz.at(11);
+
+
+    position_xz_graphs.at(4)->setData(tkd_z, tkd_x);
+    position_yz_graphs.at(4)->setData(tkd_z, tkd_y);
+    momentum_t_graphs.at(2)->setData(tkd_z, tkd_px);
+    momentum_t_graphs.at(5)->setData(tkd_z, tkd_py);
+    momentum_z_graphs.at(2)->setData(tkd_z, tkd_pz);
+
+    // plot TOF2:
+    QVector<double> tof2_x, tof2_y, tof2_z;
+    tof2_x << x.at(12);
+    tof2_y << y.at(12);
+    tof2_z << z.at(12);
+
+    position_xz_graphs.at(5)->setData(tof2_z, tof2_x);
+    position_yz_graphs.at(5)->setData(tof2_z, tof2_y);
+}
+
+void EventDisplay::SetDerived(const EventStore &store, int row){
+    // Pt and |P| at every detector that measured them, none if row is -1
+    QVector<double> z_pt, pt, z_p, p;
+    if(row >= 0){
+        for(int slot = 0; slot < EventStore::NSlots; slot++){
+            double z = store.Value(2, slot, row);
+            double transverse = store.Value(EventStore::TransverseMomentum, slot, row);
+            double total = store.Value(EventStore::Momentum, slot, row);
+            if(z == TMath::Infinity()){
+                continue;
+            }
+            if(transverse != TMath::Infinity()){
+                z_pt << z;
+                pt << transverse;
+            }
+            if(total != TMath::Infinity()){
+                z_p << z;
+                p << total;
+            }
+        }
+    }
+    momentum_t_graphs.at(6)->setData(z_pt, pt);
+    momentum_z_graphs.at(3)->setData(z_p, p);
+}
+
+void EventDisplay::SetOverlay(const QVector<double> &z, const QVector<double> &x,
+                              const QVector<double> &y, bool visible){
+    // every hit in the chunk, drawn behind the current event on the (z, x) and (z, y) plots
+    position_xz_graphs.at(6)->setData(z, x);
+    position_yz_graphs.at(6)->setData(z, y);
+    position_xz_graphs.at(6)->setVisible(visible);
+    position_yz_graphs.at(6)->setVisible(visible);
+}
+
+void EventDisplay::add_species_overlays(QCustomPlot *plot, QVector<QCPVectorGraph*> &graphs){
+    // one overlay graph per identified species, in that species' colour
+    QPen pen;
+    for(int species = ParticleID::Electron; species <= ParticleID::Pion; species++){
+        QCPVectorGraph *graph = add_graph(plot);
+        pen.setColor(ParticleID::Colour(species).lighter(160));
+        graph->setPen(pen);
+        graph->setScatterStyle(QCPScatterStyle(QCPScatterStyle::ssDisc, 3));
+        graph->setLineStyle(QCPGraph::lsNone);
+        graph->setScatterDecimation(true);
+        graph->setVisible(false);
+        graph->removeFromLegend();
+        graph->setLayer("overlay");
+        graphs << graph;
+    }
+}
+
+void EventDisplay::SetOverlayEvents(const QVector<const QVector<QVector<double> >*> &events,
+                                    const QVector<int> &species, bool visible){
+    /*
+     * Trajectories of many events at once, as points, in the colour of each event's
+     * species (graph 6 for unidentified events, 7-9 for e, mu and pi).  While they are
+     * visible, their points are also indexed for PickOverlay(), by their place in events.
+     */
+    update_tolerance();
+    QVector<QVector<const QVector<QVector<double> >*> > by_species(ParticleID::NSpecies);
+    QVector<QVector<int> > positions(ParticleID::NSpecies);
+    for(int i = 0; i < events.size(); i++){
+        int s = qBound(0, species.value(i), ParticleID::NSpecies - 1);
+        by_species[s] << events.at(i);
+        positions[s] << i;
+    }
+
+    // cells of about 4 pixels at the current zoom
+    overlay_xz_index.SetCellSize(plot_position_xz->xAxis->range().size()/qMax(1, plot_position_xz->axisRect()->width()/4),
+                                 plot_position_xz->yAxis->range().size()/qMax(1, plot_position_xz->axisRect()->height()/4));
+    overlay_yz_index.SetCellSize(plot_position_yz->xAxis->range().size()/qMax(1, plot_position_yz->axisRect()->width()/4),
+                                 plot_position_yz->yAxis->range().size()/qMax(1, plot_position_yz->axisRect()->height()/4));
+
+    for(int s = 0; s < ParticleID::NSpecies; s++){
+        TrackPropagator::Trajectory trajectories = propagator.PropagateAll(by_species.at(s));
+        position_xz_graphs.at(6 + s)->setData(trajectories.z, trajectories.x);
+        position_yz_graphs.at(6 + s)->setData(trajectories.z, trajectories.y);
+        position_xz_graphs.at(6 + s)->setVisible(visible);
+        position_yz_graphs.at(6 + s)->setVisible(visible);
+
+        if(visible){
+            QVector<int> owners(trajectories.event.size());
+            for(int i = 0; i < owners.size(); i++){
+                owners[i] = positions.at(s).at(trajectories.event.at(i));
+            }
+            overlay_xz_index.Add(trajectories.z, trajectories.x, owners);
+            overlay_yz_index.Add(trajectories.z, trajectories.y, owners);
+        }
+    }
+}
+
+int EventDisplay::PickOverlay(QCustomPlot *plot, QPoint pixel, double max_pixels) const{
+    // the event (its place in SetOverlayEvents()' events) with a point nearest pixel, or -1
+    const PointIndex *index = plot == plot_position_xz ? &overlay_xz_index
+                            : plot == plot_position_yz ? &overlay_yz_index : 0;
+    if(index == 0){
+        return -1;
+    }
+    double key_scale = plot->axisRect()->width()/plot->xAxis->range().size();
+    double value_scale = plot->axisRect()->height()/plot->yAxis->range().size();
+    int point = index->Nearest(plot->xAxis->pixelToCoord(pixel.x()), plot->yAxis->pixelToCoord(pixel.y()),
+                               key_scale, value_scale, max_pixels);
+    return point >= 0 ? index->Owner(point) : -1;
+}
+
+QVector<int> EventDisplay::OverlayEventsIn(QCustomPlot *plot, QRect pixels) const{
+    // every event with a point inside a rectangle on the plot, in order
+    const PointIndex *index = plot == plot_position_xz ? &overlay_xz_index
+                            : plot == plot_position_yz ? &overlay_yz_index : 0;
+    if(index == 0){
+        return QVector<int>();
+    }
+    QRectF box(QPointF(plot->xAxis->pixelToCoord(pixels.left()), plot->yAxis->pixelToCoord(pixels.top())),
+               QPointF(plot->xAxis->pixelToCoord(pixels.right()), plot->yAxis->pixelToCoord(pixels.bottom())));
+    return index->InBox(box);
+}
+
+qint64 EventDisplay::PickIndexBytes() const{
+    return overlay_xz_index.MemoryBytes() + overlay_yz_index.MemoryBytes();
+}
+
+void EventDisplay::SetSpecies(int species){
+    // the current event's track, in the colour of its species
+    QPen pen(ParticleID::Colour(species));
+    position_xz_graphs.at(0)->setPen(pen);
+    position_yz_graphs.at(0)->setPen(pen);
+}
+
+void EventDisplay::SetTracks(QVector<double> tracker_fields, int charge){
+    // solenoid fields (T) in TKU and TKD, and the charge of the beam particles
+    propagator.SetFields(tracker_fields.value(0), tracker_fields.value(1));
+    propagator.SetCharge(charge);
+}
+
+void EventDisplay::update_tolerance(){
+    // about one pixel in x or y on the position plots, whichever is finer
+    double tolerance = TMath::Infinity();
+    QList<QCustomPlot*> plots;
+    plots << plot_position_xz << plot_position_yz;
+    foreach(QCustomPlot *plot, plots){
+        int height = plot->yAxis->axisRect()->height();
+        if(height > 0){
+            tolerance = qMin(tolerance, plot->yAxis->range().size()/height);
+        }
+    }
+    if(tolerance != TMath::Infinity()){
+        propagator.SetTolerance(tolerance);
+    }
+}
+
+void EventDisplay::add_comparison_graph(QCustomPlot *plot, QVector<QCPVectorGraph*> &graphs){
+    // the event's hits in another reconstruction, open circles over the event's own
+    QCPVectorGraph *graph = add_graph(plot);
+    graph->setPen(QPen(Qt::magenta));
+    graph->setScatterStyle(QCPScatterStyle(QCPScatterStyle::ssCircle, 9));
+    graph->setLineStyle(QCPGraph::lsNone);
+    graph->setName("Compared file");
+    graph->setVisible(false);
+    graph->removeFromLegend();
+    graphs << graph;
+}
+
+void EventDisplay::SetComparison(const QVector<QVector<double> > &event, bool visible){
+    // the same event from the file being compared with, see RunComparison
+    QVector<double> z_x, x, z_y, y;
+    if(visible && event.size() >= 3){
+        for(int slot = 0; slot < event.at(2).size(); slot++){
+            if(event.at(2).at(slot) == TMath::Infinity()){
+                continue;
+            }
+            if(event.at(0).at(slot) != TMath::Infinity()){
+                z_x << event.at(2).at(slot);
+                x << event.at(0).at(slot);
+            }
+            if(event.at(1).at(slot) != TMath::Infinity()){
+                z_y << event.at(2).at(slot);
+                y << event.at(1).at(slot);
+            }
+        }
+    }
+    position_xz_graphs.at(10)->setData(z_x, x);
+    position_yz_graphs.at(10)->setData(z_y, y);
+    position_xz_graphs.at(10)->setVisible(visible);
+    position_yz_graphs.at(10)->setVisible(visible);
+}
+
+QCPVectorGraph* EventDisplay::add_graph(QCustomPlot *plot){
+    QCPVectorGraph *graph = new QCPVectorGraph(plot->xAxis, plot->yAxis);
+    plot->addPlottable(graph);
+    return graph;
+}
+
+void EventDisplay::setup_layers(QCustomPlot *plot){
+    // detector outlines sit just above the grid, below any overlays and the event itself
+    plot->addLayer("geometry", plot->layer("grid"), QCustomPlot::limAbove);
+    plot->layer("main")->setMode(QCPLayer::lmBuffered);
+}
+
+void EventDisplay::SetGeometry(QVector<double> tof0_location, QVector<double> tof1_location,
+                               QVector<double> tof2_location, QVector<double> tracker_station_z){
+    /*
+     * Draw the detectors on the (z, x) and (z, y) plots:
+     *   TOFs     -> one outline per slab, TOF locations are (x offset, y offset, z)
+     *   trackers -> a line at each station z, Infinity if the station isn't known
+     *   aperture -> lines at +/- the tracker bore radius
+     */
+    foreach(QCPAbstractItem *item, geometry_items){
+        item->parentPlot()->removeItem(item);
+    }
+    geometry_items.clear();
+
+    // called whenever a chunk is read or the positions change, so the cached
+    // trajectories may no longer match the events
+    propagator.ClearCache();
+
+    add_tof_geometry(tof0_location, 10, 40.0);
+    add_tof_geometry(tof1_location, 7, 60.0);
+    add_tof_geometry(tof2_location, 10, 60.0);
+
+    for(int i = 0; i < tracker_station_z.size(); i++){
+        if(tracker_station_z.at(i) != TMath::Infinity()){
+            add_plane(plot_position_xz, tracker_station_z.at(i));
+            add_plane(plot_position_yz, tracker_station_z.at(i));
+        }
+    }
+
+    double aperture_radius = 150.0; // mm
+    add_aperture(plot_position_xz, aperture_radius);
+    add_aperture(plot_position_yz, aperture_radius);
+
+    static_layers_changed = true;
+}
+
+void EventDisplay::add_tof_geometry(QVector<double> location, int n_slabs, double slab_width){
+    // slabs are centred on the offset position; vertical slabs measure x, horizontal
+    // slabs measure y, and both have the same count and width
+    double half_depth = 25.4; // two planes of 1 inch slabs
+    double z = location.at(2);
+
+    QPen pen(QColor(170, 170, 170));
+
+    for(int plot_number = 0; plot_number < 2; plot_number++){
+        QCustomPlot *plot = plot_number == 0 ? plot_position_xz : plot_position_yz;
+        double offset = location.at(plot_number);
+        double lower_edge = offset - 0.5*n_slabs*slab_width;
+
+        for(int slab = 0; slab < n_slabs; slab++){
+            QCPItemRect *outline = new QCPItemRect(plot);
+            plot->addItem(outline);
+            outline->setLayer("geometry");
+            outline->setSelectable(false);
+            outline->setPen(pen);
+            outline->topLeft->setCoords(z - half_depth, lower_edge + (slab+1)*slab_width);
+            outline->bottomRight->setCoords(z + half_depth, lower_edge + slab*slab_width);
+            geometry_items << outline;
+        }
+    }
+}
+
+void EventDisplay::add_plane(QCustomPlot *plot, double z){
+    QCPItemStraightLine *plane = new QCPItemStraightLine(plot);
+    plot->addItem(plane);
+    plane->setLayer("geometry");
+    plane->setSelectable(false);
+    plane->setPen(QPen(QColor(170, 170, 170), 0, Qt::DashLine));
+    plane->point1->setCoords(z, 0.0);
+    plane->point2->setCoords(z, 1.0);
+    geometry_items << plane;
+}
+
+void EventDisplay::add_aperture(QCustomPlot *plot, double radius){
+    for(int side = -1; side <= 1; side += 2){
+        QCPItemStraightLine *edge = new QCPItemStraightLine(plot);
+        plot->addItem(edge);
+        edge->setLayer("geometry");
+        edge->setSelectable(false);
+        edge->setPen(QPen(QColor(200, 200, 200), 0, Qt::DotLine));
+        edge->point1->setCoords(0.0, side*radius);
+        edge->point2->setCoords(1.0, side*radius);
+        geometry_items << edge;
+    }
+}
+
+void EventDisplay::Replot(){
+    TRACE_SCOPE("EventDisplay::Replot");
+    /*
+     * After a geometry change everything has to be drawn again.  Otherwise only the
+     * event layer is redrawn and composited with the cached axes/grid/geometry; any
+     * range change from zooming/dragging triggers a full replot inside QCustomPlot.
+     */
+    foreach(QCustomPlot *plot, Plots()){
+        if(static_layers_changed){
+            plot->replot();
+        }
+        else{
+            plot->layer("main")->replot();
+        }
+    }
+    static_layers_changed = false;
+}
+
+QList<QCustomPlot*> EventDisplay::Plots(){
+    QList<QCustomPlot*> plots;
+    plots << plot_position_xz << plot_position_yz << plot_momentum_t << plot_momentum_z;
+    return plots;
+}
+
+qint64 EventDisplay::TrackCacheBytes() const{
+    return propagator.CacheBytes();
+}
@@ -0,0 +1,85 @@
+#ifndef EVENTDISPLAY_H
+#define EVENTDISPLAY_H
+
+#include <QVector>
+#include <QList>
+#include <QPen>
+#include "qcustomplot.h"
+#include "trackpropagator.h"
+#include "eventstore.h"
+#include "pointindex.h"
+
+/*
+ * Owns the graphs of the four per-event plots, (z, x), (z, y), (z, px/py) and (z, pz),
+ * for whichever QCustomPlot widgets it is handed.  The main window uses it with the
+ * plots in its tabs; batch export uses it with plots that are never shown.
+ *
+ * The graphs are QCPVectorGraphs: every event replaces all of their data, which for them
+ * is adopting a few short vectors rather than rebuilding a QMap per graph.
+ *
+ * The event graphs live on the "main" layer, which is buffered on its own.  Everything
+ * else (axes, grid, legend and the detector outlines on the "geometry" layer) is cached,
+ * so stepping from one event to the next only repaints the event layer.
+ *
+ * The line through an event on the position plots, and the overlay of the chunk, are
+ * trajectories from a TrackPropagator: helices in the trackers, straight lines
+ * elsewhere, sampled to about a pixel on the position plots.
+ *
+ * The overlay's points are held in a PointIndex per position plot, so that
+ * PickOverlay() and OverlayEventsIn() can say which events are under the mouse.
+ */
+class EventDisplay
+{
+public:
+    EventDisplay(QCustomPlot *position_xz, QCustomPlot *position_yz,
+                 QCustomPlot *momentum_t, QCustomPlot *momentum_z);
+    ~EventDisplay();
+
+    void SetEvent(const QVector<QVector<double> > &event, int spill_number = -1, int event_number = -1);
+    void SetOverlay(const QVector<double> &z, const QVector<double> &x,
+                    const QVector<double> &y, bool visible);
+    void SetOverlayEvents(const QVector<const QVector<QVector<double> >*> &events,
+                          const QVector<int> &species, bool visible);
+    void SetDerived(const EventStore &store, int row);
+    void SetComparison(const QVector<QVector<double> > &event, bool visible);
+    void SetSpecies(int species);
+    void SetTracks(QVector<double> tracker_fields, int charge);
+    void SetGeometry(QVector<double> tof0_location, QVector<double> tof1_location,
+                     QVector<double> tof2_location, QVector<double> tracker_station_z);
+    void Replot();
+    QList<QCustomPlot*> Plots();
+    qint64 TrackCacheBytes() const;
+    int PickOverlay(QCustomPlot *plot, QPoint pixel, double max_pixels) const;
+    QVector<int> OverlayEventsIn(QCustomPlot *plot, QRect pixels) const;
+    qint64 PickIndexBytes() const;
+
+private:
+    QCustomPlot *plot_position_xz;
+    QCustomPlot *plot_position_yz;
+    QCustomPlot *plot_momentum_t;
+    QCustomPlot *plot_momentum_z;
+
+    QVector<QCPVectorGraph*> position_xz_graphs;
+    QVector<QCPVectorGraph*> position_yz_graphs;
+    QVector<QCPVectorGraph*> momentum_t_graphs;
+    QVector<QCPVectorGraph*> momentum_z_graphs;
+
+    QList<QCPAbstractItem*> geometry_items;
+    bool static_layers_changed;
+
+    TrackPropagator propagator;
+    PointIndex overlay_xz_index, overlay_yz_index;
+    void update_tolerance();
+
+    void position_plots();
+    void momentum_plots();
+    void setup_layers(QCustomPlot *plot);
+    QCPVectorGraph* add_graph(QCustomPlot *plot);
+    void add_species_overlays(QCustomPlot *plot, QVector<QCPVectorGraph*> &graphs);
+    void add_comparison_graph(QCustomPlot *plot, QVector<QCPVectorGraph*> &graphs);
+    void add_tof_geometry(QVector<double> location, int n_slabs, double slab_width);
+    void add_plane(QCustomPlot *plot, double z);
+    void add_aperture(QCustomPlot *plot, double radius);
+};
+
+#endif // EVENTDISPLAY_H
@@ -0,0 +1,426 @@
+#include "eventquery.h"
+#include "particleid.h"
+#include "trace.h"
+#include "TMath.h"
+
+#include <QFuture>
+#include <QList>
+#include <QtConcurrentRun>
+
+EventQuery::EventQuery()
+{
+    root = -1;
+    position = 0;
+}
+
+EventQuery::~EventQuery(){
+
+}
+
+bool EventQuery::Compile(QString text){
+    /*
+     * Parse the expression into nodes, by recursive descent in order of precedence:
+     *   or -> and -> not -> comparison -> sum -> product -> unary -> primary
+     * An empty expression compiles to a query that matches nothing.
+     */
+    expression = text.trimmed();
+    error.clear();
+    nodes.clear();
+    root = -1;
+
+    if(expression.isEmpty()){
+        return true;
+    }
+    if(!tokenise(expression)){
+        return false;
+    }
+
+    position = 0;
+    root = parse_or();
+    if(root >= 0 && position < tokens.size()){
+        error = QString("unexpected \"%1\"").arg(tokens.at(position));
+        root = -1;
+    }
+    if(root < 0){
+        nodes.clear();
+        return false;
+    }
+    return true;
+}
+
+QString EventQuery::Expression() const{
+    return expression;
+}
+
+QString EventQuery::ErrorString() const{
+    return error;
+}
+
+bool EventQuery::IsEmpty() const{
+    return root < 0;
+}
+
+bool EventQuery::tokenise(QString text){
+    tokens.clear();
+    int i = 0;
+    while(i < text.size()){
+        QChar c = text.at(i);
+        if(c.isSpace()){
+            i++;
+        }
+        else if(c.isDigit() || (c == '.' && i+1 < text.size() && text.at(i+1).isDigit())){
+            int start = i;
+            while(i < text.size() && (text.at(i).isDigit() || text.at(i) == '.')){
+                i++;
+            }
+            // exponent, e.g. 1.5e3 or 2E-2
+            if(i < text.size() && (text.at(i) == 'e' || text.at(i) == 'E')){
+                int exponent = i+1;
+                if(exponent < text.size() && (text.at(exponent) == '+' || text.at(exponent) == '-')){
+                    exponent++;
+                }
+                if(exponent < text.size() && text.at(exponent).isDigit()){
+                    i = exponent;
+                    while(i < text.size() && text.at(i).isDigit()){
+                        i++;
+                    }
+                }
+            }
+            tokens << text.mid(start, i - start);
+        }
+        else if(c.isLetter() || c == '_'){
+            int start = i;
+            while(i < text.size() && (text.at(i).isLetterOrNumber() || text.at(i) == '_')){
+                i++;
+            }
+            tokens << text.mid(start, i - start).toLower();
+        }
+        else{
+            QString pair = text.mid(i, 2);
+            if(pair == "&&" || pair == "||" || pair == "<=" || pair == ">=" || pair == "==" || pair == "!="){
+                tokens << pair;
+                i += 2;
+            }
+            else if(QString("+-*/<>!()").contains(c)){
+                tokens << QString(c);
+                i++;
+            }
+            else if(c == '='){
+                tokens << "==";
+                i++;
+            }
+            else{
+                error = QString("unexpected character '%1'").arg(c);
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+QString EventQuery::peek() const{
+    return position < tokens.size() ? tokens.at(position) : QString();
+}
+
+bool EventQuery::accept(QString token){
+    if(peek() == token){
+        position++;
+        return true;
+    }
+    return false;
+}
+
+int EventQuery::add_node(node_type type, int first, int second, double value){
+    node n;
+    n.type = type;
+    n.first = first;
+    n.second = second;
+    n.value = value;
+    nodes << n;
+    return nodes.size() - 1;
+}
+
+int EventQuery::parse_or(){
+    int left = parse_and();
+    while(left >= 0 && (accept("||") || accept("or"))){
+        int right = parse_and();
+        if(right < 0){
+            return -1;
+        }
+        left = add_node(node_or, left, right);
+    }
+    return left;
+}
+
+int EventQuery::parse_and(){
+    int left = parse_not();
+    while(left >= 0 && (accept("&&") || accept("and"))){
+        int right = parse_not();
+        if(right < 0){
+            return -1;
+        }
+        left = add_node(node_and, left, right);
+    }
+    return left;
+}
+
+int EventQuery::parse_not(){
+    if(accept("!") || accept("not")){
+        int operand = parse_not();
+        return operand < 0 ? -1 : add_node(node_not, operand);
+    }
+    return parse_comparison();
+}
+
+int EventQuery::parse_comparison(){
+    // "a < b < c" means "a < b && b < c"
+    int left = parse_sum();
+    int result = left;
+    bool chained = false;
+    while(left >= 0){
+        node_type type;
+        if(accept("<")) type = node_less;
+        else if(accept("<=")) type = node_less_equal;
+        else if(accept(">")) type = node_greater;
+        else if(accept(">=")) type = node_greater_equal;
+        else if(accept("==")) type = node_equal;
+        else if(accept("!=")) type = node_not_equal;
+        else break;
+
+        int right = parse_sum();
+        if(right < 0){
+            return -1;
+        }
+        int comparison = add_node(type, left, right);
+        result = chained ? add_node(node_and, result, comparison) : comparison;
+        chained = true;
+        left = right;
+    }
+    return left < 0 ? -1 : result;
+}
+
+int EventQuery::parse_sum(){
+    int left = parse_product();
+    while(left >= 0){
+        node_type type;
+        if(accept("+")) type = node_add;
+        else if(accept("-")) type = node_subtract;
+        else break;
+
+        int right = parse_product();
+        if(right < 0){
+            return -1;
+        }
+        left = add_node(type, left, right);
+    }
+    return left;
+}
+
+int EventQuery::parse_product(){
+    int left = parse_unary();
+    while(left >= 0){
+        node_type type;
+        if(accept("*")) type = node_multiply;
+        else if(accept("/")) type = node_divide;
+        else break;
+
+        int right = parse_unary();
+        if(right < 0){
+            return -1;
+        }
+        left = add_node(type, left, right);
+    }
+    return left;
+}
+
+int EventQuery::parse_unary(){
+    if(accept("-")){
+        int operand = parse_unary();
+        return operand < 0 ? -1 : add_node(node_negate, operand);
+    }
+    if(accept("+")){
+        return parse_unary();
+    }
+    return parse_primary();
+}
+
+int EventQuery::parse_primary(){
+    QString token = peek();
+    if(token.isEmpty()){
+        error = "expression ends too early";
+        return -1;
+    }
+
+    if(accept("(")){
+        int inner = parse_or();
+        if(inner >= 0 && !accept(")")){
+            error = "missing \")\"";
+            return -1;
+        }
+        return inner;
+    }
+
+    position++;
+    bool is_number = false;
+    double number = token.toDouble(&is_number);
+    if(is_number){
+        return add_node(node_number, -1, -1, number);
+    }
+
+    if((token == "abs" || token == "sqrt") && accept("(")){
+        int argument = parse_or();
+        if(argument >= 0 && !accept(")")){
+            error = "missing \")\"";
+            return -1;
+        }
+        return argument < 0 ? -1 : add_node(token == "abs" ? node_abs : node_sqrt, argument);
+    }
+
+    if(token.at(0).isLetter() || token.at(0) == '_'){
+        return parse_variable(token);
+    }
+
+    error = QString("unexpected \"%1\"").arg(token);
+    return -1;
+}
+
+int EventQuery::parse_variable(QString name){
+    if(name == "spill") return add_node(node_spill);
+    if(name == "event") return add_node(node_event);
+    if(name == "species") return add_node(node_species);
+    if(name == "e" || name == "electron") return add_node(node_number, -1, -1, ParticleID::Electron);
+    if(name == "mu" || name == "muon") return add_node(node_number, -1, -1, ParticleID::Muon);
+    if(name == "pi" || name == "pion") return add_node(node_number, -1, -1, ParticleID::Pion);
+    if(name == "unknown") return add_node(node_number, -1, -1, ParticleID::Unknown);
+    int event_column = EventStore::EventColumnIndex(name);
+    if(event_column >= 0) return add_node(node_event_column, event_column);
+    if(name == "nhits") return add_node(node_hits, 0, EventStore::NSlots);
+    if(name == "ntku") return add_node(node_hits, 2, 7);
+    if(name == "ntkd") return add_node(node_hits, 7, 12);
+
+    int separator = name.indexOf('_');
+    if(separator > 0){
+        QString quantity = name.left(separator);
+        int slot = EventStore::SlotIndex(name.mid(separator+1));
+        if(slot >= 0){
+            int quantity_index = EventStore::QuantityIndex(quantity);
+            if(quantity_index >= 0){
+                return add_node(node_column, quantity_index, slot);
+            }
+        }
+    }
+
+    error = QString("unknown variable \"%1\"").arg(name);
+    return -1;
+}
+
+double EventQuery::measurement(const EventStore &store, int quantity, int slot, int row) const{
+    double value = store.Value(quantity, slot, row);
+    return value == TMath::Infinity() ? TMath::QuietNaN() : value;
+}
+
+double EventQuery::evaluate(int index, const EventStore &store, int row) const{
+    const node &n = nodes.at(index);
+    switch(n.type){
+    case node_number:
+        return n.value;
+    case node_column:
+        return measurement(store, n.first, n.second, row);
+    case node_event_column:{
+        double value = store.EventValue(n.first, row);
+        return value == TMath::Infinity() ? TMath::QuietNaN() : value;
+    }
+    case node_hits:{
+        int hits = 0;
+        for(int slot = n.first; slot < n.second; slot++){
+            if(store.Value(2, slot, row) != TMath::Infinity()){
+                hits++;
+            }
+        }
+        return hits;
+    }
+    case node_spill:
+        return store.Spill(row);
+    case node_event:
+        return store.Event(row);
+    case node_species:
+        return store.Species(row);
+    default:
+        break;
+    }
+
+    double a = evaluate(n.first, store, row);
+    switch(n.type){
+    case node_negate: return -a;
+    case node_abs: return TMath::Abs(a);
+    case node_sqrt: return TMath::Sqrt(a);
+    case node_not: return (a != 0 && a == a) ? 0.0 : 1.0;
+    default: break;
+    }
+
+    // && and || don't evaluate their right hand side unless they have to
+    bool a_true = a != 0 && a == a;
+    if(n.type == node_and && !a_true) return 0.0;
+    if(n.type == node_or && a_true) return 1.0;
+
+    double b = evaluate(n.second, store, row);
+    bool b_true = b != 0 && b == b;
+    bool valid = a == a && b == b; // comparisons with a missing measurement are false
+    switch(n.type){
+    case node_add: return a + b;
+    case node_subtract: return a - b;
+    case node_multiply: return a * b;
+    case node_divide: return a / b;
+    case node_less: return valid && a < b;
+    case node_less_equal: return valid && a <= b;
+    case node_greater: return valid && a > b;
+    case node_greater_equal: return valid && a >= b;
+    case node_equal: return valid && a == b;
+    case node_not_equal: return valid && a != b;
+    case node_and:
+    case node_or: return b_true;
+    default: break;
+    }
+    return TMath::QuietNaN();
+}
+
+bool EventQuery::Matches(const EventStore &store, int row) const{
+    if(root < 0){
+        return false;
+    }
+    double result = evaluate(root, store, row);
+    return result != 0 && result == result;
+}
+
+QVector<int> EventQuery::match_block(const EventQuery *query, const EventStore *store, int begin, int end){
+    TRACE_SCOPE("EventQuery::match_block");
+    QVector<int> rows;
+    for(int row = begin; row < end; row++){
+        if(query->Matches(*store, row)){
+            rows << row;
+        }
+    }
+    return rows;
+}
+
+QVector<int> EventQuery::Match(const EventStore &store) const{
+    /*
+     * Split the rows into blocks and test them on the global thread pool.  Blocks are
+     * joined in order, so the matching rows come back sorted by (spill, event).
+     */
+    QVector<int> rows;
+    if(root < 0){
+        return rows;
+    }
+
+    const int block_size = 4096;
+    QList<QFuture<QVector<int> > > blocks;
+    for(int begin = 0; begin < store.Size(); begin += block_size){
+        blocks << QtConcurrent::run(&EventQuery::match_block, this, &store,
+                                    begin, qMin(begin + block_size, store.Size()));
+    }
+    for(int i = 0; i < blocks.size(); i++){
+        rows += blocks[i].result();
+    }
+    return rows;
+}
@@ -0,0 +1,89 @@
+#ifndef EVENTQUERY_H
+#define EVENTQUERY_H
+
+#include <QString>
+#include <QStringList>
+#include <QVector>
+#include "eventstore.h"
+
+/*
+ * A filter expression over the per-event quantities in an EventStore, compiled once
+ * into a small expression tree and then evaluated row by row.
+ *
+ * Variables:
+ *   x_tof0 ... pz_tkd5      quantity_detector, quantity one of x y z t px py pz and
+ *                           detector one of tof0 tof1 tku1-5 tkd1-5 tof2
+ *   r_tku1, pt_tku1, p_tku1 radius, transverse and total momentum at a detector
+ *   dp_tku2 ... dp_tkd5     change in total momentum from the previous tracker station
+ *   tof01, tof02, tof12     time of flight between two TOF stations (ns)
+ * The derived variables are read from the store's derived columns, not worked out
+ * again for every row.
+ *   nhits, ntku, ntkd       number of detectors / tracker stations with a hit
+ *   spill, event
+ *   species                 particle ID tag, compared with e, mu or pi (or electron,
+ *                           muon, pion, unknown), e.g. "species == mu"
+ * Operators: + - * /, < <= > >= == !=, && (and), || (or), ! (not), brackets and the
+ * functions abs() and sqrt().  Comparisons can be chained, e.g. "27 < tof01 < 30".
+ *
+ * A missing measurement is NaN inside the expression, so any comparison involving one
+ * is false.
+ */
+class EventQuery
+{
+public:
+    EventQuery();
+    ~EventQuery();
+
+    bool Compile(QString expression);
+    QString Expression() const;
+    QString ErrorString() const;
+    bool IsEmpty() const;
+
+    bool Matches(const EventStore &store, int row) const;
+    QVector<int> Match(const EventStore &store) const;
+
+private:
+    enum node_type {
+        node_number, node_column, node_event_column, node_hits,
+        node_spill, node_event, node_species,
+        node_negate, node_abs, node_sqrt, node_not,
+        node_add, node_subtract, node_multiply, node_divide,
+        node_less, node_less_equal, node_greater, node_greater_equal, node_equal, node_not_equal,
+        node_and, node_or
+    };
+
+    struct node {
+        node_type type;
+        double value;
+        int first, second;  // slots, or child nodes
+    };
+
+    QString expression;
+    QString error;
+    QVector<node> nodes;
+    int root;
+
+    QStringList tokens;
+    int position;
+
+    int add_node(node_type type, int first = -1, int second = -1, double value = 0.0);
+    bool tokenise(QString text);
+    QString peek() const;
+    bool accept(QString token);
+    int parse_or();
+    int parse_and();
+    int parse_not();
+    int parse_comparison();
+    int parse_sum();
+    int parse_product();
+    int parse_unary();
+    int parse_primary();
+    int parse_variable(QString name);
+
+    double evaluate(int index, const EventStore &store, int row) const;
+    double measurement(const EventStore &store, int quantity, int slot, int row) const;
+
+    static QVector<int> match_block(const EventQuery *query, const EventStore *store, int begin, int end);
+};
+
+#endif // EVENTQUERY_H
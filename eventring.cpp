@@ -0,0 +1,287 @@
+#include "eventring.h"
+#include "trace.h"
+#include "TMath.h"
+
+#include <atomic>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+const char ring_magic[8] = {'E', 'V', 'R', 'I', 'N', 'G', '1', '\0'};
+
+QString system_error(QString what){
+    return QString("%1: %2").arg(what).arg(QString::fromLocal8Bit(std::strerror(errno)));
+}
+
+QByteArray shm_name(QString name){
+    // POSIX wants one leading slash and no others
+    QString cleaned = name;
+    cleaned.replace('/', '_');
+    return ("/" + cleaned).toLocal8Bit();
+}
+
+}
+
+#if ATOMIC_LLONG_LOCK_FREE != 2
+#error "EventRing needs lock-free 64-bit atomics to share them between processes"
+#endif
+
+struct EventRing::header {
+    char magic[8];      // written last by Create(), so Open() can tell a finished ring
+    quint32 capacity;   // records
+    quint32 record_bytes;
+    char padding[48];   // head gets a cache line of its own
+    std::atomic<quint64> head; // records ever pushed
+};
+
+struct EventRing::record {
+    std::atomic<quint64> sequence; // 2n+1 while record n is written, 2n+2 once it is
+    qint32 spill, event;
+    double values[Quantities*Slots]; // quantity-major, as event[quantity][slot]
+};
+
+EventRing::EventRing(){
+    owner = false;
+    memory = 0;
+    memoryBytes = 0;
+    ring = 0;
+    records = 0;
+    next = 0;
+    dropped = 0;
+}
+
+EventRing::~EventRing(){
+    Close();
+}
+
+QString EventRing::DefaultName(){
+    return "eventviewer";
+}
+
+bool EventRing::Create(QString name, int capacity, QString *error){
+    // for the producer; replaces any ring of this name
+    Close();
+    if(capacity < 1){
+        if(error != 0){
+            *error = QString("A ring needs room for at least one event");
+        }
+        return false;
+    }
+    return map(name, true, capacity, error);
+}
+
+bool EventRing::Open(QString name, QString *error){
+    // for the consumer; starts from the events pushed from now on
+    Close();
+    return map(name, false, 0, error);
+}
+
+bool EventRing::map(QString name, bool create, int capacity, QString *error){
+    QByteArray path = shm_name(name);
+    if(create){
+        shm_unlink(path.constData());
+    }
+    int fd = shm_open(path.constData(), create ? O_CREAT | O_EXCL | O_RDWR : O_RDWR, 0600);
+    if(fd < 0){
+        if(error != 0){
+            *error = system_error(QString("Couldn't open ring %1").arg(name));
+        }
+        return false;
+    }
+
+    size_t bytes = 0;
+    if(create){
+        bytes = sizeof(header) + size_t(capacity)*sizeof(record);
+        if(ftruncate(fd, off_t(bytes)) != 0){
+            if(error != 0){
+                *error = system_error(QString("Couldn't size ring %1").arg(name));
+            }
+            close(fd);
+            shm_unlink(path.constData());
+            return false;
+        }
+    }
+    else{
+        struct stat info;
+        if(fstat(fd, &info) != 0 || size_t(info.st_size) < sizeof(header)){
+            if(error != 0){
+                *error = QString("Ring %1 isn't ready yet").arg(name);
+            }
+            close(fd);
+            return false;
+        }
+        bytes = size_t(info.st_size);
+    }
+
+    void *mapped = mmap(0, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if(mapped == MAP_FAILED){
+        if(error != 0){
+            *error = system_error(QString("Couldn't map ring %1").arg(name));
+        }
+        if(create){
+            shm_unlink(path.constData());
+        }
+        return false;
+    }
+
+    header *mapped_ring = static_cast<header*>(mapped);
+    if(create){
+        // ftruncate() zeroed everything, so every sequence number is 0: never written
+        mapped_ring->capacity = quint32(capacity);
+        mapped_ring->record_bytes = quint32(sizeof(record));
+        mapped_ring->head.store(0, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        std::memcpy(mapped_ring->magic, ring_magic, sizeof(ring_magic));
+    }
+    else{
+        // magic first, the fence then keeps capacity and record_bytes from being read before it
+        char magic[sizeof(ring_magic)];
+        std::memcpy(magic, mapped_ring->magic, sizeof(magic));
+        std::atomic_thread_fence(std::memory_order_acquire);
+        bool valid = std::memcmp(magic, ring_magic, sizeof(ring_magic)) == 0 &&
+                mapped_ring->record_bytes == sizeof(record) &&
+                sizeof(header) + size_t(mapped_ring->capacity)*sizeof(record) <= bytes;
+        if(!valid){
+            if(error != 0){
+                *error = QString("%1 isn't an event ring of this version").arg(name);
+            }
+            munmap(mapped, bytes);
+            return false;
+        }
+    }
+
+    ringName = name;
+    owner = create;
+    memory = mapped;
+    memoryBytes = bytes;
+    ring = mapped_ring;
+    records = reinterpret_cast<record*>(static_cast<char*>(mapped) + sizeof(header));
+    next = ring->head.load(std::memory_order_acquire);
+    dropped = 0;
+    return true;
+}
+
+void EventRing::Close(){
+    // the producer removes the name, a consumer still holding the ring keeps its mapping
+    if(memory == 0){
+        return;
+    }
+    munmap(memory, memoryBytes);
+    if(owner){
+        shm_unlink(shm_name(ringName).constData());
+    }
+    memory = 0;
+    memoryBytes = 0;
+    ring = 0;
+    records = 0;
+    owner = false;
+    ringName.clear();
+}
+
+bool EventRing::IsOpen() const{
+    return memory != 0;
+}
+
+QString EventRing::Name() const{
+    return ringName;
+}
+
+void EventRing::Push(int spill_number, int event_number, const QVector<QVector<double> > &event){
+    /*
+     * The only writer, so head needs no atomic update, just publishing once the record
+     * is whole.  Missing quantities and slots go in as Infinity.
+     */
+    if(ring == 0 || !owner){
+        return;
+    }
+    quint64 n = ring->head.load(std::memory_order_relaxed);
+    record &slot = records[n % ring->capacity];
+    slot.sequence.store(2*n + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    slot.spill = spill_number;
+    slot.event = event_number;
+    for(int quantity = 0; quantity < Quantities; quantity++){
+        const QVector<double> *values = quantity < event.size() ? &event.at(quantity) : 0;
+        for(int point = 0; point < Slots; point++){
+            slot.values[quantity*Slots + point] = values != 0 && point < values->size()
+                    ? values->at(point) : TMath::Infinity();
+        }
+    }
+
+    slot.sequence.store(2*n + 2, std::memory_order_release);
+    ring->head.store(n + 1, std::memory_order_release);
+}
+
+int EventRing::Pop(QHash<int, QHash<int, QVector<QVector<double> > > > &events, int max_events,
+                   int *last_spill, int *last_event){
+    /*
+     * Add up to max_events of what has arrived to events, oldest first, and say which
+     * was the newest; returns how many were added.  A record is copied out and only kept
+     * if its sequence number was the same before and after.
+     */
+    if(ring == 0){
+        return 0;
+    }
+    quint64 head = ring->head.load(std::memory_order_acquire);
+    quint64 capacity = ring->capacity;
+    if(head < next){
+        next = head; // can only be a ring made again under the same mapping
+    }
+    if(head - next > capacity){
+        dropped += head - capacity - next;
+        next = head - capacity;
+    }
+    if(head == next){
+        return 0;
+    }
+
+    TRACE_SCOPE("EventRing::Pop");
+    int popped = 0;
+    double values[Quantities*Slots];
+    for(; next < head && popped < max_events; next++){
+        const record &slot = records[next % capacity];
+        quint64 expected = 2*next + 2;
+        if(slot.sequence.load(std::memory_order_acquire) != expected){
+            dropped++;
+            continue;
+        }
+        int spill_number = slot.spill;
+        int event_number = slot.event;
+        std::memcpy(values, slot.values, sizeof(values));
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if(slot.sequence.load(std::memory_order_relaxed) != expected){
+            dropped++; // overwritten while it was copied
+            continue;
+        }
+
+        QVector<QVector<double> > event(Quantities);
+        for(int quantity = 0; quantity < Quantities; quantity++){
+            event[quantity] = QVector<double>(Slots);
+            std::memcpy(event[quantity].data(), values + quantity*Slots, Slots*sizeof(double));
+        }
+        events[spill_number].insert(event_number, event);
+        if(last_spill != 0){
+            *last_spill = spill_number;
+        }
+        if(last_event != 0){
+            *last_event = event_number;
+        }
+        popped++;
+    }
+    return popped;
+}
+
+quint64 EventRing::Pushed() const{
+    return ring != 0 ? ring->head.load(std::memory_order_acquire) : 0;
+}
+
+quint64 EventRing::Dropped() const{
+    return dropped;
+}
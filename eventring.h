@@ -0,0 +1,64 @@
+#ifndef EVENTRING_H
+#define EVENTRING_H
+
+#include <QString>
+#include <QVector>
+#include <QHash>
+
+/*
+ * Events handed over from a running reconstruction through a POSIX shared-memory ring,
+ * for online monitoring without waiting on ROOT to flush a file.
+ *
+ * One producer Create()s the ring and Push()es events; each is a fixed-size record of
+ * its spill and event numbers and the 7 quantities x 13 slots of add_to_events(), so
+ * nothing is serialised.  One consumer Open()s it and Pop()s what has arrived since it
+ * last looked.  Neither side ever waits on the other, or takes a lock: the producer
+ * never blocks, and overwrites the oldest records if the consumer falls more than the
+ * ring's capacity behind.  Every record carries a sequence number, odd while it is being
+ * written, so the consumer can tell a record it copied whole from one overwritten under
+ * it; those, and any records skipped over, are counted by Dropped().
+ *
+ * A consumer only sees events pushed after it opened the ring, and has to open it again
+ * if the producer creates it again.
+ */
+class EventRing
+{
+public:
+    EventRing();
+    ~EventRing();
+
+    bool Create(QString name, int capacity, QString *error = 0);
+    bool Open(QString name, QString *error = 0);
+    void Close();
+    bool IsOpen() const;
+    QString Name() const;
+
+    void Push(int spill_number, int event_number, const QVector<QVector<double> > &event);
+    int Pop(QHash<int, QHash<int, QVector<QVector<double> > > > &events, int max_events,
+            int *last_spill = 0, int *last_event = 0);
+    quint64 Pushed() const;
+    quint64 Dropped() const;
+
+    static QString DefaultName();
+
+    enum { Quantities = 7, Slots = 13 };
+
+private:
+    struct header;
+    struct record;
+
+    bool map(QString name, bool create, int capacity, QString *error);
+
+    QString ringName;
+    bool owner;
+    void *memory;
+    size_t memoryBytes;
+    header *ring;
+    record *records;
+    quint64 next;
+    quint64 dropped;
+
+    Q_DISABLE_COPY(EventRing)
+};
+
+#endif // EVENTRING_H
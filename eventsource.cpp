@@ -0,0 +1,101 @@
+#include "eventsource.h"
+#include "eventsourceplugin.h"
+#include "syntheticsource.h"
+#include "trace.h"
+
+#include <QCoreApplication>
+#include <QDir>
+#include <QStringList>
+#include <QPluginLoader>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QtConcurrentRun>
+
+namespace {
+
+struct maus_plugin {
+    QMutex mutex; // held while loading, so a Create() waits for a Preload() under way
+    bool tried;
+    EventSourcePlugin *plugin;
+    QString error;
+
+    maus_plugin() : tried(false), plugin(0) {}
+};
+
+maus_plugin& maus(){
+    static maus_plugin instance;
+    return instance;
+}
+
+EventSourcePlugin* load_maus_plugin(QString *error){
+    /*
+     * Look for the plugin in plugins/ next to the executable, then next to its parent
+     * (for the benchmark, which is built a directory down).  Only tried once: the
+     * plugin stays loaded for good, and a plugin that failed won't load later either.
+     */
+    TRACE_SCOPE("EventSource::load_maus_plugin");
+    maus_plugin &state = maus();
+    QMutexLocker lock(&state.mutex);
+    if(!state.tried){
+        state.tried = true;
+        QStringList directories;
+        directories << QCoreApplication::applicationDirPath() + "/plugins"
+                    << QCoreApplication::applicationDirPath() + "/../plugins";
+        QStringList errors;
+        foreach(QString directory, directories){
+            QPluginLoader loader(QDir(directory).absoluteFilePath("readmaus"));
+            state.plugin = qobject_cast<EventSourcePlugin*>(loader.instance());
+            if(state.plugin != 0){
+                break;
+            }
+            errors << loader.errorString();
+        }
+        if(state.plugin == 0){
+            state.error = QCoreApplication::translate("EventSource", "No MAUS reader: %1")
+                    .arg(errors.join("; "));
+        }
+    }
+    if(error != 0){
+        *error = state.error;
+    }
+    return state.plugin;
+}
+
+}
+
+bool EventSource::IsSynthetic(QString file){
+    return file.startsWith(SyntheticSource::Scheme());
+}
+
+bool EventSource::CanRead(QString file, QString *error){
+    // loads the MAUS plugin if it isn't already; a synthetic run's name has to parse
+    if(IsSynthetic(file)){
+        QString problem;
+        SyntheticSource::Parse(file, &problem);
+        if(!problem.isEmpty() && error != 0){
+            *error = problem;
+        }
+        return problem.isEmpty();
+    }
+    return load_maus_plugin(error) != 0;
+}
+
+void EventSource::Preload(){
+    // e.g. once the window is up, so that the first file opens without waiting
+    QtConcurrent::run(&load_maus_plugin, static_cast<QString*>(0));
+}
+
+EventSource* EventSource::Create(QString file){
+    /*
+     * The caller owns the source.  Without the MAUS plugin, a MAUS file gets a synthetic
+     * source all the same, which reads nothing from it, rather than no source at all.
+     */
+    if(IsSynthetic(file)){
+        return new SyntheticSource();
+    }
+    EventSourcePlugin *plugin = load_maus_plugin(0);
+    if(plugin == 0){
+        return new SyntheticSource();
+    }
+    return plugin->Create();
+}
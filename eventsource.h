@@ -0,0 +1,71 @@
+#ifndef EVENTSOURCE_H
+#define EVENTSOURCE_H
+
+#include <QString>
+#include <QVector>
+#include <QHash>
+#include <QMap>
+#include <QAtomicInt>
+#include <Rtypes.h>
+#include "tofcalibration.h"
+
+/*
+ * Where events come from: a MAUS recon file (ReadMAUS), or a run made up on the spot
+ * (SyntheticSource).  Everything that reads events, the main window, the chunk loader
+ * and the fits, goes through this, and Create() picks the source from the name of the
+ * "file": names starting with "synthetic:" are synthetic runs, anything else a MAUS
+ * file.
+ *
+ * ReadMAUS lives in a plugin, with MAUS, ROOT's I/O and Geant4, so the viewer starts
+ * without them.  The plugin is loaded by the first Create() for a MAUS file, or ahead
+ * of that by Preload(), on a thread of its own.  Without it (CONFIG += no_maus, or a
+ * plugin that won't load) only synthetic runs can be read; CanRead() says why not,
+ * as it does for a synthetic run whose name doesn't parse.
+ *
+ * Events come back as ReadMAUS::add_to_events() lays them out: spill number -> event
+ * number -> 7 quantities (x, y, z, t, px, py, pz) x 13 detector slots, with Infinity
+ * wherever a detector saw nothing.
+ *
+ * An "entry" is whatever IndexSpills() maps a spill to and ReadEntries() takes back:
+ * the tree entry for MAUS files, the spill's position in the run for synthetic ones.
+ */
+class EventSource
+{
+public:
+    struct SlabTime {
+        int spill, event;
+        int tof, plane, slab; // plane 0 is horizontal, 1 vertical
+        double dt;            // raw_t0 - raw_t1
+    };
+
+    struct SpillTiming {
+        int spill, events;
+        qint64 read_ns;    // everything for the spill, from reading the entry on
+        qint64 tof_ns;     // of which matching TOF slab hits to space points
+        qint64 tracker_ns; // and of which extracting tracker track points
+    };
+
+    virtual ~EventSource(){}
+
+    static EventSource* Create(QString file);
+    static bool IsSynthetic(QString file);
+    static bool CanRead(QString file, QString *error = 0);
+    static void Preload();
+
+    virtual QHash<int, QHash<int, QVector<QVector<double> > > > Read(QString fileToOpen) = 0;
+    virtual QHash<int, QHash<int, QVector<QVector<double> > > > ReadEntries(QString fileToOpen, QVector<Long64_t> entries) = 0;
+    virtual QMap<int, Long64_t> IndexSpills(QString fileToOpen) = 0;
+    virtual void SetDetectorPositions(QVector<double> tof0_location, QVector<double> tof1_location,
+                                      QVector<double> tku_location, QVector<double> tkd_location,
+                                      QVector<double> tof2_location) = 0;
+    virtual void SetSpillRange(int spill_range) = 0;
+    virtual void SetStartingSpill(int start_spill) = 0;
+    virtual void SetCancelFlag(QAtomicInt *cancel_flag) = 0;
+    virtual void SetTOFCalibration(const TOFCalibration &calibration) = 0;
+    virtual void SetRecordSlabTimes(bool record) = 0;
+    virtual QVector<SlabTime> SlabTimes() = 0;
+    virtual void SetTimeStages(bool time_stages) = 0;
+    virtual QVector<SpillTiming> StageTimings() = 0;
+};
+
+#endif // EVENTSOURCE_H
@@ -0,0 +1,24 @@
+#ifndef EVENTSOURCEPLUGIN_H
+#define EVENTSOURCEPLUGIN_H
+
+#include <QtPlugin>
+#include "eventsource.h"
+
+/*
+ * What a plugin holding an EventSource gives the viewer: a way to make sources.  The
+ * MAUS reader is one (plugins/readmaus), so that MAUS, ROOT's I/O and Geant4 are only
+ * loaded once a MAUS file is opened; see EventSource::Create().
+ */
+class EventSourcePlugin
+{
+public:
+    virtual ~EventSourcePlugin(){}
+
+    virtual EventSource* Create() = 0;
+};
+
+#define EventSourcePlugin_iid "org.mice.EventViewer.EventSourcePlugin/1.0"
+
+Q_DECLARE_INTERFACE(EventSourcePlugin, EventSourcePlugin_iid)
+
+#endif // EVENTSOURCEPLUGIN_H
@@ -0,0 +1,329 @@
+#include "eventstore.h"
+#include "trace.h"
+#include "memoryaccount.h"
+#include "TMath.h"
+
+#include <algorithm>
+
+EventStore::EventStore()
+{
+    columns.resize((NQuantities + NDerivedQuantities)*NSlots);
+    eventColumns.resize(NEventColumns);
+}
+
+EventStore::~EventStore(){
+
+}
+
+void EventStore::Fill(const QHash<int, QHash<int, QVector<QVector<double> > > > &data){
+    TRACE_SCOPE("EventStore::Fill");
+    Clear();
+
+    int n_events = 0;
+    QHash<int, QHash<int, QVector<QVector<double> > > >::const_iterator spill_iter;
+    for(spill_iter = data.constBegin(); spill_iter != data.constEnd(); ++spill_iter){
+        n_events += spill_iter.value().size();
+    }
+
+    spills.reserve(n_events);
+    events.reserve(n_events);
+    species.fill(0, n_events);
+    for(int column = 0; column < columns.size(); column++){
+        columns[column].reserve(n_events);
+    }
+
+    QList<int> spill_numbers = data.keys();
+    std::sort(spill_numbers.begin(), spill_numbers.end());
+    for(int i = 0; i < spill_numbers.size(); i++){
+        const QHash<int, QVector<QVector<double> > > &spill = data[spill_numbers.at(i)];
+        QList<int> event_numbers = spill.keys();
+        std::sort(event_numbers.begin(), event_numbers.end());
+
+        for(int j = 0; j < event_numbers.size(); j++){
+            const QVector<QVector<double> > &event = spill[event_numbers.at(j)];
+            spills << spill_numbers.at(i);
+            events << event_numbers.at(j);
+            for(int quantity = 0; quantity < NQuantities; quantity++){
+                for(int slot = 0; slot < NSlots; slot++){
+                    double value = TMath::Infinity();
+                    if(quantity < event.size() && slot < event.at(quantity).size()){
+                        value = event.at(quantity).at(slot);
+                    }
+                    columns[quantity*NSlots + slot] << value;
+                }
+            }
+        }
+    }
+    derive();
+}
+
+void EventStore::derive(){
+    /*
+     * Every input is either a finite value or Infinity, so r, pt and p come out missing
+     * on their own (Infinity squared is Infinity).  Differences need a select, as
+     * Infinity - Infinity is NaN.
+     */
+    TRACE_SCOPE("EventStore::derive");
+    const int rows = spills.size();
+    const double missing = TMath::Infinity();
+
+    for(int slot = 0; slot < NSlots; slot++){
+        const double *x = Column(0, slot);
+        const double *y = Column(1, slot);
+        const double *px = Column(4, slot);
+        const double *py = Column(5, slot);
+        const double *pz = Column(6, slot);
+        QVector<double> &r = columns[Radius*NSlots + slot];
+        QVector<double> &pt = columns[TransverseMomentum*NSlots + slot];
+        QVector<double> &p = columns[Momentum*NSlots + slot];
+        r.resize(rows);
+        pt.resize(rows);
+        p.resize(rows);
+        double *r_out = r.data();
+        double *pt_out = pt.data();
+        double *p_out = p.data();
+        // a loop per output, each with few enough pointers for g++ to check they don't overlap
+        for(int row = 0; row < rows; row++){
+            r_out[row] = TMath::Sqrt(x[row]*x[row] + y[row]*y[row]);
+        }
+        for(int row = 0; row < rows; row++){
+            pt_out[row] = TMath::Sqrt(px[row]*px[row] + py[row]*py[row]);
+        }
+        for(int row = 0; row < rows; row++){
+            p_out[row] = TMath::Sqrt(px[row]*px[row] + py[row]*py[row] + pz[row]*pz[row]);
+        }
+    }
+
+    // station to station within a tracker, missing at station 1 and at the TOFs
+    for(int slot = 0; slot < NSlots; slot++){
+        QVector<double> &dp = columns[MomentumChange*NSlots + slot];
+        bool has_previous = (slot >= 3 && slot <= 6) || (slot >= 8 && slot <= 11);
+        if(!has_previous){
+            dp.fill(missing, rows);
+            continue;
+        }
+        dp.resize(rows);
+        difference(Column(Momentum, slot), Column(Momentum, slot - 1), dp.data(), rows);
+    }
+
+    const int from[NEventColumns] = {0, 0, 1};
+    const int to[NEventColumns] = {1, 12, 12};
+    for(int column = 0; column < NEventColumns; column++){
+        eventColumns[column].resize(rows);
+        difference(Column(3, to[column]), Column(3, from[column]), eventColumns[column].data(), rows);
+    }
+}
+
+void EventStore::difference(const double *a, const double *b, double *out, int rows){
+    const double missing = TMath::Infinity();
+    for(int row = 0; row < rows; row++){
+        out[row] = (a[row] != missing) & (b[row] != missing) ? a[row] - b[row] : missing;
+    }
+}
+
+void EventStore::Append(const EventStore &store){
+    // the rows have to come after these in (spill, event) order, e.g. the next slice of a file
+    TRACE_SCOPE("EventStore::Append");
+    spills += store.spills;
+    events += store.events;
+    species += store.species;
+    for(int column = 0; column < columns.size(); column++){
+        columns[column] += store.columns.at(column);
+    }
+    for(int column = 0; column < eventColumns.size(); column++){
+        eventColumns[column] += store.eventColumns.at(column);
+    }
+}
+
+QHash<int, QHash<int, QVector<QVector<double> > > > EventStore::Events() const{
+    // the event vectors back, as Fill() takes them
+    QHash<int, QHash<int, QVector<QVector<double> > > > data;
+    QVector<QVector<double> > event(NQuantities, QVector<double>(NSlots));
+    for(int row = 0; row < spills.size(); row++){
+        for(int quantity = 0; quantity < NQuantities; quantity++){
+            for(int slot = 0; slot < NSlots; slot++){
+                event[quantity][slot] = columns.at(quantity*NSlots + slot).at(row);
+            }
+        }
+        data[spills.at(row)].insert(events.at(row), event);
+    }
+    return data;
+}
+
+void EventStore::Clear(){
+    spills.clear();
+    events.clear();
+    species.clear();
+    for(int column = 0; column < columns.size(); column++){
+        columns[column].clear();
+    }
+    for(int column = 0; column < eventColumns.size(); column++){
+        eventColumns[column].clear();
+    }
+}
+
+int EventStore::Size() const{
+    return spills.size();
+}
+
+int EventStore::Spill(int row) const{
+    return spills.at(row);
+}
+
+int EventStore::Event(int row) const{
+    return events.at(row);
+}
+
+int EventStore::Row(int spill, int event) const{
+    // rows are sorted by (spill, event), so this is a binary search
+    int lower = 0;
+    int upper = spills.size();
+    while(lower < upper){
+        int middle = (lower + upper)/2;
+        if(spills.at(middle) < spill || (spills.at(middle) == spill && events.at(middle) < event)){
+            lower = middle + 1;
+        }
+        else{
+            upper = middle;
+        }
+    }
+    if(lower < spills.size() && spills.at(lower) == spill && events.at(lower) == event){
+        return lower;
+    }
+    return -1;
+}
+
+qint64 EventStore::MemoryBytes() const{
+    // see MemoryAccount; the columns' SizeOf() includes the columns themselves
+    return MemoryAccount::SizeOf(spills) + MemoryAccount::SizeOf(events)
+            + MemoryAccount::SizeOf(species) + MemoryAccount::SizeOf(columns)
+            + MemoryAccount::SizeOf(eventColumns);
+}
+
+int EventStore::FirstRow(int spill) const{
+    // the first row of this spill, or of the next spill after it if it has no rows
+    return std::lower_bound(spills.constBegin(), spills.constEnd(), spill) - spills.constBegin();
+}
+
+double EventStore::Value(int quantity, int slot, int row) const{
+    return columns.at(quantity*NSlots + slot).at(row);
+}
+
+const double* EventStore::Column(int quantity, int slot) const{
+    return columns.at(quantity*NSlots + slot).constData();
+}
+
+double EventStore::EventValue(int column, int row) const{
+    return eventColumns.at(column).at(row);
+}
+
+const double* EventStore::EventColumn(int column) const{
+    return eventColumns.at(column).constData();
+}
+
+QVector<double> EventStore::TrackerStationZ() const{
+    /*
+     * The z of each of the 10 tracker stations (slots 2-11), from the first row with a
+     * track point there, or Infinity where no row has one.  Station positions aren't
+     * set anywhere else, so this is what the displays draw them at.
+     */
+    const int rows = spills.size();
+    QVector<double> station_z(10, TMath::Infinity());
+    for(int station = 0; station < 10; station++){
+        const double *z = Column(2, 2 + station);
+        for(int row = 0; row < rows; row++){
+            if(z[row] != TMath::Infinity()){
+                station_z[station] = z[row];
+                break;
+            }
+        }
+    }
+    return station_z;
+}
+
+QVector<int> EventStore::NearestSlot(int first_slot, int last_slot, int target_slot) const{
+    /*
+     * For each row, the slot from first_slot to last_slot whose z is nearest the z of
+     * target_slot, among those with a position and momentum, or -1 if there is none or
+     * the target is missing.  Station numbers don't say which end of a tracker faces a
+     * detector (station 1 is at the absorber end of both), so this goes by z.
+     */
+    const int rows = spills.size();
+    const double missing = TMath::Infinity();
+    const double *target_z = Column(2, target_slot);
+    QVector<int> nearest(rows, -1);
+    QVector<double> nearest_dz(rows, missing);
+    int *best = nearest.data();
+    double *best_dz = nearest_dz.data();
+    for(int slot = first_slot; slot <= last_slot; slot++){
+        const double *x = Column(0, slot);
+        const double *z = Column(2, slot);
+        const double *pz = Column(6, slot);
+        for(int row = 0; row < rows; row++){
+            bool measured = x[row] != missing && pz[row] != missing && pz[row] != 0.0
+                    && target_z[row] != missing;
+            double dz = measured ? TMath::Abs(target_z[row] - z[row]) : missing;
+            bool nearer = dz < best_dz[row];
+            best[row] = nearer ? slot : best[row];
+            best_dz[row] = nearer ? dz : best_dz[row];
+        }
+    }
+    return nearest;
+}
+
+QStringList EventStore::quantity_names(){
+    // the derived quantities follow the measured ones
+    QStringList quantities;
+    quantities << "x" << "y" << "z" << "t" << "px" << "py" << "pz"
+               << "r" << "pt" << "p" << "dp";
+    return quantities;
+}
+
+QStringList EventStore::event_column_names(){
+    QStringList names;
+    names << "tof01" << "tof02" << "tof12";
+    return names;
+}
+
+QStringList EventStore::slot_names(){
+    QStringList names;
+    names << "tof0" << "tof1"
+          << "tku1" << "tku2" << "tku3" << "tku4" << "tku5"
+          << "tkd1" << "tkd2" << "tkd3" << "tkd4" << "tkd5"
+          << "tof2";
+    return names;
+}
+
+int EventStore::Species(int row) const{
+    return species.at(row);
+}
+
+void EventStore::SetSpecies(const QVector<qint8> &tags){
+    if(tags.size() == spills.size()){
+        species = tags;
+    }
+}
+
+int EventStore::QuantityIndex(QString name){
+    return quantity_names().indexOf(name.toLower());
+}
+
+int EventStore::SlotIndex(QString name){
+    return slot_names().indexOf(name.toLower());
+}
+
+QString EventStore::QuantityName(int quantity){
+    return quantity_names().value(quantity);
+}
+
+QString EventStore::SlotName(int slot){
+    return slot_names().value(slot);
+}
+
+int EventStore::EventColumnIndex(QString name){
+    return event_column_names().indexOf(name.toLower());
+}
+
+QString EventStore::EventColumnName(int column){
+    return event_column_names().value(column);
+}
@@ -0,0 +1,91 @@
+#ifndef EVENTSTORE_H
+#define EVENTSTORE_H
+
+#include <QHash>
+#include <QVector>
+#include <QString>
+#include <QStringList>
+
+/*
+ * Column-wise copy of a chunk of events, for code that looks at one quantity across
+ * many events (filters, summaries) rather than at one event at a time.
+ *
+ * Rows are ordered by spill and then event number.  There is one column of doubles for
+ * each quantity (x, y, z, t, px, py, pz) at each of the 13 detector slots used by
+ * ReadMAUS: 0 TOF0, 1 TOF1, 2-6 TKU stations 1-5, 7-11 TKD stations 1-5, 12 TOF2.
+ * Missing values stay as TMath::Infinity(), as in the event vectors.
+ *
+ * Fill() also derives, in one vectorised pass, columns that the plots and filters would
+ * otherwise work out again for every event they look at: at every slot the transverse
+ * radius r, the transverse and total momentum pt and p, and dp, the change in p from
+ * the tracker station before (quantities NQuantities on, in that order), and for every
+ * event the times of flight TOF01, TOF02 and TOF12 (EventColumn()).  They are missing
+ * wherever a value they need is.
+ *
+ * Append() adds the rows of another store after these, derived columns and all, so a
+ * whole file can be filled a slice of spills at a time.
+ *
+ * NearestSlot() picks, event by event, the tracker station with a track point that is
+ * nearest in z to another slot's hit, for code that extrapolates from a tracker to a
+ * TOF or to the other tracker.
+ *
+ * Alongside the columns there is a tag per row for the particle species
+ * (ParticleID::Species), which is Unknown until SetSpecies() is given the tags.
+ */
+class EventStore
+{
+public:
+    static const int NQuantities = 7;
+    static const int NDerivedQuantities = 4;
+    static const int NSlots = 13;
+
+    enum DerivedQuantity { Radius = NQuantities, TransverseMomentum, Momentum, MomentumChange };
+    enum EventColumns { TOF01, TOF02, TOF12, NEventColumns };
+
+    EventStore();
+    ~EventStore();
+
+    void Fill(const QHash<int, QHash<int, QVector<QVector<double> > > > &data);
+    void Append(const EventStore &store);
+    QHash<int, QHash<int, QVector<QVector<double> > > > Events() const;
+    void Clear();
+
+    int Size() const;
+    int Spill(int row) const;
+    int Event(int row) const;
+    int Row(int spill, int event) const;
+    int FirstRow(int spill) const;
+    double Value(int quantity, int slot, int row) const;
+    const double* Column(int quantity, int slot) const;
+    double EventValue(int column, int row) const;
+    const double* EventColumn(int column) const;
+    QVector<int> NearestSlot(int first_slot, int last_slot, int target_slot) const;
+    QVector<double> TrackerStationZ() const;
+    int Species(int row) const;
+    void SetSpecies(const QVector<qint8> &tags);
+    qint64 MemoryBytes() const;
+
+    static int QuantityIndex(QString name);
+    static int SlotIndex(QString name);
+    static QString QuantityName(int quantity);
+    static QString SlotName(int slot);
+    static int EventColumnIndex(QString name);
+    static QString EventColumnName(int column);
+
+private:
+    friend class CompactStore; // Expand() fills the columns directly
+
+    static QStringList quantity_names();
+    static QStringList slot_names();
+    static QStringList event_column_names();
+    void derive();
+    static void difference(const double *a, const double *b, double *out, int rows);
+
+    QVector<int> spills;
+    QVector<int> events;
+    QVector<qint8> species;
+    QVector<QVector<double> > columns; // [quantity*NSlots + slot][row], derived quantities last
+    QVector<QVector<double> > eventColumns; // [EventColumns][row]
+};
+
+#endif // EVENTSTORE_H
@@ -0,0 +1,102 @@
+# Everything EventViewer and the benchmarks share: Qt modules, sources, and MAUS/ROOT.
+#
+# qmake CONFIG+=no_maus builds without MAUS, against the ROOT that root-config finds,
+# and without the MAUS reader plugin; only synthetic runs (see syntheticsource.h) can
+# be read then.  qmake CONFIG+=trace
+# compiles in the trace spans (see trace.h).
+
+QT       += core gui
+
+greaterThan(QT_MAJOR_VERSION, 4): QT += widgets printsupport concurrent network
+
+CONFIG += c++11
+
+# The loops down EventStore columns (EventStore, CompactStore, RunSummary, Emittance,
+# ParticleID, AlignmentFit, RunComparison) mask missing values with selects so that they
+# can be vectorised, but g++ only does that at -O3, and for sums and sqrt only if it may
+# reassociate and needn't set errno.  Infinity and NaN still behave, so missing values
+# still propagate; only signed zeros, FP traps and errno are given up.
+gcc|clang {
+    QMAKE_CXXFLAGS_RELEASE -= -O2
+    QMAKE_CXXFLAGS_RELEASE += -O3
+    QMAKE_CXXFLAGS += -fno-math-errno -fno-signed-zeros -fno-trapping-math -fassociative-math
+}
+
+trace {
+    DEFINES += EVENTVIEWER_TRACE
+}
+
+INCLUDEPATH += $$PWD
+
+SOURCES += $$PWD/mainwindow.cpp \
+    $$PWD/qcustomplot.cpp \
+    $$PWD/settings.cpp \
+    $$PWD/eventdisplay.cpp \
+    $$PWD/batchexport.cpp \
+    $$PWD/chunkloader.cpp \
+    $$PWD/eventstore.cpp \
+    $$PWD/eventquery.cpp \
+    $$PWD/runsummary.cpp \
+    $$PWD/emittance.cpp \
+    $$PWD/trackpropagator.cpp \
+    $$PWD/particleid.cpp \
+    $$PWD/alignmentfit.cpp \
+    $$PWD/tofcalibration.cpp \
+    $$PWD/tofcalibrationfit.cpp \
+    $$PWD/eventsource.cpp \
+    $$PWD/syntheticsource.cpp \
+    $$PWD/trace.cpp \
+    $$PWD/memoryaccount.cpp \
+    $$PWD/eventring.cpp \
+    $$PWD/tofplots.cpp \
+    $$PWD/renderserver.cpp \
+    $$PWD/runcomparison.cpp \
+    $$PWD/compactstore.cpp \
+    $$PWD/pointindex.cpp
+
+HEADERS += $$PWD/mainwindow.h \
+    $$PWD/qcustomplot.h \
+    $$PWD/settings.h \
+    $$PWD/eventdisplay.h \
+    $$PWD/batchexport.h \
+    $$PWD/chunkloader.h \
+    $$PWD/eventstore.h \
+    $$PWD/eventquery.h \
+    $$PWD/runsummary.h \
+    $$PWD/emittance.h \
+    $$PWD/trackpropagator.h \
+    $$PWD/particleid.h \
+    $$PWD/alignmentfit.h \
+    $$PWD/tofcalibration.h \
+    $$PWD/tofcalibrationfit.h \
+    $$PWD/eventsource.h \
+    $$PWD/eventsourceplugin.h \
+    $$PWD/syntheticsource.h \
+    $$PWD/trace.h \
+    $$PWD/memoryaccount.h \
+    $$PWD/eventring.h \
+    $$PWD/tofplots.h \
+    $$PWD/renderserver.h \
+    $$PWD/runcomparison.h \
+    $$PWD/compactstore.h \
+    $$PWD/pointindex.h
+
+FORMS += $$PWD/mainwindow.ui \
+    $$PWD/settings.ui
+
+
+# The viewer itself only needs ROOT's maths; ReadMAUS, with MAUS, ROOT's I/O and Geant4,
+# is a plugin (plugins/readmaus) loaded once a MAUS file is opened.  -rdynamic lets the
+# plugin use the viewer's TOFCalibration and trace spans.
+QMAKE_LFLAGS += -rdynamic
+
+no_maus {
+    INCLUDEPATH += $$system(root-config --incdir)
+    LIBS += -L$$system(root-config --libdir) -lCore -lMathCore -lMathMore -lMatrix -lThread
+}
+else {
+    include($$PWD/maus.pri)
+
+    LIBS += -L$${ROOT_LIB_DIR} -lCint -lCore -lMathCore -lMathMore -lMatrix -lThread
+}
+LIBS += -pthread -lm -ldl -lrt
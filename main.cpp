@@ -1,11 +1,96 @@
 #include "mainwindow.h"
+#include "eventsource.h"
+#include "renderserver.h"
 #include <QApplication>
+#include <QStringList>
+#include <cstdio>
+
+namespace {
+
+int serve(QApplication &app, QStringList arguments){
+    /*
+     * EventViewer --server [--listen ADDRESS] [--port N] [--size WxH] [--cache MB] FILE
+     * serves FILE's events and plots over HTTP, see RenderServer.  Run with
+     * -platform offscreen where there's no display.
+     */
+    QString filename;
+    QHostAddress address(QHostAddress::LocalHost);
+    int port = 8080;
+    int width = 800;
+    int height = 400;
+    int cache_mb = 256;
+    bool ok = true;
+    for(int i = 1; i < arguments.size() && ok; i++){
+        QString argument = arguments.at(i);
+        QString value = i + 1 < arguments.size() ? arguments.at(i + 1) : QString();
+        if(argument == "--server"){
+            continue;
+        }
+        else if(argument == "--listen"){
+            ok = address.setAddress(value);
+            i++;
+        }
+        else if(argument == "--port"){
+            port = value.toInt(&ok);
+            i++;
+        }
+        else if(argument == "--size"){
+            QStringList dimensions = value.split('x');
+            ok = dimensions.size() == 2;
+            if(ok){
+                width = dimensions.at(0).toInt();
+                height = dimensions.at(1).toInt();
+                ok = width > 0 && height > 0;
+            }
+            i++;
+        }
+        else if(argument == "--cache"){
+            cache_mb = value.toInt(&ok);
+            i++;
+        }
+        else{
+            filename = argument;
+        }
+    }
+    if(!ok || filename.isEmpty() || port <= 0 || port > 65535 || cache_mb < 0){
+        std::fprintf(stderr, "usage: %s --server [--listen ADDRESS] [--port N] [--size WxH] "
+                             "[--cache MB] file.root|synthetic:...\n",
+                     arguments.first().toLocal8Bit().constData());
+        return 1;
+    }
+
+    QString error;
+    if(!EventSource::CanRead(filename, &error)){
+        std::fprintf(stderr, "%s\n", error.toLocal8Bit().constData());
+        return 1;
+    }
+    RenderServer server;
+    server.SetPlotSize(width, height);
+    server.SetCacheSize(qint64(cache_mb)*1024*1024);
+    server.SetFile(filename);
+    if(!server.Listen(address, quint16(port), &error)){
+        std::fprintf(stderr, "couldn't listen on %s:%d: %s\n", address.toString().toLocal8Bit().constData(),
+                     port, error.toLocal8Bit().constData());
+        return 1;
+    }
+    std::fprintf(stderr, "serving %s on http://%s:%d/\n", filename.toLocal8Bit().constData(),
+                 address.toString().toLocal8Bit().constData(), port);
+    return app.exec();
+}
+
+}
 
 int main(int argc, char *argv[])
 {
     QApplication a(argc, argv);
+    if(a.arguments().contains("--server")){
+        return serve(a, a.arguments());
+    }
+
     MainWindow w;
     w.show();
+    // MAUS comes in with the reader plugin, which is loaded while the window comes up
+    EventSource::Preload();
 
     return a.exec();
 }
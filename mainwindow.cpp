@@ -1,5 +1,22 @@
 #include "mainwindow.h"
 #include "ui_mainwindow.h"
+#include "batchexport.h"
+#include "syntheticsource.h"
+#include "trace.h"
+#include "memoryaccount.h"
+
+#include <QInputDialog>
+#include <QMouseEvent>
+#include <QVBoxLayout>
+#include <QProgressDialog>
+#include <QRegExp>
+#include <QScopedPointer>
+#include <QSet>
+#include <QScreen>
+#include <QGuiApplication>
+#include <QtConcurrentRun>
+#include <algorithm>
+#include <limits>
 
 MainWindow::MainWindow(QWidget *parent) :
     QMainWindow(parent),
@@ -7,54 +24,233 @@ MainWindow::MainWindow(QWidget *parent) :
 {
     ui->setupUi(this);
     setup_ui();
-    filename = "~/work/Software/ReadMAUSOutput/InputFiles/07157_offline/07157_recon.root";
     //getData();
     //replot();
 }
 
 MainWindow::~MainWindow()
 {
+    play_timer->stop();
+    memory_timer->stop();
+    ring_timer->stop();
+    delete display;
+    delete tof_display;
     delete ui;
 }
 
 void MainWindow::setup_ui(){
+    fileOpen = false;
+    trackerCharge = 0;
     spillNumber = 0;
     eventNumber = 0;
+    chunkStart = 0;
+    chunkEnd = 0;
+    waitingForChunk = false;
+    waitingChunk = 0;
+    waitingSpill = 0;
+    waitingEvent = 0;
+    waitingForSpill = false;
+    fillingChunk = false;
+    wantedSpill = 0;
+    fillChunk = 0;
+    navigateSpill = false;
+    navigateEvent = false;
+    framesDropped = 0;
+    fpsFrames = 0;
+    fps = 0.0;
+    lastFrame = 0;
+    buildTime = 0.0;
+    renderTime = 0.0;
+    ringUnstored = false;
+    ringUndrawn = false;
 
     connect(ui->btn_nextEvent, SIGNAL(clicked()), SLOT(next_event()));
     connect(ui->btn_nextSpill, SIGNAL(clicked()), SLOT(next_spill()));
-    connect(ui->int_goToSpill, SIGNAL(valueChanged(int)), SLOT(choose_spill()));
+    connect(ui->int_goToSpill, SIGNAL(valueChanged(int)), SLOT(request_spill()));
+    connect(ui->int_goToSpill, SIGNAL(editingFinished()), SLOT(navigate()));
 
     connect(ui->btn_previousEvent, SIGNAL(clicked()), SLOT(previous_event()));
     connect(ui->btn_previousSpill, SIGNAL(clicked()), SLOT(previous_spill()));
-    connect(ui->int_goToEvent, SIGNAL(valueChanged(int)), SLOT(choose_event()));
+    connect(ui->int_goToEvent, SIGNAL(valueChanged(int)), SLOT(request_event()));
+    connect(ui->int_goToEvent, SIGNAL(editingFinished()), SLOT(navigate()));
+
+    // typing "1234" shouldn't go to spills 1, 12 and 123 on the way, so only act on
+    // the spin boxes once they've been left alone for a moment (or on return)
+    navigate_timer = new QTimer(this);
+    navigate_timer->setSingleShot(true);
+    navigate_timer->setInterval(250);
+    connect(navigate_timer, SIGNAL(timeout()), SLOT(navigate()));
 
     connect(ui->btn_inputFile, SIGNAL(clicked()), SLOT(choose_open_file()));
 
     connect(ui->btn_settings, SIGNAL(clicked()), SLOT(open_settings()));
+    connect(ui->check_overlayChunk, SIGNAL(toggled(bool)), SLOT(overlay_chunk()));
+    connect(ui->action_exportEvents, SIGNAL(triggered()), SLOT(export_events()));
+    connect(ui->action_openSyntheticRun, SIGNAL(triggered()), SLOT(choose_synthetic_run()));
+    connect(ui->action_captureTrace, SIGNAL(toggled(bool)), SLOT(capture_trace(bool)));
+    connect(ui->action_followRing, SIGNAL(toggled(bool)), SLOT(follow_ring(bool)));
+    ring_timer = new QTimer(this);
+    ring_timer->setTimerType(Qt::PreciseTimer);
+    ring_timer->setInterval(1);
+    connect(ring_timer, SIGNAL(timeout()), SLOT(ring_tick()));
+    ui->action_captureTrace->setEnabled(Trace::Available());
+    Trace::SetThreadName("GUI");
+
+    connect(ui->btn_play, SIGNAL(toggled(bool)), SLOT(play(bool)));
+    connect(ui->int_playRate, SIGNAL(valueChanged(int)), SLOT(set_play_rate()));
+    play_timer = new QTimer(this);
+    connect(play_timer, SIGNAL(timeout()), SLOT(play_tick()));
+    label_playStats = new QLabel(this);
+    ui->statusBar->addPermanentWidget(label_playStats);
+
+    // what the chunks, caches and plots hold, redone every second; a click shows the detail
+    memory_gauge = new QProgressBar(this);
+    memory_gauge->setMaximumWidth(180);
+    memory_gauge->setTextVisible(true);
+    memory_gauge->setToolTip(tr("Memory held, against the budget; click for the detail"));
+    memory_gauge->installEventFilter(this);
+    ui->statusBar->addPermanentWidget(memory_gauge);
+    memory_dialog = new QDialog(this);
+    memory_dialog->setWindowTitle(tr("Memory usage"));
+    memory_dialog->resize(480, 360);
+    memory_text = new QTextBrowser(memory_dialog);
+    QVBoxLayout *memory_layout = new QVBoxLayout(memory_dialog);
+    memory_layout->addWidget(memory_text);
+    connect(ui->action_memoryUsage, SIGNAL(triggered()), SLOT(show_memory()));
+    memory_timer = new QTimer(this);
+    memory_timer->setInterval(1000);
+    connect(memory_timer, SIGNAL(timeout()), SLOT(update_memory()));
+    memory_timer->start();
+
+    connect(ui->btn_filter, SIGNAL(clicked()), SLOT(apply_filter()));
+    connect(ui->line_filter, SIGNAL(returnPressed()), SLOT(apply_filter()));
+    connect(ui->btn_nextMatch, SIGNAL(clicked()), SLOT(next_match()));
+    connect(ui->btn_previousMatch, SIGNAL(clicked()), SLOT(previous_match()));
+    filter_watcher = new QFutureWatcher<QList<QPair<int, int> > >(this);
+    connect(filter_watcher, SIGNAL(finished()), SLOT(filter_finished()));
+
+    connect(ui->btn_summary, SIGNAL(clicked()), SLOT(compute_summary()));
+    summary_watcher = new QFutureWatcher<RunSummary>(this);
+    connect(summary_watcher, SIGNAL(finished()), SLOT(summary_finished()));
+
+    boxSelecting = false;
+    foreach(QCustomPlot *plot, QList<QCustomPlot*>() << ui->plot_position_xz << ui->plot_position_yz){
+        connect(plot, SIGNAL(mousePress(QMouseEvent*)), SLOT(pick_press(QMouseEvent*)));
+        connect(plot, SIGNAL(mouseMove(QMouseEvent*)), SLOT(pick_move(QMouseEvent*)));
+        connect(plot, SIGNAL(mouseRelease(QMouseEvent*)), SLOT(pick_release(QMouseEvent*)));
+    }
 
+    connect(ui->btn_compareFile, SIGNAL(clicked()), SLOT(choose_compare_file()));
+    connect(ui->btn_compare, SIGNAL(clicked()), SLOT(compare()));
+    connect(ui->btn_nextDifference, SIGNAL(clicked()), SLOT(next_difference()));
+    connect(ui->btn_previousDifference, SIGNAL(clicked()), SLOT(previous_difference()));
+    compare_watcher = new QFutureWatcher<comparison_result>(this);
+    connect(compare_watcher, SIGNAL(finished()), SLOT(compare_finished()));
+    differenceIndex = -1;
+
+    connect(ui->combo_emittanceScope, SIGNAL(currentIndexChanged(int)), SLOT(update_emittance()));
+    connect(ui->combo_phaseStation, SIGNAL(currentIndexChanged(int)), SLOT(update_emittance()));
+    connect(ui->tabs_changePlot, SIGNAL(currentChanged(int)), SLOT(show_tab()));
+    file_store_watcher = new QFutureWatcher<EventStore>(this);
+    connect(file_store_watcher, SIGNAL(finished()), SLOT(file_store_ready()));
+    export_watcher = new QFutureWatcher<spill_events>(this);
+    connect(export_watcher, SIGNAL(finished()), SLOT(export_read()));
 
     settings_window = new Settings();
-    read_data = new ReadMAUS();
-    read_settings();
+    loader = new ChunkLoader(this);
+    connect(loader, SIGNAL(ChunkReady(int)), SLOT(chunk_ready(int)));
+    connect(loader, SIGNAL(SpillReady(int)), SLOT(spill_ready(int)));
+    connect(loader, SIGNAL(RunReady()), SLOT(run_ready()));
+    alignment_fit = new AlignmentFit(this);
+    connect(settings_window, SIGNAL(AlignmentRequested()), SLOT(fit_alignment()));
+    connect(alignment_fit, SIGNAL(Progress(int,int)), SLOT(alignment_progress()));
+    connect(alignment_fit, SIGNAL(Finished(int)), SLOT(alignment_finished(int)));
+    connect(alignment_fit, SIGNAL(Failed(QString)), SLOT(alignment_failed(QString)));
+    calibration_fit = new TOFCalibrationFit(this);
+    connect(settings_window, SIGNAL(TOFCalibrationRequested()), SLOT(fit_tof_calibration()));
+    connect(calibration_fit, SIGNAL(Progress(int,int)), SLOT(tof_calibration_progress()));
+    connect(calibration_fit, SIGNAL(Finished(int)), SLOT(tof_calibration_finished(int)));
+    connect(calibration_fit, SIGNAL(Failed(QString)), SLOT(tof_calibration_failed(QString)));
     plot_settings();
+    read_settings();
 }
 
 void MainWindow::open_settings(){
-    settings_window->exec();
-    read_settings();
+    // the fields keep whatever was typed into them, but only take effect if accepted
+    if(settings_window->exec() == QDialog::Accepted){
+        read_settings();
+    }
 }
 
 void MainWindow::read_settings(){
-    QVector<double> tof0_location = settings_window->GetTOF0Settings();
-    QVector<double> tof1_location = settings_window->GetTOF1Settings();
-    QVector<double> tku_location = settings_window->GetTKUSettings();
-    QVector<double> tkd_location = settings_window->GetTKDSettings();
-    QVector<double> tof2_location = settings_window->GetTOF2Settings();
-    int spillRange = settings_window->GetSpillRange();
+    /*
+     * Only what a changed setting affects is redone.  New positions or a new TOF
+     * calibration mean reading again (the loader drops what it holds itself); new cuts
+     * only need the events classifying again, new fields the tracks drawing again.
+     */
+    QVector<QVector<double> > locations = detector_locations();
+    bool positions_changed = locations != readLocations;
+    readLocations = locations;
+
+    loader->SetDetectorPositions(locations.at(0), locations.at(1), locations.at(2), locations.at(3),
+                                 locations.at(4));
+    loader->SetSpillRange(settings_window->GetSpillRange());
+
+    // without a table the reader's own constants are used, so positions come from pixels
+    TOFCalibration calibration;
+    QString calibration_file = settings_window->GetTOFCalibrationFile();
+    QString calibration_error;
+    if(!calibration_file.isEmpty() && !calibration.Load(calibration_file, &calibration_error)){
+        ui->statusBar->showMessage(tr("Couldn't read TOF calibration %1: %2")
+                                   .arg(calibration_file).arg(calibration_error));
+    }
+    bool calibration_changed = calibration != tof_calibration;
+    tof_calibration = calibration;
+    loader->SetTOFCalibration(tof_calibration);
+
+    QVector<double> fields = settings_window->GetTrackerFields();
+    int charge = settings_window->GetCharge();
+    bool tracks_changed = fields != trackerFields || charge != trackerCharge;
+    trackerFields = fields;
+    trackerCharge = charge;
+    if(tracks_changed){
+        display->SetTracks(fields, charge);
+    }
+
+    MemoryAccount::SetBudget(settings_window->GetMemoryBudget());
+    loader->SetResident(settings_window->GetResidentRun());
+
+    QVector<double> cuts = settings_window->GetParticleIDCuts();
+    bool cuts_changed = cuts != pid.Cuts();
+    if(cuts_changed){
+        pid.SetCuts(cuts);
+        loader->SetParticleID(pid);
+        store.SetSpecies(pid.Classify(store));
+    }
+    if(!data.isEmpty() && cuts_changed){
+        chunk_changed();
+        overlay_chunk();
+    }
+    if(!data.isEmpty() && (cuts_changed || tracks_changed)){
+        replot();
+    }
+
+    // anything read from the whole file so far used the old positions
+    if(positions_changed || calibration_changed){
+        fileStoreName.clear();
+        fileStoreReading.clear();
+    }
+    if(positions_changed){
+        update_geometry();
+    }
+}
 
-    read_data->SetDetectorPositions(tof0_location, tof1_location, tku_location, tkd_location, tof2_location);
-    read_data->SetSpillRange(spillRange);
+void MainWindow::update_geometry(){
+    // TOF positions come from the Settings window, tracker stations from the chunk's track points
+    trackerStationZ = store.TrackerStationZ();
+    display->SetGeometry(settings_window->GetTOF0Settings(), settings_window->GetTOF1Settings(),
+                         settings_window->GetTOF2Settings(), trackerStationZ);
+    display->Replot();
 }
 
 
@@ -70,310 +266,460 @@ void MainWindow::choose_open_file(){
     }
 
     if(!filenames.empty()){
-        ui->line_inputFile->setText(filenames.first());
-        filename = filenames.first();
-        data.clear();
-        spill.clear();
-        event.clear();
-        getData(0);
-        replot();
+        open_file(filenames.first());
     }
 
 }
 
-void MainWindow::plot_settings(){
-    position_plots();
-    momentum_plots();
-    time_plots();
+void MainWindow::choose_synthetic_run(){
+    // a made-up run, described by its name; see SyntheticSource
+    QString current = EventSource::IsSynthetic(filename) ? filename
+                                                         : SyntheticSource::Name(SyntheticSource::Config());
+    bool ok = false;
+    QString name = QInputDialog::getText(this, tr("Open synthetic run"),
+                                         tr("Run, e.g. \"synthetic:spills=200,events=40,noise=0.05\":"),
+                                         QLineEdit::Normal, current, &ok);
+    if(!ok || name.isEmpty()){
+        return;
+    }
+
+    QString error;
+    SyntheticSource::Parse(name, &error);
+    if(!error.isEmpty()){
+        ui->statusBar->showMessage(QString("Synthetic run: %1").arg(error));
+        return;
+    }
+    open_file(name);
 }
 
-void MainWindow::position_plots(){
-    QPen pen;
+void MainWindow::open_file(QString file){
+    // the first MAUS file loads the MAUS reader plugin, if Preload() hasn't already
+    QString error;
+    if(!EventSource::CanRead(file, &error)){
+        ui->statusBar->showMessage(error);
+        return;
+    }
+    ui->action_followRing->setChecked(false);
+    ui->line_inputFile->setText(file);
+    filename = file;
+    fileOpen = true;
+    data.clear();
+    spill.clear();
+    event.clear();
+    matches.clear();
+    clear_comparison();
+    alignment_fit->Stop();
+    calibration_fit->Stop();
+    getData(0, spillNumber);
+}
 
+void MainWindow::follow_ring(bool following){
     /*
-     * (z, x) and (z, y) plot settings:
-     * -> colours, symbols, plot interactivity
+     * Show what a running reconstruction pushes into an EventRing, in place of the file.
+     * The ring is looked at every millisecond and the newest event drawn as soon as it
+     * is in; the store, TOF plots and overlay of the last spill range's worth of spills
+     * are brought up to date at most every half second.  Stopping leaves those events
+     * on screen, and stepping off them goes back to the file.
      */
+    ring_timer->stop();
+    ring.Close();
+    if(!following){
+        return;
+    }
 
-    ui->plot_position_xz->addGraph(); // graph 0
-    ui->plot_position_xz->addGraph(); // tof0, graph 1
-    ui->plot_position_xz->addGraph(); // tof1, graph 2
-    ui->plot_position_xz->addGraph(); // tku, graph 3
-    ui->plot_position_xz->addGraph(); // tkd, graph 4
-    ui->plot_position_xz->addGraph(); // tof2, graph 5
-
-    int yBoundLower = -180.0;
-    int yBoundUpper = 180.0;
-
-    ui->plot_position_xz->xAxis->setLabel("z (mm)");
-    ui->plot_position_xz->yAxis->setLabel("x (mm)");
-    ui->plot_position_xz->xAxis->setRange(5000.0, 25000.0);
-    ui->plot_position_xz->yAxis->setRange(yBoundLower, yBoundUpper);
-
-    pen.setColor(Qt::gray);
-    ui->plot_position_xz->graph(0)->setPen(pen);
-
-    pen.setColor(Qt::darkBlue);
-    ui->plot_position_xz->graph(1)->setPen(pen);
-    ui->plot_position_xz->graph(1)->setScatterStyle(QCPScatterStyle::ssSquare);
-    ui->plot_position_xz->graph(1)->setLineStyle(QCPGraph::lsNone);
-
-    pen.setColor(Qt::red);
-    ui->plot_position_xz->graph(2)->setPen(pen);
-    ui->plot_position_xz->graph(2)->setScatterStyle(QCPScatterStyle::ssSquare);
-    ui->plot_position_xz->graph(2)->setLineStyle(QCPGraph::lsNone);
-
-    pen.setColor(Qt::darkGreen);
-    ui->plot_position_xz->graph(3)->setPen(pen);
-    ui->plot_position_xz->graph(3)->setScatterStyle(QCPScatterStyle::ssSquare);
-    ui->plot_position_xz->graph(3)->setLineStyle(QCPGraph::lsNone);
-
-    pen.setColor(Qt::green);
-    ui->plot_position_xz->graph(4)->setPen(pen);
-    ui->plot_position_xz->graph(4)->setScatterStyle(QCPScatterStyle::ssSquare);
-    ui->plot_position_xz->graph(4)->setLineStyle(QCPGraph::lsNone);
-
-    pen.setColor(Qt::cyan);
-    ui->plot_position_xz->graph(5)->setPen(pen);
-    ui->plot_position_xz->graph(5)->setScatterStyle(QCPScatterStyle::ssSquare);
-    ui->plot_position_xz->graph(5)->setLineStyle(QCPGraph::lsNone);
-
-
-    // interactive elements set here
-    ui->plot_position_xz->setInteraction(QCP::iRangeDrag, true);
-    ui->plot_position_xz->setInteraction(QCP::iRangeZoom, true);
-
-    // legend set here
-    ui->plot_position_xz->setLocale(QLocale(QLocale::English, QLocale::UnitedKingdom));
-    ui->plot_position_xz->legend->setVisible(true);
-    ui->plot_position_xz->graph(0)->removeFromLegend();
-    ui->plot_position_xz->graph(1)->setName("TOF0");
-    ui->plot_position_xz->graph(2)->setName("TOF1");
-    ui->plot_position_xz->graph(3)->setName("TkUS");
-    ui->plot_position_xz->graph(4)->setName("TkDS");
-    ui->plot_position_xz->graph(5)->setName("TOF2");
-
-
-
-    ui->plot_position_yz->addGraph(); // graph 0
-    ui->plot_position_yz->addGraph(); // tof0, graph 1
-    ui->plot_position_yz->addGraph(); // tof1, graph 2
-    ui->plot_position_yz->addGraph(); // tku, graph 3
-    ui->plot_position_yz->addGraph(); // tkd, graph 4
-    ui->plot_position_yz->addGraph(); // tof2, graph 5
-
-    ui->plot_position_yz->xAxis->setLabel("z (mm)");
-    ui->plot_position_yz->yAxis->setLabel("y (mm)");
-    ui->plot_position_yz->xAxis->setRange(5000.0, 25000.0);
-    ui->plot_position_yz->yAxis->setRange(yBoundLower, yBoundUpper);
-
-    pen.setColor(Qt::gray);
-    ui->plot_position_yz->graph(0)->setPen(pen);
-
-    pen.setColor(Qt::darkBlue);
-    ui->plot_position_yz->graph(1)->setPen(pen);
-    ui->plot_position_yz->graph(1)->setScatterStyle(QCPScatterStyle::ssSquare);
-    ui->plot_position_yz->graph(1)->setLineStyle(QCPGraph::lsNone);
-
-    pen.setColor(Qt::red);
-    ui->plot_position_yz->graph(2)->setPen(pen);
-    ui->plot_position_yz->graph(2)->setScatterStyle(QCPScatterStyle::ssSquare);
-    ui->plot_position_yz->graph(2)->setLineStyle(QCPGraph::lsNone);
-
-    pen.setColor(Qt::darkGreen);
-    ui->plot_position_yz->graph(3)->setPen(pen);
-    ui->plot_position_yz->graph(3)->setScatterStyle(QCPScatterStyle::ssSquare);
-    ui->plot_position_yz->graph(3)->setLineStyle(QCPGraph::lsNone);
-
-    pen.setColor(Qt::green);
-    ui->plot_position_yz->graph(4)->setPen(pen);
-    ui->plot_position_yz->graph(4)->setScatterStyle(QCPScatterStyle::ssSquare);
-    ui->plot_position_yz->graph(4)->setLineStyle(QCPGraph::lsNone);
-
-    pen.setColor(Qt::cyan);
-    ui->plot_position_yz->graph(5)->setPen(pen);
-    ui->plot_position_yz->graph(5)->setScatterStyle(QCPScatterStyle::ssSquare);
-    ui->plot_position_yz->graph(5)->setLineStyle(QCPGraph::lsNone);
-
-    // interactive elements set here
-    ui->plot_position_yz->setInteraction(QCP::iRangeDrag, true);
-    ui->plot_position_yz->setInteraction(QCP::iRangeZoom, true);
-
-    // legend set here
-    ui->plot_position_yz->setLocale(QLocale(QLocale::English, QLocale::UnitedKingdom));
-    ui->plot_position_yz->legend->setVisible(true);
-    ui->plot_position_yz->graph(0)->removeFromLegend();
-    ui->plot_position_yz->graph(1)->setName("TOF0");
-    ui->plot_position_yz->graph(2)->setName("TOF1");
-    ui->plot_position_yz->graph(3)->setName("TkUS");
-    ui->plot_position_yz->graph(4)->setName("TkDS");
-    ui->plot_position_yz->graph(5)->setName("TOF2");
-
+    bool ok = false;
+    QString name = QInputDialog::getText(this, tr("Follow event ring"),
+                                         tr("Shared-memory ring, as given to the producer:"),
+                                         QLineEdit::Normal, EventRing::DefaultName(), &ok);
+    QString error;
+    if(!ok || name.isEmpty() || !ring.Open(name, &error)){
+        if(!error.isEmpty()){
+            ui->statusBar->showMessage(error);
+        }
+        ui->action_followRing->blockSignals(true);
+        ui->action_followRing->setChecked(false);
+        ui->action_followRing->blockSignals(false);
+        return;
+    }
 
+    ui->btn_play->setChecked(false);
+    if(waitingForSpill){
+        loader->CancelSpill();
+    }
+    waitingForChunk = false;
+    waitingForSpill = false;
+    fillingChunk = false;
+    data.clear();
+    spill.clear();
+    event.clear();
+    store.Clear();
+    matches.clear();
+    ring_refresh.invalidate();
+    ring_frame.invalidate();
+    ringUnstored = false;
+    ringUndrawn = false;
+    ring_timer->start();
+    ui->statusBar->showMessage(tr("Following ring %1, waiting for events...").arg(name));
 }
 
-void MainWindow::time_plots(){
+void MainWindow::ring_tick(){
+    /*
+     * Events are taken off the ring every millisecond, but only drawn at the screen's
+     * frame rate, and the store (and with it the TOF plots, overlay and emittance) only
+     * refilled every 500 ms.  replot() classifies the newest event itself until then.
+     */
+    int last_spill = spillNumber;
+    int last_event = eventNumber;
+    if(ring.Pop(data, 10000, &last_spill, &last_event) > 0){
+        // keep a chunk's worth of spills, up to the newest
+        int spill_range = settings_window->GetSpillRange();
+        foreach(int spill_number, data.keys()){
+            if(spill_number <= last_spill - spill_range){
+                data.remove(spill_number);
+            }
+        }
+        chunkEnd = last_spill + 1;
+        chunkStart = chunkEnd - spill_range;
+        spillNumber = last_spill;
+        eventNumber = last_event;
+        ringUnstored = true;
+        ringUndrawn = true;
+    }
 
-    QPen pen;
-    pen.setColor(Qt::gray);
+    if(ringUnstored && (!ring_refresh.isValid() || ring_refresh.elapsed() >= 500)){
+        ring_refresh.start();
+        ringUnstored = false;
+        store.Fill(data);
+        store.SetSpecies(pid.Classify(store));
+        chunk_changed();
+        overlay_chunk();
+        if(ui->combo_emittanceScope->currentIndex() == 0){
+            update_emittance();
+        }
+        ui->statusBar->showMessage(tr("Following ring %1: %2 events pushed, %3 missed")
+                                   .arg(ring.Name()).arg(ring.Pushed()).arg(ring.Dropped()));
+    }
 
-    ui->plot_tof0_to_tof1->addGraph(); // time of flight histogram
-    ui->plot_tof0_to_tof1->addGraph(); // time of flight of this particle
-    ui->plot_tof0_to_tof1->xAxis->setLabel("Time of flight: TOF0 to TOF1 (ns)");
-    ui->plot_tof0_to_tof1->yAxis->setLabel("Number of Particles");
-    ui->plot_tof0_to_tof1->setInteraction(QCP::iRangeDrag, true);
-    ui->plot_tof0_to_tof1->setInteraction(QCP::iRangeZoom, true);
-    ui->plot_tof0_to_tof1->graph(0)->setPen(pen);
+    QScreen *screen = QGuiApplication::primaryScreen();
+    double refresh_rate = screen != 0 && screen->refreshRate() > 0 ? screen->refreshRate() : 60.0;
+    qint64 frame_ms = qMax(1, qRound(1000.0/refresh_rate));
+    if(ringUndrawn && (!ring_frame.isValid() || ring_frame.elapsed() >= frame_ms)){
+        ring_frame.start();
+        ringUndrawn = false;
+        replot();
+    }
+}
 
+void MainWindow::capture_trace(bool capturing){
+    // see trace.h; the spans are only there in builds with CONFIG+=trace
+    if(capturing){
+        Trace::Start();
+        ui->statusBar->showMessage(tr("Capturing trace..."));
+        return;
+    }
 
-    ui->plot_tof0_to_tof2->addGraph(); // time of flight histogram
-    ui->plot_tof0_to_tof2->addGraph(); // time of flight of this particle
-    ui->plot_tof0_to_tof2->xAxis->setLabel("Time of flight: TOF0 to TOF2 (ns)");
-    ui->plot_tof0_to_tof2->yAxis->setLabel("Number of Particles");
-    ui->plot_tof0_to_tof2->setInteraction(QCP::iRangeDrag, true);
-    ui->plot_tof0_to_tof2->setInteraction(QCP::iRangeZoom, true);
-    ui->plot_tof0_to_tof2->graph(0)->setPen(pen);
+    Trace::Stop();
+    QString file = QFileDialog::getSaveFileName(this, tr("Save trace"), "eventviewer_trace.json",
+                                                tr("Trace files (*.json)"));
+    if(file.isEmpty()){
+        ui->statusBar->showMessage(tr("Trace discarded"));
+        return;
+    }
+    QString error;
+    if(Trace::Save(file, &error)){
+        ui->statusBar->showMessage(tr("%1 spans written to %2 (%3 dropped)")
+                                   .arg(Trace::Spans()).arg(file).arg(Trace::Dropped()));
+    }
+    else{
+        ui->statusBar->showMessage(tr("Couldn't write %1: %2").arg(file).arg(error));
+    }
+}
 
+void MainWindow::export_events(){
+    /*
+     * Either a list of spills and events, or a filter (see EventQuery) picking events
+     * from the spills held.  A list that goes outside the chunk in memory is read on a
+     * worker thread, with a reader of our own so the chunk being viewed is left alone,
+     * and written out by export_read() once it's in.
+     */
+    if(data.isEmpty() || export_watcher->isRunning()){
+        return;
+    }
 
-    ui->plot_tof1_to_tof2->addGraph(); // time of flight histogram
-    ui->plot_tof1_to_tof2->addGraph(); // time of flight of this particle
-    ui->plot_tof1_to_tof2->xAxis->setLabel("Time of flight: TOF1 to TOF2 (ns)");
-    ui->plot_tof1_to_tof2->yAxis->setLabel("Number of Particles");
-    ui->plot_tof1_to_tof2->setInteraction(QCP::iRangeDrag, true);
-    ui->plot_tof1_to_tof2->setInteraction(QCP::iRangeZoom, true);
-    ui->plot_tof1_to_tof2->graph(0)->setPen(pen);
+    bool ok = false;
+    QString list = QInputDialog::getText(this, tr("Export events"),
+                                         tr("Spills and events to export, e.g. \"12, 14:3, 20-25\",\n"
+                                            "or a filter on the spills held, e.g. \"species == mu && tof01 < 28\":"),
+                                         QLineEdit::Normal, QString::number(spillNumber), &ok);
+    if(!ok || list.isEmpty()){
+        return;
+    }
 
-    pen.setColor(Qt::red);
-    ui->plot_tof0_to_tof1->graph(1)->setPen(pen);
-    ui->plot_tof0_to_tof1->graph(1)->setScatterStyle(QCPScatterStyle::ssSquare);
-    ui->plot_tof0_to_tof1->graph(1)->setLineStyle(QCPGraph::lsNone);
+    QList<QPair<int, int> > requested;
+    bool is_filter = !QRegExp("[\\d\\s,:-]+").exactMatch(list);
+    if(is_filter){
+        EventQuery export_query;
+        if(!export_query.Compile(list)){
+            ui->statusBar->showMessage(tr("Export filter: %1").arg(export_query.ErrorString()));
+            return;
+        }
+        QVector<int> rows = export_query.Match(store);
+        for(int i = 0; i < rows.size(); i++){
+            requested << qMakePair(store.Spill(rows.at(i)), store.Event(rows.at(i)));
+        }
+    }
+    else{
+        requested = BatchExport::ParseEventList(list);
+    }
+    if(requested.isEmpty()){
+        ui->statusBar->showMessage(tr("No events to export"));
+        return;
+    }
 
-    ui->plot_tof0_to_tof2->graph(1)->setPen(pen);
-    ui->plot_tof0_to_tof2->graph(1)->setScatterStyle(QCPScatterStyle::ssSquare);
-    ui->plot_tof0_to_tof2->graph(1)->setLineStyle(QCPGraph::lsNone);
+    QStringList formats;
+    formats << "png" << "pdf";
+    QString format = QInputDialog::getItem(this, tr("Export events"), tr("Image format:"),
+                                           formats, 0, false, &ok);
+    if(!ok){
+        return;
+    }
 
-    ui->plot_tof1_to_tof2->graph(1)->setPen(pen);
-    ui->plot_tof1_to_tof2->graph(1)->setScatterStyle(QCPScatterStyle::ssSquare);
-    ui->plot_tof1_to_tof2->graph(1)->setLineStyle(QCPGraph::lsNone);
+    QString directory = QFileDialog::getExistingDirectory(this, tr("Export events to"));
+    if(directory.isEmpty()){
+        return;
+    }
 
-    ui->plot_tof0_to_tof1->legend->visible();
-    ui->plot_tof0_to_tof1->graph(0)->setName("All events");
-    ui->plot_tof0_to_tof1->graph(1)->setName("This event");
+    exportRequested = requested;
+    exportFormat = format;
+    exportDirectory = directory;
+
+    int first_spill = requested.first().first;
+    int last_spill = requested.first().first;
+    bool in_memory = true;
+    for(int i = 0; i < requested.size(); i++){
+        first_spill = qMin(first_spill, requested.at(i).first);
+        last_spill = qMax(last_spill, requested.at(i).first);
+        if(!data.contains(requested.at(i).first)){
+            in_memory = false;
+        }
+    }
 
-    ui->plot_tof0_to_tof2->legend->visible();
-    ui->plot_tof0_to_tof2->graph(0)->setName("All events");
-    ui->plot_tof0_to_tof2->graph(1)->setName("This event");
+    if(in_memory){
+        write_export(data, store);
+    }
+    else if(!fileOpen || ring.IsOpen()){
+        ui->statusBar->showMessage(tr("Only the spills held can be exported"));
+    }
+    else{
+        // only the tree entries of the spills asked for, if the loader has indexed the file
+        spill_request request;
+        request.filename = filename;
+        request.locations = detector_locations();
+        request.calibration = tof_calibration;
+        request.first_spill = first_spill;
+        request.last_spill = last_spill;
+        QMap<int, Long64_t> index = loader->Index();
+        QSet<int> spills_requested;
+        for(int i = 0; i < requested.size(); i++){
+            spills_requested.insert(requested.at(i).first);
+        }
+        QSet<int>::const_iterator spill_iter;
+        for(spill_iter = spills_requested.constBegin(); spill_iter != spills_requested.constEnd(); ++spill_iter){
+            if(index.contains(*spill_iter)){
+                request.entries << index.value(*spill_iter);
+            }
+        }
+        std::sort(request.entries.begin(), request.entries.end());
+        request.indexed = !index.isEmpty();
+
+        // the event vectors and store of the spills read, per spill as in the chunk held
+        int spills_read = request.indexed ? request.entries.size() : last_spill - first_spill + 1;
+        qint64 read_bytes = (MemoryAccount::SizeOf(data) + store.MemoryBytes())/data.size()*spills_read;
+        update_memory();
+        if(!MemoryAccount::Fits(read_bytes)){
+            ui->statusBar->showMessage(tr("Reading spills %1 to %2 would take about %3 MB, over the memory budget")
+                                       .arg(first_spill).arg(last_spill).arg(MemoryAccount::Megabytes(read_bytes)));
+            return;
+        }
 
-    ui->plot_tof1_to_tof2->legend->visible();
-    ui->plot_tof1_to_tof2->graph(0)->setName("All events");
-    ui->plot_tof1_to_tof2->graph(1)->setName("This event");
+        ui->statusBar->showMessage(tr("Reading spills %1 to %2 to export...").arg(first_spill).arg(last_spill));
+        export_watcher->setFuture(QtConcurrent::run(&MainWindow::read_spills, request, pid));
+    }
 }
 
-void MainWindow::momentum_plots(){
+MainWindow::spill_events MainWindow::read_spills(spill_request request, ParticleID spill_pid){
+    // the entries asked for if the file was indexed, otherwise a read of the spill range
+    TRACE_SCOPE("MainWindow::read_spills");
+    QScopedPointer<EventSource> reader(EventSource::Create(request.filename));
+    const QVector<QVector<double> > &locations = request.locations;
+    reader->SetDetectorPositions(locations.at(0), locations.at(1), locations.at(2),
+                                 locations.at(3), locations.at(4));
+    reader->SetTOFCalibration(request.calibration);
+
+    spill_events result;
+    if(request.indexed){
+        result.data = reader->ReadEntries(request.filename, request.entries);
+    }
+    else{
+        reader->SetStartingSpill(request.first_spill);
+        reader->SetSpillRange(request.last_spill - request.first_spill + 1);
+        result.data = reader->Read(request.filename);
+    }
+    result.store.Fill(result.data);
+    result.store.SetSpecies(spill_pid.Classify(result.store));
+    return result;
+}
 
-    ui->plot_momentum_t->addGraph(); // graph 0, all Px
-    ui->plot_momentum_t->addGraph(); // graph 1, upstream tracker Px
-    ui->plot_momentum_t->addGraph(); // graph 2, downstream tracker Px
+void MainWindow::export_read(){
+    spill_events read = export_watcher->result();
+    write_export(read.data, read.store);
+}
 
-    ui->plot_momentum_t->addGraph(); // graph 3, all Py
-    ui->plot_momentum_t->addGraph(); // graph 4, upstream tracker Py
-    ui->plot_momentum_t->addGraph(); // graph 5, downstream tracker Py
+void MainWindow::write_export(const QHash<int, QHash<int, QVector<QVector<double> > > > &export_data,
+                              const EventStore &export_store){
+    // on the GUI thread, which the plots have to be drawn on; BatchExport writes the images on the pool
+    QProgressDialog progress(tr("Exporting events..."), tr("Cancel"), 0, 0, this);
+    progress.setWindowModality(Qt::WindowModal);
+    progress.setMinimumDuration(0);
+
+    BatchExport exporter;
+    exporter.SetGeometry(settings_window->GetTOF0Settings(), settings_window->GetTOF1Settings(),
+                         settings_window->GetTOF2Settings(), trackerStationZ);
+    exporter.SetTracks(settings_window->GetTrackerFields(), settings_window->GetCharge());
+    exporter.SetOutputDirectory(exportDirectory);
+    exporter.SetFormat(exportFormat);
+    int written = exporter.Export(exportRequested, export_data, export_store, &progress);
+
+    ui->statusBar->showMessage(tr("Exported %1 events to %2 (%3 images/s)")
+                               .arg(written).arg(exportDirectory)
+                               .arg(exporter.ImagesPerSecond(), 0, 'f', 1));
+}
 
-    ui->plot_momentum_t->xAxis->setLabel("z (mm)");
-    ui->plot_momentum_t->xAxis->setRange(5000.0, 25000.0);
-    ui->plot_momentum_t->yAxis->setLabel("Px or Py (MeV)");
-    ui->plot_momentum_t->yAxis->setRange(-50.0, 50.0);
+void MainWindow::plot_settings(){
+    display = new EventDisplay(ui->plot_position_xz, ui->plot_position_yz,
+                               ui->plot_momentum_t, ui->plot_momentum_z);
+    time_plots();
+    phase_space_plots();
+}
 
-    ui->plot_momentum_t->setInteraction(QCP::iRangeDrag, true);
-    ui->plot_momentum_t->setInteraction(QCP::iRangeZoom, true);
+void MainWindow::phase_space_plots(){
+    /*
+     * (x, px) and (y, py) at one tracker station for every event in the emittance
+     * selection: potentially a whole file's worth of points, so these are decimated
+     * QCPVectorGraphs like the chunk overlay.
+     */
+    QPen pen;
+    pen.setColor(Qt::darkBlue);
 
-    ui->plot_momentum_z->addGraph(); // graph 0, all Pz
-    ui->plot_momentum_z->addGraph(); // graph 1, upstream tracker Pz
-    ui->plot_momentum_z->addGraph(); // graoh 2, downstream tracker Pz
+    phase_x_graph = new QCPVectorGraph(ui->plot_phase_x->xAxis, ui->plot_phase_x->yAxis);
+    ui->plot_phase_x->addPlottable(phase_x_graph);
+    ui->plot_phase_x->xAxis->setLabel("x (mm)");
+    ui->plot_phase_x->yAxis->setLabel("px (MeV/c)");
+
+    phase_y_graph = new QCPVectorGraph(ui->plot_phase_y->xAxis, ui->plot_phase_y->yAxis);
+    ui->plot_phase_y->addPlottable(phase_y_graph);
+    ui->plot_phase_y->xAxis->setLabel("y (mm)");
+    ui->plot_phase_y->yAxis->setLabel("py (MeV/c)");
+
+    QList<QCPVectorGraph*> graphs;
+    graphs << phase_x_graph << phase_y_graph;
+    for(int i = 0; i < graphs.size(); i++){
+        graphs.at(i)->setPen(pen);
+        graphs.at(i)->setScatterStyle(QCPScatterStyle(QCPScatterStyle::ssDisc, 3));
+        graphs.at(i)->setLineStyle(QCPGraph::lsNone);
+        graphs.at(i)->setScatterDecimation(true);
+    }
 
-    ui->plot_momentum_z->xAxis->setLabel("z (mm)");
-    ui->plot_momentum_z->xAxis->setRange(5000.0, 25000.0);
-    ui->plot_momentum_z->yAxis->setLabel("Pz (MeV)");
-    ui->plot_momentum_z->yAxis->setRange(100.0, 400.0);
+    ui->plot_phase_x->setInteraction(QCP::iRangeDrag, true);
+    ui->plot_phase_x->setInteraction(QCP::iRangeZoom, true);
+    ui->plot_phase_y->setInteraction(QCP::iRangeDrag, true);
+    ui->plot_phase_y->setInteraction(QCP::iRangeZoom, true);
+}
 
-    ui->plot_momentum_z->setInteraction(QCP::iRangeDrag, true);
-    ui->plot_momentum_z->setInteraction(QCP::iRangeZoom, true);
+void MainWindow::time_plots(){
+    tof_display = new TOFPlots(ui->plot_tof0_to_tof1, ui->plot_tof0_to_tof2, ui->plot_tof1_to_tof2);
+}
 
-    QPen pen;
-    pen.setColor(Qt::darkBlue);
-    ui->plot_momentum_t->graph(0)->setPen(pen);
-    ui->plot_momentum_t->graph(0)->setName("Px");
-    pen.setColor(Qt::darkGreen);
-    ui->plot_momentum_t->graph(1)->setPen(pen);
-    ui->plot_momentum_t->graph(1)->setScatterStyle(QCPScatterStyle::ssSquare);
-    ui->plot_momentum_t->graph(1)->setLineStyle(QCPGraph::lsNone);
-    ui->plot_momentum_t->graph(1)->setName("Px, Upstream Tracker");
-    pen.setColor(Qt::green);
-    ui->plot_momentum_t->graph(2)->setPen(pen);
-    ui->plot_momentum_t->graph(2)->setScatterStyle(QCPScatterStyle::ssSquare);
-    ui->plot_momentum_t->graph(2)->setLineStyle(QCPGraph::lsNone);
-    ui->plot_momentum_t->graph(2)->setName("Px, Downstream Tracker");
-
-
-    pen.setColor(Qt::darkRed);
-    ui->plot_momentum_t->graph(3)->setPen(pen);
-    ui->plot_momentum_t->graph(3)->setName("Py");
-    pen.setColor(Qt::darkGreen);
-    ui->plot_momentum_t->graph(4)->setPen(pen);
-    ui->plot_momentum_t->graph(4)->setScatterStyle(QCPScatterStyle::ssSquare);
-    ui->plot_momentum_t->graph(4)->setLineStyle(QCPGraph::lsNone);
-    ui->plot_momentum_t->graph(4)->setName("Py, Upstream Tracker");
-    pen.setColor(Qt::green);
-    ui->plot_momentum_t->graph(5)->setPen(pen);
-    ui->plot_momentum_t->graph(5)->setScatterStyle(QCPScatterStyle::ssSquare);
-    ui->plot_momentum_t->graph(5)->setLineStyle(QCPGraph::lsNone);
-    ui->plot_momentum_t->graph(5)->setName("Py, Downstream Tracker");
-    ui->plot_momentum_t->legend->setVisible(true);
+QList<QCustomPlot*> MainWindow::tof_plots(){
+    return tof_display->Plots();
+}
 
-    pen.setColor(Qt::darkBlue);
-    ui->plot_momentum_z->graph(0)->setPen(pen);
-    pen.setColor(Qt::darkGreen);
-    ui->plot_momentum_z->graph(1)->setPen(pen);
-    ui->plot_momentum_z->graph(1)->setScatterStyle(QCPScatterStyle::ssSquare);
-    ui->plot_momentum_z->graph(1)->setLineStyle(QCPGraph::lsNone);
-    ui->plot_momentum_z->graph(1)->setName("Pz, Upstream Tracker");
-    pen.setColor(Qt::green);
-    ui->plot_momentum_z->graph(2)->setPen(pen);
-    ui->plot_momentum_z->graph(1)->setName("Pz, Downstream Tracker");
-    ui->plot_momentum_z->graph(2)->setScatterStyle(QCPScatterStyle::ssSquare);
-    ui->plot_momentum_z->graph(2)->setLineStyle(QCPGraph::lsNone);
-    ui->plot_momentum_z->legend->setVisible(true);
+void MainWindow::fill_tof_plots(){
+    tof_display->Fill(store);
+}
 
+void MainWindow::update_tof_marker(){
+    tof_display->SetEvent(store, store.Row(spillNumber, eventNumber));
+}
 
+void MainWindow::show_tab(){
+    // plots that aren't redrawn while hidden are brought up to date when shown
+    if(ui->tabs_changePlot->currentWidget() == ui->tab_time){
+        foreach(QCustomPlot *plot, tof_plots()){
+            plot->replot();
+        }
+    }
+    update_emittance();
 }
 
 
 void MainWindow::next_event(){
-    if(!data.isEmpty() && !spill.isEmpty() && spill.contains(eventNumber+1)){
-        eventNumber++;
+    if(data.isEmpty() || waitingForChunk){
+        return;
+    }
+    if(advance(false)){
         replot();
     }
-    else if(!data.isEmpty()){
-        next_spill();
+    else{
+        next_chunk();
     }
 }
 
 void MainWindow::next_spill(){
-    if(!data.isEmpty() && data.contains(spillNumber+1)){
-        spillNumber++;
-        eventNumber = 0;
-        replot();
+    if(data.isEmpty() || waitingForChunk){
+        return;
     }
-    else if(!data.isEmpty()){
-        // requested spill does not match one in the current memory chunk
-        // need to go to the next chunk of data
-        spillNumber++;
-        getData(spillNumber);
+    if(advance(true)){
         replot();
     }
+    else{
+        next_chunk();
+    }
+}
+
+void MainWindow::next_chunk(){
+    // the next spill isn't in the current memory chunk, move on to the chunk after it
+    // (normally prefetched by now, see chunk_ready()); if the chunk around a spill we
+    // jumped to is still being filled in, that is the next chunk, so wait for it
+    if(!fillingChunk){
+        getData(chunkEnd, chunkEnd);
+    }
+}
+
+bool MainWindow::advance(bool by_spill){
+    /*
+     * Step to the next event, or to the first event of the next spill, without drawing
+     * anything.  Spill numbers with no physics events are skipped over.  Returns false
+     * if there is nothing further in the chunk held in memory.
+     */
+    if(!by_spill && data.value(spillNumber).contains(eventNumber+1)){
+        eventNumber++;
+        return true;
+    }
+    for(int next = spillNumber+1; next < chunkEnd; next++){
+        if(data.contains(next)){
+            spillNumber = next;
+            eventNumber = 0;
+            return true;
+        }
+    }
+    return false;
 }
 
 void MainWindow::previous_event(){
+    if(waitingForChunk){
+        return;
+    }
     if(!data.isEmpty() && !spill.isEmpty() && spill.contains(eventNumber-1)){
         eventNumber--;
         replot();
@@ -384,12 +730,15 @@ void MainWindow::previous_event(){
 }
 
 void MainWindow::previous_spill(){
+    if(waitingForChunk){
+        return;
+    }
     if(!data.isEmpty() && data.contains(spillNumber-1)){
         spillNumber--;
         eventNumber = 0;
         replot();
     }
-    else if(!data.isEmpty()){
+    else if(!data.isEmpty() && !fillingChunk){
         // requested spill does not match one in the current memory chunk
         // if requested spill > 0, we need to go to a previous chunk
         if(spillNumber-1 >= 1){
@@ -402,17 +751,109 @@ void MainWindow::previous_spill(){
             // so starting spill must be at current spill - spill range = 100 - 100 = 0
 
             int start_spill = (spillNumber) - settings_window->GetSpillRange();
-            getData(start_spill);
-            spillNumber--;
-            replot();
+            getData(start_spill, spillNumber-1);
         }
     }
 }
 
 void MainWindow::choose_spill(){
-    if(!data.isEmpty() && data.contains(ui->int_goToSpill->value())){
-        spillNumber = ui->int_goToSpill->value();
+    /*
+     * A spill in memory is shown straight away.  Any other spill is read on its own with
+     * the loader's entry index and shown as soon as it's in; the chunk around it is then
+     * filled in behind it (see spill_ready()).  Until the index has been built, fall back
+     * to reading a chunk starting at that spill.
+     */
+    int target = ui->int_goToSpill->value();
+    if(data.isEmpty()){
+        return;
+    }
+    if(data.contains(target)){
+        // drop anything still being read for an earlier target
+        waitingForChunk = false;
+        if(waitingForSpill){
+            loader->CancelSpill();
+            waitingForSpill = false;
+        }
+        spillNumber = target;
         replot();
+        return;
+    }
+    if(ring.IsOpen()){
+        ui->statusBar->showMessage(tr("Spill %1 isn't in the ring's last spills").arg(target));
+        return;
+    }
+
+    // a newer target replaces whatever is still on its way; the loader cancels the
+    // reads that are no longer wanted
+    if(loader->HasIndex()){
+        if(!loader->IndexContains(target)){
+            ui->statusBar->showMessage(tr("Spill %1 isn't in this file").arg(target));
+            return;
+        }
+        waitingForChunk = false;
+        fillingChunk = false;
+        waitingForSpill = true;
+        wantedSpill = target;
+        ui->statusBar->showMessage(tr("Reading spill %1...").arg(target));
+        loader->RequestSpill(target);
+    }
+    else{
+        getData(target, target);
+    }
+}
+
+void MainWindow::spill_ready(int spill_number){
+    if(!waitingForSpill || spill_number != wantedSpill){
+        return;
+    }
+    waitingForSpill = false;
+
+    EventStore spill_store;
+    QHash<int, QHash<int, QVector<QVector<double> > > > single_spill = loader->TakeSpill(spill_number, &spill_store);
+    if(single_spill.isEmpty()){
+        ui->statusBar->showMessage(tr("Couldn't read spill %1").arg(spill_number));
+        return;
+    }
+
+    data = single_spill;
+    store = spill_store;
+    chunkStart = spill_number;
+    chunkEnd = spill_number + 1;
+    spillNumber = spill_number;
+    eventNumber = 0;
+    ui->statusBar->clearMessage();
+
+    update_geometry();
+    chunk_changed();
+    overlay_chunk();
+    replot();
+
+    // now read the chunk around it; until that's in, only this spill can be browsed
+    fillChunk = qMax(0, spill_number - settings_window->GetSpillRange()/2);
+    fillingChunk = true;
+    loader->Request(fillChunk);
+}
+
+void MainWindow::request_spill(){
+    navigateSpill = true;
+    navigate_timer->start();
+}
+
+void MainWindow::request_event(){
+    navigateEvent = true;
+    navigate_timer->start();
+}
+
+void MainWindow::navigate(){
+    // go to whatever the spin boxes say now; earlier values were never acted on
+    navigate_timer->stop();
+    if(navigateSpill){
+        navigateSpill = false;
+        choose_spill();
+    }
+    if(navigateEvent){
+        navigateEvent = false;
+        choose_event();
     }
 }
 
@@ -423,22 +864,127 @@ void MainWindow::choose_event(){
     }
 }
 
-void MainWindow::getData(int start_spill){
-    if(data.isEmpty())
-    {
-        read_data->SetStartingSpill(start_spill);
-        data = read_data->Read(filename); // start from spill 0
+void MainWindow::getData(int start_spill, int target_spill, int target_event){
+    /*
+     * Chunks are read on a worker thread by the ChunkLoader.  If this one has already
+     * been prefetched it's swapped in straight away; otherwise the current chunk stays
+     * on screen and navigation is ignored until chunk_ready() gets it.  Once it's in,
+     * target_spill/target_event (or the first spill after it that has events) is shown.
+     */
+    if(ring.IsOpen() || !fileOpen){
+        return; // following a ring, or before a file is opened, there's nothing to read
+    }
+    loader->SetFile(filename);
+    if(waitingForSpill){
+        loader->CancelSpill();
+    }
+    waitingForSpill = false;
+    fillingChunk = false;
+    waitingForChunk = true;
+    waitingChunk = start_spill;
+    waitingSpill = target_spill;
+    waitingEvent = target_event;
+    if(loader->IsReady(start_spill)){
+        chunk_ready(start_spill);
     }
     else{
-        // we already have some data, but have requested a spill that
-        // isn't in the current segment we've got in memory
-        data.clear();
-        read_data->SetStartingSpill(start_spill);
-        data = read_data->Read(filename);
+        ui->statusBar->showMessage(tr("Reading spills %1 to %2...")
+                                   .arg(start_spill).arg(start_spill + settings_window->GetSpillRange() - 1));
+        loader->Request(start_spill);
     }
 }
 
+void MainWindow::chunk_ready(int start_spill){
+    TRACE_SCOPE("MainWindow::chunk_ready");
+    if(fillingChunk && start_spill == fillChunk){
+        // the chunk around a spill we jumped to: swap it in, staying where we are
+        fillingChunk = false;
+        data = loader->Take(start_spill, &store);
+        chunkStart = start_spill;
+        chunkEnd = start_spill + settings_window->GetSpillRange();
+        update_geometry();
+        chunk_changed();
+        overlay_chunk();
+        replot();
+        loader->Prefetch(chunkEnd);
+        return;
+    }
+
+    if(!waitingForChunk || start_spill != waitingChunk){
+        // a prefetched chunk, keep it in the loader until it's needed
+        return;
+    }
+    waitingForChunk = false;
+
+    EventStore chunk_store;
+    QHash<int, QHash<int, QVector<QVector<double> > > > chunk = loader->Take(start_spill, &chunk_store);
+    if(chunk.isEmpty() && !data.isEmpty()){
+        // ran off the end of the file, stay where we are
+        ui->btn_play->setChecked(false);
+        ui->statusBar->showMessage(tr("No spills from spill %1 on").arg(start_spill));
+        return;
+    }
+
+    data = chunk;
+    store = chunk_store;
+    chunkStart = start_spill;
+    chunkEnd = start_spill + settings_window->GetSpillRange();
+    ui->statusBar->clearMessage();
+
+    spillNumber = waitingSpill;
+    eventNumber = data.value(spillNumber).contains(waitingEvent) ? waitingEvent : 0;
+    while(!data.contains(spillNumber) && spillNumber < chunkEnd - 1){
+        spillNumber++;
+    }
+    if(!data.contains(spillNumber)){
+        spillNumber = waitingSpill;
+    }
+
+    update_geometry();
+    chunk_changed();
+    overlay_chunk();
+    replot();
+
+    // start reading the chunk after this one so stepping/playing into it doesn't wait
+    loader->Prefetch(chunkEnd);
+    if(play_timer->isActive()){
+        lastFrame = play_clock.elapsed();
+    }
+}
+
+void MainWindow::overlay_chunk(){
+    /*
+     * Put the trajectory of every event in the chunk currently held in memory into the
+     * overlay graphs of the (z, x) and (z, y) plots.  With a full chunk this is easily
+     * 10^5 points, so these graphs use scatter decimation: only one point per occupied
+     * pixel is drawn.
+     */
+    bool overlay = ui->check_overlayChunk->isChecked();
+    QVector<const QVector<QVector<double> >*> events;
+    QVector<int> species;
+    overlayEvents.clear();
+
+    if(overlay){
+        QHash<int, QHash<int, QVector<QVector<double> > > >::const_iterator spill_iter;
+        for(spill_iter = data.constBegin(); spill_iter != data.constEnd(); ++spill_iter){
+            QHash<int, QVector<QVector<double> > >::const_iterator event_iter;
+            for(event_iter = spill_iter.value().constBegin(); event_iter != spill_iter.value().constEnd(); ++event_iter){
+                int row = store.Row(spill_iter.key(), event_iter.key());
+                events << &event_iter.value();
+                species << (row >= 0 ? store.Species(row) : int(ParticleID::Unknown));
+                overlayEvents << qMakePair(spill_iter.key(), event_iter.key());
+            }
+        }
+    }
+
+    display->SetOverlayEvents(events, species, overlay);
+
+    ui->plot_position_xz->replot();
+    ui->plot_position_yz->replot();
+}
+
 void MainWindow::replot(){
+    TRACE_SCOPE("MainWindow::replot");
     spillLabel = QString::number(spillNumber);
     eventLabel = QString::number(eventNumber);
     ui->label_eventNumber->setText(eventLabel);
@@ -450,95 +996,749 @@ void MainWindow::replot(){
     spill = data.value(spillNumber);
     event = spill.value(eventNumber);
 
-    QVector<double> x = event.at(0);
-    QVector<double> y = event.at(1);
-    QVector<double> z = event.at(2);
-    QVector<double> t = event.at(3);
-    QVector<double> px = event.at(4);
-    QVector<double> py = event.at(5);
-    QVector<double> pz = event.at(6);
-
-   // QVector<double> pt, p;
-   // for(int i = 0; i < px.size(); i++){
-   //     pt << TMath::Sqrt(px.at(i)*px.at(i) + py.at(i)*py.at(i));
-   //     p << TMath::Sqrt(px.at(i)*px.at(i) + py.at(i)*py.at(i) + pz.at(i)*pz.at(i));
-   // }
-
-    ui->plot_position_xz->graph(0)->setData(z, x);
-    ui->plot_position_yz->graph(0)->setData(z, y);
-
-    ui->plot_momentum_t->graph(0)->setData(z, px);
-    ui->plot_momentum_t->graph(3)->setData(z, py);
-    //ui->plot_momentum_t->graph(6)->setData(z, pt);
-
-    ui->plot_momentum_z->graph(0)->setData(z, pz);
-    //ui->plot_momentum_z->graph(3)->setData(z, p);
-
-
-    // plot TOF0:
-    QVector<double> tof0_x, tof0_y, tof0_z;
-    tof0_x << x.at(0);
-    tof0_y << y.at(0);
-    tof0_z << z.at(0);
-
-    ui->plot_position_xz->graph(1)->setData(tof0_z, tof0_x);
-    ui->plot_position_yz->graph(1)->setData(tof0_z, tof0_y);
-
-    // plot TOF1:
-    QVector<double> tof1_x, tof1_y, tof1_z;
-    tof1_x << x.at(1);
-    tof1_y << y.at(1);
-    tof1_z << z.at(1);
-
-    ui->plot_position_xz->graph(2)->setData(tof1_z, tof1_x);
-    ui->plot_position_yz->graph(2)->setData(tof1_z, tof1_y);
-
-    // plot upstream tracker:
-    QVector<double> tku_x, tku_y, tku_z, tku_px, tku_py, tku_pt, tku_pz, tku_p;
-    tku_x << x.at(2) << x.at(3) << x.at(4) << x.at(5) << x.at(6);
-    tku_y << y.at(2) << y.at(3) << y.at(4) << y.at(5) << y.at(6);
-    tku_z << z.at(2) << z.at(3) << z.at(4) << z.at(5) << z.at(6);
-    tku_px << px.at(2) << px.at(3) << px.at(4) << px.at(5) << px.at(6);
-    tku_py << py.at(2) << py.at(3) << py.at(4) << py.at(5) << py.at(6);
-    tku_pz << pz.at(2) << pz.at(3) << pz.at(4) << pz.at(5) << pz.at(6);
-    //tku_pt << pt.at(2) << pt.at(3) << pt.at(4) << pt.at(5) << pt.at(6);
-    //tku_p << p.at(2) << p.at(3) << p.at(4) << p.at(5) << p.at(6);
-
-    ui->plot_position_xz->graph(3)->setData(tku_z, tku_x);
-    ui->plot_position_yz->graph(3)->setData(tku_z, tku_y);
-    ui->plot_momentum_t->graph(1)->setData(tku_z, tku_px);
-    ui->plot_momentum_t->graph(4)->setData(tku_z, tku_py);
-    ui->plot_momentum_z->graph(1)->setData(tku_z, tku_pz);
-
-    // plot downstream tracker:
-    QVector<double> tkd_x, tkd_y, tkd_z, tkd_px, tkd_py, tkd_pt, tkd_pz, tkd_p;
-    tkd_x << x.at(7) << x.at(8) << x.at(9) << x.at(10) << x.at(11);
-    tkd_y << y.at(7) << y.at(8) << y.at(9) << y.at(10) << y.at(11);
-    tkd_z << z.at(7) << z.at(8) << z.at(9) << z.at(10) << z.at(11);
-    tkd_px << px.at(7) << px.at(8) << px.at(9) << px.at(10) << px.at(11);
-    tkd_py << py.at(7) << py.at(8) << py.at(9) << py.at(10) << py.at(11);
-    tkd_pz << pz.at(7) << pz.at(8) << pz.at(9) << pz.at(10) << pz.at(11);
-    //tkd_pt << pt.at(7) << pt.at(8) << pt.at(9) << pt.at(10) << pt.at(11);
-    //tkd_p << p.at(7) << p.at(8) << p.at(9) << p.at(10) << p.at(11);
-
-
-    ui->plot_position_xz->graph(4)->setData(tkd_z, tkd_x);
-    ui->plot_position_yz->graph(4)->setData(tkd_z, tkd_y);
-    ui->plot_momentum_t->graph(2)->setData(tkd_z, tkd_px);
-    ui->plot_momentum_t->graph(5)->setData(tkd_z, tkd_py);
-    ui->plot_momentum_z->graph(2)->setData(tkd_z, tkd_pz);
-
-    // plot TOF2:
-    QVector<double> tof2_x, tof2_y, tof2_z;
-    tof2_x << x.at(12);
-    tof2_y << y.at(12);
-    tof2_z << z.at(12);
-
-    ui->plot_position_xz->graph(5)->setData(tof2_z, tof2_x);
-    ui->plot_position_yz->graph(5)->setData(tof2_z, tof2_y);
+    QElapsedTimer stage_timer;
+    stage_timer.start();
+    int row = store.Row(spillNumber, eventNumber);
+    if(row >= 0){
+        display->SetSpecies(store.Species(row));
+        display->SetEvent(event, spillNumber, eventNumber);
+        display->SetDerived(store, row);
+    }
+    else{
+        // not in the store yet, e.g. the newest event from a ring: classify and derive it on its own
+        QHash<int, QHash<int, QVector<QVector<double> > > > single_data;
+        if(!event.isEmpty()){
+            single_data[spillNumber].insert(eventNumber, event);
+        }
+        EventStore single;
+        single.Fill(single_data);
+        display->SetSpecies(pid.Classify(event));
+        display->SetEvent(event, spillNumber, eventNumber);
+        display->SetDerived(single, single.Size() > 0 ? 0 : -1);
+    }
+    show_comparison();
+    buildTime = stage_timer.nsecsElapsed()/1.0e6;
+
+    stage_timer.restart();
+    display->Replot();
+    renderTime = stage_timer.nsecsElapsed()/1.0e6;
+
+    update_play_stats();
+    update_match_label();
+    update_difference_label();
+    update_tof_marker();
+    if(ui->tabs_changePlot->currentWidget() == ui->tab_time){
+        foreach(QCustomPlot *plot, tof_plots()){
+            plot->replot();
+        }
+    }
+    // following a ring, ring_tick() updates it when it refills the store
+    if(ui->combo_emittanceScope->currentIndex() == 0 && !ring_timer->isActive()){
+        update_emittance();
+    }
+}
 
-    ui->plot_position_xz->replot();
-    ui->plot_position_yz->replot();
-    ui->plot_momentum_t->replot();
-    ui->plot_momentum_z->replot();
+void MainWindow::play(bool playing){
+    if(playing && data.isEmpty()){
+        ui->btn_play->setChecked(false);
+        return;
+    }
+
+    if(playing){
+        ui->btn_play->setText(tr("Pause"));
+        framesDropped = 0;
+        fpsFrames = 0;
+        fps = 0.0;
+        play_clock.start();
+        fps_clock.start();
+        lastFrame = 0;
+        set_play_rate();
+        play_timer->start();
+    }
+    else{
+        ui->btn_play->setText(tr("Play"));
+        play_timer->stop();
+    }
+    update_play_stats();
+}
+
+void MainWindow::set_play_rate(){
+    play_timer->setInterval(qMax(1, 1000/ui->int_playRate->value()));
+}
+
+void MainWindow::play_tick(){
+    /*
+     * Work out how many events should have been shown since the last frame at the chosen
+     * rate.  If decoding or drawing can't keep up, the events in between are skipped
+     * rather than queued: only the latest one is drawn and the rest count as dropped.
+     * The timer never stacks up ticks, so a slow frame just delays the next one.
+     */
+    if(waitingForChunk){
+        // the next chunk is still being read, try again next tick
+        return;
+    }
+
+    double interval = 1000.0/ui->int_playRate->value();
+    qint64 now = play_clock.elapsed();
+    int due = qMax(1, qRound((now - lastFrame)/interval));
+    bool by_spill = ui->combo_playStep->currentIndex() == 1;
+
+    int advanced = 0;
+    while(advanced < due && advance(by_spill)){
+        advanced++;
+    }
+    lastFrame = now;
+
+    if(advanced == 0){
+        next_chunk();
+        return;
+    }
+
+    framesDropped += advanced - 1;
+    fpsFrames++;
+    if(fps_clock.elapsed() >= 1000){
+        fps = 1000.0*fpsFrames/fps_clock.elapsed();
+        fpsFrames = 0;
+        fps_clock.restart();
+    }
+    replot();
+}
+
+void MainWindow::update_play_stats(){
+    QString stats = tr("decode %1 ms/chunk | build %2 ms | render %3 ms")
+            .arg(loader->DecodeTime(), 0, 'f', 0)
+            .arg(buildTime, 0, 'f', 2)
+            .arg(renderTime, 0, 'f', 2);
+    if(play_timer->isActive()){
+        stats = tr("%1 fps, %2 dropped | ").arg(fps, 0, 'f', 1).arg(framesDropped) + stats;
+    }
+    label_playStats->setText(stats);
+}
+
+void MainWindow::update_memory(){
+    /*
+     * Account what this window holds (the loader accounts its own chunks) and show the
+     * total.  spill and event share data's storage, so only data is counted.
+     */
+    MemoryAccount::Set("Displayed chunk", MemoryAccount::SizeOf(data));
+    MemoryAccount::Set("Displayed chunk's store", store.MemoryBytes());
+    MemoryAccount::Set("Whole-file store", fileStoreName.isEmpty() ? 0 : file_store.MemoryBytes());
+    MemoryAccount::Set("Comparison file store", compareName.isEmpty() ? 0 : compare_store.MemoryBytes());
+    MemoryAccount::Set("Trajectory cache", display->TrackCacheBytes());
+    MemoryAccount::Set("Overlay pick index", display->PickIndexBytes());
+    qint64 event_plots = 0;
+    foreach(QCustomPlot *plot, display->Plots()){
+        event_plots += MemoryAccount::SizeOf(plot);
+    }
+    MemoryAccount::Set("Event plots", event_plots);
+    qint64 tof_plot_bytes = 0;
+    foreach(QCustomPlot *plot, tof_plots()){
+        tof_plot_bytes += MemoryAccount::SizeOf(plot);
+    }
+    MemoryAccount::Set("TOF plots", tof_plot_bytes);
+    MemoryAccount::Set("Phase-space plots", MemoryAccount::SizeOf(ui->plot_phase_x) +
+                       MemoryAccount::SizeOf(ui->plot_phase_y));
+
+    qint64 total = MemoryAccount::Total();
+    qint64 budget = MemoryAccount::Budget();
+    // a QProgressBar only takes ints, so the gauge is in MB
+    memory_gauge->setRange(0, budget > 0 ? int(budget/(1024*1024)) : 0);
+    memory_gauge->setValue(int(qMin(total, budget > 0 ? budget : total)/(1024*1024)));
+    memory_gauge->setFormat(budget > 0 ? tr("%1 / %2 MB").arg(MemoryAccount::Megabytes(total))
+                                         .arg(MemoryAccount::Megabytes(budget))
+                                       : tr("%1 MB").arg(MemoryAccount::Megabytes(total)));
+    if(memory_dialog->isVisible()){
+        memory_text->setHtml(MemoryAccount::Report());
+    }
+}
+
+void MainWindow::run_ready(){
+    ui->statusBar->showMessage(tr("%1 is held in memory, %2 MB").arg(filename)
+                               .arg(MemoryAccount::Megabytes(MemoryAccount::Bytes("Resident run"))));
+}
+
+void MainWindow::show_memory(){
+    update_memory();
+    memory_dialog->show();
+    memory_dialog->raise();
+}
+
+bool MainWindow::eventFilter(QObject *watched, QEvent *event){
+    if(watched == memory_gauge && event->type() == QEvent::MouseButtonRelease){
+        show_memory();
+        return true;
+    }
+    return QMainWindow::eventFilter(watched, event);
+}
+
+qint64 MainWindow::file_store_estimate(){
+    /*
+     * What read_file() holds at its peak: the displayed chunk's store, per spill, times
+     * the spills in the file, and the event vectors of one slice of ReadSlice spills on
+     * top.  0 if unknown.
+     */
+    int chunk_spills = data.size();
+    QMap<int, Long64_t> index = loader->Index();
+    if(chunk_spills == 0 || index.isEmpty()){
+        return 0;
+    }
+    return store.MemoryBytes()/chunk_spills*index.size()
+            + MemoryAccount::SizeOf(data)/chunk_spills*qMin(index.size(), int(ReadSlice));
+}
+
+void MainWindow::apply_filter(){
+    /*
+     * Compile the filter bar expression and collect the (spill, event) of every event
+     * it matches, either in the chunk held in memory (done here, in parallel over the
+     * chunk's EventStore) or in the whole file (read and tested on a worker thread).
+     */
+    if(filter_watcher->isRunning()){
+        return;
+    }
+
+    if(!query.Compile(ui->line_filter->text())){
+        ui->statusBar->showMessage(tr("Filter: %1").arg(query.ErrorString()));
+        return;
+    }
+
+    matches.clear();
+    if(query.IsEmpty()){
+        update_match_label();
+        return;
+    }
+
+    if(ui->combo_filterScope->currentIndex() == 0){
+        QVector<int> rows = query.Match(store);
+        for(int i = 0; i < rows.size(); i++){
+            matches << qMakePair(store.Spill(rows.at(i)), store.Event(rows.at(i)));
+        }
+        update_match_label();
+    }
+    else if(!fileOpen){
+        ui->statusBar->showMessage(tr("Open a file to filter"));
+    }
+    else if(fileStoreName == filename){
+        // already read for the emittance, only the matching is left to do
+        ui->btn_filter->setEnabled(false);
+        ui->label_matches->setText(tr("Filtering..."));
+        filter_watcher->setFuture(QtConcurrent::run(&MainWindow::match_store, file_store, query, pid));
+    }
+    else{
+        update_memory();
+        if(!MemoryAccount::Fits(file_store_estimate())){
+            ui->statusBar->showMessage(tr("Reading the whole file would take about %1 MB, over the memory budget")
+                                       .arg(MemoryAccount::Megabytes(file_store_estimate())));
+            return;
+        }
+        ui->btn_filter->setEnabled(false);
+        ui->label_matches->setText(tr("Filtering..."));
+        filter_watcher->setFuture(QtConcurrent::run(&MainWindow::scan_file, filename, detector_locations(),
+                                                    tof_calibration, query, pid));
+    }
+}
+
+QList<QPair<int, int> > MainWindow::scan_file(QString file, QVector<QVector<double> > locations,
+                                              TOFCalibration calibration, EventQuery file_query,
+                                              ParticleID file_pid){
+    // one pass over the file, then the same as for a store that is already held
+    return match_store(read_file(file, locations, calibration), file_query, file_pid);
+}
+
+QList<QPair<int, int> > MainWindow::match_store(EventStore file_events, EventQuery file_query,
+                                                ParticleID file_pid){
+    // classify every event, then test them all at once
+    file_events.SetSpecies(file_pid.Classify(file_events));
+
+    QVector<int> rows = file_query.Match(file_events);
+    QList<QPair<int, int> > file_matches;
+    for(int i = 0; i < rows.size(); i++){
+        file_matches << qMakePair(file_events.Spill(rows.at(i)), file_events.Event(rows.at(i)));
+    }
+    return file_matches;
+}
+
+void MainWindow::filter_finished(){
+    matches = filter_watcher->result();
+    ui->btn_filter->setEnabled(true);
+    update_match_label();
+}
+
+void MainWindow::compute_summary(){
+    /*
+     * Summarise the chunk held in memory straight from its EventStore, or read the
+     * whole file on a worker thread and summarise that.
+     */
+    if(summary_watcher->isRunning()){
+        return;
+    }
+
+    if(ui->combo_summaryScope->currentIndex() == 0){
+        RunSummary summary;
+        summary.Compute(store);
+        ui->text_summary->setHtml(summary.Report());
+    }
+    else if(!fileOpen){
+        ui->statusBar->showMessage(tr("Open a file to summarise"));
+    }
+    else{
+        update_memory();
+        if(!MemoryAccount::Fits(file_store_estimate())){
+            ui->statusBar->showMessage(tr("Reading the whole file would take about %1 MB, over the memory budget")
+                                       .arg(MemoryAccount::Megabytes(file_store_estimate())));
+            return;
+        }
+        ui->btn_summary->setEnabled(false);
+        ui->text_summary->setPlainText(tr("Reading %1...").arg(filename));
+        summary_watcher->setFuture(QtConcurrent::run(&MainWindow::summarise_file, filename, detector_locations(),
+                                                             tof_calibration));
+    }
+}
+
+RunSummary MainWindow::summarise_file(QString file, QVector<QVector<double> > locations,
+                                      TOFCalibration calibration){
+    RunSummary summary;
+    summary.Compute(read_file(file, locations, calibration));
+    return summary;
+}
+
+EventStore MainWindow::read_file(QString file, QVector<QVector<double> > locations,
+                                 TOFCalibration calibration){
+    /*
+     * One pass over the whole file with a reader of our own, ReadSlice spills of the
+     * index at a time, so that only that slice's event vectors are held alongside the
+     * store.  A file that can't be indexed is read in one go.
+     */
+    TRACE_SCOPE("MainWindow::read_file");
+    QScopedPointer<EventSource> reader(EventSource::Create(file));
+    reader->SetDetectorPositions(locations.at(0), locations.at(1), locations.at(2),
+                                 locations.at(3), locations.at(4));
+    reader->SetTOFCalibration(calibration);
+
+    EventStore file_events;
+    QVector<Long64_t> entries = reader->IndexSpills(file).values().toVector();
+    if(entries.isEmpty()){
+        reader->SetStartingSpill(0);
+        reader->SetSpillRange(std::numeric_limits<int>::max()/2);
+        file_events.Fill(reader->Read(file));
+        return file_events;
+    }
+    for(int begin = 0; begin < entries.size(); begin += ReadSlice){
+        EventStore slice;
+        slice.Fill(reader->ReadEntries(file, entries.mid(begin, ReadSlice)));
+        file_events.Append(slice);
+    }
+    return file_events;
+}
+
+QVector<QVector<double> > MainWindow::detector_locations(){
+    QVector<QVector<double> > locations;
+    locations << settings_window->GetTOF0Settings() << settings_window->GetTOF1Settings()
+              << settings_window->GetTKUSettings() << settings_window->GetTKDSettings()
+              << settings_window->GetTOF2Settings();
+    return locations;
+}
+
+bool MainWindow::emittance_visible(){
+    QWidget *tab = ui->tabs_changePlot->currentWidget();
+    return tab == ui->tab_emittance || tab == ui->tab_phase_x || tab == ui->tab_phase_y;
+}
+
+void MainWindow::chunk_changed(){
+    fill_tof_plots();
+
+    // per-spill moments for the new chunk, so that any selection within it is a merge
+    chunk_emittance.Fill(store);
+    if(ui->combo_emittanceScope->currentIndex() == 1){
+        update_emittance();
+    }
+}
+
+void MainWindow::update_emittance(){
+    /*
+     * Emittances for the selection come from merging per-spill moments (see Emittance),
+     * so this is cheap enough to redo on every change of spill; the phase-space plots
+     * are filled straight from the columns of the store the selection is in.
+     */
+    if(!emittance_visible()){
+        return;
+    }
+
+    int scope = ui->combo_emittanceScope->currentIndex();
+    const EventStore *source = &store;
+    Emittance *emittance = &chunk_emittance;
+    int first_row = 0;
+    int end_row = store.Size();
+
+    if(scope == 0){
+        chunk_emittance.Select(spillNumber, spillNumber);
+        first_row = store.FirstRow(spillNumber);
+        end_row = store.FirstRow(spillNumber + 1);
+    }
+    else if(scope == 1){
+        chunk_emittance.Select(std::numeric_limits<int>::min(), std::numeric_limits<int>::max());
+    }
+    else{
+        if(!fileOpen){
+            ui->text_emittance->setPlainText(tr("Open a file to take the emittance of."));
+            return;
+        }
+        if(fileStoreName != filename){
+            update_memory();
+            if(!MemoryAccount::Fits(file_store_estimate(), "Whole-file store")){
+                ui->text_emittance->setPlainText(tr("Reading %1 would take about %2 MB, over the memory budget")
+                                                 .arg(filename).arg(MemoryAccount::Megabytes(file_store_estimate())));
+                return;
+            }
+            if(!file_store_watcher->isRunning()){
+                fileStoreReading = filename;
+                file_store_watcher->setFuture(QtConcurrent::run(&MainWindow::read_file, filename,
+                                                                detector_locations(), tof_calibration));
+            }
+            ui->text_emittance->setPlainText(tr("Reading %1...").arg(filename));
+            return;
+        }
+        source = &file_store;
+        emittance = &file_emittance;
+        end_row = file_store.Size();
+    }
+
+    ui->text_emittance->setHtml(emittance->Report());
+
+    int slot = Emittance::FirstSlot + ui->combo_phaseStation->currentIndex();
+    const double *x = source->Column(0, slot);
+    const double *y = source->Column(1, slot);
+    const double *px = source->Column(4, slot);
+    const double *py = source->Column(5, slot);
+    QVector<double> phase_x, phase_px, phase_y, phase_py;
+    phase_x.reserve(end_row - first_row);
+    phase_px.reserve(end_row - first_row);
+    phase_y.reserve(end_row - first_row);
+    phase_py.reserve(end_row - first_row);
+    for(int row = first_row; row < end_row; row++){
+        if(x[row] != TMath::Infinity() && px[row] != TMath::Infinity()){
+            phase_x << x[row];
+            phase_px << px[row];
+        }
+        if(y[row] != TMath::Infinity() && py[row] != TMath::Infinity()){
+            phase_y << y[row];
+            phase_py << py[row];
+        }
+    }
+    phase_x_graph->setData(phase_x, phase_px);
+    phase_y_graph->setData(phase_y, phase_py);
+    phase_x_graph->rescaleAxes();
+    phase_y_graph->rescaleAxes();
+    ui->plot_phase_x->replot();
+    ui->plot_phase_y->replot();
+}
+
+void MainWindow::file_store_ready(){
+    if(fileStoreReading != filename){
+        update_emittance(); // the file changed while it was being read, start again
+        return;
+    }
+    file_store = file_store_watcher->result();
+    fileStoreName = fileStoreReading;
+    file_emittance.Fill(file_store);
+    update_emittance();
+}
+
+void MainWindow::summary_finished(){
+    ui->text_summary->setHtml(summary_watcher->result().Report());
+    ui->btn_summary->setEnabled(true);
+}
+
+void MainWindow::choose_compare_file(){
+    QString file = QFileDialog::getOpenFileName(this, tr("Compare with"), ui->line_compareFile->text(),
+                                                tr("ROOT Files (*.root)"));
+    if(!file.isEmpty()){
+        ui->line_compareFile->setText(file);
+    }
+}
+
+void MainWindow::compare(){
+    /*
+     * Read this file and the other one in full on worker threads and compare them.  Only
+     * the other file's store is kept, to draw its hits over the displayed event, so the
+     * two stores are only both held while comparing.
+     */
+    if(compare_watcher->isRunning()){
+        return;
+    }
+    QString other_file = ui->line_compareFile->text();
+    QString error;
+    if(!fileOpen || other_file.isEmpty()){
+        ui->statusBar->showMessage(tr("Open a file and choose one to compare it with"));
+        return;
+    }
+    if(!EventSource::CanRead(other_file, &error)){
+        ui->statusBar->showMessage(error);
+        return;
+    }
+
+    clear_comparison();
+    update_memory();
+    if(!MemoryAccount::Fits(2*file_store_estimate())){
+        ui->statusBar->showMessage(tr("Comparing the two files would take about %1 MB, over the memory budget")
+                                   .arg(MemoryAccount::Megabytes(2*file_store_estimate())));
+        return;
+    }
+    ui->btn_compare->setEnabled(false);
+    ui->text_compare->setPlainText(tr("Reading %1 and %2...").arg(filename).arg(other_file));
+    compare_watcher->setFuture(QtConcurrent::run(&MainWindow::compare_files, filename, other_file,
+                                                 detector_locations(), tof_calibration));
+}
+
+MainWindow::comparison_result MainWindow::compare_files(QString file, QString other_file,
+                                                        QVector<QVector<double> > locations,
+                                                        TOFCalibration calibration){
+    /*
+     * The other file is decoded on a second pool thread while this one decodes the
+     * first.  read_file() only holds a slice of event vectors at a time, so the two
+     * stores are all that is large, which is what compare() checks the budget for.
+     */
+    TRACE_SCOPE("MainWindow::compare_files");
+    QFuture<EventStore> other = QtConcurrent::run(&MainWindow::read_file, other_file, locations, calibration);
+    EventStore first = read_file(file, locations, calibration);
+
+    comparison_result result;
+    result.other = other.result();
+    result.comparison.Compute(first, result.other);
+    return result;
+}
+
+void MainWindow::compare_finished(){
+    ui->btn_compare->setEnabled(true);
+    comparison_result result = compare_watcher->result();
+    comparison = result.comparison;
+    compare_store = result.other;
+    compareName = ui->line_compareFile->text();
+    differenceIndex = -1;
+    ui->text_compare->setHtml(comparison.Report(filename, compareName));
+    update_memory();
+    replot();
+}
+
+void MainWindow::clear_comparison(){
+    comparison.Clear();
+    compare_store = EventStore();
+    compareName.clear();
+    differenceIndex = -1;
+    ui->text_compare->clear();
+    ui->label_difference->clear();
+}
+
+void MainWindow::show_comparison(){
+    // the displayed event as the other file has it, if it has it
+    int row = compareName.isEmpty() ? -1 : compare_store.Row(spillNumber, eventNumber);
+    QVector<QVector<double> > other_event;
+    if(row >= 0){
+        other_event.resize(EventStore::NQuantities);
+        for(int quantity = 0; quantity < EventStore::NQuantities; quantity++){
+            other_event[quantity].resize(EventStore::NSlots);
+            for(int slot = 0; slot < EventStore::NSlots; slot++){
+                other_event[quantity][slot] = compare_store.Value(quantity, slot, row);
+            }
+        }
+    }
+    display->SetComparison(other_event, row >= 0);
+}
+
+void MainWindow::next_difference(){
+    // Differences() is sorted largest first, so "next" is the next smaller one
+    const QVector<RunComparison::Difference> &differences = comparison.Differences();
+    if(differenceIndex + 1 < differences.size()){
+        differenceIndex++;
+        go_to_event(differences.at(differenceIndex).spill, differences.at(differenceIndex).event);
+        update_difference_label();
+    }
+}
+
+void MainWindow::previous_difference(){
+    const QVector<RunComparison::Difference> &differences = comparison.Differences();
+    if(differenceIndex > 0 && differenceIndex - 1 < differences.size()){
+        differenceIndex--;
+        go_to_event(differences.at(differenceIndex).spill, differences.at(differenceIndex).event);
+        update_difference_label();
+    }
+}
+
+void MainWindow::update_difference_label(){
+    if(compareName.isEmpty()){
+        ui->label_difference->clear();
+        return;
+    }
+    const QVector<RunComparison::Difference> &differences = comparison.Differences();
+    if(differenceIndex < 0 || differenceIndex >= differences.size()){
+        ui->label_difference->setText(tr("%1 events differ").arg(differences.size()));
+        return;
+    }
+    const RunComparison::Difference &difference = differences.at(differenceIndex);
+    QString where = difference.slot >= 0 ? tr(", largest at %1").arg(EventStore::SlotName(difference.slot))
+                                         : difference.side == RunComparison::OnlyFirst ? tr(", only in this file")
+                                         : difference.side == RunComparison::OnlySecond ? tr(", only in %1").arg(compareName)
+                                         : QString();
+    ui->label_difference->setText(tr("difference %1 of %2: spill %3 event %4, %5 slots missing, %6 mm%7")
+                                  .arg(differenceIndex + 1).arg(differences.size())
+                                  .arg(difference.spill).arg(difference.event).arg(difference.missing)
+                                  .arg(difference.distance, 0, 'f', 2).arg(where));
+}
+
+void MainWindow::next_match(){
+    // matches are sorted by (spill, event): go to the first one after the current event
+    QList<QPair<int, int> >::const_iterator match =
+            std::upper_bound(matches.constBegin(), matches.constEnd(), qMakePair(spillNumber, eventNumber));
+    if(match != matches.constEnd()){
+        go_to_event(match->first, match->second);
+    }
+}
+
+void MainWindow::previous_match(){
+    QList<QPair<int, int> >::const_iterator match =
+            std::lower_bound(matches.constBegin(), matches.constEnd(), qMakePair(spillNumber, eventNumber));
+    if(match != matches.constBegin()){
+        --match;
+        go_to_event(match->first, match->second);
+    }
+}
+
+void MainWindow::go_to_event(int spill_number, int event_number){
+    if(waitingForChunk){
+        return;
+    }
+    if(data.contains(spill_number)){
+        spillNumber = spill_number;
+        eventNumber = event_number;
+        replot();
+    }
+    else if(!fillingChunk){
+        getData(spill_number, spill_number, event_number);
+    }
+}
+
+void MainWindow::pick_press(QMouseEvent *event){
+    /*
+     * On the position plots with the chunk overlaid, a click goes to the event nearest
+     * the mouse, and a shift-drag selects every event with a point in the box as the
+     * matches to step through.
+     */
+    QCustomPlot *plot = qobject_cast<QCustomPlot*>(sender());
+    pickStart = event->pos();
+    if(plot == 0 || !ui->check_overlayChunk->isChecked() || !(event->modifiers() & Qt::ShiftModifier)){
+        return;
+    }
+    boxSelecting = true;
+    plot->setInteraction(QCP::iRangeDrag, false);
+    pick_band = new QRubberBand(QRubberBand::Rectangle, plot);
+    pick_band->setGeometry(QRect(pickStart, QSize()));
+    pick_band->show();
+}
+
+void MainWindow::pick_move(QMouseEvent *event){
+    if(boxSelecting && pick_band){
+        pick_band->setGeometry(QRect(pickStart, event->pos()).normalized());
+    }
+}
+
+void MainWindow::pick_release(QMouseEvent *event){
+    QCustomPlot *plot = qobject_cast<QCustomPlot*>(sender());
+    if(plot == 0 || !ui->check_overlayChunk->isChecked()){
+        return;
+    }
+
+    if(boxSelecting){
+        boxSelecting = false;
+        plot->setInteraction(QCP::iRangeDrag, true);
+        if(pick_band){
+            pick_band->deleteLater();
+        }
+        QVector<int> picked = display->OverlayEventsIn(plot, QRect(pickStart, event->pos()).normalized());
+        matches.clear();
+        for(int i = 0; i < picked.size(); i++){
+            matches << overlayEvents.value(picked.at(i));
+        }
+        std::sort(matches.begin(), matches.end());
+        update_match_label();
+        ui->statusBar->showMessage(tr("%1 events in the box, step through them with the match buttons")
+                                   .arg(matches.size()));
+        return;
+    }
+
+    // a click, not the end of a drag
+    if((event->pos() - pickStart).manhattanLength() > 3){
+        return;
+    }
+    int picked = display->PickOverlay(plot, event->pos(), 6.0);
+    if(picked >= 0 && picked < overlayEvents.size()){
+        go_to_event(overlayEvents.at(picked).first, overlayEvents.at(picked).second);
+    }
+}
+
+void MainWindow::update_match_label(){
+    if(query.IsEmpty() && matches.isEmpty()){
+        ui->label_matches->clear();
+        return;
+    }
+
+    QPair<int, int> current = qMakePair(spillNumber, eventNumber);
+    QList<QPair<int, int> >::const_iterator match =
+            std::lower_bound(matches.constBegin(), matches.constEnd(), current);
+    if(match != matches.constEnd() && *match == current){
+        ui->label_matches->setText(tr("match %1 of %2").arg(match - matches.constBegin() + 1)
+                                   .arg(matches.size()));
+    }
+    else{
+        ui->label_matches->setText(tr("%1 matches").arg(matches.size()));
+    }
+}
+
+void MainWindow::fit_alignment(){
+    /*
+     * Fit with the positions currently in the Settings window, which the proposal is
+     * relative to, reusing the loader's spill index if it has one.
+     */
+    if(!fileOpen){
+        settings_window->SetAlignmentStatus(tr("Open a file to fit the alignment from."));
+        return;
+    }
+    settings_window->SetAlignmentStatus(tr("Reading %1...").arg(filename));
+    ui->statusBar->showMessage(tr("Fitting the alignment from %1...").arg(filename));
+    alignment_fit->Start(filename, detector_locations(), tof_calibration, loader->Index());
+}
+
+void MainWindow::alignment_progress(){
+    settings_window->SetAlignmentProposal(alignment_fit->Proposal(), alignment_fit->Report());
+}
+
+void MainWindow::alignment_finished(int spills_read){
+    ui->statusBar->showMessage(tr("Alignment fitted from %1 spills").arg(spills_read));
+}
+
+void MainWindow::alignment_failed(QString error){
+    settings_window->SetAlignmentStatus(tr("The alignment fit failed: %1").arg(error));
+    ui->statusBar->showMessage(tr("Alignment fit: %1").arg(error));
+}
+
+void MainWindow::fit_tof_calibration(){
+    // the raw PMT times don't depend on the calibration in use, only the tracker positions
+    if(!fileOpen){
+        settings_window->SetTOFCalibrationStatus(tr("Open a file to calibrate the TOFs from."));
+        return;
+    }
+    settings_window->SetTOFCalibrationStatus(tr("Reading %1...").arg(filename));
+    ui->statusBar->showMessage(tr("Fitting the TOF calibration from %1...").arg(filename));
+    calibration_fit->Start(filename, detector_locations(), loader->Index());
+}
+
+void MainWindow::tof_calibration_progress(){
+    settings_window->SetTOFCalibrationProposal(calibration_fit->Result(), calibration_fit->Report());
+}
+
+void MainWindow::tof_calibration_finished(int spills_read){
+    ui->statusBar->showMessage(tr("TOF calibration fitted from %1 spills").arg(spills_read));
+}
+
+void MainWindow::tof_calibration_failed(QString error){
+    settings_window->SetTOFCalibrationStatus(tr("The TOF calibration fit failed: %1").arg(error));
+    ui->statusBar->showMessage(tr("TOF calibration fit: %1").arg(error));
 }
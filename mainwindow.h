@@ -2,11 +2,34 @@
 #define MAINWINDOW_H
 
 #include <QMainWindow>
-#include "readmaus.h"
+#include "eventsource.h"
 #include <QString>
 #include <QPen>
 #include <QFont>
 #include "settings.h"
+#include "eventdisplay.h"
+#include "tofplots.h"
+#include "chunkloader.h"
+#include "eventstore.h"
+#include "eventquery.h"
+#include "runsummary.h"
+#include "runcomparison.h"
+#include "emittance.h"
+#include "particleid.h"
+#include "alignmentfit.h"
+#include "tofcalibration.h"
+#include "tofcalibrationfit.h"
+#include "eventring.h"
+#include <QFutureWatcher>
+#include <QPair>
+#include <QTimer>
+#include <QElapsedTimer>
+#include <QLabel>
+#include <QProgressBar>
+#include <QDialog>
+#include <QTextBrowser>
+#include <QRubberBand>
+#include <QPointer>
 
 namespace Ui {
 class MainWindow;
@@ -27,34 +50,195 @@ public slots:
     void previous_event();
     void choose_event();
     void choose_spill();
+    void request_event();
+    void request_spill();
+    void navigate();
     void choose_open_file();
+    void choose_synthetic_run();
+    void follow_ring(bool following);
+    void ring_tick();
+    void capture_trace(bool capturing);
     void open_settings();
+    void overlay_chunk();
+    void export_events();
+    void export_read();
+    void play(bool playing);
+    void set_play_rate();
+    void play_tick();
+    void chunk_ready(int start_spill);
+    void spill_ready(int spill_number);
+    void apply_filter();
+    void filter_finished();
+    void next_match();
+    void previous_match();
+    void compute_summary();
+    void summary_finished();
+    void choose_compare_file();
+    void compare();
+    void compare_finished();
+    void next_difference();
+    void previous_difference();
+    void update_emittance();
+    void file_store_ready();
+    void show_tab();
+    void fit_alignment();
+    void alignment_progress();
+    void alignment_finished(int spills_read);
+    void alignment_failed(QString error);
+    void fit_tof_calibration();
+    void tof_calibration_progress();
+    void tof_calibration_finished(int spills_read);
+    void tof_calibration_failed(QString error);
+    void update_memory();
+    void show_memory();
+    void run_ready();
+    void pick_press(QMouseEvent *event);
+    void pick_move(QMouseEvent *event);
+    void pick_release(QMouseEvent *event);
+
+protected:
+    bool eventFilter(QObject *watched, QEvent *event);
 
 private:
     Ui::MainWindow *ui;
     Settings* settings_window;
-    ReadMAUS* read_data;
+    ChunkLoader* loader;
+    EventDisplay* display;
 
     void setup_ui();
+    void open_file(QString file);
 
     QString filename;
+    bool fileOpen; // filename has been opened, see open_file()
     int spillNumber, eventNumber;
     QString spillLabel, eventLabel;
-
-    void getData(int start_spill);
+    QVector<double> trackerStationZ;
+
+    int chunkStart, chunkEnd;
+    bool waitingForChunk;
+    int waitingChunk, waitingSpill, waitingEvent;
+    bool waitingForSpill, fillingChunk;
+    int wantedSpill, fillChunk;
+
+    QTimer* navigate_timer;
+    bool navigateSpill, navigateEvent;
+
+    QTimer* play_timer;
+    QElapsedTimer play_clock, fps_clock;
+    qint64 lastFrame;
+    int framesDropped, fpsFrames;
+    double fps, buildTime, renderTime;
+    QLabel* label_playStats;
+
+    void getData(int start_spill, int target_spill, int target_event = 0);
+    void next_chunk();
+    bool advance(bool by_spill);
     void replot();
+    void update_play_stats();
+
+    QTimer* memory_timer;
+    QProgressBar* memory_gauge;
+    QDialog* memory_dialog;
+    QTextBrowser* memory_text;
+    qint64 file_store_estimate();
+
+    EventRing ring;
+    QTimer* ring_timer;
+    QElapsedTimer ring_refresh, ring_frame;
+    bool ringUnstored, ringUndrawn; // events popped since the store was filled, since the last replot()
 
 
 
     QHash<int, QHash<int, QVector<QVector<double> > > > data;
     QHash<int, QVector<QVector<double> > > spill;
     QVector<QVector<double> > event;
+    EventStore store;
+
+    EventQuery query;
+    QList<QPair<int, int> > matches;
+    QFutureWatcher<QList<QPair<int, int> > >* filter_watcher;
+
+    void go_to_event(int spill_number, int event_number);
+    void update_match_label();
+
+    QVector<QPair<int, int> > overlayEvents; // (spill, event) of each event in the overlay
+    QPointer<QRubberBand> pick_band;
+    QPoint pickStart;
+    bool boxSelecting;
+    static QList<QPair<int, int> > scan_file(QString file, QVector<QVector<double> > locations,
+                                             TOFCalibration calibration, EventQuery file_query,
+                                             ParticleID file_pid);
+    static QList<QPair<int, int> > match_store(EventStore file_events, EventQuery file_query,
+                                               ParticleID file_pid);
+
+    QFutureWatcher<RunSummary>* summary_watcher;
+    static RunSummary summarise_file(QString file, QVector<QVector<double> > locations,
+                                     TOFCalibration calibration);
+    static const int ReadSlice = 500; // spills read_file() decodes at a time
+    static EventStore read_file(QString file, QVector<QVector<double> > locations,
+                                TOFCalibration calibration);
+    QVector<QVector<double> > detector_locations();
+
+    struct spill_request {
+        QString filename;
+        QVector<QVector<double> > locations;
+        TOFCalibration calibration;
+        int first_spill, last_spill;
+        bool indexed;
+        QVector<Long64_t> entries; // of the spills asked for, if indexed
+    };
+    struct spill_events {
+        QHash<int, QHash<int, QVector<QVector<double> > > > data;
+        EventStore store;
+    };
+    QList<QPair<int, int> > exportRequested;
+    QString exportFormat, exportDirectory;
+    QFutureWatcher<spill_events>* export_watcher;
+    static spill_events read_spills(spill_request request, ParticleID spill_pid);
+    void write_export(const QHash<int, QHash<int, QVector<QVector<double> > > > &export_data,
+                      const EventStore &export_store);
+
+    struct comparison_result {
+        RunComparison comparison;
+        EventStore other;
+    };
+    RunComparison comparison;
+    EventStore compare_store;
+    QString compareName;
+    int differenceIndex;
+    QFutureWatcher<comparison_result>* compare_watcher;
+    static comparison_result compare_files(QString file, QString other_file, QVector<QVector<double> > locations,
+                                           TOFCalibration calibration);
+    void show_comparison();
+    void clear_comparison();
+    void update_difference_label();
+
+    Emittance chunk_emittance, file_emittance;
+    EventStore file_store;
+    QString fileStoreName, fileStoreReading;
+    QVector<QVector<double> > readLocations; // as last read by read_settings()
+    QVector<double> trackerFields;
+    int trackerCharge;
+    QFutureWatcher<EventStore>* file_store_watcher;
+    QCPVectorGraph *phase_x_graph, *phase_y_graph;
+    void phase_space_plots();
+    void chunk_changed();
+    bool emittance_visible();
+
+    ParticleID pid;
+    TOFPlots* tof_display;
+    void fill_tof_plots();
+    void update_tof_marker();
+    QList<QCustomPlot*> tof_plots();
+
+    AlignmentFit* alignment_fit;
+    TOFCalibration tof_calibration;
+    TOFCalibrationFit* calibration_fit;
 
 
     void read_settings();
+    void update_geometry();
     void plot_settings();
-    void position_plots();
-    void momentum_plots();
     void time_plots();
 
 
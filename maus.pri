@@ -0,0 +1,7 @@
+# Where MAUS and the ROOT it was built with live, for the viewer and the MAUS reader plugin.
+
+MAUS_DIR = /vols/fets2/adobbs/MAUS/maus/trunk
+ROOT_LIB_DIR = $${MAUS_DIR}/third_party/build/root/lib
+
+INCLUDEPATH += $${MAUS_DIR}/third_party/build/root/include/
+DEPENDPATH += $${MAUS_DIR}/third_party/build/root/include
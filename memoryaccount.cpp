@@ -0,0 +1,175 @@
+#include "memoryaccount.h"
+#include "qcustomplot.h"
+
+#include <QMutex>
+#include <QMutexLocker>
+#include <QList>
+#include <QPair>
+#include <algorithm>
+
+namespace {
+
+struct account {
+    QMutex mutex;
+    QMap<QString, qint64> categories;
+    qint64 budget;
+
+    account() : budget(0) {}
+};
+
+account& global_account(){
+    static account instance;
+    return instance;
+}
+
+bool larger_first(const QPair<qint64, QString> &a, const QPair<qint64, QString> &b){
+    return a.first > b.first;
+}
+
+}
+
+void MemoryAccount::Set(QString category, qint64 bytes){
+    account &memory = global_account();
+    QMutexLocker lock(&memory.mutex);
+    memory.categories.insert(category, bytes);
+}
+
+void MemoryAccount::Remove(QString category){
+    account &memory = global_account();
+    QMutexLocker lock(&memory.mutex);
+    memory.categories.remove(category);
+}
+
+qint64 MemoryAccount::Bytes(QString category){
+    account &memory = global_account();
+    QMutexLocker lock(&memory.mutex);
+    return memory.categories.value(category, 0);
+}
+
+qint64 MemoryAccount::Total(){
+    account &memory = global_account();
+    QMutexLocker lock(&memory.mutex);
+    qint64 total = 0;
+    foreach(qint64 bytes, memory.categories){
+        total += bytes;
+    }
+    return total;
+}
+
+QMap<QString, qint64> MemoryAccount::Categories(){
+    account &memory = global_account();
+    QMutexLocker lock(&memory.mutex);
+    return memory.categories;
+}
+
+void MemoryAccount::SetBudget(qint64 bytes){
+    account &memory = global_account();
+    QMutexLocker lock(&memory.mutex);
+    memory.budget = qMax(Q_INT64_C(0), bytes);
+}
+
+qint64 MemoryAccount::Budget(){
+    account &memory = global_account();
+    QMutexLocker lock(&memory.mutex);
+    return memory.budget;
+}
+
+bool MemoryAccount::Fits(qint64 bytes, QString replacing){
+    // whether Total() would stay within the budget with bytes more, less what replacing holds now
+    qint64 budget = Budget();
+    if(budget <= 0){
+        return true;
+    }
+    qint64 replaced = replacing.isEmpty() ? 0 : Bytes(replacing);
+    return Total() - replaced + bytes <= budget;
+}
+
+QString MemoryAccount::Megabytes(qint64 bytes){
+    return QString::number(bytes/(1024.0*1024.0), 'f', 1);
+}
+
+QString MemoryAccount::Report(){
+    // an HTML table, largest first, for the memory dialog
+    QMap<QString, qint64> categories = Categories();
+    QList<QPair<qint64, QString> > sorted;
+    QMap<QString, qint64>::const_iterator iter;
+    for(iter = categories.constBegin(); iter != categories.constEnd(); ++iter){
+        sorted << qMakePair(iter.value(), iter.key());
+    }
+    std::stable_sort(sorted.begin(), sorted.end(), larger_first);
+
+    qint64 total = Total();
+    qint64 budget = Budget();
+    QString report = "<table border=\"1\" cellpadding=\"3\" cellspacing=\"0\">"
+            "<tr><th>Held by</th><th>Bytes</th><th>MB</th><th>Share</th></tr>";
+    for(int i = 0; i < sorted.size(); i++){
+        report += QString("<tr><td>%1</td><td align=\"right\">%2</td><td align=\"right\">%3</td>"
+                          "<td align=\"right\">%4%</td></tr>")
+                .arg(sorted.at(i).second.toHtmlEscaped()).arg(sorted.at(i).first)
+                .arg(Megabytes(sorted.at(i).first))
+                .arg(total > 0 ? 100.0*sorted.at(i).first/total : 0.0, 0, 'f', 1);
+    }
+    report += QString("<tr><th>Total</th><th align=\"right\">%1</th><th align=\"right\">%2</th><th></th></tr>")
+            .arg(total).arg(Megabytes(total));
+    report += "</table>";
+    report += budget > 0 ? QString("<p>Budget: %1 MB, %2% used.</p>").arg(Megabytes(budget))
+                           .arg(100.0*total/budget, 0, 'f', 1)
+                         : QString("<p>No budget set.</p>");
+    return report;
+}
+
+qint64 MemoryAccount::SizeOf(const QVector<QVector<double> > &event){
+    qint64 bytes = SizeOf<QVector<double> >(event);
+    for(int i = 0; i < event.size(); i++){
+        bytes += SizeOf<double>(event.at(i));
+    }
+    return bytes;
+}
+
+qint64 MemoryAccount::SizeOf(const QHash<int, QVector<QVector<double> > > &spill){
+    qint64 bytes = hash_overhead(spill);
+    QHash<int, QVector<QVector<double> > >::const_iterator iter;
+    for(iter = spill.constBegin(); iter != spill.constEnd(); ++iter){
+        bytes += SizeOf(iter.value());
+    }
+    return bytes;
+}
+
+qint64 MemoryAccount::SizeOf(const QHash<int, QHash<int, QVector<QVector<double> > > > &data){
+    qint64 bytes = hash_overhead(data);
+    QHash<int, QHash<int, QVector<QVector<double> > > >::const_iterator iter;
+    for(iter = data.constBegin(); iter != data.constEnd(); ++iter){
+        bytes += SizeOf(iter.value());
+    }
+    return bytes;
+}
+
+qint64 MemoryAccount::SizeOf(const QCustomPlot *plot){
+    /*
+     * The data of every plottable and the paint buffers.  QCPGraph, QCPCurve and QCPBars
+     * keep a QMap node per point.
+     */
+    if(plot == 0){
+        return 0;
+    }
+    qint64 bytes = plot->bufferBytes();
+    for(int i = 0; i < plot->plottableCount(); i++){
+        QCPAbstractPlottable *plottable = plot->plottable(i);
+        if(QCPVectorGraph *vector_graph = qobject_cast<QCPVectorGraph*>(plottable)){
+            bytes += vector_graph->memoryBytes();
+        }
+        else if(QCPGraph *graph = qobject_cast<QCPGraph*>(plottable)){
+            bytes += qint64(graph->data()->size())*sizeof(QMapNode<double, QCPData>);
+        }
+        else if(QCPCurve *curve = qobject_cast<QCPCurve*>(plottable)){
+            bytes += qint64(curve->data()->size())*sizeof(QMapNode<double, QCPCurveData>);
+        }
+        else if(QCPBars *bars = qobject_cast<QCPBars*>(plottable)){
+            bytes += qint64(bars->data()->size())*sizeof(QMapNode<double, QCPBarData>);
+        }
+        else if(QCPColorMap *map = qobject_cast<QCPColorMap*>(plottable)){
+            bytes += qint64(map->data()->keySize())*map->data()->valueSize()*sizeof(double);
+        }
+    }
+    return bytes;
+}
@@ -0,0 +1,59 @@
+#ifndef MEMORYACCOUNT_H
+#define MEMORYACCOUNT_H
+
+#include <QString>
+#include <QVector>
+#include <QHash>
+#include <QMap>
+
+class QCustomPlot;
+
+/*
+ * What the viewer's big structures hold, by name, against one global budget.
+ *
+ * Whatever owns a structure Set()s its category whenever the structure changes, with a
+ * size from SizeOf() or the structure's own MemoryBytes(): the element storage from
+ * the containers' capacities, the containers' headers, and QHash's buckets and nodes,
+ * so heap bookkeeping is all that is left out.  Implicitly shared data should only be
+ * counted by one of its holders.
+ *
+ * The budget (0 for none) is what the loaders go by: Fits() says whether some more
+ * bytes, or a structure replacing a category, would stay within it.  Everything here
+ * is safe to call from any thread.
+ */
+class MemoryAccount
+{
+public:
+    static void Set(QString category, qint64 bytes);
+    static void Remove(QString category);
+    static qint64 Bytes(QString category);
+    static qint64 Total();
+    static QMap<QString, qint64> Categories();
+
+    static void SetBudget(qint64 bytes);
+    static qint64 Budget();
+    static bool Fits(qint64 bytes, QString replacing = QString());
+
+    static QString Report();
+    static QString Megabytes(qint64 bytes);
+
+    template <typename T>
+    static qint64 SizeOf(const QVector<T> &vector){
+        // the shared empty vector has no storage of its own
+        return vector.capacity() > 0 ? qint64(sizeof(QArrayData)) + qint64(vector.capacity())*sizeof(T) : 0;
+    }
+    static qint64 SizeOf(const QVector<QVector<double> > &event);
+    static qint64 SizeOf(const QHash<int, QVector<QVector<double> > > &spill);
+    static qint64 SizeOf(const QHash<int, QHash<int, QVector<QVector<double> > > > &data);
+    static qint64 SizeOf(const QCustomPlot *plot);
+
+private:
+    template <typename K, typename V>
+    static qint64 hash_overhead(const QHash<K, V> &hash){
+        return hash.capacity() > 0 ? qint64(sizeof(QHashData)) + qint64(hash.capacity())*sizeof(void*)
+                                     + qint64(hash.size())*sizeof(QHashNode<K, V>)
+                                   : 0;
+    }
+};
+
+#endif // MEMORYACCOUNT_H
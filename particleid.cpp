@@ -0,0 +1,122 @@
+#include "particleid.h"
+#include "trace.h"
+#include "TMath.h"
+
+namespace {
+
+const double speed_of_light = 299.792458; // mm/ns
+
+// TKU station 5, the upstream end of the tracker and so the station nearest TOF1
+const int tracker_slot = 6;
+
+double signed_mass(double tof01, double z0, double z1, double px, double py, double pz,
+                   double momentum_loss){
+    /*
+     * m^2 = p^2 (1/beta^2 - 1), beta = L/(c t).  Missing values are Infinity, which
+     * makes the result non-finite (or NaN) and so outside every band.
+     */
+    double p = TMath::Sqrt(px*px + py*py + pz*pz) + momentum_loss;
+    double beta = (z1 - z0)/(speed_of_light*tof01);
+    double mass2 = p*p*(1.0/(beta*beta) - 1.0);
+    return mass2 >= 0 ? TMath::Sqrt(mass2) : -TMath::Sqrt(-mass2);
+}
+
+}
+
+ParticleID::ParticleID()
+{
+    QVector<double> cuts;
+    cuts << -100.0 << 40.0    // e
+         << 80.0 << 130.0     // mu
+         << 130.0 << 180.0    // pi
+         << 0.0;              // momentum loss
+    SetCuts(cuts);
+}
+
+ParticleID::~ParticleID(){
+
+}
+
+void ParticleID::SetCuts(QVector<double> cuts){
+    cuts.resize(7);
+    bandLow[Unknown] = bandHigh[Unknown] = 0.0;
+    for(int s = Electron; s <= Pion; s++){
+        bandLow[s] = cuts.at(2*(s - 1));
+        bandHigh[s] = cuts.at(2*(s - 1) + 1);
+    }
+    momentumLoss = cuts.at(6);
+}
+
+QVector<double> ParticleID::Cuts() const{
+    QVector<double> cuts;
+    for(int s = Electron; s <= Pion; s++){
+        cuts << bandLow[s] << bandHigh[s];
+    }
+    cuts << momentumLoss;
+    return cuts;
+}
+
+int ParticleID::species(double mass) const{
+    // the first band that contains the mass; NaN is in none of them
+    for(int s = Electron; s <= Pion; s++){
+        if(mass >= bandLow[s] && mass < bandHigh[s]){
+            return s;
+        }
+    }
+    return Unknown;
+}
+
+QVector<qint8> ParticleID::Classify(const EventStore &store) const{
+    /*
+     * One pass down the columns of the store computing the masses of every row, missing
+     * values and all, then another binning them into species.  The time of flight is
+     * the store's TOF01 column.
+     */
+    TRACE_SCOPE("ParticleID::Classify");
+    const int rows = store.Size();
+    const double *tof01 = store.EventColumn(EventStore::EventColumnIndex("tof01"));
+    const double *z0 = store.Column(2, 0);
+    const double *z1 = store.Column(2, 1);
+    const double *px = store.Column(4, tracker_slot);
+    const double *py = store.Column(5, tracker_slot);
+    const double *pz = store.Column(6, tracker_slot);
+
+    QVector<double> masses(rows);
+    double *mass = masses.data();
+    for(int row = 0; row < rows; row++){
+        mass[row] = signed_mass(tof01[row], z0[row], z1[row], px[row], py[row], pz[row], momentumLoss);
+    }
+
+    QVector<qint8> tags(rows);
+    for(int row = 0; row < rows; row++){
+        tags[row] = species(mass[row]);
+    }
+    return tags;
+}
+
+int ParticleID::Classify(const QVector<QVector<double> > &event) const{
+    if(event.size() < 7 || event.at(0).size() <= tracker_slot){
+        return Unknown;
+    }
+    return species(signed_mass(event.at(3).at(1) - event.at(3).at(0), event.at(2).at(0), event.at(2).at(1),
+                               event.at(4).at(tracker_slot), event.at(5).at(tracker_slot),
+                               event.at(6).at(tracker_slot), momentumLoss));
+}
+
+QString ParticleID::Name(int species){
+    switch(species){
+    case Electron: return "e";
+    case Muon: return "mu";
+    case Pion: return "pi";
+    default: return "unknown";
+    }
+}
+
+QColor ParticleID::Colour(int species){
+    switch(species){
+    case Electron: return QColor(Qt::darkYellow);
+    case Muon: return QColor(Qt::blue);
+    case Pion: return QColor(Qt::red);
+    default: return QColor(Qt::gray);
+    }
+}
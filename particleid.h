@@ -0,0 +1,50 @@
+#ifndef PARTICLEID_H
+#define PARTICLEID_H
+
+#include <QVector>
+#include <QString>
+#include <QColor>
+#include "eventstore.h"
+
+/*
+ * Electron/muon/pion identification from the TOF0 to TOF1 time of flight and the
+ * momentum at the upstream end of the upstream tracker (TKU station 5, as the stations
+ * are numbered from the absorber).
+ *
+ * The time of flight over the TOF0-TOF1 distance gives beta, and with the momentum that
+ * gives a mass, m = p sqrt(1/beta^2 - 1).  This is signed (-sqrt(|m^2|) when the
+ * measured beta is above 1, as it often is for electrons) and compared with a band
+ * for each species.  The momentum is taken at TKU station 5, the station the particle
+ * reaches first after TOF1, so the momentum lost between TOF1 and the tracker is only
+ * that in the material before it, and can be added back.
+ *
+ * Cuts, in the order SetCuts() takes them:
+ *   electron mass low, high; muon mass low, high; pion mass low, high (MeV/c^2);
+ *   momentum lost between TOF1 and TKU (MeV/c)
+ */
+class ParticleID
+{
+public:
+    enum Species { Unknown = 0, Electron = 1, Muon = 2, Pion = 3 };
+    static const int NSpecies = 4;
+
+    ParticleID();
+    ~ParticleID();
+
+    void SetCuts(QVector<double> cuts);
+    QVector<double> Cuts() const;
+
+    QVector<qint8> Classify(const EventStore &store) const;
+    int Classify(const QVector<QVector<double> > &event) const;
+
+    static QString Name(int species);
+    static QColor Colour(int species);
+
+private:
+    double bandLow[NSpecies], bandHigh[NSpecies];
+    double momentumLoss;
+
+    int species(double mass) const;
+};
+
+#endif // PARTICLEID_H
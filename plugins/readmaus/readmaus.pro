@@ -0,0 +1,50 @@
+#-------------------------------------------------
+#
+# ReadMAUS as a plugin, loaded by the viewer when a MAUS file is first opened
+#
+#-------------------------------------------------
+
+QT       += core
+
+TARGET = readmaus
+TEMPLATE = lib
+CONFIG += plugin c++11
+
+# next to the viewer's plugins/ directory, see EventSource::Create()
+DESTDIR = $$OUT_PWD/..
+
+trace {
+    DEFINES += EVENTVIEWER_TRACE
+}
+
+INCLUDEPATH += $$PWD $$PWD/../..
+
+SOURCES += readmausplugin.cpp \
+    $$PWD/../../readmaus.cpp
+
+HEADERS += readmausplugin.h \
+    $$PWD/../../readmaus.h \
+    $$PWD/../../eventsource.h \
+    $$PWD/../../eventsourceplugin.h
+
+OTHER_FILES += readmaus.json
+
+include(../../maus.pri)
+
+LIBS += -L$${ROOT_LIB_DIR} -lCint -lCore -lMathCore
+LIBS += -lMathMore -lHist -lTree -lMatrix -lRIO -lThread
+LIBS += -lGui -lRIO -lNet -lGraf -lGraf3d -lGpad -lRint -lPostscript -lPhysics -lThread -pthread -lm -ldl
+LIBS += -L$${MAUS_DIR}/src/common_cpp -lMausCpp
+LIBS += -L$${MAUS_DIR}/third_party/install/lib
+LIBS += -L$${MAUS_DIR}/third_party/build/geant4.9.6.p02/outputs/library/Linux-g++
+LIBS += -ljson -lPhysics
+LIBS += -lCLHEP
+LIBS += -lG4geometry -lG4graphics_reps -lG4materials -lG4particles
+LIBS += -lG4processes -lG4run -lG4event -lG4global -lG4intercoms
+LIBS += -lG4modeling -lG4tracking -lG4visHepRep -lG4VRML -lG4digits_hits
+LIBS += -lG4FR -lG4physicslists -lG4vis_management -lG4clhep -lG4track -lG4zlib
+
+INCLUDEPATH += $${MAUS_DIR}/src/common_cpp
+INCLUDEPATH += $${MAUS_DIR}
+INCLUDEPATH += $${MAUS_DIR}/src/legacy
+INCLUDEPATH += $${MAUS_DIR}/third_party/install/include
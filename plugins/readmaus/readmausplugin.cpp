@@ -0,0 +1,6 @@
+#include "readmausplugin.h"
+#include "readmaus.h"
+
+EventSource* ReadMAUSPlugin::Create(){
+    return new ReadMAUS();
+}
@@ -0,0 +1,21 @@
+#ifndef READMAUSPLUGIN_H
+#define READMAUSPLUGIN_H
+
+#include <QObject>
+#include "eventsourceplugin.h"
+
+/*
+ * The MAUS reader, ReadMAUS, as a plugin: everything it links against comes in with
+ * it, rather than with the viewer.
+ */
+class ReadMAUSPlugin : public QObject, public EventSourcePlugin
+{
+    Q_OBJECT
+    Q_PLUGIN_METADATA(IID EventSourcePlugin_iid FILE "readmaus.json")
+    Q_INTERFACES(EventSourcePlugin)
+
+public:
+    EventSource* Create();
+};
+
+#endif // READMAUSPLUGIN_H
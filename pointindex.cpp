@@ -0,0 +1,169 @@
+#include "pointindex.h"
+#include "trace.h"
+#include "memoryaccount.h"
+#include "TMath.h"
+
+#include <algorithm>
+
+PointIndex::PointIndex()
+{
+    keySize = 1.0;
+    valueSize = 1.0;
+}
+
+PointIndex::~PointIndex(){
+
+}
+
+void PointIndex::SetCellSize(double key_size, double value_size){
+    // throws the points away, they would all be in the wrong cells
+    Clear();
+    keySize = key_size > 0 ? key_size : 1.0;
+    valueSize = value_size > 0 ? value_size : 1.0;
+}
+
+void PointIndex::Clear(){
+    keys.clear();
+    values.clear();
+    owners.clear();
+    cells.clear();
+}
+
+qint64 PointIndex::cell_key(qint64 column, qint64 row){
+    // shifted unsigned, shifting a negative column left is undefined
+    return qint64(quint64(quint32(column)) << 32 | quint32(row));
+}
+
+qint64 PointIndex::cell_of(double key, double value) const{
+    qint64 column = qint64(qBound(-2.0e9, TMath::Floor(key/keySize), 2.0e9));
+    qint64 row = qint64(qBound(-2.0e9, TMath::Floor(value/valueSize), 2.0e9));
+    return cell_key(column, row);
+}
+
+void PointIndex::Add(const QVector<double> &point_keys, const QVector<double> &point_values,
+                     const QVector<int> &point_owners){
+    // points that aren't finite can't be clicked on, and are left out
+    TRACE_SCOPE("PointIndex::Add");
+    int n = qMin(point_keys.size(), qMin(point_values.size(), point_owners.size()));
+    keys.reserve(keys.size() + n);
+    values.reserve(values.size() + n);
+    owners.reserve(owners.size() + n);
+    for(int i = 0; i < n; i++){
+        if(!qIsFinite(point_keys.at(i)) || !qIsFinite(point_values.at(i))){
+            continue;
+        }
+        cells[cell_of(point_keys.at(i), point_values.at(i))] << keys.size();
+        keys << point_keys.at(i);
+        values << point_values.at(i);
+        owners << point_owners.at(i);
+    }
+}
+
+int PointIndex::Size() const{
+    return keys.size();
+}
+
+int PointIndex::Owner(int point) const{
+    return owners.at(point);
+}
+
+QVector<const QVector<int>*> PointIndex::occupied_cells(qint64 first_column, qint64 last_column,
+                                                        qint64 first_row, qint64 last_row) const{
+    // the occupied cells in a range, found by looking each up or, if that's more, all of them
+    QVector<const QVector<int>*> found;
+    if(double(last_column - first_column + 1)*double(last_row - first_row + 1) > cells.size()){
+        QHash<qint64, QVector<int> >::const_iterator cell;
+        for(cell = cells.constBegin(); cell != cells.constEnd(); ++cell){
+            found << &cell.value();
+        }
+        return found;
+    }
+    for(qint64 column = first_column; column <= last_column; column++){
+        for(qint64 row = first_row; row <= last_row; row++){
+            QHash<qint64, QVector<int> >::const_iterator cell = cells.constFind(cell_key(column, row));
+            if(cell != cells.constEnd()){
+                found << &cell.value();
+            }
+        }
+    }
+    return found;
+}
+
+int PointIndex::Nearest(double key, double value, double key_scale, double value_scale, double max_pixels) const{
+    /*
+     * The point closest to (key, value) on screen, scales in pixels per unit, or -1 if
+     * there is none within max_pixels.  Only the cells that overlap that reach are
+     * looked in.
+     */
+    if(keys.isEmpty() || key_scale <= 0 || value_scale <= 0){
+        return -1;
+    }
+    double reach_key = max_pixels/key_scale;
+    double reach_value = max_pixels/value_scale;
+    qint64 first_column = qint64(TMath::Floor((key - reach_key)/keySize));
+    qint64 last_column = qint64(TMath::Floor((key + reach_key)/keySize));
+    qint64 first_row = qint64(TMath::Floor((value - reach_value)/valueSize));
+    qint64 last_row = qint64(TMath::Floor((value + reach_value)/valueSize));
+
+    int nearest = -1;
+    double best = max_pixels*max_pixels;
+    const double *point_keys = keys.constData();
+    const double *point_values = values.constData();
+    QVector<const QVector<int>*> candidates = occupied_cells(first_column, last_column, first_row, last_row);
+
+    for(int c = 0; c < candidates.size(); c++){
+        const QVector<int> &points = *candidates.at(c);
+        for(int i = 0; i < points.size(); i++){
+            int point = points.at(i);
+            double dk = (point_keys[point] - key)*key_scale;
+            double dv = (point_values[point] - value)*value_scale;
+            double distance2 = dk*dk + dv*dv;
+            if(distance2 <= best){
+                best = distance2;
+                nearest = point;
+            }
+        }
+    }
+    return nearest;
+}
+
+QVector<int> PointIndex::InBox(const QRectF &box) const{
+    // the owners, each once and in order, of the points with key in [left, right] and value in [top, bottom]
+    QRectF normal = box.normalized();
+    QVector<int> found;
+    if(keys.isEmpty()){
+        return found;
+    }
+    qint64 first_column = qint64(TMath::Floor(normal.left()/keySize));
+    qint64 last_column = qint64(TMath::Floor(normal.right()/keySize));
+    qint64 first_row = qint64(TMath::Floor(normal.top()/valueSize));
+    qint64 last_row = qint64(TMath::Floor(normal.bottom()/valueSize));
+
+    QVector<const QVector<int>*> candidates = occupied_cells(first_column, last_column, first_row, last_row);
+
+    for(int c = 0; c < candidates.size(); c++){
+        const QVector<int> &points = *candidates.at(c);
+        for(int i = 0; i < points.size(); i++){
+            int point = points.at(i);
+            if(keys.at(point) >= normal.left() && keys.at(point) <= normal.right() &&
+               values.at(point) >= normal.top() && values.at(point) <= normal.bottom()){
+                found << owners.at(point);
+            }
+        }
+    }
+    std::sort(found.begin(), found.end());
+    found.erase(std::unique(found.begin(), found.end()), found.end());
+    return found;
+}
+
+qint64 PointIndex::MemoryBytes() const{
+    // see MemoryAccount
+    qint64 bytes = MemoryAccount::SizeOf(keys) + MemoryAccount::SizeOf(values) + MemoryAccount::SizeOf(owners)
+            + (cells.capacity() > 0 ? qint64(sizeof(QHashData)) + qint64(cells.capacity())*sizeof(void*) : 0)
+            + qint64(cells.size())*sizeof(QHashNode<qint64, QVector<int> >);
+    QHash<qint64, QVector<int> >::const_iterator cell;
+    for(cell = cells.constBegin(); cell != cells.constEnd(); ++cell){
+        bytes += MemoryAccount::SizeOf(cell.value());
+    }
+    return bytes;
+}
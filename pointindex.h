@@ -0,0 +1,51 @@
+#ifndef POINTINDEX_H
+#define POINTINDEX_H
+
+#include <QVector>
+#include <QHash>
+#include <QRectF>
+
+/*
+ * A uniform grid over the points of a plot, in data coordinates (key along the x axis,
+ * value along the y axis), for finding the points under the mouse without testing
+ * every one of them as QCustomPlot's selectTest() would.
+ *
+ * Each point carries an owner, whatever the caller wants a hit mapped back to, e.g. the
+ * index of the event it belongs to.  Add() puts points into the grid as they come, in
+ * cells of SetCellSize(); only occupied cells are held, in a hash, so the grid needs no
+ * bounds.
+ *
+ * Nearest() measures distance in pixels, given the plot's scale in pixels per unit on
+ * each axis, and only looks in the cells within that many pixels of the click, so it
+ * takes microseconds however many points there are.  InBox() collects the owners of
+ * every point in a rectangle.
+ */
+class PointIndex
+{
+public:
+    PointIndex();
+    ~PointIndex();
+
+    void SetCellSize(double key_size, double value_size);
+    void Clear();
+    void Add(const QVector<double> &keys, const QVector<double> &values, const QVector<int> &owners);
+
+    int Size() const;
+    int Nearest(double key, double value, double key_scale, double value_scale, double max_pixels) const;
+    int Owner(int point) const;
+    QVector<int> InBox(const QRectF &box) const;
+    qint64 MemoryBytes() const;
+
+private:
+    qint64 cell_of(double key, double value) const;
+    QVector<const QVector<int>*> occupied_cells(qint64 first_column, qint64 last_column,
+                                                qint64 first_row, qint64 last_row) const;
+    static qint64 cell_key(qint64 column, qint64 row);
+
+    double keySize, valueSize;
+    QVector<double> keys, values;
+    QVector<int> owners;
+    QHash<qint64, QVector<int> > cells; // point indices by cell_key()
+};
+
+#endif // POINTINDEX_H
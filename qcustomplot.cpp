@@ -24,6 +24,7 @@
 ****************************************************************************/
 
 #include "qcustomplot.h"
+#include "trace.h"
 
 
 
@@ -741,7 +742,9 @@ QCPLayer::QCPLayer(QCustomPlot *parentPlot, const QString &layerName) :
   mParentPlot(parentPlot),
   mName(layerName),
   mIndex(-1), // will be set to a proper value by the QCustomPlot layer creation function
-  mVisible(true)
+  mVisible(true),
+  mMode(lmLogical),
+  mPaintBufferIndex(-1)
 {
   // Note: no need to make sure layerName is unique, because layer
   // management is done with QCustomPlot functions.
@@ -774,6 +777,91 @@ void QCPLayer::setVisible(bool visible)
   mVisible = visible;
 }
 
+/*!
+  Sets how this layer is rendered into the paint buffers of the parent plot.
+  
+  By default all layers are \ref lmLogical, and a \ref QCustomPlot::replot draws every layer into
+  the single widget buffer. As soon as one layer is set to \ref lmBuffered, QCustomPlot keeps one
+  pixmap for each buffered layer and one for each run of consecutive logical layers between them,
+  and composites them onto the widget.
+  
+  A buffered layer can then be redrawn on its own with \ref replot, while the cached pixmaps of all
+  other layers are reused. This is useful when only the objects on one layer change between
+  replots, e.g. the data of an event display drawn on top of static axes, grids and detector
+  outlines.
+  
+  \see replot
+*/
+void QCPLayer::setMode(LayerMode mode)
+{
+  if (mMode != mode)
+  {
+    mMode = mode;
+    mParentPlot->mLayerBuffersValid = false;
+  }
+}
+
+/*!
+  Redraws only the layerables on this layer and updates the widget surface.
+  
+  If the layer is \ref lmBuffered and the paint buffers of the parent plot are valid, only this
+  layer's pixmap is repainted and then composited with the cached pixmaps of the other layers.
+  Otherwise (logical layer, or no full replot happened since the layer configuration or widget size
+  changed), a full \ref QCustomPlot::replot is performed.
+  
+  The layout and the axis ranges of the last full replot are reused, so this must only be used when
+  nothing but the objects on this layer has changed. Unlike \ref QCustomPlot::replot, the signals
+  \ref QCustomPlot::beforeReplot and \ref QCustomPlot::afterReplot are not emitted.
+  
+  \see setMode
+*/
+void QCPLayer::replot()
+{
+  TRACE_SCOPE("QCPLayer::replot");
+  if (mMode != lmBuffered || !mParentPlot->mLayerBuffersValid ||
+      mPaintBufferIndex < 0 || mPaintBufferIndex >= mParentPlot->mLayerBuffers.size() ||
+      mParentPlot->mLayerBuffers.at(mPaintBufferIndex).size() != mParentPlot->mPaintBuffer.size())
+  {
+    mParentPlot->replot();
+    return;
+  }
+  
+  QPixmap &buffer = mParentPlot->mLayerBuffers[mPaintBufferIndex];
+  buffer.fill(Qt::transparent);
+  QCPPainter painter;
+  painter.begin(&buffer);
+  if (painter.isActive())
+  {
+    painter.setRenderHint(QPainter::HighQualityAntialiasing);
+    draw(&painter);
+    painter.end();
+  }
+  mParentPlot->compositeLayerBuffers();
+  if (mParentPlot->plottingHints().testFlag(QCP::phForceRepaint))
+    mParentPlot->repaint();
+  else
+    mParentPlot->update();
+}
+
+/*! \internal
+  
+  Draws all visible layerables of this layer with \a painter, in their rendering order.
+*/
+void QCPLayer::draw(QCPPainter *painter)
+{
+  foreach (QCPLayerable *child, mChildren)
+  {
+    if (child->realVisibility())
+    {
+      painter->save();
+      painter->setClipRect(child->clipRect().translated(0, -1));
+      child->applyDefaultAntialiasingHint(painter);
+      child->draw(painter);
+      painter->restore();
+    }
+  }
+}
+
 /*! \internal
   
   Adds the \a layerable to the list of this layer. If \a prepend is set to true, the layerable will
@@ -9033,6 +9121,7 @@ QCustomPlot::QCustomPlot(QWidget *parent) :
   mPlottingHints(QCP::phCacheLabels|QCP::phForceRepaint),
   mMultiSelectModifier(Qt::ControlModifier),
   mPaintBuffer(size()),
+  mLayerBuffersValid(false),
   mMouseEventElement(0),
   mReplotting(false)
 {
@@ -10096,6 +10185,7 @@ bool QCustomPlot::addLayer(const QString &name, QCPLayer *otherLayer, QCustomPlo
   QCPLayer *newLayer = new QCPLayer(this, name);
   mLayers.insert(otherLayer->index() + (insertMode==limAbove ? 1:0), newLayer);
   updateLayerIndices();
+  mLayerBuffersValid = false;
   return true;
 }
 
@@ -10147,6 +10237,7 @@ bool QCustomPlot::removeLayer(QCPLayer *layer)
   delete layer;
   mLayers.removeOne(layer);
   updateLayerIndices();
+  mLayerBuffersValid = false;
   return true;
 }
 
@@ -10174,6 +10265,7 @@ bool QCustomPlot::moveLayer(QCPLayer *layer, QCPLayer *otherLayer, QCustomPlot::
   
   mLayers.move(layer->index(), otherLayer->index() + (insertMode==limAbove ? 1:0));
   updateLayerIndices();
+  mLayerBuffersValid = false;
   return true;
 }
 
@@ -10359,11 +10451,47 @@ void QCustomPlot::deselectAll()
 */
 void QCustomPlot::replot(QCustomPlot::RefreshPriority refreshPriority)
 {
+  TRACE_SCOPE("QCustomPlot::replot");
   if (mReplotting) // incase signals loop back to replot slot
     return;
   mReplotting = true;
   emit beforeReplot();
   
+  if (hasBufferedLayers())
+  {
+    // draw every layer into its paint buffer, then put the buffers together on the widget buffer:
+    mPlotLayout->update(QCPLayoutElement::upPreparation);
+    mPlotLayout->update(QCPLayoutElement::upMargins);
+    mPlotLayout->update(QCPLayoutElement::upLayout);
+    setupLayerBuffers();
+    QCPPainter layerPainter;
+    int currentBuffer = -1;
+    foreach (QCPLayer *layer, mLayers)
+    {
+      if (layer->mPaintBufferIndex != currentBuffer)
+      {
+        if (layerPainter.isActive())
+          layerPainter.end();
+        currentBuffer = layer->mPaintBufferIndex;
+        layerPainter.begin(&mLayerBuffers[currentBuffer]);
+        layerPainter.setRenderHint(QPainter::HighQualityAntialiasing);
+      }
+      if (layerPainter.isActive())
+        layer->draw(&layerPainter);
+    }
+    if (layerPainter.isActive())
+      layerPainter.end();
+    mLayerBuffersValid = true;
+    compositeLayerBuffers();
+    if ((refreshPriority == rpHint && mPlottingHints.testFlag(QCP::phForceRepaint)) || refreshPriority==rpImmediate)
+      repaint();
+    else
+      update();
+    emit afterReplot();
+    mReplotting = false;
+    return;
+  }
+  
   mPaintBuffer.fill(mBackgroundBrush.style() == Qt::SolidPattern ? mBackgroundBrush.color() : Qt::transparent);
   QCPPainter painter;
   painter.begin(&mPaintBuffer);
@@ -10651,6 +10779,7 @@ QSize QCustomPlot::sizeHint() const
 void QCustomPlot::paintEvent(QPaintEvent *event)
 {
   Q_UNUSED(event);
+  TRACE_SCOPE("QCustomPlot::paintEvent");
   QPainter painter(this);
   painter.drawPixmap(0, 0, mPaintBuffer);
 }
@@ -10877,19 +11006,7 @@ void QCustomPlot::draw(QCPPainter *painter)
 
   // draw all layered objects (grid, axes, plottables, items, legend,...):
   foreach (QCPLayer *layer, mLayers)
-  {
-    foreach (QCPLayerable *child, layer->children())
-    {
-      if (child->realVisibility())
-      {
-        painter->save();
-        painter->setClipRect(child->clipRect().translated(0, -1));
-        child->applyDefaultAntialiasingHint(painter);
-        child->draw(painter);
-        painter->restore();
-      }
-    }
-  }
+    layer->draw(painter);
   
   /* Debug code to draw all layout element rects
   foreach (QCPLayoutElement* el, findChildren<QCPLayoutElement*>())
@@ -10942,6 +11059,76 @@ void QCustomPlot::drawBackground(QCPPainter *painter)
   }
 }
 
+/*! \internal
+  
+  Returns whether any layer of this plot is in \ref QCPLayer::lmBuffered mode, in which case \ref
+  replot renders via the layer buffers (see \ref setupLayerBuffers).
+*/
+bool QCustomPlot::hasBufferedLayers() const
+{
+  foreach (QCPLayer *layer, mLayers)
+  {
+    if (layer->mode() == QCPLayer::lmBuffered)
+      return true;
+  }
+  return false;
+}
+
+/*! \internal
+  
+  Assigns each layer the index of the paint buffer it is drawn into, and makes sure there are
+  enough transparent buffers of the current widget size. Every buffered layer gets a buffer of its
+  own, consecutive logical layers share one.
+*/
+void QCustomPlot::setupLayerBuffers()
+{
+  int bufferIndex = -1;
+  bool previousBuffered = true; // so the first layer always starts a new buffer
+  foreach (QCPLayer *layer, mLayers)
+  {
+    bool buffered = layer->mode() == QCPLayer::lmBuffered;
+    if (buffered || previousBuffered)
+      ++bufferIndex;
+    layer->mPaintBufferIndex = bufferIndex;
+    previousBuffered = buffered;
+  }
+  
+  int bufferCount = bufferIndex+1;
+  while (mLayerBuffers.size() > bufferCount)
+    mLayerBuffers.removeLast();
+  for (int i=0; i<mLayerBuffers.size(); ++i)
+  {
+    if (mLayerBuffers.at(i).size() != mPaintBuffer.size())
+      mLayerBuffers[i] = QPixmap(mPaintBuffer.size());
+  }
+  while (mLayerBuffers.size() < bufferCount)
+    mLayerBuffers.append(QPixmap(mPaintBuffer.size()));
+  for (int i=0; i<mLayerBuffers.size(); ++i)
+    mLayerBuffers[i].fill(Qt::transparent);
+}
+
+/*! \internal
+  
+  Draws the background and then all layer buffers, bottom to top, onto the widget buffer
+  (mPaintBuffer). Used by \ref replot and \ref QCPLayer::replot when buffered layers are in use.
+*/
+void QCustomPlot::compositeLayerBuffers()
+{
+  mPaintBuffer.fill(mBackgroundBrush.style() == Qt::SolidPattern ? mBackgroundBrush.color() : Qt::transparent);
+  QCPPainter painter;
+  painter.begin(&mPaintBuffer);
+  if (painter.isActive())
+  {
+    if (mBackgroundBrush.style() != Qt::SolidPattern && mBackgroundBrush.style() != Qt::NoBrush)
+      painter.fillRect(mViewport, mBackgroundBrush);
+    drawBackground(&painter);
+    for (int i=0; i<mLayerBuffers.size(); ++i)
+      painter.drawPixmap(0, 0, mLayerBuffers.at(i));
+    painter.end();
+  } else // might happen if QCustomPlot has width or height zero
+    qDebug() << Q_FUNC_INFO << "Couldn't activate painter on buffer. This usually happens because QCustomPlot has width or height zero.";
+}
+
 
 /*! \internal
   
@@ -11043,6 +11230,18 @@ bool QCustomPlot::saveRastered(const QString &fileName, int width, int height, d
     return false;
 }
 
+/*!
+  Returns the bytes held by the paint buffer and the layer buffers (see \ref QCPLayer::setMode),
+  from their sizes and depths.
+*/
+qint64 QCustomPlot::bufferBytes() const
+{
+  qint64 bytes = qint64(mPaintBuffer.width())*mPaintBuffer.height()*mPaintBuffer.depth()/8;
+  foreach (const QPixmap &buffer, mLayerBuffers)
+    bytes += qint64(buffer.width())*buffer.height()*buffer.depth()/8;
+  return bytes;
+}
+
 /*!
   Renders the plot to a pixmap and returns it.
   
@@ -14491,6 +14690,8 @@ QCPGraph::QCPGraph(QCPAxis *keyAxis, QCPAxis *valueAxis) :
   setErrorBarSkipSymbol(true);
   setChannelFillGraph(0);
   setAdaptiveSampling(true);
+  setScatterDecimation(false);
+  mScatterCacheValid = false;
 }
 
 QCPGraph::~QCPGraph()
@@ -14510,6 +14711,7 @@ QCPGraph::~QCPGraph()
 */
 void QCPGraph::setData(QCPDataMap *data, bool copy)
 {
+  mScatterCacheValid = false;
   if (mData == data)
   {
     qDebug() << Q_FUNC_INFO << "The data pointer is already in (and owned by) this plottable" << reinterpret_cast<quintptr>(data);
@@ -14533,6 +14735,7 @@ void QCPGraph::setData(QCPDataMap *data, bool copy)
 */
 void QCPGraph::setData(const QVector<double> &key, const QVector<double> &value)
 {
+  mScatterCacheValid = false;
   mData->clear();
   int n = key.size();
   n = qMin(n, value.size());
@@ -14556,6 +14759,7 @@ void QCPGraph::setData(const QVector<double> &key, const QVector<double> &value)
 */
 void QCPGraph::setDataValueError(const QVector<double> &key, const QVector<double> &value, const QVector<double> &valueError)
 {
+  mScatterCacheValid = false;
   mData->clear();
   int n = key.size();
   n = qMin(n, value.size());
@@ -14582,6 +14786,7 @@ void QCPGraph::setDataValueError(const QVector<double> &key, const QVector<doubl
 */
 void QCPGraph::setDataValueError(const QVector<double> &key, const QVector<double> &value, const QVector<double> &valueErrorMinus, const QVector<double> &valueErrorPlus)
 {
+  mScatterCacheValid = false;
   mData->clear();
   int n = key.size();
   n = qMin(n, value.size());
@@ -14609,6 +14814,7 @@ void QCPGraph::setDataValueError(const QVector<double> &key, const QVector<doubl
 */
 void QCPGraph::setDataKeyError(const QVector<double> &key, const QVector<double> &value, const QVector<double> &keyError)
 {
+  mScatterCacheValid = false;
   mData->clear();
   int n = key.size();
   n = qMin(n, value.size());
@@ -14635,6 +14841,7 @@ void QCPGraph::setDataKeyError(const QVector<double> &key, const QVector<double>
 */
 void QCPGraph::setDataKeyError(const QVector<double> &key, const QVector<double> &value, const QVector<double> &keyErrorMinus, const QVector<double> &keyErrorPlus)
 {
+  mScatterCacheValid = false;
   mData->clear();
   int n = key.size();
   n = qMin(n, value.size());
@@ -14662,6 +14869,7 @@ void QCPGraph::setDataKeyError(const QVector<double> &key, const QVector<double>
 */
 void QCPGraph::setDataBothError(const QVector<double> &key, const QVector<double> &value, const QVector<double> &keyError, const QVector<double> &valueError)
 {
+  mScatterCacheValid = false;
   mData->clear();
   int n = key.size();
   n = qMin(n, value.size());
@@ -14691,6 +14899,7 @@ void QCPGraph::setDataBothError(const QVector<double> &key, const QVector<double
 */
 void QCPGraph::setDataBothError(const QVector<double> &key, const QVector<double> &value, const QVector<double> &keyErrorMinus, const QVector<double> &keyErrorPlus, const QVector<double> &valueErrorMinus, const QVector<double> &valueErrorPlus)
 {
+  mScatterCacheValid = false;
   mData->clear();
   int n = key.size();
   n = qMin(n, value.size());
@@ -14845,6 +15054,29 @@ void QCPGraph::setAdaptiveSampling(bool enabled)
   mAdaptiveSampling = enabled;
 }
 
+/*!
+  Sets whether scatter points are decimated on a pixel grid before drawing.
+  
+  When enabled, the visible data is binned into one-pixel cells of the axis rect in a single pass,
+  and only the first data point that falls into each occupied cell is drawn as a scatter symbol.
+  The number of data points represented by each drawn symbol is available via \ref
+  scatterCellCounts. This keeps the drawing cost of dense scatter plots bounded by the number of
+  pixels in the axis rect rather than the number of data points, which is what makes overlays of
+  many thousand points interactive.
+  
+  The decimated points are cached and only recalculated when the data, the key/value axis ranges
+  or the axis rect geometry change. If you modify the data directly via the \ref data pointer,
+  call one of the data setters (e.g. \ref setData) afterwards so the cache is invalidated.
+  
+  Scatter decimation takes precedence over \ref setAdaptiveSampling for the scatter points. The
+  line of the graph (if any) is unaffected. Error bars are only drawn for the representative points.
+*/
+void QCPGraph::setScatterDecimation(bool enabled)
+{
+  mScatterDecimation = enabled;
+  mScatterCacheValid = false;
+}
+
 /*!
   Adds the provided data points in \a dataMap to the current data.
   
@@ -14855,6 +15087,7 @@ void QCPGraph::setAdaptiveSampling(bool enabled)
 */
 void QCPGraph::addData(const QCPDataMap &dataMap)
 {
+  mScatterCacheValid = false;
   mData->unite(dataMap);
 }
 
@@ -14868,6 +15101,7 @@ void QCPGraph::addData(const QCPDataMap &dataMap)
 */
 void QCPGraph::addData(const QCPData &data)
 {
+  mScatterCacheValid = false;
   mData->insertMulti(data.key, data);
 }
 
@@ -14881,6 +15115,7 @@ void QCPGraph::addData(const QCPData &data)
 */
 void QCPGraph::addData(double key, double value)
 {
+  mScatterCacheValid = false;
   QCPData newData;
   newData.key = key;
   newData.value = value;
@@ -14897,6 +15132,7 @@ void QCPGraph::addData(double key, double value)
 */
 void QCPGraph::addData(const QVector<double> &keys, const QVector<double> &values)
 {
+  mScatterCacheValid = false;
   int n = qMin(keys.size(), values.size());
   QCPData newData;
   for (int i=0; i<n; ++i)
@@ -14913,6 +15149,7 @@ void QCPGraph::addData(const QVector<double> &keys, const QVector<double> &value
 */
 void QCPGraph::removeDataBefore(double key)
 {
+  mScatterCacheValid = false;
   QCPDataMap::iterator it = mData->begin();
   while (it != mData->end() && it.key() < key)
     it = mData->erase(it);
@@ -14924,6 +15161,7 @@ void QCPGraph::removeDataBefore(double key)
 */
 void QCPGraph::removeDataAfter(double key)
 {
+  mScatterCacheValid = false;
   if (mData->isEmpty()) return;
   QCPDataMap::iterator it = mData->upperBound(key);
   while (it != mData->end())
@@ -14939,6 +15177,7 @@ void QCPGraph::removeDataAfter(double key)
 */
 void QCPGraph::removeData(double fromKey, double toKey)
 {
+  mScatterCacheValid = false;
   if (fromKey >= toKey || mData->isEmpty()) return;
   QCPDataMap::iterator it = mData->upperBound(fromKey);
   QCPDataMap::iterator itEnd = mData->upperBound(toKey);
@@ -14956,6 +15195,7 @@ void QCPGraph::removeData(double fromKey, double toKey)
 */
 void QCPGraph::removeData(double key)
 {
+  mScatterCacheValid = false;
   mData->remove(key);
 }
 
@@ -14965,6 +15205,7 @@ void QCPGraph::removeData(double key)
 */
 void QCPGraph::clearData()
 {
+  mScatterCacheValid = false;
   mData->clear();
 }
 
@@ -15656,6 +15897,14 @@ void QCPGraph::getPreparedData(QVector<QCPData> *lineData, QVector<QCPData> *sca
   QCPAxis *keyAxis = mKeyAxis.data();
   QCPAxis *valueAxis = mValueAxis.data();
   if (!keyAxis || !valueAxis) { qDebug() << Q_FUNC_INFO << "invalid key or value axis"; return; }
+  // decimated scatter points are handled separately, only line data remains to be prepared below:
+  if (scatterData && mScatterDecimation)
+  {
+    getDecimatedScatterData(scatterData);
+    scatterData = 0;
+    if (!lineData)
+      return;
+  }
   // get visible data range:
   QCPDataMap::const_iterator lower, upper; // note that upper is the actual upper point, and not 1 step after the upper point
   getVisibleDataBounds(lower, upper);
@@ -15832,6 +16081,74 @@ void QCPGraph::getPreparedData(QVector<QCPData> *lineData, QVector<QCPData> *sca
   }
 }
 
+/*! \internal
+  
+  Returns the scatter points to draw in \a scatterData when \ref setScatterDecimation is enabled.
+  
+  The visible data is transformed to pixel coordinates and binned into a grid of one-pixel cells
+  covering the axis rect. Only the first data point that lands in an occupied cell is kept, and the
+  number of points per kept cell is recorded in mScatterCacheCounts. Points outside the axis rect,
+  as well as NaN and infinite values, are dropped. This is done in a single pass over the visible
+  data range.
+  
+  The result is cached and reused as long as the data, the axis ranges and the axis rect remain
+  unchanged, so pure repaints (e.g. replots caused by other plottables) don't repeat the binning.
+*/
+void QCPGraph::getDecimatedScatterData(QVector<QCPData> *scatterData) const
+{
+  QCPAxis *keyAxis = mKeyAxis.data();
+  QCPAxis *valueAxis = mValueAxis.data();
+  if (!keyAxis || !valueAxis) { qDebug() << Q_FUNC_INFO << "invalid key or value axis"; return; }
+  
+  QRect axisRect = keyAxis->axisRect()->rect();
+  if (!mScatterCacheValid ||
+      mScatterCacheKeyRange != keyAxis->range() ||
+      mScatterCacheValueRange != valueAxis->range() ||
+      mScatterCacheAxisRect != axisRect)
+  {
+    mScatterCache.clear();
+    mScatterCacheCounts.clear();
+    
+    QCPDataMap::const_iterator lower, upper;
+    getVisibleDataBounds(lower, upper);
+    const int gridWidth = axisRect.width()+1;
+    const int gridHeight = axisRect.height()+1;
+    if (lower != mData->constEnd() && upper != mData->constEnd() && gridWidth > 0 && gridHeight > 0)
+    {
+      // each grid cell holds the index+1 of its representative point in mScatterCache, 0 means empty:
+      mScatterCacheGrid.fill(0, gridWidth*gridHeight);
+      const bool keyIsVertical = keyAxis->orientation() == Qt::Vertical;
+      QCPDataMap::const_iterator it = lower;
+      QCPDataMap::const_iterator upperEnd = upper+1;
+      while (it != upperEnd)
+      {
+        double keyPixel = keyAxis->coordToPixel(it.value().key);
+        double valuePixel = valueAxis->coordToPixel(it.value().value);
+        double x = (keyIsVertical ? valuePixel : keyPixel) - axisRect.left();
+        double y = (keyIsVertical ? keyPixel : valuePixel) - axisRect.top();
+        if (x >= 0 && x < gridWidth && y >= 0 && y < gridHeight) // also rejects NaN and infinite coordinates
+        {
+          int cell = int(y)*gridWidth + int(x);
+          int &cellEntry = mScatterCacheGrid[cell];
+          if (cellEntry == 0)
+          {
+            mScatterCache.append(it.value());
+            mScatterCacheCounts.append(1);
+            cellEntry = mScatterCache.size();
+          } else
+            ++mScatterCacheCounts[cellEntry-1];
+        }
+        ++it;
+      }
+    }
+    mScatterCacheKeyRange = keyAxis->range();
+    mScatterCacheValueRange = valueAxis->range();
+    mScatterCacheAxisRect = axisRect;
+    mScatterCacheValid = true;
+  }
+  *scatterData = mScatterCache; // implicitly shared, no copy of the points
+}
+
 /*!  \internal
   
   called by the scatter drawing function (\ref drawScatterPlot) to draw the error bars on one data
@@ -16716,6 +17033,486 @@ QCPRange QCPGraph::getValueRange(bool &foundRange, SignDomain inSignDomain, bool
 }
 
 
+////////////////////////////////////////////////////////////////////////////////////////////////////
+//////////////////// QCPVectorGraph
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/*! \class QCPVectorGraph
+  \brief A graph plottable that keeps its data in two sorted arrays instead of a QCPDataMap.
+  
+  QCPVectorGraph draws the same kind of single-valued data as QCPGraph with line styles \ref
+  QCPGraph::lsNone and \ref QCPGraph::lsLine. Keys and values are held in two contiguous,
+  key-sorted QVectors, so replacing the whole data set is cheap: \ref setData adopts the passed
+  vectors through Qt's implicit sharing when the keys are already ascending, and only otherwise
+  sorts them once. Finding the visible part of the data for drawing and hit testing is a binary
+  search (\ref findBegin, \ref findEnd).
+  
+  This makes it the better choice over QCPGraph for plots whose entire data is replaced often, e.g.
+  once per displayed event. It has no error bars, fills or adaptive sampling. Step and impulse line
+  styles are drawn as \ref QCPGraph::lsLine.
+  
+  Points whose key or value is NaN or infinite are not drawn and create a gap in the line. Points
+  with a NaN key can't be ordered and are dropped by \ref setData.
+  
+  Like QCPGraph, scatter points can be decimated to one per pixel, see \ref setScatterDecimation.
+  
+  The graph must be registered with QCustomPlot::addPlottable, which then takes ownership of it.
+*/
+
+/* start of documentation of inline functions */
+
+/*! \fn QVector<double> QCPVectorGraph::keys() const
+  
+  Returns the sorted keys of the graph. The returned vector shares its data with the graph, so no
+  copy is made unless either is modified.
+*/
+
+/*! \fn QVector<double> QCPVectorGraph::values() const
+  
+  Returns the values of the graph, in the order of \ref keys.
+*/
+
+/* end of documentation of inline functions */
+
+/*! \internal
+  
+  Orders point indices by their key, used by \ref QCPVectorGraph::setData for unsorted input.
+*/
+struct QCPVectorGraphKeyLess
+{
+  QCPVectorGraphKeyLess(const QVector<double> &keys) : mKeys(keys) {}
+  bool operator()(int a, int b) const { return mKeys.at(a) < mKeys.at(b); }
+  const QVector<double> &mKeys;
+};
+
+/*!
+  Constructs a graph which uses \a keyAxis as its key axis ("x") and \a valueAxis as its value
+  axis ("y"). \a keyAxis and \a valueAxis must reside in the same QCustomPlot instance and not have
+  the same orientation.
+  
+  The constructed QCPVectorGraph can be added to the plot with QCustomPlot::addPlottable,
+  QCustomPlot then takes ownership of the graph.
+*/
+QCPVectorGraph::QCPVectorGraph(QCPAxis *keyAxis, QCPAxis *valueAxis) :
+  QCPAbstractPlottable(keyAxis, valueAxis)
+{
+  setPen(QPen(Qt::blue, 0));
+  setBrush(Qt::NoBrush);
+  setSelectedPen(QPen(QColor(80, 80, 255), 2.5));
+  setSelectedBrush(Qt::NoBrush);
+  
+  setLineStyle(QCPGraph::lsLine);
+  setScatterDecimation(false);
+  mScatterCacheValid = false;
+}
+
+QCPVectorGraph::~QCPVectorGraph()
+{
+}
+
+/*!
+  Replaces the current data with the provided points, \a keys[i] and \a values[i] forming one data
+  point. If the two vectors differ in size, the extra entries of the larger one are ignored.
+  
+  If the keys are in ascending order, the graph adopts both vectors without copying them (they are
+  implicitly shared with the caller until either side modifies them). Otherwise the points are
+  sorted by key, keeping the order of points with equal keys. Checking the order is a single pass
+  over \a keys; if the caller knows the keys are ascending, it can skip it by passing true for \a
+  alreadySorted.
+*/
+void QCPVectorGraph::setData(const QVector<double> &keys, const QVector<double> &values, bool alreadySorted)
+{
+  mScatterCacheValid = false;
+  const int n = qMin(keys.size(), values.size());
+  
+  bool sorted = alreadySorted;
+  if (!sorted)
+  {
+    sorted = true;
+    for (int i=0; i<n; ++i)
+    {
+      if (qIsNaN(keys.at(i)) || (i > 0 && keys.at(i) < keys.at(i-1)))
+      {
+        sorted = false;
+        break;
+      }
+    }
+  }
+  
+  if (sorted)
+  {
+    mKeys = keys;
+    mValues = values;
+    if (mKeys.size() > n) mKeys.resize(n);
+    if (mValues.size() > n) mValues.resize(n);
+    return;
+  }
+  
+  // sort a permutation of the point indices and gather keys and values through it:
+  QVector<int> order;
+  order.reserve(n);
+  for (int i=0; i<n; ++i)
+  {
+    if (!qIsNaN(keys.at(i)))
+      order.append(i);
+  }
+  std::stable_sort(order.begin(), order.end(), QCPVectorGraphKeyLess(keys));
+  
+  mKeys.resize(order.size());
+  mValues.resize(order.size());
+  double *keyData = mKeys.data();
+  double *valueData = mValues.data();
+  for (int i=0; i<order.size(); ++i)
+  {
+    keyData[i] = keys.at(order.at(i));
+    valueData[i] = values.at(order.at(i));
+  }
+}
+
+/*!
+  Sets how the data points are connected. Only \ref QCPGraph::lsNone and \ref QCPGraph::lsLine are
+  distinguished, all other line styles are drawn as \ref QCPGraph::lsLine.
+*/
+void QCPVectorGraph::setLineStyle(QCPGraph::LineStyle ls)
+{
+  mLineStyle = ls;
+}
+
+/*!
+  Sets the visual appearance of single data points in the plot. If set to \ref
+  QCPScatterStyle::ssNone, no scatter points are drawn.
+*/
+void QCPVectorGraph::setScatterStyle(const QCPScatterStyle &style)
+{
+  mScatterStyle = style;
+}
+
+/*!
+  Sets whether scatter points are decimated to one per pixel, in the same way as \ref
+  QCPGraph::setScatterDecimation. The decimated points are cached until the data, the axis ranges
+  or the axis rect size change. \ref scatterCellCounts returns how many data points each drawn
+  scatter point stands for.
+*/
+void QCPVectorGraph::setScatterDecimation(bool enabled)
+{
+  mScatterDecimation = enabled;
+  mScatterCacheValid = false;
+}
+
+/*!
+  Returns the index of the first data point whose key is not smaller than \a key, or \ref
+  dataCount if there is none.
+  
+  \see findEnd
+*/
+int QCPVectorGraph::findBegin(double key) const
+{
+  return std::lower_bound(mKeys.constBegin(), mKeys.constEnd(), key) - mKeys.constBegin();
+}
+
+/*!
+  Returns the index of the first data point whose key is larger than \a key, or \ref dataCount if
+  there is none.
+  
+  \see findBegin
+*/
+int QCPVectorGraph::findEnd(double key) const
+{
+  return std::upper_bound(mKeys.constBegin(), mKeys.constEnd(), key) - mKeys.constBegin();
+}
+
+/*!
+  Returns the bytes allocated for the data and the scatter decimation cache, from the vectors'
+  capacities.
+*/
+qint64 QCPVectorGraph::memoryBytes() const
+{
+  return qint64(mKeys.capacity() + mValues.capacity())*sizeof(double)
+      + qint64(mScatterCache.capacity())*sizeof(QPointF)
+      + qint64(mScatterCacheCounts.capacity() + mScatterCacheGrid.capacity())*sizeof(int);
+}
+
+/* inherits documentation from base class */
+void QCPVectorGraph::clearData()
+{
+  mScatterCacheValid = false;
+  mKeys.clear();
+  mValues.clear();
+}
+
+/* inherits documentation from base class */
+double QCPVectorGraph::selectTest(const QPointF &pos, bool onlySelectable, QVariant *details) const
+{
+  Q_UNUSED(details)
+  if ((onlySelectable && !mSelectable) || mKeys.isEmpty())
+    return -1;
+  if (!mKeyAxis || !mValueAxis) { qDebug() << Q_FUNC_INFO << "invalid key or value axis"; return -1; }
+  
+  if (mKeyAxis.data()->axisRect()->rect().contains(pos.toPoint()))
+    return pointDistance(pos);
+  else
+    return -1;
+}
+
+/* inherits documentation from base class */
+void QCPVectorGraph::draw(QCPPainter *painter)
+{
+  if (!mKeyAxis || !mValueAxis) { qDebug() << Q_FUNC_INFO << "invalid key or value axis"; return; }
+  if (mKeyAxis.data()->range().size() <= 0 || mKeys.isEmpty()) return;
+  if (mLineStyle == QCPGraph::lsNone && mScatterStyle.isNone()) return;
+  
+  int begin, end;
+  getVisibleDataBounds(begin, end);
+  if (begin >= end) return;
+  
+  // draw line, broken into segments at points that can't be drawn:
+  if (mLineStyle != QCPGraph::lsNone && mainPen().style() != Qt::NoPen && mainPen().color().alpha() != 0)
+  {
+    QVector<QPointF> lineData;
+    getLinePixels(&lineData, begin, end);
+    applyDefaultAntialiasingHint(painter);
+    painter->setPen(mainPen());
+    painter->setBrush(Qt::NoBrush);
+    int segmentStart = 0;
+    const int lineDataSize = lineData.size();
+    for (int i=0; i<=lineDataSize; ++i)
+    {
+      if (i == lineDataSize || qIsNaN(lineData.at(i).x()))
+      {
+        if (i-segmentStart > 1)
+          painter->drawPolyline(lineData.constData()+segmentStart, i-segmentStart);
+        segmentStart = i+1;
+      }
+    }
+  }
+  
+  // draw scatters:
+  if (!mScatterStyle.isNone())
+  {
+    QVector<QPointF> scatterData;
+    if (mScatterDecimation)
+      getDecimatedScatterPixels(&scatterData, begin, end);
+    else
+      getScatterPixels(&scatterData, begin, end);
+    applyScattersAntialiasingHint(painter);
+    mScatterStyle.applyTo(painter, mPen);
+    for (int i=0; i<scatterData.size(); ++i)
+      mScatterStyle.drawShape(painter, scatterData.at(i));
+  }
+}
+
+/* inherits documentation from base class */
+void QCPVectorGraph::drawLegendIcon(QCPPainter *painter, const QRectF &rect) const
+{
+  // draw line vertically centered:
+  if (mLineStyle != QCPGraph::lsNone)
+  {
+    applyDefaultAntialiasingHint(painter);
+    painter->setPen(mPen);
+    painter->drawLine(QLineF(rect.left(), rect.top()+rect.height()/2.0, rect.right()+5, rect.top()+rect.height()/2.0)); // +5 on x2 else last segment is missing from dashed/dotted pens
+  }
+  // draw scatter symbol:
+  if (!mScatterStyle.isNone())
+  {
+    applyScattersAntialiasingHint(painter);
+    // scale scatter pixmap if it's too large to fit in legend icon rect:
+    if (mScatterStyle.shape() == QCPScatterStyle::ssPixmap && (mScatterStyle.pixmap().size().width() > rect.width() || mScatterStyle.pixmap().size().height() > rect.height()))
+    {
+      QCPScatterStyle scaledStyle(mScatterStyle);
+      scaledStyle.setPixmap(scaledStyle.pixmap().scaled(rect.size().toSize(), Qt::KeepAspectRatio, Qt::SmoothTransformation));
+      scaledStyle.applyTo(painter, mPen);
+      scaledStyle.drawShape(painter, QRectF(rect).center());
+    } else
+    {
+      mScatterStyle.applyTo(painter, mPen);
+      mScatterStyle.drawShape(painter, QRectF(rect).center());
+    }
+  }
+}
+
+/*! \internal
+  
+  Returns the index range [\a begin, \a end) of the data points that need to be drawn for the
+  current key axis range. As in QCPGraph, one point outside the range on either side is included,
+  so lines leaving the axis rect are drawn up to its border.
+*/
+void QCPVectorGraph::getVisibleDataBounds(int &begin, int &end) const
+{
+  if (!mKeyAxis) { qDebug() << Q_FUNC_INFO << "invalid key axis"; begin = end = 0; return; }
+  begin = findBegin(mKeyAxis.data()->range().lower);
+  end = findEnd(mKeyAxis.data()->range().upper);
+  if (begin > 0)
+    --begin;
+  if (end < mKeys.size())
+    ++end;
+}
+
+/*! \internal
+  
+  Fills \a lineData with the pixel positions of the data points with indices in [\a begin, \a end).
+  Points that can't be drawn are marked with a NaN x coordinate, so the line is interrupted there.
+*/
+void QCPVectorGraph::getLinePixels(QVector<QPointF> *lineData, int begin, int end) const
+{
+  lineData->resize(end-begin);
+  QPointF *pixelData = lineData->data();
+  for (int i=begin; i<end; ++i)
+  {
+    if (QCP::isInvalidData(mKeys.at(i), mValues.at(i)))
+      pixelData[i-begin] = QPointF(qQNaN(), qQNaN());
+    else
+      pixelData[i-begin] = coordsToPixels(mKeys.at(i), mValues.at(i));
+  }
+}
+
+/*! \internal
+  
+  Fills \a scatterData with the pixel positions of the drawable data points with indices in [\a
+  begin, \a end).
+*/
+void QCPVectorGraph::getScatterPixels(QVector<QPointF> *scatterData, int begin, int end) const
+{
+  scatterData->clear();
+  scatterData->reserve(end-begin);
+  for (int i=begin; i<end; ++i)
+  {
+    if (!QCP::isInvalidData(mKeys.at(i), mValues.at(i)))
+      scatterData->append(coordsToPixels(mKeys.at(i), mValues.at(i)));
+  }
+}
+
+/*! \internal
+  
+  Like \ref getScatterPixels, but keeps only the first point falling into each pixel of the axis
+  rect and counts the others in \ref scatterCellCounts. The result is cached and only recomputed
+  when the data, the axis ranges or the axis rect change.
+*/
+void QCPVectorGraph::getDecimatedScatterPixels(QVector<QPointF> *scatterData, int begin, int end) const
+{
+  QCPAxis *keyAxis = mKeyAxis.data();
+  QCPAxis *valueAxis = mValueAxis.data();
+  if (!keyAxis || !valueAxis) { qDebug() << Q_FUNC_INFO << "invalid key or value axis"; return; }
+  
+  QRect axisRect = keyAxis->axisRect()->rect();
+  if (!mScatterCacheValid ||
+      mScatterCacheKeyRange != keyAxis->range() ||
+      mScatterCacheValueRange != valueAxis->range() ||
+      mScatterCacheAxisRect != axisRect)
+  {
+    mScatterCache.clear();
+    mScatterCacheCounts.clear();
+    
+    const int gridWidth = axisRect.width()+1;
+    const int gridHeight = axisRect.height()+1;
+    if (gridWidth > 0 && gridHeight > 0)
+    {
+      // each grid cell holds the index+1 of its representative point in mScatterCache, 0 means empty:
+      mScatterCacheGrid.fill(0, gridWidth*gridHeight);
+      for (int i=begin; i<end; ++i)
+      {
+        QPointF pixel = coordsToPixels(mKeys.at(i), mValues.at(i));
+        double x = pixel.x() - axisRect.left();
+        double y = pixel.y() - axisRect.top();
+        if (x >= 0 && x < gridWidth && y >= 0 && y < gridHeight) // also rejects NaN and infinite coordinates
+        {
+          int &cellEntry = mScatterCacheGrid[int(y)*gridWidth + int(x)];
+          if (cellEntry == 0)
+          {
+            mScatterCache.append(pixel);
+            mScatterCacheCounts.append(1);
+            cellEntry = mScatterCache.size();
+          } else
+            ++mScatterCacheCounts[cellEntry-1];
+        }
+      }
+    }
+    mScatterCacheKeyRange = keyAxis->range();
+    mScatterCacheValueRange = valueAxis->range();
+    mScatterCacheAxisRect = axisRect;
+    mScatterCacheValid = true;
+  }
+  *scatterData = mScatterCache; // implicitly shared, no copy of the points
+}
+
+/*! \internal
+  
+  Calculates the minimum distance in pixels the graph's representation has from the given \a
+  pixelPoint, considering only the visible data points. Returns -1.0 if there is nothing to compare
+  against.
+*/
+double QCPVectorGraph::pointDistance(const QPointF &pixelPoint) const
+{
+  if (mLineStyle == QCPGraph::lsNone && mScatterStyle.isNone())
+    return -1.0;
+  
+  int begin, end;
+  getVisibleDataBounds(begin, end);
+  QVector<QPointF> pixels;
+  getLinePixels(&pixels, begin, end);
+  
+  double minDistSqr = std::numeric_limits<double>::max();
+  bool found = false;
+  for (int i=0; i<pixels.size(); ++i)
+  {
+    if (qIsNaN(pixels.at(i).x()))
+      continue;
+    double currentDistSqr;
+    if (mLineStyle != QCPGraph::lsNone && i > 0 && !qIsNaN(pixels.at(i-1).x()))
+      currentDistSqr = distSqrToLine(pixels.at(i-1), pixels.at(i), pixelPoint);
+    else
+      currentDistSqr = QVector2D(pixels.at(i)-pixelPoint).lengthSquared();
+    if (currentDistSqr < minDistSqr)
+      minDistSqr = currentDistSqr;
+    found = true;
+  }
+  return found ? qSqrt(minDistSqr) : -1.0;
+}
+
+/* inherits documentation from base class */
+QCPRange QCPVectorGraph::getKeyRange(bool &foundRange, SignDomain inSignDomain) const
+{
+  // keys are sorted, so the range is spanned by the first and last finite key in the sign domain:
+  int begin = 0;
+  int end = mKeys.size();
+  if (inSignDomain == sdPositive)
+    begin = findEnd(0);
+  else if (inSignDomain == sdNegative)
+    end = findBegin(0);
+  while (begin < end && QCP::isInvalidData(mKeys.at(begin)))
+    ++begin;
+  while (end > begin && QCP::isInvalidData(mKeys.at(end-1)))
+    --end;
+  
+  foundRange = begin < end;
+  if (!foundRange)
+    return QCPRange();
+  return QCPRange(mKeys.at(begin), mKeys.at(end-1));
+}
+
+/* inherits documentation from base class */
+QCPRange QCPVectorGraph::getValueRange(bool &foundRange, SignDomain inSignDomain) const
+{
+  QCPRange range;
+  bool haveRange = false;
+  for (int i=0; i<mValues.size(); ++i)
+  {
+    double current = mValues.at(i);
+    if (QCP::isInvalidData(current, mKeys.at(i)))
+      continue;
+    if ((inSignDomain == sdNegative && current >= 0) || (inSignDomain == sdPositive && current <= 0))
+      continue;
+    if (current < range.lower || !haveRange)
+      range.lower = current;
+    if (current > range.upper || !haveRange)
+      range.upper = current;
+    haveRange = true;
+  }
+  
+  foundRange = haveRange;
+  return range;
+}
+
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 //////////////////// QCPCurveData
 ////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -45,6 +45,7 @@
 #include <QMargins>
 #include <qmath.h>
 #include <limits>
+#include <algorithm>
 #if QT_VERSION < QT_VERSION_CHECK(5, 0, 0)
 #  include <qnumeric.h>
 #  include <QPrinter>
@@ -371,8 +372,18 @@ class QCP_LIB_DECL QCPLayer : public QObject
   Q_PROPERTY(int index READ index)
   Q_PROPERTY(QList<QCPLayerable*> children READ children)
   Q_PROPERTY(bool visible READ visible WRITE setVisible)
+  Q_PROPERTY(LayerMode mode READ mode WRITE setMode)
   /// \endcond
 public:
+  /*!
+    Defines how the layer is rendered into the paint buffers of the parent QCustomPlot.
+    \see setMode
+  */
+  enum LayerMode { lmLogical   ///< Layer is drawn into a paint buffer shared with its neighbouring logical layers
+                   ,lmBuffered ///< Layer has its own paint buffer and may be replotted on its own, see \ref replot
+                 };
+  Q_ENUMS(LayerMode)
+  
   QCPLayer(QCustomPlot* parentPlot, const QString &layerName);
   ~QCPLayer();
   
@@ -382,9 +393,14 @@ public:
   int index() const { return mIndex; }
   QList<QCPLayerable*> children() const { return mChildren; }
   bool visible() const { return mVisible; }
+  LayerMode mode() const { return mMode; }
   
   // setters:
   void setVisible(bool visible);
+  void setMode(LayerMode mode);
+  
+  // non-property methods:
+  void replot();
   
 protected:
   // property members:
@@ -393,10 +409,15 @@ protected:
   int mIndex;
   QList<QCPLayerable*> mChildren;
   bool mVisible;
+  LayerMode mMode;
+  
+  // non-property members:
+  int mPaintBufferIndex;
   
   // non-virtual methods:
   void addChild(QCPLayerable *layerable, bool prepend);
   void removeChild(QCPLayerable *layerable);
+  void draw(QCPPainter *painter);
   
 private:
   Q_DISABLE_COPY(QCPLayer)
@@ -470,6 +491,7 @@ private:
   
   friend class QCustomPlot;
   friend class QCPAxisRect;
+  friend class QCPLayer;
 };
 
 
@@ -1813,6 +1835,7 @@ public:
   bool saveBmp(const QString &fileName, int width=0, int height=0, double scale=1.0);
   bool saveRastered(const QString &fileName, int width, int height, double scale, const char *format, int quality=-1);
   QPixmap toPixmap(int width=0, int height=0, double scale=1.0);
+  qint64 bufferBytes() const;
   void toPainter(QCPPainter *painter, int width=0, int height=0);
   Q_SLOT void replot(QCustomPlot::RefreshPriority refreshPriority=QCustomPlot::rpHint);
   
@@ -1865,6 +1888,8 @@ protected:
   
   // non-property members:
   QPixmap mPaintBuffer;
+  QList<QPixmap> mLayerBuffers;
+  bool mLayerBuffersValid;
   QPoint mMousePressPos;
   QPointer<QCPLayoutElement> mMouseEventElement;
   bool mReplotting;
@@ -1889,6 +1914,9 @@ protected:
   void updateLayerIndices() const;
   QCPLayerable *layerableAt(const QPointF &pos, bool onlySelectable, QVariant *selectionDetails=0) const;
   void drawBackground(QCPPainter *painter);
+  bool hasBufferedLayers() const;
+  void setupLayerBuffers();
+  void compositeLayerBuffers();
   
   friend class QCPLegend;
   friend class QCPAxis;
@@ -2499,6 +2527,7 @@ class QCP_LIB_DECL QCPGraph : public QCPAbstractPlottable
   Q_PROPERTY(bool errorBarSkipSymbol READ errorBarSkipSymbol WRITE setErrorBarSkipSymbol)
   Q_PROPERTY(QCPGraph* channelFillGraph READ channelFillGraph WRITE setChannelFillGraph)
   Q_PROPERTY(bool adaptiveSampling READ adaptiveSampling WRITE setAdaptiveSampling)
+  Q_PROPERTY(bool scatterDecimation READ scatterDecimation WRITE setScatterDecimation)
   /// \endcond
 public:
   /*!
@@ -2538,6 +2567,8 @@ public:
   bool errorBarSkipSymbol() const { return mErrorBarSkipSymbol; }
   QCPGraph *channelFillGraph() const { return mChannelFillGraph.data(); }
   bool adaptiveSampling() const { return mAdaptiveSampling; }
+  bool scatterDecimation() const { return mScatterDecimation; }
+  QVector<int> scatterCellCounts() const { return mScatterCacheCounts; }
   
   // setters:
   void setData(QCPDataMap *data, bool copy=false);
@@ -2556,6 +2587,7 @@ public:
   void setErrorBarSkipSymbol(bool enabled);
   void setChannelFillGraph(QCPGraph *targetGraph);
   void setAdaptiveSampling(bool enabled);
+  void setScatterDecimation(bool enabled);
   
   // non-property methods:
   void addData(const QCPDataMap &dataMap);
@@ -2588,6 +2620,15 @@ protected:
   bool mErrorBarSkipSymbol;
   QPointer<QCPGraph> mChannelFillGraph;
   bool mAdaptiveSampling;
+  bool mScatterDecimation;
+  
+  // non-property members:
+  mutable bool mScatterCacheValid;
+  mutable QCPRange mScatterCacheKeyRange, mScatterCacheValueRange;
+  mutable QRect mScatterCacheAxisRect;
+  mutable QVector<QCPData> mScatterCache;
+  mutable QVector<int> mScatterCacheCounts;
+  mutable QVector<int> mScatterCacheGrid;
   
   // reimplemented virtual methods:
   virtual void draw(QCPPainter *painter);
@@ -2605,6 +2646,7 @@ protected:
   
   // non-virtual methods:
   void getPreparedData(QVector<QCPData> *lineData, QVector<QCPData> *scatterData) const;
+  void getDecimatedScatterData(QVector<QCPData> *scatterData) const;
   void getPlotData(QVector<QPointF> *lineData, QVector<QCPData> *scatterData) const;
   void getScatterPlotData(QVector<QCPData> *scatterData) const;
   void getLinePlotData(QVector<QPointF> *linePixelData, QVector<QCPData> *scatterData) const;
@@ -2635,6 +2677,79 @@ protected:
 
 
 
+class QCP_LIB_DECL QCPVectorGraph : public QCPAbstractPlottable
+{
+  Q_OBJECT
+  /// \cond INCLUDE_QPROPERTIES
+  Q_PROPERTY(QCPGraph::LineStyle lineStyle READ lineStyle WRITE setLineStyle)
+  Q_PROPERTY(QCPScatterStyle scatterStyle READ scatterStyle WRITE setScatterStyle)
+  Q_PROPERTY(bool scatterDecimation READ scatterDecimation WRITE setScatterDecimation)
+  /// \endcond
+public:
+  explicit QCPVectorGraph(QCPAxis *keyAxis, QCPAxis *valueAxis);
+  virtual ~QCPVectorGraph();
+  
+  // getters:
+  QVector<double> keys() const { return mKeys; }
+  QVector<double> values() const { return mValues; }
+  int dataCount() const { return mKeys.size(); }
+  qint64 memoryBytes() const;
+  QCPGraph::LineStyle lineStyle() const { return mLineStyle; }
+  QCPScatterStyle scatterStyle() const { return mScatterStyle; }
+  bool scatterDecimation() const { return mScatterDecimation; }
+  QVector<int> scatterCellCounts() const { return mScatterCacheCounts; }
+  
+  // setters:
+  void setData(const QVector<double> &keys, const QVector<double> &values, bool alreadySorted=false);
+  void setLineStyle(QCPGraph::LineStyle ls);
+  void setScatterStyle(const QCPScatterStyle &style);
+  void setScatterDecimation(bool enabled);
+  
+  // non-property methods:
+  int findBegin(double key) const;
+  int findEnd(double key) const;
+  
+  // reimplemented virtual methods:
+  virtual void clearData();
+  virtual double selectTest(const QPointF &pos, bool onlySelectable, QVariant *details=0) const;
+  
+protected:
+  // property members:
+  QVector<double> mKeys, mValues;
+  QCPGraph::LineStyle mLineStyle;
+  QCPScatterStyle mScatterStyle;
+  bool mScatterDecimation;
+  
+  // non-property members:
+  mutable bool mScatterCacheValid;
+  mutable QCPRange mScatterCacheKeyRange, mScatterCacheValueRange;
+  mutable QRect mScatterCacheAxisRect;
+  mutable QVector<QPointF> mScatterCache;
+  mutable QVector<int> mScatterCacheCounts;
+  mutable QVector<int> mScatterCacheGrid;
+  
+  // reimplemented virtual methods:
+  virtual void draw(QCPPainter *painter);
+  virtual void drawLegendIcon(QCPPainter *painter, const QRectF &rect) const;
+  virtual QCPRange getKeyRange(bool &foundRange, SignDomain inSignDomain=sdBoth) const;
+  virtual QCPRange getValueRange(bool &foundRange, SignDomain inSignDomain=sdBoth) const;
+  
+  // non-virtual methods:
+  void getVisibleDataBounds(int &begin, int &end) const;
+  void getLinePixels(QVector<QPointF> *lineData, int begin, int end) const;
+  void getScatterPixels(QVector<QPointF> *scatterData, int begin, int end) const;
+  void getDecimatedScatterPixels(QVector<QPointF> *scatterData, int begin, int end) const;
+  double pointDistance(const QPointF &pixelPoint) const;
+  
+  friend class QCustomPlot;
+  friend class QCPLegend;
+};
+
+
+/*! \file */
+
+
+
 class QCP_LIB_DECL QCPCurveData
 {
 public:
@@ -1,4 +1,5 @@
 #include "readmaus.h"
+#include "trace.h"
 
 #include "JsonCppStreamer/IRStream.hh"
 
@@ -13,6 +14,11 @@ ReadMAUS::ReadMAUS()
     spillRange = 2000;
     spillBegin = 0;
     spillEnd = spillBegin + spillRange;
+    cancelFlag = NULL;
+    recordSlabTimes = false;
+    timeStages = false;
+    tofTime = 0;
+    trackerTime = 0;
 }
 
 ReadMAUS::~ReadMAUS(){
@@ -77,10 +83,99 @@ void ReadMAUS::SetStartingSpill(int start_spill){
     spillEnd = spillBegin + spillRange;
 }
 
+void ReadMAUS::SetCancelFlag(QAtomicInt *cancel_flag){
+    /*
+     * Reading stops at the next spill once the flag is set (from any thread), returning
+     * whatever has been read so far.
+     */
+    cancelFlag = cancel_flag;
+}
+
+void ReadMAUS::SetTOFCalibration(const TOFCalibration &calibration){
+    // replaces the constants set_2011_TOF0_TOF1_Rayner_calibration() starts with
+    calibrated_c_eff = calibration.CEff();
+    TOF0_horizontal_slab_calibrations = calibration.Offsets(0, TOFCalibration::Horizontal);
+    TOF0_vertical_slab_calibrations = calibration.Offsets(0, TOFCalibration::Vertical);
+    TOF1_horizontal_slab_calibrations = calibration.Offsets(1, TOFCalibration::Horizontal);
+    TOF1_vertical_slab_calibrations = calibration.Offsets(1, TOFCalibration::Vertical);
+    TOF2_horizontal_slab_calibrations = calibration.Offsets(2, TOFCalibration::Horizontal);
+    TOF2_vertical_slab_calibrations = calibration.Offsets(2, TOFCalibration::Vertical);
+}
+
+void ReadMAUS::SetRecordSlabTimes(bool record){
+    /*
+     * For calibrating the TOFs: note the slabs of every TOF pixel read, and the
+     * difference of the raw PMT times in each, with the spill and event they belong to.
+     * SlabTimes() gives those from the last Read() or ReadEntries().
+     */
+    recordSlabTimes = record;
+}
+
+QVector<ReadMAUS::SlabTime> ReadMAUS::SlabTimes(){
+    return slab_times;
+}
+
+void ReadMAUS::record_slab_times(int tof, int h_slab, double h_dt, int v_slab, double v_dt){
+    // the last pixel at a TOF is the one the event keeps, so it replaces any before it
+    if(!recordSlabTimes){
+        return;
+    }
+    for(int i = event_slab_times.size() - 1; i >= 0; i--){
+        if(event_slab_times.at(i).tof == tof){
+            event_slab_times.remove(i);
+        }
+    }
+    SlabTime slab_time;
+    slab_time.spill = -1;
+    slab_time.event = -1;
+    slab_time.tof = tof;
+    slab_time.plane = 0;
+    slab_time.slab = h_slab;
+    slab_time.dt = h_dt;
+    event_slab_times << slab_time;
+    slab_time.plane = 1;
+    slab_time.slab = v_slab;
+    slab_time.dt = v_dt;
+    event_slab_times << slab_time;
+}
+
+void ReadMAUS::SetTimeStages(bool time_stages){
+    /*
+     * For benchmarking: time every spill read, and within it the TOF and tracker
+     * parts of the unpacking.  StageTimings() gives them for the last Read() or
+     * ReadEntries().
+     */
+    timeStages = time_stages;
+}
+
+QVector<ReadMAUS::SpillTiming> ReadMAUS::StageTimings(){
+    return spill_timings;
+}
+
+void ReadMAUS::time_spill(QElapsedTimer &spill_timer){
+    if(timeStages){
+        SpillTiming timing;
+        timing.spill = spillNumber;
+        timing.events = particles_in_event.size();
+        timing.read_ns = spill_timer.nsecsElapsed();
+        timing.tof_ns = tofTime;
+        timing.tracker_ns = trackerTime;
+        spill_timings << timing;
+    }
+    tofTime = 0;
+    trackerTime = 0;
+}
+
+bool ReadMAUS::cancelled(){
+    return cancelFlag != NULL && cancelFlag->load() != 0;
+}
+
 QHash<int, QHash<int, QVector<QVector<double> > > > ReadMAUS::Read(QString fileToOpen){
     particle_info.clear();
     particles_in_event.clear();
     particles_in_spill.clear();
+    slab_times.clear();
+    spill_timings.clear();
 
     particles_in_spill.clear();
     particles_in_event.clear();
@@ -90,9 +185,14 @@ QHash<int, QHash<int, QVector<QVector<double> > > > ReadMAUS::Read(QString fileT
     irstream infile(fileToOpen.toStdString().c_str(), "Spill");
 
     // iterate over events:
+    QElapsedTimer spill_timer;
+    spill_timer.start();
 
     while(infile >> readEvent != NULL){
-        infile >> branchName("data") >> data;
+        {
+            TRACE_SCOPE("irstream read");
+            infile >> branchName("data") >> data;
+        }
         spill = data.GetSpill();
 
         if(spill != NULL && spill->GetDaqEventType() == "physics_event"){
@@ -104,22 +204,107 @@ QHash<int, QHash<int, QVector<QVector<double> > > > ReadMAUS::Read(QString fileT
             spillNumber = spill->GetSpillNumber();
             if(spillNumber >= spillBegin && spillNumber < spillEnd){
                 readParticleEvent();
+                time_spill(spill_timer);
             }
 
         }
         if(spillNumber >= spillBegin && spillNumber < spillEnd){
             add_to_spills();
         }
-        if(spillNumber > spillEnd){
+        if(spillNumber > spillEnd || cancelled()){
             break;
         }
+        spill_timer.restart();
+
+    }
+
+    return particles_in_spill;
+}
+
+QHash<int, QHash<int, QVector<QVector<double> > > > ReadMAUS::ReadEntries(QString fileToOpen, QVector<Long64_t> entries){
+    /*
+     * Read only the given entries of the Spill tree, e.g. from IndexSpills(), rather than
+     * streaming through the file from the start.  The spill range isn't applied.
+     */
+    particle_info.clear();
+    particles_in_event.clear();
+    particles_in_spill.clear();
+    slab_times.clear();
+    spill_timings.clear();
+
+    TFile root_file(fileToOpen.toStdString().c_str(), "READ");
+    TTree *tree = root_file.IsZombie() ? NULL : (TTree*)root_file.Get("Spill");
+    if(tree == NULL){
+        return particles_in_spill;
+    }
+
+    MAUS::Data *data = new MAUS::Data();
+    tree->SetBranchAddress("data", &data);
+
+    QElapsedTimer spill_timer;
+    for(int i = 0; i < entries.size() && !cancelled(); i++){
+        spill_timer.start();
+        {
+            TRACE_SCOPE("TTree::GetEntry");
+            tree->GetEntry(entries.at(i));
+        }
+        spill = data->GetSpill();
 
+        if(spill != NULL && spill->GetDaqEventType() == "physics_event"){
+            spillNumber = spill->GetSpillNumber();
+            readParticleEvent();
+            time_spill(spill_timer);
+            add_to_spills();
+        }
     }
 
+    tree->ResetBranchAddresses();
+    delete data;
+    spill = NULL;
+
     return particles_in_spill;
 }
 
+QMap<int, Long64_t> ReadMAUS::IndexSpills(QString fileToOpen){
+    /*
+     * One pass over the Spill tree noting the entry that holds each physics spill, so
+     * that any spill can later be read on its own with ReadEntries().  The entries still
+     * have to be unpacked to get at the spill number, so this costs about as much as
+     * reading the file once, but it only has to be done once per file.
+     */
+    TRACE_SCOPE("ReadMAUS::IndexSpills");
+    QMap<int, Long64_t> index;
+
+    TFile root_file(fileToOpen.toStdString().c_str(), "READ");
+    TTree *tree = root_file.IsZombie() ? NULL : (TTree*)root_file.Get("Spill");
+    if(tree == NULL){
+        return index;
+    }
+
+    MAUS::Data *data = new MAUS::Data();
+    tree->SetBranchAddress("data", &data);
+
+    Long64_t n_entries = tree->GetEntries();
+    for(Long64_t entry = 0; entry < n_entries && !cancelled(); entry++){
+        tree->GetEntry(entry);
+        MAUS::Spill *entry_spill = data->GetSpill();
+        if(entry_spill != NULL && entry_spill->GetDaqEventType() == "physics_event"
+           && !index.contains(entry_spill->GetSpillNumber())){
+            index.insert(entry_spill->GetSpillNumber(), entry);
+        }
+    }
+
+    tree->ResetBranchAddresses();
+    delete data;
+
+    return index;
+}
+
 void ReadMAUS::readParticleEvent(){
+    TRACE_SCOPE("ReadMAUS::readParticleEvent");
+    // start each spill afresh, otherwise events from a longer previous spill are kept
+    particles_in_event.clear();
+
     for(size_t i = 0; i < spill->GetReconEvents()->size(); ++i){
         /*
          * For now we're only going to look at TOF events. Other events will
@@ -131,25 +316,41 @@ void ReadMAUS::readParticleEvent(){
         tof_event = (*spill->GetReconEvents())[i]->GetTOFEvent();
         scifi_event = (*spill->GetReconEvents())[i]->GetSciFiEvent();
 
+        if(timeStages){
+            stage_timer.start();
+        }
+
         if(tof_event != NULL){
             // there are hits at TOFs, we should try and do something with them
             particle_at_TOF0();
             particle_at_TOF1();
         }
+        if(timeStages){
+            tofTime += stage_timer.nsecsElapsed();
+            stage_timer.start();
+        }
 
         if(scifi_event != NULL){
             particle_at_tracker(); // this function needs renaming
         }
+        if(timeStages){
+            trackerTime += stage_timer.nsecsElapsed();
+            stage_timer.start();
+        }
 
         if(tof_event != NULL){
             particle_at_TOF2();
         }
+        if(timeStages){
+            tofTime += stage_timer.nsecsElapsed();
+        }
 
         add_to_events();
     }
 }
 
 void ReadMAUS::add_to_events(){
+    TRACE_SCOPE("ReadMAUS::add_to_events");
     particle_info.clear();
     particle_x.clear();
     particle_y.clear();
@@ -268,6 +469,12 @@ void ReadMAUS::add_to_events(){
                   << particle_py << particle_pz;
 
     particles_in_event.insert(reconstructed_event_number, particle_info);
+
+    for(int i = 0; i < event_slab_times.size(); i++){
+        event_slab_times[i].spill = spillNumber;
+        event_slab_times[i].event = reconstructed_event_number;
+    }
+    slab_times += event_slab_times;
 }
 
 void ReadMAUS::add_to_spills(){
@@ -287,6 +494,8 @@ void ReadMAUS::reset_particle_variables(){
      * in further analysis code.  Ints get set to -1.
      */
 
+    event_slab_times.clear();
+
     TOF0_xPixel = TMath::Infinity();
     TOF0_yPixel = TMath::Infinity();
     TOF0_x = TMath::Infinity();
@@ -422,6 +631,8 @@ void ReadMAUS::spacePoints_at_TOF0(){
             if((TOF0_hSlab == horizontalHit) && (TOF0_vSlab == verticalHit)){
                 // we have a pixel
                 get_TOF0_pixel_xy();
+                record_slab_times(0, TOF0_hSlab, TOF0_hSlab_raw_t0 - TOF0_hSlab_raw_t1,
+                                  TOF0_vSlab, TOF0_vSlab_raw_t0 - TOF0_vSlab_raw_t1);
                 TOF0_hitTime = tof0_space_points.GetTime();
             }
         }
@@ -488,6 +699,8 @@ void ReadMAUS::spacePoints_at_TOF1(){
             if((TOF1_hSlab == horizontalHit) && (TOF1_vSlab == verticalHit)){
                 // we have a pixel
                 get_TOF1_pixel_xy();
+                record_slab_times(1, TOF1_hSlab, TOF1_hSlab_raw_t0 - TOF1_hSlab_raw_t1,
+                                  TOF1_vSlab, TOF1_vSlab_raw_t0 - TOF1_vSlab_raw_t1);
                 TOF1_hitTime = tof1_space_points.GetTime();
             }
         }
@@ -555,6 +768,8 @@ void ReadMAUS::spacePoints_at_TOF2(){
             if((TOF2_hSlab == horizontalHit) && (TOF2_vSlab == verticalHit)){
                 // we have a pixel
                 get_TOF2_pixel_xy();
+                record_slab_times(2, TOF2_hSlab, TOF2_hSlab_raw_t0 - TOF2_hSlab_raw_t1,
+                                  TOF2_vSlab, TOF2_vSlab_raw_t0 - TOF2_vSlab_raw_t1);
                 TOF2_hitTime = tof2_space_points.GetTime();
             }
         }
@@ -699,9 +914,7 @@ void ReadMAUS::get_TOF0_pixel_xy(){
     else{
         TOF0_y = TOF0_yPixel;
     }
-
-    TOF0_x = TOF0_x + TOF0_xOffset;
-    TOF0_y = TOF0_y + TOF0_yOffset;
+    // the offsets are added in add_to_events(), along with the trackers'
 }
 
 void ReadMAUS::get_TOF1_pixel_xy(){
@@ -814,9 +1027,7 @@ void ReadMAUS::get_TOF1_pixel_xy(){
     else{
         TOF1_y = TOF1_yPixel;
     }
-
-    TOF1_x = TOF1_x + TOF1_xOffset;
-    TOF1_y = TOF1_y + TOF1_yOffset;
+    // the offsets are added in add_to_events(), along with the trackers'
 }
 
 
@@ -957,9 +1168,7 @@ void ReadMAUS::get_TOF2_pixel_xy(){
     else{
         TOF2_y = TOF2_yPixel;
     }
-
-    TOF2_x = TOF2_x + TOF2_xOffset;
-    TOF2_y = TOF2_y + TOF2_yOffset;
+    // the offsets are added in add_to_events(), along with the trackers'
 
 }
 
@@ -1038,6 +1247,7 @@ void ReadMAUS::particle_at_tracker(){
      * (a) figure out what info I really want to strip off, and (b) make sure I've nabbed
      * the correct info!
      */
+    TRACE_SCOPE("ReadMAUS::particle_at_tracker");
 
     int tracker, station;
     MAUS::ThreeVector position;
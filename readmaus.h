@@ -27,23 +27,39 @@
 #include <DataStructure/ThreeVector.hh>
 
 #include <QHash>
+#include <QMap>
+#include <QAtomicInt>
+#include <QElapsedTimer>
+#include "tofcalibration.h"
+#include "eventsource.h"
 
 
 
-class ReadMAUS
+class ReadMAUS : public EventSource
 {
 public:
     ReadMAUS();
     ~ReadMAUS();
 
     QHash<int, QHash<int, QVector<QVector<double> > > > Read(QString fileToOpen);
+    QHash<int, QHash<int, QVector<QVector<double> > > > ReadEntries(QString fileToOpen, QVector<Long64_t> entries);
+    QMap<int, Long64_t> IndexSpills(QString fileToOpen);
     void SetDetectorPositions(QVector<double> tof0_location, QVector<double> tof1_location,
                               QVector<double> tku_location, QVector<double> tkd_location,
                               QVector<double> tof2_location);
     void SetSpillRange(int spill_range);
     void SetStartingSpill(int start_spill);
+    void SetCancelFlag(QAtomicInt *cancel_flag);
+    void SetTOFCalibration(const TOFCalibration &calibration);
+    void SetRecordSlabTimes(bool record);
+    QVector<SlabTime> SlabTimes();
+    void SetTimeStages(bool time_stages);
+    QVector<SpillTiming> StageTimings();
 
 private:
+    QAtomicInt *cancelFlag;
+    bool cancelled();
+
     MAUS::Spill *spill;
     MAUS::TOFEvent *tof_event;
     MAUS::SciFiEvent *scifi_event;
@@ -132,6 +148,16 @@ private:
     QVector<double> TOF2_vertical_slab_calibrations;
     double calibrated_c_eff;
 
+    bool recordSlabTimes;
+    QVector<SlabTime> slab_times, event_slab_times;
+    void record_slab_times(int tof, int h_slab, double h_dt, int v_slab, double v_dt);
+
+    bool timeStages;
+    QVector<SpillTiming> spill_timings;
+    QElapsedTimer stage_timer;
+    qint64 tofTime, trackerTime;
+    void time_spill(QElapsedTimer &spill_timer);
+
     QVector<double> particle_x;
     QVector<double> particle_y;
     QVector<double> particle_z;
@@ -0,0 +1,427 @@
+#include "renderserver.h"
+#include "settings.h"
+#include "tofcalibration.h"
+#include "memoryaccount.h"
+#include "trace.h"
+#include "TMath.h"
+
+#include <QUrl>
+#include <QUrlQuery>
+#include <QBuffer>
+#include <QPixmap>
+#include <QDataStream>
+#include <QJsonObject>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <limits>
+#include <algorithm>
+
+RenderServer::RenderServer(QObject *parent) :
+    QObject(parent)
+{
+    chunkStart = 0;
+    hasChunk = false;
+    shownSpill = -1;
+    shownEvent = -1;
+    plotWidth = 800;
+    plotHeight = 400;
+    SetCacheSize(Q_INT64_C(256)*1024*1024);
+
+    // never shown: everything comes from the defaults the viewer starts with
+    settings = new Settings();
+
+    for(int i = 0; i < PlotNames().size(); i++){
+        QCustomPlot *plot = new QCustomPlot();
+        plot->setAttribute(Qt::WA_DontShowOnScreen);
+        plot->resize(plotWidth, plotHeight);
+        plots << plot;
+    }
+    display = new EventDisplay(plots.at(0), plots.at(1), plots.at(2), plots.at(3));
+    tof_display = new TOFPlots(plots.at(4), plots.at(5), plots.at(6));
+    display->SetTracks(settings->GetTrackerFields(), settings->GetCharge());
+    pid.SetCuts(settings->GetParticleIDCuts());
+
+    loader = new ChunkLoader(this);
+    loader->SetDetectorPositions(settings->GetTOF0Settings(), settings->GetTOF1Settings(),
+                                 settings->GetTKUSettings(), settings->GetTKDSettings(),
+                                 settings->GetTOF2Settings());
+    loader->SetSpillRange(settings->GetSpillRange());
+    TOFCalibration calibration;
+    if(!settings->GetTOFCalibrationFile().isEmpty()){
+        calibration.Load(settings->GetTOFCalibrationFile());
+    }
+    loader->SetTOFCalibration(calibration);
+    loader->SetParticleID(pid);
+    connect(loader, SIGNAL(ChunkReady(int)), SLOT(chunk_ready(int)));
+
+    connect(&server, SIGNAL(newConnection()), SLOT(new_connection()));
+}
+
+RenderServer::~RenderServer(){
+    MemoryAccount::Remove("Render cache");
+    delete display;
+    delete tof_display;
+    qDeleteAll(plots);
+    delete settings;
+}
+
+QStringList RenderServer::PlotNames(){
+    QStringList names;
+    names << "position_xz" << "position_yz" << "momentum_t" << "momentum_z"
+          << "tof0_to_tof1" << "tof0_to_tof2" << "tof1_to_tof2";
+    return names;
+}
+
+bool RenderServer::Listen(QHostAddress address, quint16 port, QString *error){
+    if(!server.listen(address, port)){
+        if(error != 0){
+            *error = server.errorString();
+        }
+        return false;
+    }
+    return true;
+}
+
+quint16 RenderServer::Port() const{
+    // the port listened on, the one chosen if Listen() was given 0
+    return server.serverPort();
+}
+
+void RenderServer::SetFile(QString file){
+    filename = file;
+    loader->SetFile(file);
+    data.clear();
+    store.Clear();
+    hasChunk = false;
+    shownSpill = -1;
+    cache.clear();
+    MemoryAccount::Set("Render cache", 0);
+}
+
+void RenderServer::SetPlotSize(int width, int height){
+    // the size of plots asked for without one
+    plotWidth = qBound(16, width, 4096);
+    plotHeight = qBound(16, height, 4096);
+}
+
+void RenderServer::SetCacheSize(qint64 bytes){
+    cache.setMaxCost(int(qBound(Q_INT64_C(0), bytes, qint64(std::numeric_limits<int>::max()))));
+}
+
+void RenderServer::new_connection(){
+    while(server.hasPendingConnections()){
+        QTcpSocket *client = server.nextPendingConnection();
+        connect(client, SIGNAL(readyRead()), SLOT(read_request()));
+        connect(client, SIGNAL(disconnected()), SLOT(client_gone()));
+        connect(client, SIGNAL(disconnected()), client, SLOT(deleteLater()));
+    }
+}
+
+void RenderServer::client_gone(){
+    // requests still waiting for a chunk drop out on their own, see request::client
+    incoming.remove(static_cast<QTcpSocket*>(sender()));
+}
+
+void RenderServer::read_request(){
+    // only the request line matters; the headers are read and ignored
+    QTcpSocket *client = qobject_cast<QTcpSocket*>(sender());
+    if(client == 0){
+        return;
+    }
+    QByteArray &buffer = incoming[client];
+    buffer += client->readAll();
+    int end = buffer.indexOf("\r\n\r\n");
+    if(end < 0){
+        if(buffer.size() > 16384){
+            incoming.remove(client);
+            respond(client, 400, "text/plain", "Request too long\n");
+        }
+        return;
+    }
+
+    QList<QByteArray> line = buffer.left(buffer.indexOf("\r\n")).split(' ');
+    incoming.remove(client);
+    client->disconnect(this, SLOT(read_request()));
+    if(line.size() < 2){
+        respond(client, 400, "text/plain", "Bad request\n");
+        return;
+    }
+    if(line.at(0) != "GET"){
+        respond(client, 405, "text/plain", "Only GET\n");
+        return;
+    }
+    handle(client, line.at(1));
+}
+
+void RenderServer::handle(QTcpSocket *client, QByteArray target){
+    QUrl url(QString::fromUtf8(target));
+    QUrlQuery query(url);
+    QString path = url.path();
+    if(path == "/"){
+        // not cached: the spills only appear once the file has been indexed
+        respond(client, 200, "application/json", info_json());
+        return;
+    }
+
+    request wanted;
+    wanted.client = client;
+    wanted.spill = 0;
+    wanted.event = 0;
+    wanted.width = query.hasQueryItem("width") ? query.queryItemValue("width").toInt() : plotWidth;
+    wanted.height = query.hasQueryItem("height") ? query.queryItemValue("height").toInt() : plotHeight;
+    wanted.width = qBound(16, wanted.width, 4096);
+    wanted.height = qBound(16, wanted.height, 4096);
+
+    QStringList parts = path.split('/', QString::SkipEmptyParts);
+    bool spill_ok = parts.size() >= 2;
+    bool event_ok = parts.size() >= 3;
+    if(parts.size() == 2 && parts.at(0) == "spill" && parts.at(1).endsWith(".json")){
+        wanted.spill = parts.at(1).left(parts.at(1).size() - 5).toInt(&spill_ok);
+        event_ok = true; // no event in the path
+        wanted.kind = "spill";
+        wanted.key = path;
+    }
+    else if(parts.size() == 3 && parts.at(0) == "event" &&
+            (parts.at(2).endsWith(".json") || parts.at(2).endsWith(".bin"))){
+        wanted.spill = parts.at(1).toInt(&spill_ok);
+        wanted.kind = parts.at(2).section('.', -1);
+        wanted.event = parts.at(2).section('.', 0, 0).toInt(&event_ok);
+        wanted.key = path;
+    }
+    else if(parts.size() == 4 && parts.at(0) == "event" && parts.at(3).endsWith(".png") &&
+            PlotNames().contains(parts.at(3).left(parts.at(3).size() - 4))){
+        wanted.spill = parts.at(1).toInt(&spill_ok);
+        wanted.event = parts.at(2).toInt(&event_ok);
+        wanted.kind = parts.at(3).left(parts.at(3).size() - 4);
+        wanted.key = QString("%1?%2x%3").arg(path).arg(wanted.width).arg(wanted.height);
+    }
+    else{
+        respond(client, 404, "text/plain", "Not found\n");
+        return;
+    }
+    if(!spill_ok || !event_ok){
+        respond(client, 400, "text/plain", "Spills and events are numbers\n");
+        return;
+    }
+
+    if(cache.contains(wanted.key)){
+        respond_cached(client, wanted.key);
+    }
+    else if(hasChunk && chunk_of(wanted.spill) == chunkStart){
+        serve(wanted);
+    }
+    else{
+        // one chunk is read at a time: the first waiting request's, see serve_waiting()
+        waiting << wanted;
+        if(waiting.size() == 1){
+            loader->Request(chunk_of(wanted.spill));
+        }
+    }
+}
+
+int RenderServer::chunk_of(int spill_number){
+    // chunks on a fixed grid, so that every client's requests share them
+    int spill_range = settings->GetSpillRange();
+    spill_number = qMax(0, spill_number);
+    return spill_number - spill_number%spill_range;
+}
+
+void RenderServer::chunk_ready(int start_spill){
+    TRACE_SCOPE("RenderServer::chunk_ready");
+    data = loader->Take(start_spill, &store);
+    chunkStart = start_spill;
+    hasChunk = true;
+    shownSpill = -1;
+    tof_display->Fill(store);
+    update_geometry();
+    serve_waiting();
+}
+
+void RenderServer::serve_waiting(){
+    // everything the chunk held can answer, then read the chunk the next request needs
+    QList<request> still_waiting;
+    for(int i = 0; i < waiting.size(); i++){
+        if(waiting.at(i).client.isNull()){
+            continue;
+        }
+        if(cache.contains(waiting.at(i).key)){
+            respond_cached(waiting.at(i).client, waiting.at(i).key);
+        }
+        else if(chunk_of(waiting.at(i).spill) == chunkStart){
+            serve(waiting.at(i));
+        }
+        else{
+            still_waiting << waiting.at(i);
+        }
+    }
+    waiting = still_waiting;
+    if(!waiting.isEmpty()){
+        loader->Request(chunk_of(waiting.first().spill));
+    }
+}
+
+void RenderServer::serve(const request &wanted){
+    if(wanted.client.isNull()){
+        return;
+    }
+    QByteArray type, body;
+    if(wanted.kind == "spill"){
+        if(!data.contains(wanted.spill)){
+            respond(wanted.client, 404, "text/plain", QString("No spill %1\n").arg(wanted.spill).toUtf8());
+            return;
+        }
+        type = "application/json";
+        body = spill_json(wanted.spill);
+    }
+    else{
+        if(!data.value(wanted.spill).contains(wanted.event)){
+            respond(wanted.client, 404, "text/plain",
+                    QString("No event %1 in spill %2\n").arg(wanted.event).arg(wanted.spill).toUtf8());
+            return;
+        }
+        if(wanted.kind == "json"){
+            type = "application/json";
+            body = event_json(wanted.spill, wanted.event);
+        }
+        else if(wanted.kind == "bin"){
+            type = "application/octet-stream";
+            body = event_binary(wanted.spill, wanted.event);
+        }
+        else{
+            show_event(wanted.spill, wanted.event);
+            type = "image/png";
+            body = plot_png(wanted.kind, wanted.width, wanted.height);
+        }
+    }
+    cache_response(wanted.key, type, body);
+    respond(wanted.client, 200, type, body);
+}
+
+void RenderServer::cache_response(QString key, QByteArray type, QByteArray body){
+    response *cached = new response;
+    cached->type = type;
+    cached->body = body;
+    cache.insert(key, cached, body.size() + key.size()*int(sizeof(QChar)));
+    MemoryAccount::Set("Render cache", cache.totalCost());
+}
+
+void RenderServer::respond_cached(QTcpSocket *client, QString key){
+    // only called for keys the cache holds
+    const response *cached = cache.object(key);
+    respond(client, 200, cached->type, cached->body);
+}
+
+void RenderServer::respond(QTcpSocket *client, int status, QByteArray type, QByteArray body){
+    QByteArray reason = status == 200 ? "OK" : status == 400 ? "Bad Request"
+                      : status == 404 ? "Not Found" : "Method Not Allowed";
+    QByteArray header = "HTTP/1.0 " + QByteArray::number(status) + " " + reason + "\r\n"
+            + "Content-Type: " + type + "\r\n"
+            + "Content-Length: " + QByteArray::number(body.size()) + "\r\n"
+            + "Access-Control-Allow-Origin: *\r\n"
+            + "Connection: close\r\n\r\n";
+    client->write(header);
+    client->write(body);
+    client->disconnectFromHost();
+}
+
+void RenderServer::show_event(int spill_number, int event_number){
+    // the graphs hold one event at a time; every plot of it is drawn before the next
+    if(spill_number == shownSpill && event_number == shownEvent){
+        return;
+    }
+    int row = store.Row(spill_number, event_number);
+    display->SetSpecies(row >= 0 ? store.Species(row) : ParticleID::Unknown);
+    display->SetEvent(data[spill_number][event_number], spill_number, event_number);
+    display->SetDerived(store, row);
+    tof_display->SetEvent(store, row);
+    shownSpill = spill_number;
+    shownEvent = event_number;
+}
+
+void RenderServer::update_geometry(){
+    // as MainWindow::update_geometry()
+    display->SetGeometry(settings->GetTOF0Settings(), settings->GetTOF1Settings(),
+                         settings->GetTOF2Settings(), store.TrackerStationZ());
+}
+
+QByteArray RenderServer::info_json(){
+    QJsonObject info;
+    info["file"] = filename;
+    info["indexed"] = loader->HasIndex();
+    QJsonArray spills;
+    foreach(int spill_number, loader->Index().keys()){
+        spills << spill_number;
+    }
+    info["spills"] = spills;
+    info["plots"] = QJsonArray::fromStringList(PlotNames());
+    info["width"] = plotWidth;
+    info["height"] = plotHeight;
+    return QJsonDocument(info).toJson(QJsonDocument::Compact);
+}
+
+QByteArray RenderServer::spill_json(int spill_number){
+    QList<int> events = data.value(spill_number).keys();
+    std::sort(events.begin(), events.end());
+    QJsonArray event_numbers;
+    foreach(int event_number, events){
+        event_numbers << event_number;
+    }
+    QJsonObject spill;
+    spill["spill"] = spill_number;
+    spill["events"] = event_numbers;
+    return QJsonDocument(spill).toJson(QJsonDocument::Compact);
+}
+
+QByteArray RenderServer::event_json(int spill_number, int event_number){
+    const QVector<QVector<double> > &event = data[spill_number][event_number];
+    int row = store.Row(spill_number, event_number);
+    QJsonArray quantities, slots, values;
+    for(int slot = 0; slot < 13; slot++){
+        slots << EventStore::SlotName(slot);
+    }
+    for(int quantity = 0; quantity < event.size(); quantity++){
+        quantities << EventStore::QuantityName(quantity);
+        QJsonArray row_values;
+        for(int slot = 0; slot < event.at(quantity).size(); slot++){
+            double value = event.at(quantity).at(slot);
+            row_values << (value == TMath::Infinity() ? QJsonValue() : QJsonValue(value));
+        }
+        values << row_values;
+    }
+    QJsonObject json;
+    json["spill"] = spill_number;
+    json["event"] = event_number;
+    json["species"] = ParticleID::Name(row >= 0 ? store.Species(row) : ParticleID::Unknown);
+    json["quantities"] = quantities;
+    json["slots"] = slots;
+    json["values"] = values;
+    return QJsonDocument(json).toJson(QJsonDocument::Compact);
+}
+
+QByteArray RenderServer::event_binary(int spill_number, int event_number){
+    const QVector<QVector<double> > &event = data[spill_number][event_number];
+    int row = store.Row(spill_number, event_number);
+    QByteArray bytes;
+    QDataStream stream(&bytes, QIODevice::WriteOnly);
+    stream.setByteOrder(QDataStream::LittleEndian);
+    stream.setFloatingPointPrecision(QDataStream::DoublePrecision);
+    stream << qint32(spill_number) << qint32(event_number)
+           << qint32(row >= 0 ? store.Species(row) : ParticleID::Unknown);
+    for(int quantity = 0; quantity < 7; quantity++){
+        for(int slot = 0; slot < 13; slot++){
+            stream << (quantity < event.size() && slot < event.at(quantity).size()
+                       ? event.at(quantity).at(slot) : TMath::Infinity());
+        }
+    }
+    return bytes;
+}
+
+QByteArray RenderServer::plot_png(QString plot, int width, int height){
+    TRACE_SCOPE("RenderServer::plot_png");
+    QPixmap pixmap = plots.at(PlotNames().indexOf(plot))->toPixmap(width, height);
+    QByteArray png;
+    QBuffer buffer(&png);
+    buffer.open(QIODevice::WriteOnly);
+    pixmap.save(&buffer, "PNG");
+    return png;
+}
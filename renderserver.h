@@ -0,0 +1,115 @@
+#ifndef RENDERSERVER_H
+#define RENDERSERVER_H
+
+#include <QObject>
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <QHostAddress>
+#include <QPointer>
+#include <QCache>
+#include <QHash>
+#include <QList>
+#include <QVector>
+#include <QString>
+#include <QStringList>
+#include "qcustomplot.h"
+#include "eventdisplay.h"
+#include "tofplots.h"
+#include "chunkloader.h"
+#include "eventstore.h"
+#include "particleid.h"
+
+class Settings;
+
+/*
+ * Serves one file's events over HTTP, for viewers that shouldn't each decode the file
+ * themselves (EventViewer --server, see main.cpp).  The file is decoded once, a chunk
+ * at a time, by a ChunkLoader, with the settings the viewer starts with, and the plots
+ * are drawn off-screen by an EventDisplay and TOFPlots of the server's own.
+ *
+ *   GET /                                   the file, its spills and the plot names, JSON
+ *   GET /spill/S.json                       the event numbers of spill S
+ *   GET /event/S/E.json                     event E of spill S: its species and the 7
+ *                                           quantities x 13 slots, null where missing
+ *   GET /event/S/E.bin                      the same, little-endian: int32 spill, event
+ *                                           and species, then 91 float64s, quantity-major
+ *   GET /event/S/E/PLOT.png?width=W&height=H   one of PlotNames() drawn for the event
+ *
+ * Every response is kept in a cache, by path, up to its size in bytes, so however many
+ * clients look at the same events each is only decoded and drawn once.  A request for
+ * an event outside the chunk held waits for its chunk; requests for other chunks wait
+ * their turn.  Connections are closed after each response.
+ */
+class RenderServer : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit RenderServer(QObject *parent = 0);
+    ~RenderServer();
+
+    bool Listen(QHostAddress address, quint16 port, QString *error = 0);
+    quint16 Port() const;
+    void SetFile(QString file);
+    void SetPlotSize(int width, int height);
+    void SetCacheSize(qint64 bytes);
+
+    static QStringList PlotNames();
+
+private slots:
+    void new_connection();
+    void read_request();
+    void client_gone();
+    void chunk_ready(int start_spill);
+
+private:
+    struct request {
+        QPointer<QTcpSocket> client;
+        QString key; // path and size, as cached
+        int spill, event;
+        QString kind; // "spill", "json", "bin" or a plot name
+        int width, height;
+    };
+
+    void handle(QTcpSocket *client, QByteArray target);
+    void serve(const request &wanted);
+    void serve_waiting();
+    void respond(QTcpSocket *client, int status, QByteArray type, QByteArray body);
+    void respond_cached(QTcpSocket *client, QString key);
+    void cache_response(QString key, QByteArray type, QByteArray body);
+
+    int chunk_of(int spill_number);
+    void show_event(int spill_number, int event_number);
+    void update_geometry();
+    QByteArray info_json();
+    QByteArray spill_json(int spill_number);
+    QByteArray event_json(int spill_number, int event_number);
+    QByteArray event_binary(int spill_number, int event_number);
+    QByteArray plot_png(QString plot, int width, int height);
+
+    QTcpServer server;
+    QHash<QTcpSocket*, QByteArray> incoming;
+    QList<request> waiting;
+
+    struct response {
+        QByteArray type, body;
+    };
+    QCache<QString, response> cache;
+
+    Settings *settings;
+    ChunkLoader *loader;
+    QList<QCustomPlot*> plots; // PlotNames() order
+    EventDisplay *display;
+    TOFPlots *tof_display;
+    ParticleID pid;
+
+    QString filename;
+    QHash<int, QHash<int, QVector<QVector<double> > > > data;
+    EventStore store;
+    int chunkStart;
+    bool hasChunk;
+    int shownSpill, shownEvent;
+    int plotWidth, plotHeight;
+};
+
+#endif // RENDERSERVER_H
@@ -0,0 +1,300 @@
+#include "runcomparison.h"
+#include "trace.h"
+#include "TMath.h"
+
+#include <QFuture>
+#include <QList>
+#include <QtConcurrentRun>
+#include <algorithm>
+
+RunComparison::RunComparison()
+{
+    Clear();
+}
+
+RunComparison::~RunComparison(){
+
+}
+
+void RunComparison::Clear(){
+    moments empty;
+    empty.n = 0;
+    empty.mean = 0.0;
+    empty.m2 = 0.0;
+
+    firstEvents = 0;
+    secondEvents = 0;
+    matched = 0;
+    residuals.fill(empty, EventStore::NQuantities*EventStore::NSlots);
+    onlyFirst.fill(0, EventStore::NSlots);
+    onlySecond.fill(0, EventStore::NSlots);
+    differences.clear();
+}
+
+void RunComparison::Compute(const EventStore &first, const EventStore &second){
+    // blocks of the first store's rows, then of the second's, on the global thread pool, merged in order
+    TRACE_SCOPE("RunComparison::Compute");
+    Clear();
+    firstEvents = first.Size();
+    secondEvents = second.Size();
+
+    const int block_size = 4096;
+    QList<QFuture<block_result> > blocks;
+    for(int begin = 0; begin < first.Size(); begin += block_size){
+        blocks << QtConcurrent::run(&RunComparison::compare_block, &first, &second,
+                                    begin, qMin(begin + block_size, first.Size()));
+    }
+    for(int begin = 0; begin < second.Size(); begin += block_size){
+        blocks << QtConcurrent::run(&RunComparison::unmatched_block, &first, &second,
+                                    begin, qMin(begin + block_size, second.Size()));
+    }
+
+    for(int i = 0; i < blocks.size(); i++){
+        block_result block = blocks[i].result();
+        for(int column = 0; column < residuals.size(); column++){
+            merge(residuals[column], block.residuals.at(column));
+        }
+        for(int slot = 0; slot < EventStore::NSlots; slot++){
+            onlyFirst[slot] += block.only_first.at(slot);
+            onlySecond[slot] += block.only_second.at(slot);
+        }
+        matched += block.matched;
+        differences += block.differences;
+    }
+    std::stable_sort(differences.begin(), differences.end(), larger);
+}
+
+RunComparison::block_result RunComparison::compare_block(const EventStore *first, const EventStore *second,
+                                                         int begin, int end){
+    TRACE_SCOPE("RunComparison::compare_block");
+    block_result result;
+    result.residuals.resize(EventStore::NQuantities*EventStore::NSlots);
+    result.only_first.fill(0, EventStore::NSlots);
+    result.only_second.fill(0, EventStore::NSlots);
+    result.matched = 0;
+
+    const double missing = TMath::Infinity();
+    const int n_rows = end - begin;
+
+    // the second store's row for each of ours, both are sorted by (spill, event)
+    QVector<int> other_rows(n_rows);
+    QVector<char> is_matched(n_rows);
+    for(int i = 0; i < n_rows; i++){
+        other_rows[i] = second->Row(first->Spill(begin + i), first->Event(begin + i));
+        is_matched[i] = other_rows.at(i) >= 0;
+        result.matched += is_matched.at(i);
+    }
+
+    // unmatched rows gather as missing, so only is_matched keeps them out of the counts
+    QVector<double> gathered(n_rows), gathered_y(n_rows);
+    const char *matched_row = is_matched.constData();
+
+    for(int quantity = 0; quantity < EventStore::NQuantities; quantity++){
+        for(int slot = 0; slot < EventStore::NSlots; slot++){
+            const double *ours = first->Column(quantity, slot) + begin;
+            const double *theirs = second->Column(quantity, slot);
+            for(int i = 0; i < n_rows; i++){
+                gathered[i] = matched_row[i] ? theirs[other_rows.at(i)] : missing;
+            }
+            const double *other = gathered.constData();
+
+            qint64 count = 0;
+            double sum = 0.0;
+            int only_first = 0, only_second = 0;
+            for(int i = 0; i < n_rows; i++){
+                bool has_ours = ours[i] != missing;
+                bool has_theirs = other[i] != missing;
+                bool both = has_ours && has_theirs;
+                count += both;
+                sum += both ? ours[i] - other[i] : 0.0;
+                only_first += has_ours && !has_theirs; // all of an unmatched event's hits
+                only_second += matched_row[i] && !has_ours && has_theirs;
+            }
+            double mean = count > 0 ? sum/count : 0.0;
+            double m2 = 0.0;
+            for(int i = 0; i < n_rows; i++){
+                double deviation = ours[i] - other[i] - mean;
+                m2 += ours[i] != missing && other[i] != missing ? deviation*deviation : 0.0;
+            }
+
+            moments &block = result.residuals[quantity*EventStore::NSlots + slot];
+            block.n = count;
+            block.mean = mean;
+            block.m2 = m2;
+            if(quantity == 0){
+                // a slot has a hit if it has an x there
+                result.only_first[slot] = only_first;
+                result.only_second[slot] = only_second;
+            }
+        }
+    }
+
+    // per event: slots with a hit in only one file, and the largest (x, y) distance
+    QVector<double> largest(n_rows, 0.0);
+    QVector<int> largest_slot(n_rows, -1);
+    QVector<int> slots_missing(n_rows, 0);
+    for(int slot = 0; slot < EventStore::NSlots; slot++){
+        const double *ours_x = first->Column(0, slot) + begin;
+        const double *ours_y = first->Column(1, slot) + begin;
+        const double *theirs_x = second->Column(0, slot);
+        const double *theirs_y = second->Column(1, slot);
+        for(int i = 0; i < n_rows; i++){
+            gathered[i] = matched_row[i] ? theirs_x[other_rows.at(i)] : missing;
+            gathered_y[i] = matched_row[i] ? theirs_y[other_rows.at(i)] : missing;
+        }
+        const double *other_x = gathered.constData();
+        const double *other_y = gathered_y.constData();
+        for(int i = 0; i < n_rows; i++){
+            bool has_ours = ours_x[i] != missing && ours_y[i] != missing;
+            bool has_theirs = other_x[i] != missing && other_y[i] != missing;
+            slots_missing[i] += matched_row[i] && has_ours != has_theirs;
+            double dx = ours_x[i] - other_x[i];
+            double dy = ours_y[i] - other_y[i];
+            double distance2 = has_ours && has_theirs ? dx*dx + dy*dy : 0.0;
+            bool further = distance2 > largest[i];
+            largest[i] = further ? distance2 : largest[i];
+            largest_slot[i] = further ? slot : largest_slot[i];
+        }
+    }
+
+    for(int i = 0; i < n_rows; i++){
+        if(is_matched.at(i) && slots_missing.at(i) == 0 && largest.at(i) == 0.0){
+            continue;
+        }
+        Difference difference;
+        difference.spill = first->Spill(begin + i);
+        difference.event = first->Event(begin + i);
+        difference.side = is_matched.at(i) ? Both : OnlyFirst;
+        difference.missing = is_matched.at(i) ? slots_missing.at(i) : int(EventStore::NSlots);
+        difference.distance = TMath::Sqrt(largest.at(i));
+        difference.slot = largest_slot.at(i);
+        result.differences << difference;
+    }
+    return result;
+}
+
+RunComparison::block_result RunComparison::unmatched_block(const EventStore *first, const EventStore *second,
+                                                           int begin, int end){
+    // rows begin to end of the second store that the first doesn't have, every hit of them only in the second
+    TRACE_SCOPE("RunComparison::unmatched_block");
+    block_result result;
+    result.residuals.resize(EventStore::NQuantities*EventStore::NSlots);
+    result.only_first.fill(0, EventStore::NSlots);
+    result.only_second.fill(0, EventStore::NSlots);
+    result.matched = 0;
+
+    const double missing = TMath::Infinity();
+    for(int row = begin; row < end; row++){
+        if(first->Row(second->Spill(row), second->Event(row)) >= 0){
+            continue;
+        }
+        for(int slot = 0; slot < EventStore::NSlots; slot++){
+            result.only_second[slot] += second->Value(0, slot, row) != missing;
+        }
+        Difference difference;
+        difference.spill = second->Spill(row);
+        difference.event = second->Event(row);
+        difference.side = OnlySecond;
+        difference.missing = EventStore::NSlots;
+        difference.distance = 0.0;
+        difference.slot = -1;
+        result.differences << difference;
+    }
+    return result;
+}
+
+void RunComparison::merge(moments &total, const moments &block){
+    // combine means and squared deviations of two sets (Chan et al.)
+    if(block.n == 0){
+        return;
+    }
+    if(total.n == 0){
+        total = block;
+        return;
+    }
+    double n_total = total.n;
+    double n_block = block.n;
+    double n = n_total + n_block;
+    double delta = block.mean - total.mean;
+    total.mean += delta*n_block/n;
+    total.m2 += block.m2 + delta*delta*n_total*n_block/n;
+    total.n += block.n;
+}
+
+bool RunComparison::larger(const Difference &a, const Difference &b){
+    if(a.missing != b.missing){
+        return a.missing > b.missing;
+    }
+    return a.distance > b.distance;
+}
+
+int RunComparison::FirstEvents() const{
+    return firstEvents;
+}
+
+int RunComparison::SecondEvents() const{
+    return secondEvents;
+}
+
+int RunComparison::Matched() const{
+    return matched;
+}
+
+int RunComparison::OnlyInFirst(int slot) const{
+    return onlyFirst.at(slot);
+}
+
+int RunComparison::OnlyInSecond(int slot) const{
+    return onlySecond.at(slot);
+}
+
+int RunComparison::Entries(int quantity, int slot) const{
+    return residuals.at(quantity*EventStore::NSlots + slot).n;
+}
+
+double RunComparison::Mean(int quantity, int slot) const{
+    const moments &column = residuals.at(quantity*EventStore::NSlots + slot);
+    return column.n > 0 ? column.mean : TMath::Infinity();
+}
+
+double RunComparison::RMS(int quantity, int slot) const{
+    const moments &column = residuals.at(quantity*EventStore::NSlots + slot);
+    return column.n > 0 ? TMath::Sqrt(column.m2/column.n) : TMath::Infinity();
+}
+
+const QVector<RunComparison::Difference>& RunComparison::Differences() const{
+    return differences;
+}
+
+QString RunComparison::Report(QString first_name, QString second_name) const{
+    // an HTML page for the comparison tab
+    QString report;
+    report += QString("<h3>Events</h3><p>%1 events in %2, %3 in %4: %5 matched by spill and event "
+                      "number, %6 only in the first and %7 only in the second; %8 differ</p>")
+            .arg(firstEvents).arg(first_name.toHtmlEscaped()).arg(secondEvents)
+            .arg(second_name.toHtmlEscaped()).arg(matched).arg(firstEvents - matched)
+            .arg(secondEvents - matched).arg(differences.size());
+
+    report += "<h3>Residuals, first minus second</h3><table border=\"1\" cellpadding=\"3\" cellspacing=\"0\">"
+              "<tr><th></th><th>Only first</th><th>Only second</th>";
+    for(int quantity = 0; quantity < EventStore::NQuantities; quantity++){
+        report += QString("<th>&Delta;%1 mean / RMS</th>").arg(EventStore::QuantityName(quantity));
+    }
+    report += "</tr>";
+    for(int slot = 0; slot < EventStore::NSlots; slot++){
+        report += QString("<tr><td>%1</td><td>%2</td><td>%3</td>")
+                .arg(EventStore::SlotName(slot).toUpper()).arg(OnlyInFirst(slot)).arg(OnlyInSecond(slot));
+        for(int quantity = 0; quantity < EventStore::NQuantities; quantity++){
+            if(Entries(quantity, slot) == 0){
+                report += "<td>-</td>";
+            }
+            else{
+                report += QString("<td>%1 / %2</td>").arg(Mean(quantity, slot), 0, 'g', 3)
+                        .arg(RMS(quantity, slot), 0, 'g', 3);
+            }
+        }
+        report += "</tr>";
+    }
+    report += "</table>";
+    return report;
+}
@@ -0,0 +1,82 @@
+#ifndef RUNCOMPARISON_H
+#define RUNCOMPARISON_H
+
+#include <QVector>
+#include <QString>
+#include "eventstore.h"
+
+/*
+ * Event-by-event differences between two reconstructions of the same run, e.g. with
+ * two MAUS versions.  Events are matched by spill number and recon event number.
+ *
+ * For every slot, Compute() counts the events with a hit in only one of the two, events
+ * that only one file has counting with all their hits, and takes the mean and RMS of
+ * the residual (first minus second) of each quantity over the events with a hit in
+ * both.  Every event that differs at all is listed by Differences(), the largest first:
+ * the most slots with a hit in only one file, then the largest transverse (x, y)
+ * distance between the two hits at any slot.  Events only in one of the stores come
+ * first, as if every slot differed, with side saying which.
+ *
+ * Like RunSummary, this is a pass over blocks of the first store's rows in parallel on
+ * the global thread pool.  Each block looks its rows up in the second store, gathers
+ * that store's columns into buffers in the same order, and then takes the residuals
+ * over both as flat arrays, with missing values masked out by selects.  A second pass
+ * over blocks of the second store's rows picks up the events the first doesn't have.
+ */
+class RunComparison
+{
+public:
+    enum Side { Both = 0, OnlyFirst = 1, OnlySecond = 2 };
+
+    struct Difference {
+        int spill, event;
+        int side;        // which files have the event
+        int missing;     // slots with a hit in only one file, NSlots for an unmatched event
+        double distance; // mm, the largest transverse distance at any slot
+        int slot;        // where that was, -1 if nowhere
+    };
+
+    RunComparison();
+    ~RunComparison();
+
+    void Compute(const EventStore &first, const EventStore &second);
+    void Clear();
+
+    int FirstEvents() const;
+    int SecondEvents() const;
+    int Matched() const;
+    int OnlyInFirst(int slot) const;
+    int OnlyInSecond(int slot) const;
+    int Entries(int quantity, int slot) const;
+    double Mean(int quantity, int slot) const;
+    double RMS(int quantity, int slot) const;
+    const QVector<Difference>& Differences() const;
+
+    QString Report(QString first_name, QString second_name) const;
+
+private:
+    struct moments {
+        qint64 n;
+        double mean;
+        double m2; // sum of squared deviations from the mean
+    };
+
+    struct block_result {
+        QVector<moments> residuals; // [quantity*NSlots + slot]
+        QVector<int> only_first, only_second; // per slot
+        int matched;
+        QVector<Difference> differences;
+    };
+
+    static block_result compare_block(const EventStore *first, const EventStore *second, int begin, int end);
+    static block_result unmatched_block(const EventStore *first, const EventStore *second, int begin, int end);
+    static void merge(moments &total, const moments &block);
+    static bool larger(const Difference &a, const Difference &b);
+
+    int firstEvents, secondEvents, matched;
+    QVector<moments> residuals;
+    QVector<int> onlyFirst, onlySecond;
+    QVector<Difference> differences;
+};
+
+#endif // RUNCOMPARISON_H
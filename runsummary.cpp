@@ -0,0 +1,289 @@
+#include "runsummary.h"
+#include "trace.h"
+#include "TMath.h"
+
+#include <QFuture>
+#include <QList>
+#include <QtConcurrentRun>
+
+const double RunSummary::tofLow = 0.0;    // ns
+const double RunSummary::tofHigh = 100.0; // ns
+
+RunSummary::RunSummary()
+{
+    Clear();
+}
+
+RunSummary::~RunSummary(){
+
+}
+
+void RunSummary::Clear(){
+    moments empty;
+    empty.n = 0;
+    empty.mean = 0.0;
+    empty.m2 = 0.0;
+
+    events = 0;
+    spills.clear();
+    columns.fill(empty, EventStore::NQuantities*EventStore::NSlots);
+    hits.fill(0, EventStore::NSlots);
+    tof.fill(QVector<int>(tofBins, 0), NTOFPairs);
+}
+
+void RunSummary::Compute(const EventStore &store){
+    /*
+     * Split the rows into blocks and summarise them on the global thread pool, then
+     * merge the blocks in order, which keeps the spills in order too.
+     */
+    TRACE_SCOPE("RunSummary::Compute");
+    Clear();
+    events = store.Size();
+
+    const int block_size = 4096;
+    QList<QFuture<block_result> > blocks;
+    for(int begin = 0; begin < store.Size(); begin += block_size){
+        blocks << QtConcurrent::run(&RunSummary::summarise_block, &store,
+                                    begin, qMin(begin + block_size, store.Size()));
+    }
+
+    for(int i = 0; i < blocks.size(); i++){
+        block_result block = blocks[i].result();
+        for(int column = 0; column < columns.size(); column++){
+            merge(columns[column], block.columns.at(column));
+        }
+        for(int slot = 0; slot < EventStore::NSlots; slot++){
+            hits[slot] += block.hits.at(slot);
+        }
+        for(int pair = 0; pair < NTOFPairs; pair++){
+            for(int bin = 0; bin < tofBins; bin++){
+                tof[pair][bin] += block.tof.at(pair).at(bin);
+            }
+        }
+        // a spill can straddle two blocks
+        int first = 0;
+        if(!spills.isEmpty() && !block.spills.isEmpty() && spills.last().first == block.spills.first().first){
+            spills.last().second += block.spills.first().second;
+            first = 1;
+        }
+        spills += block.spills.mid(first);
+    }
+}
+
+RunSummary::block_result RunSummary::summarise_block(const EventStore *store, int begin, int end){
+    TRACE_SCOPE("RunSummary::summarise_block");
+    block_result result;
+    result.columns.resize(EventStore::NQuantities*EventStore::NSlots);
+    result.hits.resize(EventStore::NSlots);
+    result.tof.fill(QVector<int>(tofBins, 0), NTOFPairs);
+
+    const double missing = TMath::Infinity();
+    const int n_rows = end - begin;
+
+    for(int quantity = 0; quantity < EventStore::NQuantities; quantity++){
+        for(int slot = 0; slot < EventStore::NSlots; slot++){
+            /*
+             * Two passes over the block, which is still in cache for the second: count and
+             * sum, then sum the squared deviations from the block mean.  Missing values are
+             * masked out with a select rather than skipped with a branch, and counted in a
+             * double like the sum, see eventviewer.pri.
+             */
+            const double *column = store->Column(quantity, slot) + begin;
+            double count = 0.0;
+            double sum = 0.0;
+            for(int i = 0; i < n_rows; i++){
+                bool valid = column[i] != missing;
+                count += valid ? 1.0 : 0.0;
+                sum += valid ? column[i] : 0.0;
+            }
+            double mean = count > 0 ? sum/count : 0.0;
+            double m2 = 0.0;
+            for(int i = 0; i < n_rows; i++){
+                double deviation = column[i] - mean;
+                m2 += column[i] != missing ? deviation*deviation : 0.0;
+            }
+
+            moments &block = result.columns[quantity*EventStore::NSlots + slot];
+            block.n = qint64(count);
+            block.mean = mean;
+            block.m2 = m2;
+        }
+    }
+
+    // an event has a hit at a slot if it has a z there
+    for(int slot = 0; slot < EventStore::NSlots; slot++){
+        result.hits[slot] = result.columns.at(2*EventStore::NSlots + slot).n;
+    }
+
+    // the pairs in EventStore::EventColumns order
+    const double bin_width = (tofHigh - tofLow)/tofBins;
+    for(int pair = 0; pair < NTOFPairs; pair++){
+        const double *tof = store->EventColumn(pair) + begin;
+        QVector<int> &histogram = result.tof[pair];
+        for(int i = 0; i < n_rows; i++){
+            if(tof[i] == missing){
+                continue;
+            }
+            double bin = (tof[i] - tofLow)/bin_width;
+            if(bin >= 0 && bin < tofBins){
+                histogram[int(bin)]++;
+            }
+        }
+    }
+
+    for(int row = begin; row < end; row++){
+        int spill_number = store->Spill(row);
+        if(!result.spills.isEmpty() && result.spills.last().first == spill_number){
+            result.spills.last().second++;
+        }
+        else{
+            result.spills << qMakePair(spill_number, 1);
+        }
+    }
+
+    return result;
+}
+
+void RunSummary::merge(moments &total, const moments &block){
+    // combine means and squared deviations of two sets (Chan et al.)
+    if(block.n == 0){
+        return;
+    }
+    if(total.n == 0){
+        total = block;
+        return;
+    }
+    double n_total = total.n;
+    double n_block = block.n;
+    double n = n_total + n_block;
+    double delta = block.mean - total.mean;
+    total.mean += delta*n_block/n;
+    total.m2 += block.m2 + delta*delta*n_total*n_block/n;
+    total.n += block.n;
+}
+
+int RunSummary::Events() const{
+    return events;
+}
+
+int RunSummary::Spills() const{
+    return spills.size();
+}
+
+double RunSummary::MeanEventsPerSpill() const{
+    return spills.isEmpty() ? 0.0 : double(events)/spills.size();
+}
+
+int RunSummary::MinEventsPerSpill() const{
+    int minimum = spills.isEmpty() ? 0 : spills.first().second;
+    for(int i = 1; i < spills.size(); i++){
+        minimum = qMin(minimum, spills.at(i).second);
+    }
+    return minimum;
+}
+
+int RunSummary::MaxEventsPerSpill() const{
+    int maximum = 0;
+    for(int i = 0; i < spills.size(); i++){
+        maximum = qMax(maximum, spills.at(i).second);
+    }
+    return maximum;
+}
+
+double RunSummary::Efficiency(int slot) const{
+    return events > 0 ? double(hits.at(slot))/events : 0.0;
+}
+
+int RunSummary::Entries(int quantity, int slot) const{
+    return columns.at(quantity*EventStore::NSlots + slot).n;
+}
+
+double RunSummary::Mean(int quantity, int slot) const{
+    const moments &column = columns.at(quantity*EventStore::NSlots + slot);
+    return column.n > 0 ? column.mean : TMath::Infinity();
+}
+
+double RunSummary::RMS(int quantity, int slot) const{
+    const moments &column = columns.at(quantity*EventStore::NSlots + slot);
+    return column.n > 0 ? TMath::Sqrt(column.m2/column.n) : TMath::Infinity();
+}
+
+int RunSummary::TOFEntries(int pair) const{
+    int entries = 0;
+    for(int bin = 0; bin < tofBins; bin++){
+        entries += tof.at(pair).at(bin);
+    }
+    return entries;
+}
+
+double RunSummary::TOFPeak(int pair) const{
+    /*
+     * Highest bin of the time-of-flight histogram, refined by the mean of the bins
+     * either side of it.
+     */
+    const QVector<int> &histogram = tof.at(pair);
+    int peak = 0;
+    for(int bin = 1; bin < tofBins; bin++){
+        if(histogram.at(bin) > histogram.at(peak)){
+            peak = bin;
+        }
+    }
+    if(histogram.at(peak) == 0){
+        return TMath::Infinity();
+    }
+
+    const double bin_width = (tofHigh - tofLow)/tofBins;
+    double sum = 0.0, weights = 0.0;
+    for(int bin = qMax(0, peak - 3); bin <= qMin(tofBins - 1, peak + 3); bin++){
+        sum += histogram.at(bin)*(tofLow + (bin + 0.5)*bin_width);
+        weights += histogram.at(bin);
+    }
+    return sum/weights;
+}
+
+QString RunSummary::TOFPairName(int pair){
+    const char *names[NTOFPairs] = {"TOF0 to TOF1", "TOF0 to TOF2", "TOF1 to TOF2"};
+    return pair >= 0 && pair < NTOFPairs ? names[pair] : "";
+}
+
+QString RunSummary::Report() const{
+    // an HTML page for the summary tab
+    QString report;
+    report += QString("<h3>Events</h3><p>%1 events in %2 spills: %3 per spill on average "
+                      "(fewest %4, most %5)</p>")
+            .arg(events).arg(Spills()).arg(MeanEventsPerSpill(), 0, 'f', 1)
+            .arg(MinEventsPerSpill()).arg(MaxEventsPerSpill());
+
+    report += "<h3>Time of flight</h3><table border=\"1\" cellpadding=\"3\" cellspacing=\"0\">"
+              "<tr><th></th><th>Events</th><th>Peak (ns)</th></tr>";
+    for(int pair = 0; pair < NTOFPairs; pair++){
+        double peak = TOFPeak(pair);
+        report += QString("<tr><td>%1</td><td>%2</td><td>%3</td></tr>")
+                .arg(TOFPairName(pair)).arg(TOFEntries(pair))
+                .arg(peak == TMath::Infinity() ? QString("-") : QString::number(peak, 'f', 2));
+    }
+    report += "</table>";
+
+    report += "<h3>Detectors</h3><table border=\"1\" cellpadding=\"3\" cellspacing=\"0\">"
+              "<tr><th></th><th>Efficiency</th>";
+    for(int quantity = 0; quantity < EventStore::NQuantities; quantity++){
+        report += QString("<th>%1 mean / RMS</th>").arg(EventStore::QuantityName(quantity));
+    }
+    report += "</tr>";
+    for(int slot = 0; slot < EventStore::NSlots; slot++){
+        report += QString("<tr><td>%1</td><td>%2%</td>")
+                .arg(EventStore::SlotName(slot).toUpper()).arg(100.0*Efficiency(slot), 0, 'f', 1);
+        for(int quantity = 0; quantity < EventStore::NQuantities; quantity++){
+            if(Entries(quantity, slot) == 0){
+                report += "<td>-</td>";
+            }
+            else{
+                report += QString("<td>%1 / %2</td>").arg(Mean(quantity, slot), 0, 'f', 2)
+                        .arg(RMS(quantity, slot), 0, 'f', 2);
+            }
+        }
+        report += "</tr>";
+    }
+    report += "</table>";
+    return report;
+}
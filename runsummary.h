@@ -0,0 +1,75 @@
+#ifndef RUNSUMMARY_H
+#define RUNSUMMARY_H
+
+#include <QVector>
+#include <QPair>
+#include <QString>
+#include "eventstore.h"
+
+/*
+ * Run-level numbers for the events in an EventStore: events per spill, the fraction
+ * of events with a hit at each detector slot, the mean and RMS of every quantity at
+ * every slot, and the peak of each time-of-flight distribution.
+ *
+ * Compute() makes a single pass over the store's columns, split into blocks of rows
+ * that are summarised in parallel on the global thread pool.  Each block keeps its own
+ * counts, means and sums of squared deviations (so large offsets like z don't lose
+ * precision), and the blocks are merged in order at the end.
+ */
+class RunSummary
+{
+public:
+    static const int NTOFPairs = EventStore::NEventColumns; // TOF0->TOF1, TOF0->TOF2, TOF1->TOF2
+
+    RunSummary();
+    ~RunSummary();
+
+    void Compute(const EventStore &store);
+    void Clear();
+
+    int Events() const;
+    int Spills() const;
+    double MeanEventsPerSpill() const;
+    int MinEventsPerSpill() const;
+    int MaxEventsPerSpill() const;
+
+    double Efficiency(int slot) const;
+    int Entries(int quantity, int slot) const;
+    double Mean(int quantity, int slot) const;
+    double RMS(int quantity, int slot) const;
+
+    double TOFPeak(int pair) const;
+    int TOFEntries(int pair) const;
+    static QString TOFPairName(int pair);
+
+    QString Report() const;
+
+private:
+    struct moments {
+        qint64 n;
+        double mean;
+        double m2; // sum of squared deviations from the mean
+    };
+
+    struct block_result {
+        QVector<moments> columns;       // [quantity*NSlots + slot]
+        QVector<qint64> hits;           // events with a hit, per slot
+        QVector<QVector<int> > tof;     // histograms, per TOF pair
+        QVector<QPair<int, int> > spills; // (spill, events), in row order
+    };
+
+    static block_result summarise_block(const EventStore *store, int begin, int end);
+    static void merge(moments &total, const moments &block);
+
+    static const int tofBins = 1000;
+    static const double tofLow;
+    static const double tofHigh;
+
+    int events;
+    QVector<QPair<int, int> > spills;
+    QVector<moments> columns;
+    QVector<qint64> hits;
+    QVector<QVector<int> > tof;
+};
+
+#endif // RUNSUMMARY_H
@@ -1,11 +1,15 @@
 #include "settings.h"
 #include "ui_settings.h"
 
+#include <QFileDialog>
+#include <QMessageBox>
+
 Settings::Settings(QWidget *parent) :
     QDialog(parent),
     ui(new Ui::Settings)
 {
     ui->setupUi(this);
+    setup_ui();
 }
 
 Settings::~Settings()
@@ -73,6 +77,36 @@ int Settings::GetSpillRange(){
     return ui->int_spillChunkSize->value();
 }
 
+qint64 Settings::GetMemoryBudget(){
+    // bytes, 0 for no budget
+    return qint64(ui->int_memoryBudget->value())*1024*1024;
+}
+
+bool Settings::GetResidentRun(){
+    return ui->check_residentRun->isChecked();
+}
+
+QVector<double> Settings::GetTrackerFields(){
+    // solenoid field in TKU and TKD (T), for drawing helical tracks
+    QVector<double> values;
+    values << ui->tku_field->value() << ui->tkd_field->value();
+    return values;
+}
+
+QVector<double> Settings::GetParticleIDCuts(){
+    // in the order ParticleID::SetCuts() takes them
+    QVector<double> values;
+    values << ui->pid_electronLow->value() << ui->pid_electronHigh->value()
+           << ui->pid_muonLow->value() << ui->pid_muonHigh->value()
+           << ui->pid_pionLow->value() << ui->pid_pionHigh->value()
+           << ui->pid_momentumLoss->value();
+    return values;
+}
+
+int Settings::GetCharge(){
+    return ui->combo_charge->currentIndex() == 0 ? 1 : -1;
+}
+
 void Settings::setup_ui(){
     connect(ui->radio_tkd_customOffsets, SIGNAL(clicked()), SLOT(select_tkd_settings()));
     connect(ui->radio_tkd_offsetsFromMAUS, SIGNAL(clicked()), SLOT(select_tkd_settings()));
@@ -88,6 +122,60 @@ void Settings::setup_ui(){
 
     connect(ui->radio_tof2_customOffsets, SIGNAL(clicked()), SLOT(select_tof2_settings()));
     connect(ui->radio_tof2_offsetsFromMAUS, SIGNAL(clicked()), SLOT(select_tof2_settings()));
+
+    connect(ui->btn_fitAlignment, SIGNAL(clicked()), SIGNAL(AlignmentRequested()));
+    connect(ui->btn_applyAlignment, SIGNAL(clicked()), SLOT(apply_alignment()));
+
+    connect(ui->btn_browseTOFCalibration, SIGNAL(clicked()), SLOT(browse_tof_calibration()));
+    connect(ui->btn_fitTOFCalibration, SIGNAL(clicked()), SIGNAL(TOFCalibrationRequested()));
+    connect(ui->btn_saveTOFCalibration, SIGNAL(clicked()), SLOT(save_tof_calibration()));
+}
+
+void Settings::SetAlignmentProposal(QVector<QVector<double> > locations, QString report){
+    // locations as from the Get*Settings() functions: TOF0, TOF1, TKU, TKD, TOF2
+    alignmentProposal = locations;
+    ui->text_alignment->setHtml(report);
+    ui->btn_applyAlignment->setEnabled(alignmentProposal.size() == 5);
+}
+
+void Settings::SetAlignmentStatus(QString status){
+    alignmentProposal.clear();
+    ui->text_alignment->setPlainText(status);
+    ui->btn_applyAlignment->setEnabled(false);
+}
+
+void Settings::apply_alignment(){
+    /*
+     * Copy the proposed x and y offsets into the detector fields.  z is left as it is,
+     * and nothing takes effect until the dialog is accepted.
+     */
+    if(alignmentProposal.size() != 5){
+        return;
+    }
+    ui->radio_tof0_customOffsets->setChecked(true);
+    ui->tof0_xOffset->setValue(alignmentProposal.at(0).at(0));
+    ui->tof0_yOffset->setValue(alignmentProposal.at(0).at(1));
+    select_tof0_settings();
+
+    ui->radio_tof1_customOffsets->setChecked(true);
+    ui->tof1_xOffset->setValue(alignmentProposal.at(1).at(0));
+    ui->tof1_yOffset->setValue(alignmentProposal.at(1).at(1));
+    select_tof1_settings();
+
+    ui->radio_tku_customOffsets->setChecked(true);
+    ui->tku_xOffset->setValue(alignmentProposal.at(2).at(0));
+    ui->tku_yOffset->setValue(alignmentProposal.at(2).at(1));
+    select_tku_settings();
+
+    ui->radio_tkd_customOffsets->setChecked(true);
+    ui->tkd_xOffset->setValue(alignmentProposal.at(3).at(0));
+    ui->tkd_yOffset->setValue(alignmentProposal.at(3).at(1));
+    select_tkd_settings();
+
+    ui->radio_tof2_customOffsets->setChecked(true);
+    ui->tof2_xOffset->setValue(alignmentProposal.at(4).at(0));
+    ui->tof2_yOffset->setValue(alignmentProposal.at(4).at(1));
+    select_tof2_settings();
 }
 
 void Settings::select_tkd_settings(){
@@ -154,3 +242,42 @@ void Settings::select_tof2_settings(){
         ui->tof2_zPosition->setEnabled(false);
     }
 }
+
+QString Settings::GetTOFCalibrationFile(){
+    return ui->line_tofCalibration->text().trimmed();
+}
+
+void Settings::SetTOFCalibrationProposal(TOFCalibration calibration, QString report){
+    calibrationProposal = calibration;
+    ui->text_tofCalibration->setHtml(report);
+    ui->btn_saveTOFCalibration->setEnabled(!calibrationProposal.IsEmpty());
+}
+
+void Settings::SetTOFCalibrationStatus(QString status){
+    calibrationProposal = TOFCalibration();
+    ui->text_tofCalibration->setPlainText(status);
+    ui->btn_saveTOFCalibration->setEnabled(false);
+}
+
+void Settings::browse_tof_calibration(){
+    QString file = QFileDialog::getOpenFileName(this, tr("TOF calibration"), GetTOFCalibrationFile(),
+                                                tr("Calibration Files (*.txt);;All Files (*)"));
+    if(!file.isEmpty()){
+        ui->line_tofCalibration->setText(file);
+    }
+}
+
+void Settings::save_tof_calibration(){
+    // the saved table becomes the one in use once the dialog is accepted
+    QString file = QFileDialog::getSaveFileName(this, tr("Save TOF calibration"), GetTOFCalibrationFile(),
+                                                tr("Calibration Files (*.txt);;All Files (*)"));
+    if(file.isEmpty()){
+        return;
+    }
+    if(calibrationProposal.Save(file)){
+        ui->line_tofCalibration->setText(file);
+    }
+    else{
+        QMessageBox::warning(this, tr("Save TOF calibration"), tr("Couldn't write %1").arg(file));
+    }
+}
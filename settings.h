@@ -4,6 +4,7 @@
 #include <QDialog>
 #include <QVector>
 #include <TMath.h>
+#include "tofcalibration.h"
 
 namespace Ui {
 class Settings;
@@ -23,8 +24,22 @@ public:
     QVector<double> GetTOF2Settings();
 
     int GetSpillRange();
+    qint64 GetMemoryBudget();
+    bool GetResidentRun();
+    QVector<double> GetTrackerFields();
+    int GetCharge();
+    QVector<double> GetParticleIDCuts();
 
+    void SetAlignmentProposal(QVector<QVector<double> > locations, QString report);
+    void SetAlignmentStatus(QString status);
 
+    QString GetTOFCalibrationFile();
+    void SetTOFCalibrationProposal(TOFCalibration calibration, QString report);
+    void SetTOFCalibrationStatus(QString status);
+
+signals:
+    void AlignmentRequested();
+    void TOFCalibrationRequested();
 
 public slots:
     void select_tof0_settings();
@@ -32,10 +47,15 @@ public slots:
     void select_tof2_settings();
     void select_tku_settings();
     void select_tkd_settings();
+    void apply_alignment();
+    void browse_tof_calibration();
+    void save_tof_calibration();
 
 private:
     Ui::Settings *ui;
     void setup_ui();
+    QVector<QVector<double> > alignmentProposal;
+    TOFCalibration calibrationProposal;
 };
 
 #endif // SETTINGS_H
@@ -0,0 +1,560 @@
+#include "syntheticsource.h"
+#include "trace.h"
+#include "TMath.h"
+
+#include <QStringList>
+
+namespace {
+
+// where the made-up detectors really are, whatever the Settings window says
+const double tof_z[TOFCalibration::NTOFs] = {5285.66, 12922.00, 21127.27};
+// by station: station 1 of both trackers is at the absorber end, as in MAUS
+const double tracker_z[2][5] = {{15068.0, 14718.0, 14418.0, 14168.0, 13968.0},
+                                {18850.0, 19200.0, 19500.0, 19750.0, 19950.0}};
+const double slab_width[TOFCalibration::NTOFs] = {40.0, 60.0, 60.0}; // mm
+
+// where each TOF is among the detector locations, and its slot in an event
+const int location_index[TOFCalibration::NTOFs] = {0, 1, 4};
+const int tof_slot[TOFCalibration::NTOFs] = {0, 1, 12};
+
+const double field = 3.0;                    // T, both trackers
+const double speed_of_light = 0.299792458;   // MeV/c per T per mm, and m per ns
+const double tracker_radius = 150.0;         // mm
+const double tof_time_resolution = 0.06;     // ns
+const double tof_position_resolution = 10.0; // mm, from the slab time difference
+const double tracker_position_resolution = 0.5; // mm
+const double absorber_loss = 10.0;           // MeV/c
+const double absorber_scattering = 0.01;     // rad
+
+const double electron_mass = 0.511, muon_mass = 105.66, pion_mass = 139.57; // MeV/c^2
+
+int station_along_beam(int tracker, int step){
+    // the station a particle reaches step-th, TKU being numbered against the beam
+    return tracker == 0 ? 4 - step : step;
+}
+
+}
+
+class SyntheticSource::random_stream
+{
+    /*
+     * splitmix64, so that a seed gives the same numbers on every platform, which the
+     * standard library's distributions don't promise.
+     */
+public:
+    explicit random_stream(quint64 seed) : state(seed) {}
+
+    quint64 next(){
+        quint64 z = (state += Q_UINT64_C(0x9E3779B97F4A7C15));
+        z = (z ^ (z >> 30))*Q_UINT64_C(0xBF58476D1CE4E5B9);
+        z = (z ^ (z >> 27))*Q_UINT64_C(0x94D049BB133111EB);
+        return z ^ (z >> 31);
+    }
+
+    double uniform(){
+        // [0, 1), from the top 53 bits
+        return (next() >> 11)*(1.0/9007199254740992.0);
+    }
+
+    double gaus(double mean, double sigma){
+        double u1 = 1.0 - uniform();
+        double u2 = uniform();
+        return mean + sigma*TMath::Sqrt(-2.0*TMath::Log(u1))*TMath::Cos(2.0*TMath::Pi()*u2);
+    }
+
+    int poisson(double mean){
+        if(mean <= 0){
+            return 0;
+        }
+        double limit = TMath::Exp(-mean);
+        double product = uniform();
+        int n = 0;
+        while(product > limit){
+            product *= uniform();
+            n++;
+        }
+        return n;
+    }
+
+private:
+    quint64 state;
+};
+
+namespace {
+
+double energy_of(double px, double py, double pz, double mass){
+    return TMath::Sqrt(px*px + py*py + pz*pz + mass*mass);
+}
+
+}
+
+SyntheticSource::Config::Config(){
+    spills = 200;
+    first_spill = 1;
+    events = 40.0;
+    spread = 0.2;
+    seed = 1;
+    tof_efficiency = 0.98;
+    tracker_efficiency = 0.95;
+    noise = 0.05;
+    ghosts = 0.02;
+}
+
+SyntheticSource::SyntheticSource()
+{
+    // the same defaults as ReadMAUS::initialise_detector_positions()
+    QVector<double> tof0_location, tof1_location, tof2_location, no_offset;
+    tof0_location << 0.0 << 0.0 << tof_z[0];
+    tof1_location << 0.0 << 0.0 << tof_z[1];
+    tof2_location << 0.0 << 0.0 << tof_z[2];
+    no_offset << 0.0 << 0.0 << 0.0;
+    SetDetectorPositions(tof0_location, tof1_location, no_offset, no_offset, tof2_location);
+
+    spillRange = 2000;
+    spillBegin = 0;
+    spillEnd = spillBegin + spillRange;
+    cancelFlag = NULL;
+    recordSlabTimes = false;
+    timeStages = false;
+    tofTime = 0;
+    trackerTime = 0;
+}
+
+SyntheticSource::~SyntheticSource(){
+
+}
+
+QString SyntheticSource::Scheme(){
+    return "synthetic:";
+}
+
+SyntheticSource::Config SyntheticSource::Parse(QString file, QString *error){
+    /*
+     * The run a name describes; anything wrong with the name is put in error, and
+     * the defaults are kept for it.
+     */
+    Config parsed;
+    QString problem;
+    if(!file.startsWith(Scheme())){
+        problem = QString("%1 is not a synthetic run").arg(file);
+    }
+
+    QStringList options = file.mid(Scheme().size()).split(',', QString::SkipEmptyParts);
+    for(int i = 0; i < options.size() && problem.isEmpty(); i++){
+        QStringList pair = options.at(i).split('=');
+        bool ok = pair.size() == 2;
+        double value = ok ? pair.at(1).trimmed().toDouble(&ok) : 0.0;
+        QString key = pair.at(0).trimmed();
+        if(!ok){
+            problem = QString("expected key=number, not \"%1\"").arg(options.at(i));
+        }
+        else if(key == "spills" && value >= 0){
+            parsed.spills = int(value);
+        }
+        else if(key == "first"){
+            parsed.first_spill = int(value);
+        }
+        else if(key == "events" && value >= 0){
+            parsed.events = value;
+        }
+        else if(key == "spread" && value >= 0){
+            parsed.spread = value;
+        }
+        else if(key == "seed" && value >= 0){
+            parsed.seed = quint64(value);
+        }
+        else if(key == "tof" && value >= 0 && value <= 1){
+            parsed.tof_efficiency = value;
+        }
+        else if(key == "tracker" && value >= 0 && value <= 1){
+            parsed.tracker_efficiency = value;
+        }
+        else if(key == "noise" && value >= 0){
+            parsed.noise = value;
+        }
+        else if(key == "ghosts" && value >= 0){
+            parsed.ghosts = value;
+        }
+        else{
+            problem = QString("unknown key or value out of range: \"%1\"").arg(options.at(i));
+        }
+    }
+
+    if(error != 0){
+        *error = problem;
+    }
+    return problem.isEmpty() ? parsed : Config();
+}
+
+QString SyntheticSource::Name(const Config &config){
+    return Scheme() + QString("spills=%1,first=%2,events=%3,spread=%4,seed=%5,tof=%6,tracker=%7,noise=%8,ghosts=%9")
+            .arg(config.spills).arg(config.first_spill).arg(config.events).arg(config.spread)
+            .arg(config.seed).arg(config.tof_efficiency).arg(config.tracker_efficiency)
+            .arg(config.noise).arg(config.ghosts);
+}
+
+bool SyntheticSource::open(QString file){
+    // parse the name once, along with the run's slab offsets, which only the seed decides
+    if(file == name && !name.isEmpty()){
+        return true;
+    }
+    QString error;
+    Config parsed = Parse(file, &error);
+    if(!error.isEmpty()){
+        name.clear();
+        return false;
+    }
+    name = file;
+    config = parsed;
+
+    random_stream random(config.seed ^ Q_UINT64_C(0x5DEECE66D));
+    trueOffsets.fill(0.0, TOFCalibration::NTOFs*2*10);
+    for(int i = 0; i < trueOffsets.size(); i++){
+        trueOffsets[i] = random.gaus(0.0, 300.0);
+    }
+    return true;
+}
+
+void SyntheticSource::SetDetectorPositions(QVector<double> tof0_location, QVector<double> tof1_location,
+                                           QVector<double> tku_location, QVector<double> tkd_location,
+                                           QVector<double> tof2_location){
+    // as ReadMAUS: (x, y) offsets for all, and z for the TOFs but a z offset for the trackers
+    locations.clear();
+    locations << tof0_location << tof1_location << tku_location << tkd_location << tof2_location;
+}
+
+void SyntheticSource::SetSpillRange(int spill_range){
+    spillRange = spill_range;
+    spillEnd = spillBegin + spillRange;
+}
+
+void SyntheticSource::SetStartingSpill(int start_spill){
+    spillBegin = start_spill;
+    spillEnd = spillBegin + spillRange;
+}
+
+void SyntheticSource::SetCancelFlag(QAtomicInt *cancel_flag){
+    cancelFlag = cancel_flag;
+}
+
+void SyntheticSource::SetTOFCalibration(const TOFCalibration &tof_calibration){
+    calibration = tof_calibration;
+}
+
+void SyntheticSource::SetRecordSlabTimes(bool record){
+    recordSlabTimes = record;
+}
+
+QVector<SyntheticSource::SlabTime> SyntheticSource::SlabTimes(){
+    return slab_times;
+}
+
+void SyntheticSource::SetTimeStages(bool time_stages){
+    timeStages = time_stages;
+}
+
+QVector<SyntheticSource::SpillTiming> SyntheticSource::StageTimings(){
+    return spill_timings;
+}
+
+bool SyntheticSource::cancelled(){
+    return cancelFlag != NULL && cancelFlag->load() != 0;
+}
+
+QHash<int, QHash<int, QVector<QVector<double> > > > SyntheticSource::Read(QString fileToOpen){
+    particles_in_spill.clear();
+    slab_times.clear();
+    spill_timings.clear();
+    if(!open(fileToOpen)){
+        return particles_in_spill;
+    }
+
+    int first = qMax(spillBegin, config.first_spill);
+    int last = qMin(spillEnd, config.first_spill + config.spills);
+    for(int spill_number = first; spill_number < last && !cancelled(); spill_number++){
+        add_spill(spill_number);
+    }
+    return particles_in_spill;
+}
+
+QHash<int, QHash<int, QVector<QVector<double> > > > SyntheticSource::ReadEntries(QString fileToOpen,
+                                                                                 QVector<Long64_t> entries){
+    // an entry is a spill's position in the run; as ReadMAUS, the spill range isn't applied
+    particles_in_spill.clear();
+    slab_times.clear();
+    spill_timings.clear();
+    if(!open(fileToOpen)){
+        return particles_in_spill;
+    }
+
+    for(int i = 0; i < entries.size() && !cancelled(); i++){
+        if(entries.at(i) >= 0 && entries.at(i) < config.spills){
+            add_spill(config.first_spill + int(entries.at(i)));
+        }
+    }
+    return particles_in_spill;
+}
+
+QMap<int, Long64_t> SyntheticSource::IndexSpills(QString fileToOpen){
+    QMap<int, Long64_t> index;
+    if(!open(fileToOpen)){
+        return index;
+    }
+    for(int entry = 0; entry < config.spills; entry++){
+        index.insert(config.first_spill + entry, entry);
+    }
+    return index;
+}
+
+void SyntheticSource::add_spill(int spill_number){
+    TRACE_SCOPE("SyntheticSource::add_spill");
+    QElapsedTimer spill_timer;
+    spill_timer.start();
+    tofTime = 0;
+    trackerTime = 0;
+
+    random_stream random(config.seed*Q_UINT64_C(0xD1B54A32D192ED03) ^ quint64(spill_number));
+    int n_events = qMax(0, int(TMath::Nint(random.gaus(config.events, config.spread*config.events))));
+
+    QHash<int, QVector<QVector<double> > > particles_in_event;
+    particles_in_event.reserve(n_events);
+    for(int event_number = 0; event_number < n_events; event_number++){
+        particles_in_event.insert(event_number, make_event(random, spill_number, event_number));
+    }
+    particles_in_spill.insert(spill_number, particles_in_event);
+
+    if(timeStages){
+        SpillTiming timing;
+        timing.spill = spill_number;
+        timing.events = n_events;
+        timing.read_ns = spill_timer.nsecsElapsed();
+        timing.tof_ns = tofTime;
+        timing.tracker_ns = trackerTime;
+        spill_timings << timing;
+    }
+}
+
+namespace {
+
+void drift(double &x, double &y, double &z, double &t, double px, double py, double pz, double mass,
+           double to_z){
+    // straight line; the path is dz p/pz at a speed of p/E
+    double dz = to_z - z;
+    x += px/pz*dz;
+    y += py/pz*dz;
+    t += dz*energy_of(px, py, pz, mass)/(pz*speed_of_light*1000.0);
+    z = to_z;
+}
+
+void helix_to(double &x, double &y, double &z, double &t, double &px, double &py, double pz, double mass,
+              double to_z){
+    // as TrackPropagator's helix, for a positive particle: dpx/dz = a py, dpy/dz = -a px
+    double dz = to_z - z;
+    double k = speed_of_light*field;
+    double a = k/pz;
+    double c = TMath::Cos(a*dz);
+    double s = TMath::Sin(a*dz);
+    x += (px*s + py*(1.0 - c))/k;
+    y += (py*s - px*(1.0 - c))/k;
+    double new_px = px*c + py*s;
+    double new_py = py*c - px*s;
+    px = new_px;
+    py = new_py;
+    t += dz*energy_of(px, py, pz, mass)/(pz*speed_of_light*1000.0);
+    z = to_z;
+}
+
+}
+
+QVector<QVector<double> > SyntheticSource::make_event(random_stream &random, int spill_number, int event_number){
+    /*
+     * One beam particle from TOF0 to TOF2.  The random numbers drawn don't depend on
+     * the detector locations, the calibration or the timing, so neither do the events.
+     */
+    QVector<QVector<double> > event(7, QVector<double>(13, TMath::Infinity()));
+
+    particle beam;
+    double species = random.uniform();
+    beam.mass = species < 0.08 ? electron_mass : (species < 0.2 ? pion_mass : muon_mass);
+    double p = qMax(100.0, random.gaus(200.0, 20.0));
+    double x_angle = random.gaus(0.0, 0.008);
+    double y_angle = random.gaus(0.0, 0.008);
+    beam.pz = p/TMath::Sqrt(1.0 + x_angle*x_angle + y_angle*y_angle);
+    beam.px = x_angle*beam.pz;
+    beam.py = y_angle*beam.pz;
+    beam.x = random.gaus(0.0, 40.0);
+    beam.y = random.gaus(0.0, 40.0);
+    beam.z = tof_z[0];
+    beam.t = 0.0;
+
+    if(timeStages){
+        stage_timer.start();
+    }
+    tof_hit(random, 0, beam, event, spill_number, event_number);
+    drift(beam.x, beam.y, beam.z, beam.t, beam.px, beam.py, beam.pz, beam.mass, tof_z[1]);
+    tof_hit(random, 1, beam, event, spill_number, event_number);
+    if(timeStages){
+        tofTime += stage_timer.nsecsElapsed();
+        stage_timer.start();
+    }
+
+    drift(beam.x, beam.y, beam.z, beam.t, beam.px, beam.py, beam.pz, beam.mass,
+          tracker_z[0][station_along_beam(0, 0)]);
+    tracker_track(random, 0, beam, event);
+
+    // across the absorber: a little slower, a little scattered
+    double momentum = TMath::Sqrt(beam.px*beam.px + beam.py*beam.py + beam.pz*beam.pz);
+    double scale = qMax(0.5, (momentum - absorber_loss)/momentum);
+    beam.px = beam.px*scale + beam.pz*scale*random.gaus(0.0, absorber_scattering);
+    beam.py = beam.py*scale + beam.pz*scale*random.gaus(0.0, absorber_scattering);
+    beam.pz *= scale;
+    drift(beam.x, beam.y, beam.z, beam.t, beam.px, beam.py, beam.pz, beam.mass,
+          tracker_z[1][station_along_beam(1, 0)]);
+    tracker_track(random, 1, beam, event);
+    if(timeStages){
+        trackerTime += stage_timer.nsecsElapsed();
+        stage_timer.start();
+    }
+
+    drift(beam.x, beam.y, beam.z, beam.t, beam.px, beam.py, beam.pz, beam.mass, tof_z[2]);
+    tof_hit(random, 2, beam, event, spill_number, event_number);
+    if(timeStages){
+        tofTime += stage_timer.nsecsElapsed();
+    }
+    return event;
+}
+
+void SyntheticSource::tof_hit(random_stream &random, int tof, const particle &at_tof,
+                              QVector<QVector<double> > &event, int spill_number, int event_number){
+    /*
+     * The particle is seen if it crosses the TOF and the TOF is efficient; noise space
+     * points come on top, and whichever of them is last is the one kept.
+     */
+    double half_width = 0.5*TOFCalibration::Slabs(tof)*slab_width[tof];
+    bool inside = TMath::Abs(at_tof.x) < half_width && TMath::Abs(at_tof.y) < half_width;
+    int seen = (random.uniform() < config.tof_efficiency && inside) ? 1 : 0;
+    int noise = random.poisson(config.noise);
+    if(seen + noise == 0){
+        return;
+    }
+
+    int kept = qMin(int(random.uniform()*(seen + noise)), seen + noise - 1);
+    if(seen == 1 && kept == 0){
+        measure_tof(random, tof, at_tof.x, at_tof.y, at_tof.t + random.gaus(0.0, tof_time_resolution),
+                    event, spill_number, event_number);
+    }
+    else{
+        double x = (2.0*random.uniform() - 1.0)*half_width;
+        double y = (2.0*random.uniform() - 1.0)*half_width;
+        double t = at_tof.t + (2.0*random.uniform() - 1.0)*20.0;
+        measure_tof(random, tof, x, y, t, event, spill_number, event_number);
+    }
+}
+
+void SyntheticSource::measure_tof(random_stream &random, int tof, double x, double y, double t,
+                                  QVector<QVector<double> > &event, int spill_number, int event_number){
+    /*
+     * Vertical slabs are numbered from +x, horizontal slabs from -y, as in
+     * ReadMAUS::get_TOF0_pixel_xy(); either way the middle of the TOF is x = y = 0.
+     */
+    int n_slabs = TOFCalibration::Slabs(tof);
+    double width = slab_width[tof];
+    int v_slab = qBound(0, int(TMath::Floor(0.5*n_slabs - x/width)), n_slabs - 1);
+    int h_slab = qBound(0, int(TMath::Floor(y/width + 0.5*n_slabs)), n_slabs - 1);
+
+    double true_c_eff = TOFCalibration().CEff();
+    double dt_sigma = 2.0*tof_position_resolution/true_c_eff;
+    double h_dt = 2.0*x/true_c_eff - trueOffsets.at((tof*2 + TOFCalibration::Horizontal)*10 + h_slab)
+            + random.gaus(0.0, dt_sigma);
+    double v_dt = 2.0*y/true_c_eff - trueOffsets.at((tof*2 + TOFCalibration::Vertical)*10 + v_slab)
+            + random.gaus(0.0, dt_sigma);
+
+    double h_offset = calibration.Offset(tof, TOFCalibration::Horizontal, h_slab);
+    double v_offset = calibration.Offset(tof, TOFCalibration::Vertical, v_slab);
+    double measured_x = h_offset != TMath::Infinity() ? 0.5*calibration.CEff()*(h_dt + h_offset)
+                                                      : (0.5*n_slabs - v_slab - 0.5)*width;
+    double measured_y = v_offset != TMath::Infinity() ? 0.5*calibration.CEff()*(v_dt + v_offset)
+                                                      : (h_slab + 0.5 - 0.5*n_slabs)*width;
+
+    const QVector<double> &location = locations.at(location_index[tof]);
+    int slot = tof_slot[tof];
+    event[0][slot] = measured_x + location.at(0);
+    event[1][slot] = measured_y + location.at(1);
+    event[2][slot] = location.at(2);
+    event[3][slot] = t;
+
+    if(recordSlabTimes){
+        SlabTime slab_time;
+        slab_time.spill = spill_number;
+        slab_time.event = event_number;
+        slab_time.tof = tof;
+        slab_time.plane = TOFCalibration::Horizontal;
+        slab_time.slab = h_slab;
+        slab_time.dt = h_dt;
+        slab_times << slab_time;
+        slab_time.plane = TOFCalibration::Vertical;
+        slab_time.slab = v_slab;
+        slab_time.dt = v_dt;
+        slab_times << slab_time;
+    }
+}
+
+bool SyntheticSource::tracker_track(random_stream &random, int tracker, particle &track,
+                                    QVector<QVector<double> > &event){
+    /*
+     * Takes the particle through the stations of the tracker in the order it meets them,
+     * and fills in the track points of whichever track is kept: the particle's, if the
+     * tracker saw it and it stayed inside, or a ghost.  Returns whether a track was kept.
+     */
+    int seen = random.uniform() < config.tracker_efficiency ? 1 : 0;
+    int ghosts = random.poisson(config.ghosts);
+    int kept = seen + ghosts > 0 ? qMin(int(random.uniform()*(seen + ghosts)), seen + ghosts - 1) : -1;
+
+    particle points[5];
+    particle ghost;
+    ghost.mass = muon_mass;
+    ghost.x = random.gaus(0.0, 60.0);
+    ghost.y = random.gaus(0.0, 60.0);
+    ghost.z = tracker_z[tracker][station_along_beam(tracker, 0)];
+    ghost.t = 0.0;
+    ghost.px = random.gaus(0.0, 25.0);
+    ghost.py = random.gaus(0.0, 25.0);
+    ghost.pz = qMax(100.0, random.gaus(180.0, 30.0));
+    bool is_ghost = kept > 0 || seen == 0;
+
+    bool inside = true;
+    for(int step = 0; step < 5; step++){
+        int station = station_along_beam(tracker, step);
+        helix_to(track.x, track.y, track.z, track.t, track.px, track.py, track.pz, track.mass,
+                 tracker_z[tracker][station]);
+        helix_to(ghost.x, ghost.y, ghost.z, ghost.t, ghost.px, ghost.py, ghost.pz, ghost.mass,
+                 tracker_z[tracker][station]);
+        points[station] = is_ghost ? ghost : track;
+        inside = inside && points[station].x*points[station].x + points[station].y*points[station].y
+                < tracker_radius*tracker_radius;
+    }
+
+    double smear[5][5];
+    for(int station = 0; station < 5; station++){
+        smear[station][0] = random.gaus(0.0, tracker_position_resolution);
+        smear[station][1] = random.gaus(0.0, tracker_position_resolution);
+        smear[station][2] = random.gaus(0.0, 1.0);
+        smear[station][3] = random.gaus(0.0, 1.0);
+        smear[station][4] = random.gaus(0.0, 2.0);
+    }
+    if(kept < 0 || !inside){
+        return false;
+    }
+
+    const QVector<double> &location = locations.at(2 + tracker);
+    for(int station = 0; station < 5; station++){
+        int slot = 2 + 5*tracker + station;
+        event[0][slot] = points[station].x + smear[station][0] + location.at(0);
+        event[1][slot] = points[station].y + smear[station][1] + location.at(1);
+        event[2][slot] = points[station].z + location.at(2);
+        event[4][slot] = points[station].px + smear[station][2];
+        event[5][slot] = points[station].py + smear[station][3];
+        event[6][slot] = points[station].pz + smear[station][4];
+    }
+    return true;
+}
@@ -0,0 +1,112 @@
+#ifndef SYNTHETICSOURCE_H
+#define SYNTHETICSOURCE_H
+
+#include <QString>
+#include <QVector>
+#include <QHash>
+#include <QMap>
+#include <QAtomicInt>
+#include <QElapsedTimer>
+#include "eventsource.h"
+#include "tofcalibration.h"
+
+/*
+ * A MAUS-like run made up on the spot, for trying the viewer, the fits and the
+ * benchmarks without MAUS or a recon file.  The run is described by its name:
+ *
+ *   synthetic:spills=200,events=40,seed=1,noise=0.05
+ *
+ * with any of these keys, in any order, the rest taking their defaults (Config()):
+ *
+ *   spills   number of spills               first    number of the first spill
+ *   events   mean events per spill          spread   rms of the spill size, relative
+ *   seed     random seed                    tof      efficiency of each TOF
+ *   tracker  efficiency of each tracker     noise    mean noise space points per TOF
+ *   ghosts   mean ghost tracks per tracker
+ *
+ * Every event is a positive beam particle (mostly muons, some pions and positrons) of
+ * about 200 MeV/c, from TOF0 to TOF1 in a straight line, through both trackers on
+ * helices in 3 T, straight across the absorber with a little energy loss and
+ * scattering, and on to TOF2.  The TOFs see the particle as the reader would: the slabs
+ * it crosses give the pixel, and raw slab time differences give positions along the
+ * slabs once a TOFCalibration is set, against slab offsets of the run's own.  A TOF
+ * hit is swapped for a noise space point, and a track for a ghost, in the same way as
+ * the reader keeps the last of several.
+ *
+ * The same name gives the same events, whichever spills are read and in whatever
+ * order: each spill has a random stream of its own, seeded from the seed and the
+ * spill number.
+ */
+class SyntheticSource : public EventSource
+{
+public:
+    struct Config {
+        int spills, first_spill;
+        double events, spread;
+        quint64 seed;
+        double tof_efficiency, tracker_efficiency;
+        double noise, ghosts;
+        Config();
+    };
+
+    SyntheticSource();
+    ~SyntheticSource();
+
+    static QString Scheme();
+    static Config Parse(QString file, QString *error = 0);
+    static QString Name(const Config &config);
+
+    QHash<int, QHash<int, QVector<QVector<double> > > > Read(QString fileToOpen);
+    QHash<int, QHash<int, QVector<QVector<double> > > > ReadEntries(QString fileToOpen, QVector<Long64_t> entries);
+    QMap<int, Long64_t> IndexSpills(QString fileToOpen);
+    void SetDetectorPositions(QVector<double> tof0_location, QVector<double> tof1_location,
+                              QVector<double> tku_location, QVector<double> tkd_location,
+                              QVector<double> tof2_location);
+    void SetSpillRange(int spill_range);
+    void SetStartingSpill(int start_spill);
+    void SetCancelFlag(QAtomicInt *cancel_flag);
+    void SetTOFCalibration(const TOFCalibration &calibration);
+    void SetRecordSlabTimes(bool record);
+    QVector<SlabTime> SlabTimes();
+    void SetTimeStages(bool time_stages);
+    QVector<SpillTiming> StageTimings();
+
+private:
+    class random_stream;
+
+    struct particle {
+        double x, y, z, t, px, py, pz;
+        double mass;
+    };
+
+    bool open(QString file);
+    bool cancelled();
+    void add_spill(int spill_number);
+    QVector<QVector<double> > make_event(random_stream &random, int spill_number, int event_number);
+    void tof_hit(random_stream &random, int tof, const particle &at_tof, QVector<QVector<double> > &event,
+                 int spill_number, int event_number);
+    bool tracker_track(random_stream &random, int tracker, particle &track, QVector<QVector<double> > &event);
+    void measure_tof(random_stream &random, int tof, double x, double y, double t,
+                     QVector<QVector<double> > &event, int spill_number, int event_number);
+
+    QString name;
+    Config config;
+    QVector<double> trueOffsets; // the run's slab offsets, as TOFCalibrationFit::bin() lays them out
+
+    QVector<QVector<double> > locations; // TOF0, TOF1, TKU, TKD, TOF2
+    TOFCalibration calibration;
+    int spillRange, spillBegin, spillEnd;
+    QAtomicInt *cancelFlag;
+
+    bool recordSlabTimes;
+    QVector<SlabTime> slab_times;
+
+    bool timeStages;
+    QVector<SpillTiming> spill_timings;
+    QElapsedTimer stage_timer;
+    qint64 tofTime, trackerTime;
+
+    QHash<int, QHash<int, QVector<QVector<double> > > > particles_in_spill;
+};
+
+#endif // SYNTHETICSOURCE_H
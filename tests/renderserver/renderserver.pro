@@ -0,0 +1,16 @@
+#-------------------------------------------------
+#
+# RenderServer's routes, against a synthetic run, see tst_renderserver.cpp
+#
+#-------------------------------------------------
+
+include(../../eventviewer.pri)
+
+QT += testlib
+
+TARGET = tst_renderserver
+TEMPLATE = app
+CONFIG += testcase
+
+
+SOURCES += tst_renderserver.cpp
@@ -0,0 +1,99 @@
+/*
+ * RenderServer answering over a real socket, for a synthetic run of a few spills:
+ *
+ *   qmake && make check
+ */
+#include <QtTest>
+#include <QTcpSocket>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QJsonArray>
+#include "renderserver.h"
+
+class TestRenderServer : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void initTestCase();
+    void spill_list();
+    void event_json();
+    void bad_numbers();
+
+private:
+    QByteArray get(QByteArray path, int *status);
+
+    RenderServer server;
+    quint16 port;
+};
+
+void TestRenderServer::initTestCase(){
+    QString error;
+    QVERIFY2(server.Listen(QHostAddress::LocalHost, 0, &error), qPrintable(error));
+    port = server.Port();
+    server.SetFile("synthetic:spills=4,first=1,events=10,seed=3");
+}
+
+QByteArray TestRenderServer::get(QByteArray path, int *status){
+    // the whole response, once the server closes the connection; the status from its first line
+    QTcpSocket client;
+    client.connectToHost(QHostAddress::LocalHost, port);
+    if(!client.waitForConnected(5000)){
+        *status = 0;
+        return QByteArray();
+    }
+    client.write("GET " + path + " HTTP/1.0\r\n\r\n");
+    QByteArray response;
+    QElapsedTimer timer;
+    timer.start();
+    while(client.state() != QAbstractSocket::UnconnectedState && timer.elapsed() < 30000){
+        // the server runs in this thread, so it only gets to answer while events are processed
+        QCoreApplication::processEvents(QEventLoop::AllEvents, 50);
+        response += client.readAll();
+    }
+    response += client.readAll();
+    *status = response.section(' ', 1, 1).toInt();
+    int body = response.indexOf("\r\n\r\n");
+    return body < 0 ? QByteArray() : response.mid(body + 4);
+}
+
+void TestRenderServer::spill_list(){
+    int status;
+    QByteArray body = get("/spill/1.json", &status);
+    QCOMPARE(status, 200);
+    QJsonObject spill = QJsonDocument::fromJson(body).object();
+    QCOMPARE(spill.value("spill").toInt(), 1);
+    QVERIFY(!spill.value("events").toArray().isEmpty());
+
+    // and from the cache, the second time
+    QCOMPARE(get("/spill/1.json", &status), body);
+    QCOMPARE(status, 200);
+
+    get("/spill/99.json", &status);
+    QCOMPARE(status, 404);
+}
+
+void TestRenderServer::event_json(){
+    int status;
+    QJsonArray events = QJsonDocument::fromJson(get("/spill/2.json", &status)).object().value("events").toArray();
+    QCOMPARE(status, 200);
+    QVERIFY(!events.isEmpty());
+    QByteArray path = "/event/2/" + QByteArray::number(events.at(0).toInt()) + ".json";
+    QJsonObject event = QJsonDocument::fromJson(get(path, &status)).object();
+    QCOMPARE(status, 200);
+    QCOMPARE(event.value("spill").toInt(), 2);
+    QCOMPARE(event.value("event").toInt(), events.at(0).toInt());
+}
+
+void TestRenderServer::bad_numbers(){
+    int status;
+    get("/spill/one.json", &status);
+    QCOMPARE(status, 400);
+    get("/event/1/two.json", &status);
+    QCOMPARE(status, 400);
+    get("/nowhere", &status);
+    QCOMPARE(status, 404);
+}
+
+QTEST_MAIN(TestRenderServer)
+#include "tst_renderserver.moc"
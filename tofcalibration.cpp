@@ -0,0 +1,165 @@
+#include "tofcalibration.h"
+#include "TMath.h"
+
+#include <QFile>
+#include <QTextStream>
+#include <QStringList>
+#include <QRegExp>
+
+TOFCalibration::TOFCalibration()
+{
+    // the 2011 effective speed, and no slab offsets, as ReadMAUS starts with
+    cEff = 135.2e-3;
+    for(int tof = 0; tof < NTOFs; tof++){
+        for(int plane = 0; plane < 2; plane++){
+            offsets[tof][plane].fill(TMath::Infinity(), Slabs(tof));
+        }
+    }
+}
+
+TOFCalibration::~TOFCalibration(){
+
+}
+
+int TOFCalibration::Slabs(int tof){
+    // TOF1 has 7 slabs in each plane, TOF0 and TOF2 have 10
+    return tof == 1 ? 7 : 10;
+}
+
+double TOFCalibration::CEff() const{
+    return cEff;
+}
+
+void TOFCalibration::SetCEff(double c_eff){
+    cEff = c_eff;
+}
+
+double TOFCalibration::Offset(int tof, int plane, int slab) const{
+    if(tof < 0 || tof >= NTOFs || plane < 0 || plane > 1){
+        return TMath::Infinity();
+    }
+    return offsets[tof][plane].value(slab, TMath::Infinity());
+}
+
+void TOFCalibration::SetOffset(int tof, int plane, int slab, double offset){
+    if(tof < 0 || tof >= NTOFs || plane < 0 || plane > 1 || slab < 0 || slab >= Slabs(tof)){
+        return;
+    }
+    offsets[tof][plane][slab] = offset;
+}
+
+QVector<double> TOFCalibration::Offsets(int tof, int plane) const{
+    return offsets[tof][plane];
+}
+
+bool TOFCalibration::IsEmpty() const{
+    for(int tof = 0; tof < NTOFs; tof++){
+        for(int plane = 0; plane < 2; plane++){
+            for(int slab = 0; slab < offsets[tof][plane].size(); slab++){
+                if(offsets[tof][plane].at(slab) != TMath::Infinity()){
+                    return false;
+                }
+            }
+        }
+    }
+    return true;
+}
+
+bool TOFCalibration::operator==(const TOFCalibration &other) const{
+    if(cEff != other.cEff){
+        return false;
+    }
+    for(int tof = 0; tof < NTOFs; tof++){
+        for(int plane = 0; plane < 2; plane++){
+            if(offsets[tof][plane] != other.offsets[tof][plane]){
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+bool TOFCalibration::operator!=(const TOFCalibration &other) const{
+    return !(*this == other);
+}
+
+QString TOFCalibration::PlaneName(int plane){
+    return plane == Horizontal ? "horizontal" : "vertical";
+}
+
+bool TOFCalibration::Load(QString file, QString *error){
+    /*
+     * Read a table written by Save(), or by hand.  Slabs not in the file are left
+     * uncalibrated; on an error the table is left as it was.
+     */
+    QFile input(file);
+    if(!input.open(QIODevice::ReadOnly | QIODevice::Text)){
+        if(error){
+            *error = input.errorString();
+        }
+        return false;
+    }
+
+    TOFCalibration table;
+    QTextStream stream(&input);
+    int line_number = 0;
+    while(!stream.atEnd()){
+        line_number++;
+        QString line = stream.readLine();
+        line = line.left(line.indexOf('#')).trimmed();
+        if(line.isEmpty()){
+            continue;
+        }
+
+        QStringList fields = line.split(QRegExp("\\s+"));
+        bool ok = false;
+        if(fields.size() == 2 && fields.at(0) == "c_eff"){
+            table.cEff = fields.at(1).toDouble(&ok);
+        }
+        else if(fields.size() == 4 && fields.at(0).startsWith("TOF")){
+            int tof = fields.at(0).mid(3).toInt(&ok);
+            int plane = fields.at(1) == PlaneName(Horizontal) ? Horizontal
+                                                               : fields.at(1) == PlaneName(Vertical) ? Vertical : -1;
+            bool slab_ok = false, offset_ok = false;
+            int slab = fields.at(2).toInt(&slab_ok);
+            double offset = fields.at(3).toDouble(&offset_ok);
+            ok = ok && slab_ok && offset_ok && tof >= 0 && tof < NTOFs && plane >= 0
+                    && slab >= 0 && slab < Slabs(tof);
+            if(ok){
+                table.offsets[tof][plane][slab] = offset;
+            }
+        }
+        if(!ok){
+            if(error){
+                *error = QString("line %1: \"%2\"").arg(line_number).arg(line);
+            }
+            return false;
+        }
+    }
+
+    *this = table;
+    return true;
+}
+
+bool TOFCalibration::Save(QString file) const{
+    QFile output(file);
+    if(!output.open(QIODevice::WriteOnly | QIODevice::Text)){
+        return false;
+    }
+    QTextStream stream(&output);
+    stream << "# TOF slab calibration: position = 0.5 c_eff (raw_t0 - raw_t1 + offset)\n";
+    stream << "c_eff " << QString::number(cEff, 'g', 10) << "\n";
+    stream << "# TOF plane slab offset\n";
+    for(int tof = 0; tof < NTOFs; tof++){
+        for(int plane = 0; plane < 2; plane++){
+            for(int slab = 0; slab < offsets[tof][plane].size(); slab++){
+                double offset = offsets[tof][plane].at(slab);
+                if(offset != TMath::Infinity()){
+                    stream << "TOF" << tof << " " << PlaneName(plane) << " " << slab << " "
+                           << QString::number(offset, 'g', 10) << "\n";
+                }
+            }
+        }
+    }
+    return stream.status() == QTextStream::Ok;
+}
@@ -0,0 +1,53 @@
+#ifndef TOFCALIBRATION_H
+#define TOFCALIBRATION_H
+
+#include <QVector>
+#include <QString>
+
+/*
+ * Constants for positions along the TOF slabs from the difference of the raw times at
+ * the PMTs at either end, as ReadMAUS uses them:
+ *
+ *   position = 0.5 c_eff (raw_t0 - raw_t1 + offset[slab])
+ *
+ * Horizontal slabs (plane 0) lie along x and so give x, vertical slabs (plane 1) give
+ * y.  A slab without an offset (Infinity) is uncalibrated, and the reader falls back
+ * to the centre of the pixel for it; a default-constructed table has no offsets.
+ *
+ * Tables are kept in text files, one constant per line, '#' starting a comment:
+ *
+ *   c_eff 0.1352
+ *   TOF0 horizontal 2 234.1
+ *   TOF1 vertical 3 34.6
+ */
+class TOFCalibration
+{
+public:
+    static const int NTOFs = 3;
+    enum Plane { Horizontal = 0, Vertical = 1 };
+
+    TOFCalibration();
+    ~TOFCalibration();
+
+    bool Load(QString file, QString *error = 0);
+    bool Save(QString file) const;
+
+    double CEff() const;
+    void SetCEff(double c_eff);
+    static int Slabs(int tof);
+    double Offset(int tof, int plane, int slab) const;
+    void SetOffset(int tof, int plane, int slab, double offset);
+    QVector<double> Offsets(int tof, int plane) const;
+    bool IsEmpty() const;
+
+    bool operator==(const TOFCalibration &other) const;
+    bool operator!=(const TOFCalibration &other) const;
+
+    static QString PlaneName(int plane);
+
+private:
+    double cEff; // mm per unit of raw time
+    QVector<double> offsets[NTOFs][2];
+};
+
+#endif // TOFCALIBRATION_H
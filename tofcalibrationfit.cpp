@@ -0,0 +1,355 @@
+#include "tofcalibrationfit.h"
+#include "trace.h"
+#include "TMath.h"
+
+#include <QFuture>
+#include <QList>
+#include <QHash>
+#include <QPair>
+#include <QMutexLocker>
+#include <QScopedPointer>
+#include <QtConcurrentRun>
+#include <algorithm>
+
+namespace {
+
+// where each TOF is among the Settings window's locations, its slot, and the first and last
+// slots of the tracker extrapolated from, whichever station is nearest, see EventStore::NearestSlot()
+const int location_index[TOFCalibration::NTOFs] = {0, 1, 4};
+const int tof_slot[TOFCalibration::NTOFs] = {0, 1, 12};
+const int source_first[TOFCalibration::NTOFs] = {2, 2, 7};
+const int source_last[TOFCalibration::NTOFs] = {6, 6, 11};
+
+const int batch_entries = 16; // tree entries read between updates
+
+}
+
+TOFCalibrationFit::TOFCalibrationFit(QObject *parent) :
+    QObject(parent)
+{
+    total = empty_sums();
+    spillsRead = 0;
+    spillsTotal = 0;
+    generation = 0;
+}
+
+TOFCalibrationFit::~TOFCalibrationFit(){
+    // the worker adds to this object, so it has to be finished before this goes away
+    Stop();
+    watcher.waitForFinished();
+}
+
+double TOFCalibrationFit::Window(){
+    return 300.0; // mm, about the half-width of TOF2
+}
+
+int TOFCalibrationFit::MinEntries(){
+    return 50;
+}
+
+int TOFCalibrationFit::bin(int tof, int plane, int slab){
+    return (tof*2 + plane)*MaxSlabs + slab;
+}
+
+TOFCalibrationFit::slab_sums TOFCalibrationFit::empty_sums(){
+    slab_sums sums;
+    for(int i = 0; i < NBins; i++){
+        sums.n[i] = sums.t[i] = sums.u[i] = sums.tt[i] = sums.tu[i] = 0.0;
+    }
+    return sums;
+}
+
+void TOFCalibrationFit::merge(slab_sums &total_sums, const slab_sums &block){
+    for(int i = 0; i < NBins; i++){
+        total_sums.n[i] += block.n[i];
+        total_sums.t[i] += block.t[i];
+        total_sums.u[i] += block.u[i];
+        total_sums.tt[i] += block.tt[i];
+        total_sums.tu[i] += block.tu[i];
+    }
+}
+
+void TOFCalibrationFit::Start(QString file, QVector<QVector<double> > locations,
+                              QMap<int, Long64_t> spill_entries){
+    // as AlignmentFit::Start(): anything still running is cancelled and its results dropped
+    Stop();
+
+    fit_request request;
+    {
+        QMutexLocker lock(&mutex);
+        generation++;
+        total = empty_sums();
+        spillsRead = 0;
+        spillsTotal = spill_entries.size();
+        request.generation = generation;
+    }
+    request.filename = file;
+    request.locations = locations;
+    request.spill_entries = spill_entries;
+    request.cancel = QSharedPointer<QAtomicInt>(new QAtomicInt(0));
+    cancel = request.cancel;
+
+    watcher.setFuture(QtConcurrent::run(&TOFCalibrationFit::fit_file, this, request));
+}
+
+void TOFCalibrationFit::Stop(){
+    if(cancel){
+        cancel->store(1);
+    }
+}
+
+bool TOFCalibrationFit::IsRunning(){
+    return watcher.isRunning();
+}
+
+void TOFCalibrationFit::fit_file(TOFCalibrationFit *fit, fit_request request){
+    QString error;
+    if(!EventSource::CanRead(request.filename, &error)){
+        fit->finish(request.generation, error);
+        return;
+    }
+    QScopedPointer<EventSource> reader(EventSource::Create(request.filename));
+    reader->SetDetectorPositions(request.locations.at(0), request.locations.at(1),
+                                 request.locations.at(2), request.locations.at(3),
+                                 request.locations.at(4));
+    reader->SetCancelFlag(request.cancel.data());
+    reader->SetRecordSlabTimes(true);
+
+    if(request.spill_entries.isEmpty()){
+        request.spill_entries = reader->IndexSpills(request.filename);
+    }
+    if(request.spill_entries.isEmpty()){
+        if(request.cancel->load() == 0){
+            fit->finish(request.generation, QString("No spills in %1").arg(request.filename));
+        }
+        return;
+    }
+    QVector<Long64_t> entries = request.spill_entries.values().toVector();
+    std::sort(entries.begin(), entries.end());
+
+    for(int begin = 0; begin < entries.size() && request.cancel->load() == 0; begin += batch_entries){
+        QVector<Long64_t> batch_of_entries = entries.mid(begin, batch_entries);
+        EventStore store;
+        store.Fill(reader->ReadEntries(request.filename, batch_of_entries));
+        if(request.cancel->load() != 0){
+            return; // the batch may be incomplete
+        }
+        fit->add(fit_batch(store, reader->SlabTimes(), request.locations),
+                 batch_of_entries.size(), entries.size(), request.generation);
+    }
+    if(request.cancel->load() == 0){
+        fit->finish(request.generation, QString());
+    }
+}
+
+TOFCalibrationFit::slab_sums TOFCalibrationFit::fit_batch(const EventStore &store,
+                                                          const QVector<EventSource::SlabTime> &slab_times,
+                                                          const QVector<QVector<double> > &locations){
+    /*
+     * Match each slab time to its event's row, then sum in blocks of slab times on the
+     * global thread pool, merged in order.
+     */
+    QHash<QPair<int, int>, int> row_of_event;
+    row_of_event.reserve(store.Size());
+    for(int row = 0; row < store.Size(); row++){
+        row_of_event.insert(qMakePair(store.Spill(row), store.Event(row)), row);
+    }
+
+    batch input;
+    input.store = &store;
+    input.slab_times = slab_times;
+    input.locations = locations;
+    input.rows.resize(slab_times.size());
+    for(int i = 0; i < slab_times.size(); i++){
+        input.rows[i] = row_of_event.value(qMakePair(slab_times.at(i).spill, slab_times.at(i).event), -1);
+    }
+    for(int tof = 0; tof < TOFCalibration::NTOFs; tof++){
+        input.sources[tof] = store.NearestSlot(source_first[tof], source_last[tof], tof_slot[tof]);
+    }
+
+    const int block_size = 4096;
+    QList<QFuture<slab_sums> > blocks;
+    for(int begin = 0; begin < slab_times.size(); begin += block_size){
+        blocks << QtConcurrent::run(&TOFCalibrationFit::fit_block, &input, begin,
+                                    qMin(begin + block_size, slab_times.size()));
+    }
+
+    slab_sums sums = empty_sums();
+    for(int i = 0; i < blocks.size(); i++){
+        merge(sums, blocks[i].result());
+    }
+    return sums;
+}
+
+TOFCalibrationFit::slab_sums TOFCalibrationFit::fit_block(const batch *input, int begin, int end){
+    TRACE_SCOPE("TOFCalibrationFit::fit_block");
+    /*
+     * A missing value in the extrapolation, or a missing raw time, makes u or dt
+     * infinite or NaN, and so fails the window test.
+     */
+    const double window = Window();
+    slab_sums sums = empty_sums();
+    for(int i = begin; i < end; i++){
+        const EventSource::SlabTime &slab_time = input->slab_times.at(i);
+        int row = input->rows.at(i);
+        if(row < 0 || slab_time.tof < 0 || slab_time.tof >= TOFCalibration::NTOFs
+           || slab_time.slab < 0 || slab_time.slab >= TOFCalibration::Slabs(slab_time.tof)){
+            continue;
+        }
+
+        const QVector<double> &location = input->locations.at(location_index[slab_time.tof]);
+        int from = input->sources[slab_time.tof].at(row);
+        if(from < 0){
+            continue;
+        }
+        int quantity = slab_time.plane == TOFCalibration::Horizontal ? 0 : 1; // x or y
+        double dz = location.at(2) - input->store->Value(2, from, row);
+        double u = input->store->Value(quantity, from, row)
+                + input->store->Value(quantity + 4, from, row)/input->store->Value(6, from, row)*dz
+                - location.at(quantity);
+        double dt = slab_time.dt;
+        if(!(TMath::Abs(u) < window && TMath::Abs(dt) < TMath::Infinity())){
+            continue;
+        }
+
+        int i_bin = bin(slab_time.tof, slab_time.plane, slab_time.slab);
+        sums.n[i_bin] += 1.0;
+        sums.t[i_bin] += dt;
+        sums.u[i_bin] += u;
+        sums.tt[i_bin] += dt*dt;
+        sums.tu[i_bin] += dt*u;
+    }
+    return sums;
+}
+
+void TOFCalibrationFit::finish(int from_generation, QString error){
+    // called on the worker thread, like add(); nothing is emitted for an older generation
+    int read;
+    {
+        QMutexLocker lock(&mutex);
+        if(from_generation != generation){
+            return;
+        }
+        read = spillsRead;
+    }
+    if(error.isEmpty()){
+        emit Finished(read);
+    }
+    else{
+        emit Failed(error);
+    }
+}
+
+void TOFCalibrationFit::add(const slab_sums &sums, int spills, int total_spills, int from_generation){
+    // called on the worker thread; Progress() is queued to receivers on the GUI thread
+    int read, spills_total;
+    {
+        QMutexLocker lock(&mutex);
+        if(from_generation != generation){
+            return;
+        }
+        merge(total, sums);
+        spillsRead += spills;
+        spillsTotal = total_spills;
+        read = spillsRead;
+        spills_total = spillsTotal;
+    }
+    emit Progress(read, spills_total);
+}
+
+int TOFCalibrationFit::SpillsRead(){
+    QMutexLocker lock(&mutex);
+    return spillsRead;
+}
+
+int TOFCalibrationFit::SpillsTotal(){
+    QMutexLocker lock(&mutex);
+    return spillsTotal;
+}
+
+int TOFCalibrationFit::Entries(int tof, int plane, int slab){
+    QMutexLocker lock(&mutex);
+    return int(total.n[bin(tof, plane, slab)]);
+}
+
+double TOFCalibrationFit::slope(int first_tof, int last_tof){
+    // pooled within-slab slope of u on dt; the mutex must be held
+    double covariance = 0.0, variance = 0.0;
+    for(int tof = first_tof; tof <= last_tof; tof++){
+        for(int plane = 0; plane < 2; plane++){
+            for(int slab = 0; slab < TOFCalibration::Slabs(tof); slab++){
+                int i = bin(tof, plane, slab);
+                double n = total.n[i];
+                if(n < 2){
+                    continue;
+                }
+                covariance += total.tu[i] - total.t[i]*total.u[i]/n;
+                variance += total.tt[i] - total.t[i]*total.t[i]/n;
+            }
+        }
+    }
+    return variance > 0 ? covariance/variance : TMath::Infinity();
+}
+
+TOFCalibration TOFCalibrationFit::Result(){
+    QMutexLocker lock(&mutex);
+    TOFCalibration calibration;
+    double a = slope(0, TOFCalibration::NTOFs - 1);
+    if(a == TMath::Infinity() || a == 0){
+        return calibration;
+    }
+
+    calibration.SetCEff(2.0*a);
+    for(int tof = 0; tof < TOFCalibration::NTOFs; tof++){
+        for(int plane = 0; plane < 2; plane++){
+            for(int slab = 0; slab < TOFCalibration::Slabs(tof); slab++){
+                int i = bin(tof, plane, slab);
+                double n = total.n[i];
+                if(n >= MinEntries()){
+                    double b = total.u[i]/n - a*total.t[i]/n;
+                    calibration.SetOffset(tof, plane, slab, b/a);
+                }
+            }
+        }
+    }
+    return calibration;
+}
+
+QString TOFCalibrationFit::Report(){
+    // an HTML summary for the Settings window
+    TOFCalibration calibration = Result();
+    QString report = QString("<p>%1 of %2 spills read.</p>").arg(SpillsRead()).arg(SpillsTotal());
+
+    double by_tof[TOFCalibration::NTOFs];
+    {
+        QMutexLocker lock(&mutex);
+        for(int tof = 0; tof < TOFCalibration::NTOFs; tof++){
+            by_tof[tof] = slope(tof, tof);
+        }
+    }
+    report += QString("<p>c<sub>eff</sub> = %1 mm per unit of raw time").arg(calibration.CEff(), 0, 'g', 5);
+    for(int tof = 0; tof < TOFCalibration::NTOFs; tof++){
+        report += by_tof[tof] == TMath::Infinity() ? QString("<br/>TOF%1 alone: -").arg(tof)
+                                                   : QString("<br/>TOF%1 alone: %2").arg(tof).arg(2.0*by_tof[tof], 0, 'g', 5);
+    }
+    report += "</p>";
+
+    for(int tof = 0; tof < TOFCalibration::NTOFs; tof++){
+        report += QString("<p>TOF%1</p>").arg(tof);
+        report += "<table border=\"1\" cellpadding=\"3\" cellspacing=\"0\">"
+                "<tr><th>Slab</th><th>Horizontal hits</th><th>Horizontal offset</th>"
+                "<th>Vertical hits</th><th>Vertical offset</th></tr>";
+        for(int slab = 0; slab < TOFCalibration::Slabs(tof); slab++){
+            report += QString("<tr><td>%1</td>").arg(slab);
+            for(int plane = 0; plane < 2; plane++){
+                double offset = calibration.Offset(tof, plane, slab);
+                report += QString("<td>%1</td>").arg(Entries(tof, plane, slab));
+                report += offset == TMath::Infinity() ? QString("<td>-</td>")
+                                                      : QString("<td>%1</td>").arg(offset, 0, 'f', 1);
+            }
+            report += "</tr>";
+        }
+        report += "</table>";
+    }
+    return report;
+}
@@ -0,0 +1,107 @@
+#ifndef TOFCALIBRATIONFIT_H
+#define TOFCALIBRATIONFIT_H
+
+#include <QObject>
+#include <QFutureWatcher>
+#include <QString>
+#include <QVector>
+#include <QMap>
+#include <QMutex>
+#include <QAtomicInt>
+#include <QSharedPointer>
+#include <Rtypes.h>
+#include "eventsource.h"
+#include "eventstore.h"
+#include "tofcalibration.h"
+
+/*
+ * Fits the TOF slab calibration (see TOFCalibration) from a whole file.
+ *
+ * Every TOF pixel in the file gives a raw PMT time difference in its horizontal and
+ * its vertical slab, and a tracker track extrapolated in a straight line to the TOF
+ * (from the TKU point nearest in z for TOF0 and TOF1, usually station 5, and the TKD
+ * point nearest for TOF2) gives the position along each slab, less the TOF's offset.  The position is taken to be
+ *
+ *   u = a dt + b[slab],  a = c_eff/2,  b[slab] = a offset[slab]
+ *
+ * with one a for every slab, as the reader has one c_eff, and a least-squares fit of
+ * that needs only five sums per slab: the slope is the pooled within-slab covariance
+ * of (dt, u) over the pooled variance of dt, and each b follows from its slab's means.
+ * Extrapolations further than Window() from the TOF axis are left out, and slabs with
+ * fewer than MinEntries() are left uncalibrated.
+ *
+ * Like AlignmentFit, Start() reads the file on a worker thread a few tree entries at a
+ * time, Progress() is emitted on the GUI thread after every batch, and Finished() or
+ * Failed() at the end.
+ */
+class TOFCalibrationFit : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit TOFCalibrationFit(QObject *parent = 0);
+    ~TOFCalibrationFit();
+
+    void Start(QString file, QVector<QVector<double> > locations,
+               QMap<int, Long64_t> spill_entries = QMap<int, Long64_t>());
+    void Stop();
+    bool IsRunning();
+    static double Window();
+    static int MinEntries();
+
+    int SpillsRead();
+    int SpillsTotal();
+    int Entries(int tof, int plane, int slab);
+    TOFCalibration Result();
+    QString Report();
+
+signals:
+    void Progress(int spills_read, int spills_total);
+    void Finished(int spills_read);
+    void Failed(QString error);
+
+private:
+    static const int MaxSlabs = 10;
+    static const int NBins = TOFCalibration::NTOFs*2*MaxSlabs;
+
+    struct slab_sums {
+        double n[NBins], t[NBins], u[NBins], tt[NBins], tu[NBins];
+    };
+
+    struct fit_request {
+        QString filename;
+        QVector<QVector<double> > locations;
+        QMap<int, Long64_t> spill_entries;
+        QSharedPointer<QAtomicInt> cancel;
+        int generation;
+    };
+
+    struct batch {
+        const EventStore *store;
+        QVector<EventSource::SlabTime> slab_times;
+        QVector<int> rows; // the row of the store each slab time's event is in, or -1
+        QVector<int> sources[TOFCalibration::NTOFs]; // by row, the station nearest each TOF, or -1
+        QVector<QVector<double> > locations;
+    };
+
+    static int bin(int tof, int plane, int slab);
+    static slab_sums empty_sums();
+    static void merge(slab_sums &total, const slab_sums &block);
+    static slab_sums fit_batch(const EventStore &store, const QVector<EventSource::SlabTime> &slab_times,
+                               const QVector<QVector<double> > &locations);
+    static slab_sums fit_block(const batch *input, int begin, int end);
+    static void fit_file(TOFCalibrationFit *fit, fit_request request);
+    void finish(int from_generation, QString error);
+    void add(const slab_sums &sums, int spills, int total_spills, int from_generation);
+    double slope(int first_tof, int last_tof);
+
+    QMutex mutex; // guards everything below, which the worker thread adds to
+    slab_sums total;
+    int spillsRead, spillsTotal;
+    int generation;
+
+    QFutureWatcher<void> watcher;
+    QSharedPointer<QAtomicInt> cancel;
+};
+
+#endif // TOFCALIBRATIONFIT_H
@@ -0,0 +1,103 @@
+#include "tofplots.h"
+#include "particleid.h"
+#include "TMath.h"
+
+TOFPlots::TOFPlots(QCustomPlot *tof0_to_tof1, QCustomPlot *tof0_to_tof2, QCustomPlot *tof1_to_tof2){
+    plots << tof0_to_tof1 << tof0_to_tof2 << tof1_to_tof2;
+
+    QStringList labels;
+    labels << "Time of flight: TOF0 to TOF1 (ns)" << "Time of flight: TOF0 to TOF2 (ns)"
+           << "Time of flight: TOF1 to TOF2 (ns)";
+    for(int p = 0; p < plots.size(); p++){
+        QCustomPlot *plot = plots.at(p);
+        plot->addGraph(); // time of flight histogram
+        plot->addGraph(); // time of flight of this particle
+        plot->xAxis->setLabel(labels.at(p));
+        plot->yAxis->setLabel("Number of Particles");
+        plot->setInteraction(QCP::iRangeDrag, true);
+        plot->setInteraction(QCP::iRangeZoom, true);
+
+        plot->graph(0)->setPen(QPen(Qt::gray));
+        plot->graph(0)->setLineStyle(QCPGraph::lsStepCenter);
+        plot->graph(0)->setName("All events");
+
+        plot->graph(1)->setPen(QPen(Qt::red));
+        plot->graph(1)->setScatterStyle(QCPScatterStyle::ssSquare);
+        plot->graph(1)->setLineStyle(QCPGraph::lsNone);
+        plot->graph(1)->setName("This event");
+
+        // histograms of each identified species, graphs 2-4
+        for(int species = ParticleID::Electron; species <= ParticleID::Pion; species++){
+            QCPGraph *graph = plot->addGraph();
+            graph->setPen(QPen(ParticleID::Colour(species)));
+            graph->setLineStyle(QCPGraph::lsStepCenter);
+            graph->setName(ParticleID::Name(species));
+        }
+    }
+}
+
+QList<QCustomPlot*> TOFPlots::Plots(){
+    return plots;
+}
+
+void TOFPlots::Fill(const EventStore &store){
+    /*
+     * Histograms of the three times of flight over the store, for every event and for
+     * each identified species, straight from its time of flight columns, which are in
+     * the plots' order.
+     */
+    const double bin_width = 0.2; // ns
+
+    for(int p = 0; p < plots.size(); p++){
+        const double *tof = store.EventColumn(p);
+        double low = TMath::Infinity();
+        double high = -TMath::Infinity();
+        for(int row = 0; row < store.Size(); row++){
+            if(tof[row] != TMath::Infinity()){
+                low = qMin(low, tof[row]);
+                high = qMax(high, tof[row]);
+            }
+        }
+
+        QVector<double> keys;
+        QVector<QVector<double> > counts(ParticleID::NSpecies + 1); // all events, then by species
+        if(low <= high){
+            int n_bins = qMin(2000, int((high - low)/bin_width) + 1);
+            for(int bin = 0; bin < n_bins; bin++){
+                keys << low + (bin + 0.5)*bin_width;
+            }
+            for(int i = 0; i < counts.size(); i++){
+                counts[i].fill(0.0, n_bins);
+            }
+            for(int row = 0; row < store.Size(); row++){
+                if(tof[row] == TMath::Infinity()){
+                    continue;
+                }
+                int bin = qMin(n_bins - 1, int((tof[row] - low)/bin_width));
+                counts[0][bin]++;
+                counts[1 + store.Species(row)][bin]++;
+            }
+        }
+
+        plots.at(p)->graph(0)->setData(keys, counts.at(0));
+        for(int species = ParticleID::Electron; species <= ParticleID::Pion; species++){
+            plots.at(p)->graph(1 + species)->setData(keys, counts.at(1 + species));
+        }
+        plots.at(p)->rescaleAxes();
+    }
+}
+
+void TOFPlots::SetEvent(const EventStore &store, int row){
+    // row -1 for an event that isn't in the store clears the marker
+    int species = row >= 0 ? store.Species(row) : ParticleID::Unknown;
+
+    for(int p = 0; p < plots.size(); p++){
+        QVector<double> tof, height;
+        if(row >= 0 && store.EventValue(p, row) != TMath::Infinity()){
+            tof << store.EventValue(p, row);
+            height << 0.0;
+        }
+        plots.at(p)->graph(1)->setData(tof, height);
+        plots.at(p)->graph(1)->setPen(QPen(ParticleID::Colour(species)));
+    }
+}
@@ -0,0 +1,30 @@
+#ifndef TOFPLOTS_H
+#define TOFPLOTS_H
+
+#include <QList>
+#include "qcustomplot.h"
+#include "eventstore.h"
+
+/*
+ * Owns the graphs of the three time-of-flight plots, TOF0 to TOF1, TOF0 to TOF2 and
+ * TOF1 to TOF2, for whichever QCustomPlot widgets it is handed: the main window's time
+ * tab, or the render server's plots that are never shown.
+ *
+ * Fill() histograms every event of a store, and each identified species; SetEvent()
+ * marks one row's times of flight, in the colour of its species.  Graph 0 is every
+ * event, graph 1 the marker, graphs 2-4 the species.
+ */
+class TOFPlots
+{
+public:
+    TOFPlots(QCustomPlot *tof0_to_tof1, QCustomPlot *tof0_to_tof2, QCustomPlot *tof1_to_tof2);
+
+    void Fill(const EventStore &store);
+    void SetEvent(const EventStore &store, int row);
+    QList<QCustomPlot*> Plots();
+
+private:
+    QList<QCustomPlot*> plots;
+};
+
+#endif // TOFPLOTS_H
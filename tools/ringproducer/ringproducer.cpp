@@ -0,0 +1,137 @@
+/*
+ * EventRingProducer: pushes events into a shared-memory EventRing, as a running
+ * reconstruction would, for the viewer's File > Follow event ring.
+ *
+ *   EventRingProducer [options] [file.root | synthetic:...]
+ *     --ring NAME      the ring to create (default eventviewer)
+ *     --capacity N     events the ring holds (default 65536)
+ *     --rate N         events per second (default 1000, 0 for as fast as possible)
+ *     --spills N       stop after N spills (default 0, never)
+ *
+ * The events come from any EventSource, a synthetic run by default.  Once they run out
+ * they are pushed again, with the spill numbers carrying on from the last, until
+ * --spills is reached or the producer is killed.
+ */
+
+#include <QCoreApplication>
+#include <QStringList>
+#include <QElapsedTimer>
+#include <QScopedPointer>
+#include <QThread>
+#include <algorithm>
+#include <cstdio>
+
+#include "eventring.h"
+#include "eventsource.h"
+#include "syntheticsource.h"
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    QStringList arguments = app.arguments();
+
+    QString filename = SyntheticSource::Name(SyntheticSource::Config());
+    QString name = EventRing::DefaultName();
+    int capacity = 65536;
+    int rate = 1000;
+    int n_spills = 0;
+
+    for(int i = 1; i < arguments.size(); i++){
+        QString argument = arguments.at(i);
+        QString value = i + 1 < arguments.size() ? arguments.at(i + 1) : QString();
+        if(argument == "--ring"){
+            name = value;
+            i++;
+        }
+        else if(argument == "--capacity"){
+            capacity = value.toInt();
+            i++;
+        }
+        else if(argument == "--rate"){
+            rate = value.toInt();
+            i++;
+        }
+        else if(argument == "--spills"){
+            n_spills = value.toInt();
+            i++;
+        }
+        else{
+            filename = argument;
+        }
+    }
+    if(name.isEmpty() || capacity <= 0 || rate < 0 || n_spills < 0){
+        std::fprintf(stderr, "usage: %s [--ring NAME] [--capacity N] [--rate N] [--spills N] "
+                             "[file.root|synthetic:...]\n", argv[0]);
+        return 1;
+    }
+
+    QScopedPointer<EventSource> reader(EventSource::Create(filename));
+    QMap<int, Long64_t> index = reader->IndexSpills(filename);
+    QVector<Long64_t> entries = index.values().toVector();
+    std::sort(entries.begin(), entries.end());
+    if(entries.isEmpty()){
+        std::fprintf(stderr, "no physics spills in %s\n", filename.toLocal8Bit().constData());
+        return 1;
+    }
+
+    EventRing ring;
+    QString error;
+    if(!ring.Create(name, capacity, &error)){
+        std::fprintf(stderr, "%s\n", error.toLocal8Bit().constData());
+        return 1;
+    }
+    std::fprintf(stderr, "pushing %s into ring %s\n", filename.toLocal8Bit().constData(),
+                 name.toLocal8Bit().constData());
+
+    /*
+     * A few spills are read at a time, and their events pushed in order at the rate
+     * asked for; a producer that falls behind pushes as fast as it can to catch up.
+     */
+    const int spills_per_read = 10;
+    QElapsedTimer clock;
+    clock.start();
+    qint64 pushed = 0;
+    int spills_pushed = 0;
+    int spill_offset = 0;
+    int last_spill = index.firstKey() - 1;
+    while(n_spills == 0 || spills_pushed < n_spills){
+        int pass_spills = spills_pushed;
+        for(int first = 0; first < entries.size() && (n_spills == 0 || spills_pushed < n_spills);
+            first += spills_per_read){
+            QHash<int, QHash<int, QVector<QVector<double> > > > data =
+                    reader->ReadEntries(filename, entries.mid(first, spills_per_read));
+            QList<int> spills = data.keys();
+            std::sort(spills.begin(), spills.end());
+            foreach(int spill_number, spills){
+                if(n_spills != 0 && spills_pushed >= n_spills){
+                    break;
+                }
+                QList<int> events = data.value(spill_number).keys();
+                std::sort(events.begin(), events.end());
+                foreach(int event_number, events){
+                    if(rate > 0){
+                        qint64 due_us = pushed*1000000/rate;
+                        qint64 now_us = clock.nsecsElapsed()/1000;
+                        if(due_us > now_us){
+                            QThread::usleep(due_us - now_us);
+                        }
+                    }
+                    ring.Push(spill_number + spill_offset, event_number,
+                              data.value(spill_number).value(event_number));
+                    pushed++;
+                }
+                last_spill = spill_number + spill_offset;
+                spills_pushed++;
+            }
+        }
+        if(spills_pushed == pass_spills){
+            std::fprintf(stderr, "no events in %s\n", filename.toLocal8Bit().constData());
+            return 1;
+        }
+        spill_offset = last_spill + 1 - index.firstKey();
+    }
+
+    std::fprintf(stderr, "pushed %lld events from %d spills in %.1f s\n", pushed, spills_pushed,
+                 clock.nsecsElapsed()/1.0e9);
+    return 0;
+}
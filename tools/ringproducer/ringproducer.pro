@@ -0,0 +1,13 @@
+#-------------------------------------------------
+#
+# A stand-in for a running reconstruction, feeding an EventRing, see ringproducer.cpp
+#
+#-------------------------------------------------
+
+include(../../eventviewer.pri)
+
+TARGET = EventRingProducer
+TEMPLATE = app
+
+
+SOURCES += ringproducer.cpp
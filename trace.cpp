@@ -0,0 +1,204 @@
+#include "trace.h"
+
+#include <QFile>
+#include <QTextStream>
+#include <QThread>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QElapsedTimer>
+#include <QAtomicInt>
+#include <QVector>
+#include <QList>
+
+namespace {
+
+struct span {
+    const char *name;
+    qint64 begin, duration; // ns
+};
+
+struct thread_buffer {
+    int tid;
+    QString name;
+    QMutex mutex; // only contended while Start() or Save() look at the buffer
+    QVector<span> spans;
+    int dropped;
+};
+
+struct trace_registry {
+    QMutex mutex; // guards buffers
+    QList<thread_buffer*> buffers; // one per thread that has ever ended a span, never freed
+    QElapsedTimer clock;
+    QAtomicInt capturing;
+
+    trace_registry() : capturing(0) {
+        clock.start();
+    }
+};
+
+trace_registry& registry(){
+    static trace_registry instance;
+    return instance;
+}
+
+thread_local thread_buffer *local_buffer = 0;
+
+thread_buffer* this_thread_buffer(){
+    if(local_buffer == 0){
+        local_buffer = new thread_buffer;
+        local_buffer->dropped = 0;
+        QString name = QThread::currentThread() != 0 ? QThread::currentThread()->objectName() : QString();
+        QMutexLocker lock(&registry().mutex);
+        local_buffer->tid = registry().buffers.size() + 1;
+        local_buffer->name = name.isEmpty() ? QString("Thread %1").arg(local_buffer->tid) : name;
+        registry().buffers << local_buffer;
+    }
+    return local_buffer;
+}
+
+QString json_string(QString text){
+    text.replace("\\", "\\\\");
+    text.replace("\"", "\\\"");
+    text.replace("\n", "\\n");
+    return "\"" + text + "\"";
+}
+
+}
+
+bool Trace::Available(){
+#ifdef EVENTVIEWER_TRACE
+    return true;
+#else
+    return false;
+#endif
+}
+
+int Trace::MaxSpans(){
+    return 1000000; // per thread, about 24 MB
+}
+
+void Trace::Start(){
+    // spans from any earlier capture are thrown away
+    trace_registry &trace = registry();
+    QMutexLocker lock(&trace.mutex);
+    for(int i = 0; i < trace.buffers.size(); i++){
+        QMutexLocker buffer_lock(&trace.buffers.at(i)->mutex);
+        trace.buffers.at(i)->spans.clear();
+        trace.buffers.at(i)->dropped = 0;
+    }
+    trace.capturing.store(1);
+}
+
+void Trace::Stop(){
+    registry().capturing.store(0);
+}
+
+bool Trace::IsCapturing(){
+    return registry().capturing.load() != 0;
+}
+
+int Trace::Spans(){
+    trace_registry &trace = registry();
+    QMutexLocker lock(&trace.mutex);
+    int n = 0;
+    for(int i = 0; i < trace.buffers.size(); i++){
+        QMutexLocker buffer_lock(&trace.buffers.at(i)->mutex);
+        n += trace.buffers.at(i)->spans.size();
+    }
+    return n;
+}
+
+int Trace::Dropped(){
+    trace_registry &trace = registry();
+    QMutexLocker lock(&trace.mutex);
+    int n = 0;
+    for(int i = 0; i < trace.buffers.size(); i++){
+        QMutexLocker buffer_lock(&trace.buffers.at(i)->mutex);
+        n += trace.buffers.at(i)->dropped;
+    }
+    return n;
+}
+
+void Trace::SetThreadName(QString name){
+    // shown instead of the QThread's objectName(), e.g. for the GUI thread
+    thread_buffer *buffer = this_thread_buffer();
+    QMutexLocker lock(&buffer->mutex);
+    buffer->name = name;
+}
+
+bool Trace::Save(QString file, QString *error){
+    /*
+     * Complete ("X") events in microseconds, one process, a thread per buffer, with
+     * the thread names as metadata.  Spans still being added while saving may or may
+     * not make it in.
+     */
+    QFile out(file);
+    if(!out.open(QIODevice::WriteOnly | QIODevice::Text)){
+        if(error != 0){
+            *error = out.errorString();
+        }
+        return false;
+    }
+
+    QTextStream stream(&out);
+    stream << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+    stream << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,\"args\":{\"name\":\"EventViewer\"}}";
+
+    trace_registry &trace = registry();
+    QMutexLocker lock(&trace.mutex);
+    for(int i = 0; i < trace.buffers.size(); i++){
+        thread_buffer *buffer = trace.buffers.at(i);
+        QMutexLocker buffer_lock(&buffer->mutex);
+        stream << ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << buffer->tid
+               << ",\"args\":{\"name\":" << json_string(buffer->name) << "}}";
+        for(int j = 0; j < buffer->spans.size(); j++){
+            const span &s = buffer->spans.at(j);
+            stream << ",\n{\"name\":" << json_string(QString::fromLatin1(s.name))
+                   << ",\"cat\":\"eventviewer\",\"ph\":\"X\",\"pid\":1,\"tid\":" << buffer->tid
+                   << ",\"ts\":" << QString::number(s.begin/1.0e3, 'f', 3)
+                   << ",\"dur\":" << QString::number(s.duration/1.0e3, 'f', 3) << "}";
+        }
+    }
+    stream << "\n]}\n";
+    stream.flush();
+
+    if(out.error() != QFile::NoError){
+        if(error != 0){
+            *error = out.errorString();
+        }
+        return false;
+    }
+    return true;
+}
+
+#ifdef EVENTVIEWER_TRACE
+
+TraceSpan::TraceSpan(const char *span_name){
+    name = span_name;
+    begin = registry().capturing.load() != 0 ? registry().clock.nsecsElapsed() : -1;
+}
+
+TraceSpan::~TraceSpan(){
+    if(begin < 0){
+        return;
+    }
+    trace_registry &trace = registry();
+    qint64 end = trace.clock.nsecsElapsed();
+    if(trace.capturing.load() == 0){
+        return; // the capture ended while the span was open
+    }
+
+    thread_buffer *buffer = this_thread_buffer();
+    QMutexLocker lock(&buffer->mutex);
+    if(buffer->spans.size() >= Trace::MaxSpans()){
+        buffer->dropped++;
+        return;
+    }
+    span s;
+    s.name = name;
+    s.begin = begin;
+    s.duration = end - begin;
+    buffer->spans << s;
+}
+
+#endif // EVENTVIEWER_TRACE
@@ -0,0 +1,62 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <QString>
+
+/*
+ * Scoped trace spans, written out as Chrome trace-event JSON for chrome://tracing or
+ * ui.perfetto.dev.
+ *
+ *   void ReadMAUS::readParticleEvent(){
+ *       TRACE_SCOPE("readParticleEvent");
+ *       ...
+ *
+ * marks the rest of the block as one span on the calling thread.  Spans are only kept
+ * between Start() and Stop(), and Save() writes the ones kept.  The name must outlive
+ * the capture, so a string literal.
+ *
+ * Unless the build defines EVENTVIEWER_TRACE (qmake CONFIG+=trace), TRACE_SCOPE is
+ * nothing at all, and Available() is false.  With it, a span outside a capture costs
+ * one atomic load, and one inside two clock reads and an append to a buffer of the
+ * thread's own, so worker threads never wait on each other.  A thread keeps at most
+ * MaxSpans() spans a capture; the rest are counted in Dropped().
+ */
+class Trace
+{
+public:
+    static bool Available();
+    static void Start();
+    static void Stop();
+    static bool IsCapturing();
+    static int Spans();
+    static int Dropped();
+    static int MaxSpans();
+    static bool Save(QString file, QString *error = 0);
+
+    static void SetThreadName(QString name);
+};
+
+#ifdef EVENTVIEWER_TRACE
+
+class TraceSpan
+{
+public:
+    explicit TraceSpan(const char *span_name);
+    ~TraceSpan();
+
+private:
+    const char *name;
+    qint64 begin; // ns, or -1 when not capturing
+};
+
+#define TRACE_CONCATENATE_(a, b) a##b
+#define TRACE_CONCATENATE(a, b) TRACE_CONCATENATE_(a, b)
+#define TRACE_SCOPE(name) TraceSpan TRACE_CONCATENATE(trace_span_, __LINE__)(name)
+
+#else
+
+#define TRACE_SCOPE(name) do {} while(0)
+
+#endif // EVENTVIEWER_TRACE
+
+#endif // TRACE_H
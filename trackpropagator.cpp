@@ -0,0 +1,259 @@
+#include "trackpropagator.h"
+#include "TMath.h"
+#include "memoryaccount.h"
+
+#include <QMap>
+#include <QFuture>
+#include <QtConcurrentRun>
+
+namespace {
+
+// c in MeV/c per T per mm: p = 0.2998 B R
+const double speed_of_light = 0.299792458;
+
+struct helix_point {
+    double x, y, px, py;
+};
+
+helix_point helix(double x0, double y0, double px0, double py0, double pz, double a, double s){
+    /*
+     * Helix about the z axis after travelling s along z, where a = q c B/pz is the
+     * rotation of the transverse momentum per unit z:
+     *   dpx/dz = a py, dpy/dz = -a px, dx/dz = px/pz, dy/dz = py/pz
+     */
+    double c = TMath::Cos(a*s);
+    double sn = TMath::Sin(a*s);
+    helix_point point;
+    point.x = x0 + (px0*sn + py0*(1.0 - c))/(a*pz);
+    point.y = y0 + (py0*sn - px0*(1.0 - c))/(a*pz);
+    point.px = px0*c + py0*sn;
+    point.py = py0*c - px0*sn;
+    return point;
+}
+
+bool valid(const QVector<double> &values, int slot){
+    return slot < values.size() && values.at(slot) != TMath::Infinity();
+}
+
+}
+
+TrackPropagator::TrackPropagator()
+{
+    tkuField = 3.0;
+    tkdField = 3.0;
+    charge = 1;
+    tolerance = 1.0;
+}
+
+TrackPropagator::~TrackPropagator(){
+
+}
+
+void TrackPropagator::SetFields(double tku_field, double tkd_field){
+    if(tku_field != tkuField || tkd_field != tkdField){
+        tkuField = tku_field;
+        tkdField = tkd_field;
+        ClearCache();
+    }
+}
+
+void TrackPropagator::SetCharge(int charge_sign){
+    if(charge_sign != charge){
+        charge = charge_sign;
+        ClearCache();
+    }
+}
+
+void TrackPropagator::SetTolerance(double sampling_tolerance){
+    // cached trajectories are kept while they're within a factor of 2 of what's wanted
+    if(sampling_tolerance <= 0){
+        return;
+    }
+    if(sampling_tolerance < tolerance/2.0 || sampling_tolerance > tolerance*2.0){
+        ClearCache();
+    }
+    tolerance = sampling_tolerance;
+}
+
+double TrackPropagator::Tolerance() const{
+    return tolerance;
+}
+
+void TrackPropagator::ClearCache(){
+    cache.clear();
+    cacheOrder.clear();
+}
+
+qint64 TrackPropagator::CacheBytes() const{
+    // the cached trajectories' vectors, the hash and the list of keys; see MemoryAccount
+    qint64 bytes = cache.capacity() > 0 ? qint64(sizeof(QHashData)) + qint64(cache.capacity())*sizeof(void*) : 0;
+    QHash<QPair<int, int>, Trajectory>::const_iterator iter;
+    for(iter = cache.constBegin(); iter != cache.constEnd(); ++iter){
+        bytes += sizeof(QHashNode<QPair<int, int>, Trajectory>);
+        bytes += MemoryAccount::SizeOf(iter.value().z) + MemoryAccount::SizeOf(iter.value().x)
+                + MemoryAccount::SizeOf(iter.value().y) + MemoryAccount::SizeOf(iter.value().px)
+                + MemoryAccount::SizeOf(iter.value().py);
+    }
+    bytes += qint64(cacheOrder.size())*(sizeof(void*) + sizeof(QPair<int, int>));
+    return bytes;
+}
+
+TrackPropagator::Trajectory TrackPropagator::Propagate(const QVector<QVector<double> > &event) const{
+    Trajectory trajectory;
+    if(event.size() < 7){
+        return trajectory;
+    }
+
+    const QVector<double> &x = event.at(0);
+    const QVector<double> &y = event.at(1);
+    const QVector<double> &z = event.at(2);
+
+    // the detector points with a position, in order of z
+    QMap<double, int> by_z;
+    for(int slot = 0; slot < z.size(); slot++){
+        if(valid(x, slot) && valid(y, slot) && valid(z, slot)){
+            by_z.insertMulti(z.at(slot), slot);
+        }
+    }
+    QList<int> points = by_z.values();
+
+    for(int i = 0; i < points.size(); i++){
+        int slot = points.at(i);
+        trajectory.z << z.at(slot);
+        trajectory.x << x.at(slot);
+        trajectory.y << y.at(slot);
+        trajectory.px << event.at(4).value(slot, TMath::Infinity());
+        trajectory.py << event.at(5).value(slot, TMath::Infinity());
+
+        if(i + 1 < points.size()){
+            int next = points.at(i + 1);
+            // slots 2-6 are TKU, 7-11 TKD; anything else is a drift
+            if(slot >= 2 && slot <= 6 && next >= 2 && next <= 6){
+                add_helix(trajectory, event, slot, next, tkuField);
+            }
+            else if(slot >= 7 && slot <= 11 && next >= 7 && next <= 11){
+                add_helix(trajectory, event, slot, next, tkdField);
+            }
+        }
+    }
+    return trajectory;
+}
+
+void TrackPropagator::add_helix(Trajectory &trajectory, const QVector<QVector<double> > &event,
+                                int from, int to, double field) const{
+    /*
+     * Samples strictly between two stations of a tracker.  With momentum at both ends,
+     * the helices from each end are blended linearly along z so that the curve meets
+     * both track points; with momentum at one end only, that end's helix is used.
+     */
+    const QVector<double> &x = event.at(0);
+    const QVector<double> &y = event.at(1);
+    const QVector<double> &z = event.at(2);
+    const QVector<double> &px = event.at(4);
+    const QVector<double> &py = event.at(5);
+    const QVector<double> &pz = event.at(6);
+
+    bool forward = valid(px, from) && valid(py, from) && valid(pz, from) && pz.at(from) != 0;
+    bool backward = valid(px, to) && valid(py, to) && valid(pz, to) && pz.at(to) != 0;
+    double k = speed_of_light*charge*field;
+    if((!forward && !backward) || k == 0){
+        return;
+    }
+
+    // sample so that the chord error R(1 - cos(step/2)) ~ R step^2/8 stays below the tolerance
+    int end = forward ? from : to;
+    double pt = TMath::Sqrt(px.at(end)*px.at(end) + py.at(end)*py.at(end));
+    double a = k/pz.at(end);
+    double dz = z.at(to) - z.at(from);
+    double radius = pt/TMath::Abs(k);
+    double angle = TMath::Abs(a*dz);
+    if(radius <= 0 || angle < 1.0e-6){
+        return;
+    }
+    double step = TMath::Sqrt(8.0*tolerance/radius);
+    int n_samples = qBound(1, int(TMath::Ceil(angle/step)), 512);
+
+    double a_from = forward ? k/pz.at(from) : 0.0;
+    double a_to = backward ? k/pz.at(to) : 0.0;
+    for(int i = 1; i < n_samples; i++){
+        double w = double(i)/n_samples;
+        double s = dz*w;
+        helix_point point;
+        if(forward && backward){
+            helix_point f = helix(x.at(from), y.at(from), px.at(from), py.at(from), pz.at(from), a_from, s);
+            helix_point b = helix(x.at(to), y.at(to), px.at(to), py.at(to), pz.at(to), a_to, s - dz);
+            point.x = (1.0 - w)*f.x + w*b.x;
+            point.y = (1.0 - w)*f.y + w*b.y;
+            point.px = (1.0 - w)*f.px + w*b.px;
+            point.py = (1.0 - w)*f.py + w*b.py;
+        }
+        else if(forward){
+            point = helix(x.at(from), y.at(from), px.at(from), py.at(from), pz.at(from), a_from, s);
+        }
+        else{
+            point = helix(x.at(to), y.at(to), px.at(to), py.at(to), pz.at(to), a_to, s - dz);
+        }
+        trajectory.z << z.at(from) + s;
+        trajectory.x << point.x;
+        trajectory.y << point.y;
+        trajectory.px << point.px;
+        trajectory.py << point.py;
+    }
+}
+
+TrackPropagator::Trajectory TrackPropagator::Cached(int spill_number, int event_number,
+                                                    const QVector<QVector<double> > &event){
+    QPair<int, int> key = qMakePair(spill_number, event_number);
+    if(cache.contains(key)){
+        return cache.value(key);
+    }
+
+    Trajectory trajectory = Propagate(event);
+    if(cacheOrder.size() >= cacheSize){
+        cache.remove(cacheOrder.takeFirst());
+    }
+    cache.insert(key, trajectory);
+    cacheOrder << key;
+    return trajectory;
+}
+
+TrackPropagator::Trajectory TrackPropagator::propagate_block(const TrackPropagator *propagator,
+                                                             const QVector<const QVector<QVector<double> >*> *events,
+                                                             int begin, int end){
+    Trajectory block;
+    for(int i = begin; i < end; i++){
+        Trajectory trajectory = propagator->Propagate(*events->at(i));
+        block.event.insert(block.event.size(), trajectory.z.size(), i);
+        block.z += trajectory.z;
+        block.x += trajectory.x;
+        block.y += trajectory.y;
+        block.px += trajectory.px;
+        block.py += trajectory.py;
+    }
+    return block;
+}
+
+TrackPropagator::Trajectory TrackPropagator::PropagateAll(const QVector<const QVector<QVector<double> >*> &events) const{
+    /*
+     * Every event's samples, one after the other, for drawing as points.  Blocks of
+     * events are propagated on the global thread pool and joined in order.
+     */
+    const int block_size = 256;
+    QList<QFuture<Trajectory> > blocks;
+    for(int begin = 0; begin < events.size(); begin += block_size){
+        blocks << QtConcurrent::run(&TrackPropagator::propagate_block, this, &events,
+                                    begin, qMin(begin + block_size, events.size()));
+    }
+
+    Trajectory all;
+    for(int i = 0; i < blocks.size(); i++){
+        Trajectory block = blocks[i].result();
+        all.z += block.z;
+        all.x += block.x;
+        all.y += block.y;
+        all.px += block.px;
+        all.py += block.py;
+        all.event += block.event;
+    }
+    return all;
+}
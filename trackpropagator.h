@@ -0,0 +1,61 @@
+#ifndef TRACKPROPAGATOR_H
+#define TRACKPROPAGATOR_H
+
+#include <QVector>
+#include <QHash>
+#include <QList>
+#include <QPair>
+
+/*
+ * Turns the 13 detector points of an event (as stored by ReadMAUS::add_to_events())
+ * into a continuous trajectory for drawing.
+ *
+ * Between two stations of the same tracker the particle follows a helix in the
+ * solenoid field, starting from the track point position and momentum at each end and
+ * blended between them, so the curve passes through both.  Everywhere else (between
+ * the TOFs and trackers, and across the absorber) the points are joined by straight
+ * lines.  Helices are sampled just finely enough that the sampled curve stays within
+ * Tolerance() (mm, normally about a pixel on screen) of the true one.
+ *
+ * Trajectories are cached by (spill, event) with Cached(); PropagateAll() propagates a
+ * batch of events in parallel for overlays.
+ */
+class TrackPropagator
+{
+public:
+    struct Trajectory {
+        QVector<double> z, x, y, px, py;
+        QVector<int> event; // from PropagateAll(), the index of the event each sample belongs to
+    };
+
+    TrackPropagator();
+    ~TrackPropagator();
+
+    void SetFields(double tku_field, double tkd_field);
+    void SetCharge(int charge_sign);
+    void SetTolerance(double sampling_tolerance);
+    double Tolerance() const;
+    void ClearCache();
+    qint64 CacheBytes() const;
+
+    Trajectory Propagate(const QVector<QVector<double> > &event) const;
+    Trajectory Cached(int spill_number, int event_number, const QVector<QVector<double> > &event);
+    Trajectory PropagateAll(const QVector<const QVector<QVector<double> >*> &events) const;
+
+private:
+    double tkuField, tkdField; // T
+    int charge;
+    double tolerance;          // mm
+
+    QHash<QPair<int, int>, Trajectory> cache;
+    QList<QPair<int, int> > cacheOrder; // oldest first
+    static const int cacheSize = 256;
+
+    static Trajectory propagate_block(const TrackPropagator *propagator,
+                                      const QVector<const QVector<QVector<double> >*> *events,
+                                      int begin, int end);
+    void add_helix(Trajectory &trajectory, const QVector<QVector<double> > &event,
+                   int from, int to, double field) const;
+};
+
+#endif // TRACKPROPAGATOR_H
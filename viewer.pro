@@ -0,0 +1,13 @@
+#-------------------------------------------------
+#
+# Project created by QtCreator 2015-09-01T14:18:02
+#
+#-------------------------------------------------
+
+include(eventviewer.pri)
+
+TARGET = EventViewer
+TEMPLATE = app
+
+
+SOURCES += main.cpp